@@ -0,0 +1,50 @@
+//
+// netbench.cpp
+//
+// Runs the NetworkConnection relay benchmark on a simulated network.
+//
+// Usage: netbench [latency_ms] [jitter_ms] [loss] [bandwidth_bytes_per_sec] [seconds]
+//
+// Every heap allocation in the process is counted through the global operator
+// new, to report allocations per message.
+//
+// Author: agent
+// Version: 10/17/2026
+//
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#include "../lib/test/TCUNetworkBench.h"
+
+/** Heap allocations made so far */
+static std::atomic<uint64_t> allocationCount(0);
+
+void* operator new(std::size_t size) {
+	allocationCount.fetch_add(1, std::memory_order_relaxed);
+	if (void* p = std::malloc(size == 0 ? 1 : size)) {
+		return p;
+	}
+	throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+	std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+	std::free(p);
+}
+
+int main(int argc, char* argv[]) {
+	cugl::NetworkLoopback::LinkConfig link;
+	double seconds = 2;
+	if (argc > 1) link.latency = std::atof(argv[1]);
+	if (argc > 2) link.jitter = std::atof(argv[2]);
+	if (argc > 3) link.loss = std::atof(argv[3]);
+	if (argc > 4) link.bandwidth = std::atof(argv[4]);
+	if (argc > 5) seconds = std::atof(argv[5]);
+
+	cugl::networkBenchmark(link, seconds, [] { return allocationCount.load(std::memory_order_relaxed); });
+	return 0;
+}
@@ -0,0 +1,25 @@
+//
+// netload.cpp
+//
+// Runs a NetworkPunchServer on localhost and puts it under load from one process.
+//
+// Usage: netload [pairs] [port]
+//
+// Every host and client logs its own handshake, so the summary comes last.
+//
+// Author: agent
+// Version: 10/17/2026
+//
+#include <cstdlib>
+
+#include "../lib/test/TCUNetworkBench.h"
+
+int main(int argc, char* argv[]) {
+	size_t pairs = 200;
+	uint16_t port = 61120;
+	if (argc > 1) pairs = static_cast<size_t>(std::atoi(argv[1]));
+	if (argc > 2) port = static_cast<uint16_t>(std::atoi(argv[2]));
+
+	cugl::punchServerLoadTest(pairs, port);
+	return 0;
+}
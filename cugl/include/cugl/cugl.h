@@ -41,5 +41,12 @@
 #include "physics2/cu_physics2.h"
 #include "net/CUNetworkConnection.h"
 #include "net/CUNetworkSerializer.h"
+#include "net/CUNetworkDelta.h"
+#include "net/CUNetworkLockstep.h"
+#include "net/CUNetworkRollback.h"
+#include "net/CUNetworkInterpolator.h"
+#include "net/CUNetworkServer.h"
+#include "net/CUNetworkLoopback.h"
+#include "net/CUNetworkPunchServer.h"
 
 #endif /* __CUGL_PKG_H__ */
@@ -20,26 +20,41 @@
 #define CU_NETWORK_CONNECTION_H
 
 #include <array>
+#include <atomic>
 #include <bitset>
+#include <chrono>
 #include <ctime>
+#include <deque>
 #include <functional>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <thread>
 #include <vector>
 #include <optional>
 #include <variant>
+#include <unordered_map>
 #include <unordered_set>
 
 #include <slikenet/BitStream.h>
 #include <slikenet/MessageIdentifiers.h>
 #include <slikenet/NatPunchthroughClient.h>
 
+#include <cugl/net/CUNetworkLoopback.h>
+
 // Forward declarations
 namespace SLNet {
 	class RakPeerInterface;
 }
 
 namespace cugl {
+	template <typename T>
+	class NetworkQueue;
+	class NetworkClock;
+	class NetworkImpairment;
+	class NetworkTransport;
+	class NetworkServer;
+
 	/**
 	 * Network connection to other players with a peer-to-peer interface.
 	 * 
@@ -57,13 +72,18 @@ namespace cugl {
 	 * Player ID 0 is the host, and all others are clients connected to the host. Calling send()
 	 * from the host works as usual; as a client, you may use sendOnlyToHost() in lieu of send()
 	 * to only send a message to the host that will not be broadcast to other players. Both the host
-	 * and clients receive messages via receive() as usual. Note that the host on the receiving end
-	 * does not know if a message was sent via send() or sendOnlyToHost().
+	 * and clients receive messages via receive() as usual. If the host needs to know whether a
+	 * message was sent via send() or sendOnlyToHost(), or who sent it, use the receive() overload
+	 * that reports the sender and message type.
 	 * 
-	 * This class does support automatic reconnections, but does NOT support host migration.
-	 * If the host drops offline, the connection is closed.
+	 * This class supports automatic reconnections. If the host drops offline, the connection
+	 * is closed, unless ConnectionConfig::hostMigration is set.
 	 */
 	class NetworkConnection {
+		/** Speaks the same protocol as the host, so it shares the packet types */
+		friend class NetworkServer;
+		/** Hands out rooms with the AssignedRoom packet */
+		friend class NetworkPunchServer;
 	public:
 
 #pragma region Setup
@@ -72,6 +92,7 @@ namespace cugl {
 		 * 
 		 * To setup a NAT punchthrough server of your own, see:
 		 * https://github.com/mt-xing/nat-punchthrough-server
+		 * or embed a NetworkPunchServer, which speaks the same protocol.
 		 */
 		struct ConnectionConfig {
 			/** Address of the NAT Punchthrough server */
@@ -86,19 +107,172 @@ namespace cugl {
 			 * time a backwards incompatible API change happens.
 			 */
 			uint8_t apiVersion;
+			/**
+			 * Whether to run the network on a dedicated background thread.
+			 * 
+			 * When enabled, a background thread owns the connection. It processes the
+			 * connection handshake and relays messages (as host) as soon as packets arrive,
+			 * instead of waiting for the next call to receive(). Received messages are queued
+			 * for the game thread, and receive() only drains that queue. Sent messages are
+			 * queued for the background thread.
+			 * 
+			 * This keeps network latency independent of frame time. receive() should still
+			 * be called every frame, and all methods of this class must still be called from
+			 * a single (game) thread.
+			 */
+			bool networkThread;
+			/**
+			 * Whether to pack messages sent with send() and sendOnlyToHost() into batches.
+			 * 
+			 * When enabled, small messages with the same delivery options are held back and
+			 * packed together into packets of up to roughly one datagram, instead of each
+			 * becoming its own packet with its own headers. Batches go out when flush() is called
+			 * (and at the end of every receive() if flushOnReceive is set). The receiving side
+			 * unpacks them automatically; each message is still dispatched individually.
+			 * Messages sent with Priority::Immediate are never batched.
+			 */
+			bool batchSends;
+			/** Whether receive() should call flush() when it finishes (only used with batchSends) */
+			bool flushOnReceive;
+			/**
+			 * Whether to throttle Priority::Low messages when the connection is congested.
+			 * 
+			 * When enabled, the connection watches send queue depth, packet loss and resend
+			 * rates on every link. While any link is congested, only a fraction of Priority::Low
+			 * messages go out (see getSendRate()): unreliable ones are dropped, and reliable ones
+			 * are held back and trickled out as the link recovers. The fraction is halved on
+			 * congestion and recovers gradually once the link is clear again.
+			 * 
+			 * At most 256 reliable messages are held back. If more are sent while the link is
+			 * still congested, the oldest held back messages are dropped to make room, so
+			 * the newest state still arrives and memory use stays bounded. Order is preserved
+			 * among the messages that are sent.
+			 * 
+			 * Messages of any other priority are never throttled, so they do not wait behind
+			 * bulk data. Use Priority::Low for traffic that can be thinned out, such as frequent
+			 * state updates.
+			 */
+			bool adaptiveSendRate;
+			/**
+			 * Whether clients should connect directly to each other.
+			 * 
+			 * Normally every message between clients goes through the host, which doubles the
+			 * latency and makes the host's upload the bottleneck. When enabled, the host
+			 * introduces every pair of clients to each other, and they try to open a direct
+			 * connection. Messages from send() then go straight to every client reachable
+			 * directly, and the host only relays them to the rest. The host still assigns
+			 * player IDs, runs the room, and receives every message.
+			 * 
+			 * Direct connections are not possible through every NAT. Whenever one cannot be made,
+			 * or is lost, messages between those two clients go through the host as usual. Must
+			 * be set the same way for the host and every client.
+			 */
+			bool mesh;
+			/**
+			 * Whether clients should take over when the host drops, instead of giving up.
+			 * 
+			 * When enabled, the host tells every client where to find every other client. If
+			 * the host is lost, the connected client with the lowest player ID becomes the new
+			 * host, and every other client reconnects to it, over a mesh link if there is one
+			 * or by connecting directly otherwise. Player IDs, the player list, whether the game
+			 * has started and session time all carry over; the status is Reconnecting meanwhile.
+			 * The new host registers a new room ID (see getRoomID()) for players joining later,
+			 * and keeps its own player ID, so it has room for one player fewer than before.
+			 * 
+			 * A client that only lost its own link to a host that is still running will follow
+			 * the successor anyway, and end up Disconnected. Must be set the same way for the host
+			 * and every client.
+			 */
+			bool hostMigration;
+			/**
+			 * Whether a client that drops should resume its session instead of starting over.
+			 * 
+			 * When enabled, the host gives each client a secret session token. A client that
+			 * loses the host first reconnects straight to the host's last known address and
+			 * presents its token, skipping the punchthrough server or LAN search; only if that
+			 * fails does it fall back to the usual reconnection. Either way, once the client is
+			 * back, the host resends every reliable message the client had not acknowledged when
+			 * it dropped, and every reliable message sent while it was gone, in order.
+			 * 
+			 * The host keeps up to 1 MB of such messages in all. A client gone for longer than
+			 * the reconnection timeout, or who missed more than that, gets no replay. A message
+			 * whose acknowledgement was lost along with the connection may arrive twice. If
+			 * hostMigration is also set, losing the host always starts a migration instead.
+			 * Must be set the same way for the host and every client.
+			 */
+			bool sessionResume;
+			/**
+			 * Whether to find the host on the local network instead of through the punchthrough server.
+			 * 
+			 * When enabled, the host listens on lanPort and makes up its own room ID, without
+			 * contacting the punchthrough server at all. Clients broadcast a query for their room
+			 * ID to lanAddress every quarter second, and connect straight to the host that answers.
+			 * Everything after that works exactly as usual. A client that finds no such room within
+			 * five seconds ends up with status RoomNotFound.
+			 * 
+			 * The punchthrough server address and port are ignored. Only one LAN host can run per
+			 * machine and port. A client that loses the host looks for it the same way, unless it
+			 * resumes its session at the host's last known address first (see sessionResume).
+			 * After a host migration, the new host answers queries for its new room ID on lanPort,
+			 * as long as that port is free on its machine. Must be set the same way for the host
+			 * and every client.
+			 */
+			bool lan;
+			/** UDP port the host listens on in LAN mode (default 61112) */
+			uint16_t lanPort;
+			/**
+			 * Where clients send LAN queries (default "255.255.255.255", the local network).
+			 * 
+			 * Set this to the host's address to skip discovery, such as "127.0.0.1" to test
+			 * with every player on one machine. To join a room on a NetworkServer, set this and
+			 * lanPort to the server's address and port.
+			 */
+			const char* lanAddress;
+			/**
+			 * Simulated network to connect through instead of UDP (default nullptr, for none).
+			 * 
+			 * Connections given the same NetworkLoopback reach each other through it, inside this
+			 * process, with the latency and loss it is set up with. This turns on LAN mode, so
+			 * the host and its clients must agree on lanPort, and lanAddress is ignored.
+			 */
+			std::shared_ptr<NetworkLoopback> loopback;
+			/**
+			 * Whether to simulate network conditions on this connection (default false).
+			 * 
+			 * When set, setLinkConditions() can add latency, jitter, loss, duplication, reordering
+			 * and a bandwidth cap to each direction of each link, at any time. This works over UDP
+			 * (including LAN mode) and over a loopback, on top of whatever that network already
+			 * does. Until conditions are set, everything goes straight through, so this costs
+			 * almost nothing.
+			 */
+			bool simulateConditions;
 
-			ConnectionConfig(const char* punchthroughServerAddr, uint16_t punchthroughServerPort, uint32_t maxPlayers, uint8_t apiVer) {
+			ConnectionConfig(const char* punchthroughServerAddr, uint16_t punchthroughServerPort, uint32_t maxPlayers, uint8_t apiVer,
+				bool networkThread = false) {
 				this->punchthroughServerAddr = punchthroughServerAddr;
 				this->punchthroughServerPort = punchthroughServerPort;
 				this->maxNumPlayers = maxPlayers;
 				this->apiVersion = apiVer;
+				this->networkThread = networkThread;
+				this->batchSends = false;
+				this->flushOnReceive = true;
+				this->adaptiveSendRate = false;
+				this->mesh = false;
+				this->hostMigration = false;
+				this->sessionResume = false;
+				this->lan = false;
+				this->lanPort = 61112;
+				this->lanAddress = "255.255.255.255";
+				this->loopback = nullptr;
+				this->simulateConditions = false;
 			}
 		};
 
 		/**
 		 * Start a new network connection as host.
 		 * 
-		 * This will automatically connect to the NAT punchthrough server and request a room ID.
+		 * This will automatically connect to the NAT punchthrough server and request a room ID
+		 * (or in LAN mode, make one up and start listening for clients right away).
 		 * This process is NOT instantaneous. Wait for getStatus() to return CONNECTED.
 		 * Once it does, getRoomID() will return your assigned room ID.
 		 * 
@@ -130,6 +304,41 @@ namespace cugl {
 #pragma endregion
 
 #pragma region Main Networking Methods
+		/**
+		 * How a message should be delivered.
+		 * 
+		 * These map directly onto the RakNet reliability modes. Sequencing and ordering
+		 * are per channel, so unrelated streams of messages should use different channels.
+		 */
+		enum class Delivery {
+			// May be dropped or arrive out of order; never resent
+			Unreliable,
+			// May be dropped; anything older than the newest message received on the same
+			// channel is discarded. Best for state that is superseded every frame (e.g. positions)
+			UnreliableSequenced,
+			// Always arrives, but not necessarily in the order it was sent
+			Reliable,
+			// Always arrives, in the order it was sent relative to other messages on the same channel
+			ReliableOrdered
+		};
+
+		/**
+		 * How urgently a message should be sent.
+		 * 
+		 * Higher priority messages jump ahead of lower priority messages still waiting
+		 * in the send queue.
+		 */
+		enum class Priority {
+			// Sent right away instead of waiting for the next network update
+			Immediate,
+			High,
+			Medium,
+			Low
+		};
+
+		/** Number of ordering channels available to send(); valid channels are 0 to NUM_CHANNELS - 1 */
+		static constexpr uint8_t NUM_CHANNELS = 16;
+
 		/**
 		 * Sends a byte array to all other players.
 		 * 
@@ -139,11 +348,34 @@ namespace cugl {
 		 * 
 		 * You may choose to either send a byte array directly, or you can use the NetworkSerializer
 		 * and NetworkDeserializer classes to encode more complex data.
+		 * 
+		 * Messages may be up to 16 MB. Anything larger than a single datagram is split up
+		 * and reassembled automatically, so large messages take proportionally longer to arrive.
 		 *
 		 * @param msg The byte array to send.
 		 */
 		void send(const std::vector<uint8_t>& msg);
 
+		/**
+		 * Sends a byte array to all other players with the given delivery guarantees.
+		 * 
+		 * This is the same as send(msg), except you control how the message is delivered.
+		 * The host relays the message to the other clients with the same settings.
+		 * 
+		 * Use Delivery::UnreliableSequenced for high rate state such as positions, so stale
+		 * updates are never retransmitted, and a higher priority for latency sensitive
+		 * messages like inputs so they are not stuck behind bulk traffic.
+		 * 
+		 * Plain send(msg) is equivalent to send(msg, Delivery::Reliable, Priority::Medium, 1).
+		 *
+		 * @param msg The byte array to send.
+		 * @param delivery Reliability and ordering guarantees for this message
+		 * @param priority Send priority for this message
+		 * @param channel Ordering channel, from 0 to NUM_CHANNELS - 1; the message is dropped for any other
+		 */
+		void send(const std::vector<uint8_t>& msg, Delivery delivery,
+			Priority priority = Priority::Medium, uint8_t channel = 1);
+
 		/**
 		 * Sends a byte array to the host only.
 		 * 
@@ -160,6 +392,20 @@ namespace cugl {
 		 */
 		void sendOnlyToHost(const std::vector<uint8_t>& msg);
 
+		/**
+		 * Sends a byte array to the host only with the given delivery guarantees.
+		 * 
+		 * See send(msg, delivery, priority, channel) for what the options mean.
+		 * As host, this is a no-op.
+		 *
+		 * @param msg The byte array to send.
+		 * @param delivery Reliability and ordering guarantees for this message
+		 * @param priority Send priority for this message
+		 * @param channel Ordering channel, from 0 to NUM_CHANNELS - 1; the message is dropped for any other
+		 */
+		void sendOnlyToHost(const std::vector<uint8_t>& msg, Delivery delivery,
+			Priority priority = Priority::Medium, uint8_t channel = 1);
+
 		/**
 		 * Method to call every network frame to process incoming network messages.
 		 * 
@@ -175,6 +421,107 @@ namespace cugl {
 		 * you should be using NetworkDeserializer to deserialize it.
 		 */
 		void receive(const std::function<void(const std::vector<uint8_t>&)>& dispatcher);
+
+		/**
+		 * Method to call every network frame to process incoming network messages, without copying them.
+		 * 
+		 * This is the same as receive() above, except the dispatcher is handed a pointer into the
+		 * network library's own packet buffer instead of a freshly allocated byte vector. Nothing
+		 * is allocated per message.
+		 * 
+		 * The pointer is ONLY valid for the duration of the dispatcher call. If you need to keep
+		 * the bytes around, copy them out before returning.
+		 *
+		 * @param dispatcher Function that will be called on every received message since the last
+		 * call to receive(), with a pointer to the first byte of the message and its length.
+		 * Pass both to NetworkDeserializer::receive(msg, length) to deserialize it.
+		 */
+		void receive(const std::function<void(const uint8_t*, size_t)>& dispatcher);
+
+		/**
+		 * How a received message was sent.
+		 */
+		enum class MessageType {
+			// Sent with send(); delivered to every player (relayed by the host)
+			Standard,
+			// Sent with sendOnlyToHost(); only ever received by the host
+			DirectToHost
+		};
+
+		/**
+		 * Method to call every network frame to process incoming network messages, with sender information.
+		 * 
+		 * This is the same as the zero-copy receive() above, except the dispatcher is also told
+		 * which player originally sent each message and how it was sent. There is no need to
+		 * spend payload bytes on a player ID.
+		 * 
+		 * Messages relayed through the host still report the player who originally sent them.
+		 * The host fills in the sender itself, so clients cannot impersonate one another.
+		 * 
+		 * The message pointer is ONLY valid for the duration of the dispatcher call.
+		 *
+		 * @param dispatcher Function that will be called on every received message since the last
+		 * call to receive(), with a pointer to the message, its length, the player ID of the
+		 * sender, and whether it was a Standard or DirectToHost message.
+		 */
+		void receive(const std::function<void(const uint8_t*, size_t, uint8_t, MessageType)>& dispatcher);
+
+		/**
+		 * Send all messages held back for batching.
+		 * 
+		 * Only does anything if ConnectionConfig::batchSends is set. Call this once per network
+		 * frame after you are done sending, unless ConnectionConfig::flushOnReceive is set, in
+		 * which case receive() does it for you.
+		 */
+		void flush();
+#pragma endregion
+
+#pragma region Interest Management
+		/**
+		 * How the host should deliver one message to one player.
+		 * 
+		 * Returned by a RelevanceFilter. The default delivers the message exactly as sent.
+		 */
+		struct Relevance {
+			/** Whether to deliver the message to this player at all */
+			bool deliver = true;
+			/** Priority to deliver the message with, or empty to keep the sender's */
+			std::optional<Priority> priority;
+			/**
+			 * Deliver only one in this many messages. Counted separately for each sender,
+			 * recipient and channel, so a far away player can get every fourth position update
+			 * while still getting every chat message.
+			 */
+			uint32_t interval = 1;
+		};
+
+		/**
+		 * Decides how the host delivers a message to one player.
+		 * 
+		 * Called with the message, the player ID of the player who sent it, and the player ID
+		 * of the recipient.
+		 */
+		using RelevanceFilter = std::function<Relevance(const uint8_t* msg, size_t length, uint8_t sender, uint8_t recipient)>;
+
+		/**
+		 * Filter which players receive each message, and how.
+		 * 
+		 * By default the host sends every message (its own and those it relays from clients)
+		 * to every other player, so host bandwidth grows with the square of the player count.
+		 * With a filter set, the host instead asks the filter, for every message and every
+		 * recipient, whether to deliver it, at what priority, and how often. Typical filters
+		 * drop updates about objects far from the recipient, or send team chat only to the team.
+		 * 
+		 * Filtered messages are never delivered, even if they were sent reliably, so only filter
+		 * messages the recipient can do without. The host itself still receives everything.
+		 * Batches from clients are unpacked and filtered message by message.
+		 * 
+		 * The filter runs on the network thread if ConnectionConfig::networkThread is set, and
+		 * must be fast: it is called once per message per player. Only used by the host.
+		 * 
+		 * @param filter The filter, or nullptr to send everything to everyone again
+		 */
+		void setRelevanceFilter(RelevanceFilter filter);
 #pragma endregion
 
 #pragma region State Management
@@ -218,11 +565,20 @@ namespace cugl {
 		/**
 		 * Returns the player ID or empty.
 		 * 
-		 * If this player is the host, this is guaranteed to be 0, even before a connection is established.
+		 * If this player is the host, this is guaranteed to be 0, even before a connection is established,
+		 * unless it took over after the original host left (see ConnectionConfig::hostMigration).
 		 * 
 		 * Otherwise, as client, this will return empty until connected to host and a player ID is assigned.
 		 */
-		std::optional<uint8_t> getPlayerID() { return playerID; }
+		std::optional<uint8_t> getPlayerID() { std::lock_guard<std::mutex> lock(stateMutex); return playerID; }
+
+		/**
+		 * Returns the player ID of the current host.
+		 * 
+		 * This is 0 unless the original host left and another player took over
+		 * (see ConnectionConfig::hostMigration).
+		 */
+		uint8_t getHostID() { std::lock_guard<std::mutex> lock(stateMutex); return hostID; }
 
 		/**
 		 * Returns the room ID or empty string.
@@ -232,7 +588,7 @@ namespace cugl {
 		 * Otherwise, as host, this will return the empty string until connected to the punchthrough server
 		 * and a room ID is assigned.
 		 */
-		std::string getRoomID() { return roomID; }
+		std::string getRoomID() { std::lock_guard<std::mutex> lock(stateMutex); return roomID; }
 
 		/**
 		 * Returns true if the given player ID is currently connected to the game.
@@ -241,19 +597,200 @@ namespace cugl {
 		 * 
 		 * As a client, if disconnected from host, player ID 0 will return disconnected.
 		 */
-		bool isPlayerActive(uint8_t playerID) { return connectedPlayers.test(playerID); }
+		bool isPlayerActive(uint8_t playerID) { std::lock_guard<std::mutex> lock(stateMutex); return connectedPlayers.test(playerID); }
+
+		/**
+		 * Returns the set of connected player IDs, indexed by player ID.
+		 * 
+		 * This is the same as calling isPlayerActive() for every ID, but takes the lock only once.
+		 */
+		std::bitset<256> getActivePlayers() { std::lock_guard<std::mutex> lock(stateMutex); return connectedPlayers; }
 
 		/** Return the number of players currently connected to this game */
-		uint8_t getNumPlayers() { return numPlayers; }
+		uint8_t getNumPlayers() { std::lock_guard<std::mutex> lock(stateMutex); return numPlayers; }
 
 		/** Return the number of players present when the game was started
 		 *  (including players that may have disconnected) */
-		uint8_t getTotalPlayers() { return maxPlayers;  }
+		uint8_t getTotalPlayers() { std::lock_guard<std::mutex> lock(stateMutex); return maxPlayers;  }
+
+		/**
+		 * Returns true if messages to and from the given player skip the host.
+		 * 
+		 * Always false unless ConnectionConfig::mesh is set. As host, every client is direct.
+		 */
+		bool hasDirectLink(uint8_t playerID);
+#pragma endregion
+
+#pragma region Statistics
+		/**
+		 * Traffic and latency statistics for the connection to one peer.
+		 * 
+		 * Byte counts are measured on the wire, so they include packet headers, acknowledgements
+		 * and resends. Message counts are messages sent with send() or sendOnlyToHost(); messages
+		 * packed into a batch count individually.
+		 */
+		struct PeerStats {
+			/** Average round trip time over the last few pings (ms) */
+			int rtt;
+			/** Most recent round trip time (ms) */
+			int lastRtt;
+			/** Smoothed difference between consecutive round trip times (ms) */
+			float jitter;
+			/** Total bytes sent since connecting */
+			uint64_t bytesSent;
+			/** Total bytes received since connecting */
+			uint64_t bytesReceived;
+			/** Bytes sent over the last second */
+			uint64_t bytesSentPerSecond;
+			/** Bytes received over the last second */
+			uint64_t bytesReceivedPerSecond;
+			/** Total messages sent since connecting (as host, including messages relayed from other clients) */
+			uint64_t messagesSent;
+			/** Total messages received since connecting (as client, including messages relayed by the host) */
+			uint64_t messagesReceived;
+			/** Total bytes of messages resent because they were not acknowledged in time */
+			uint64_t bytesResent;
+			/** Messages waiting to be sent, across all priorities */
+			uint32_t sendQueueMessages;
+			/** Bytes waiting to be sent, across all priorities */
+			uint64_t sendQueueBytes;
+			/** Reliable messages sent but not yet acknowledged */
+			uint32_t unackedMessages;
+			/** Fraction of packets lost over the last second, from 0 to 1 */
+			float packetLoss;
+			/** Fraction of packets lost since connecting, from 0 to 1 */
+			float packetLossTotal;
+		};
+
+		/**
+		 * Returns statistics for the connection to the given player, or empty if there is none.
+		 * 
+		 * As host, any connected client may be queried. As client, the only direct connection is
+		 * to the host (player ID 0), plus any other clients linked with ConnectionConfig::mesh;
+		 * everything from other players arrives over the connection to the host.
+		 * 
+		 * This is cheap enough to call every frame. Round trip times are refreshed once a second.
+		 * 
+		 * @param playerID The player to query
+		 */
+		std::optional<PeerStats> getStats(uint8_t playerID);
+
+		/**
+		 * Returns the fraction of Priority::Low messages currently being sent, from 0 to 1.
+		 * 
+		 * This is always 1 unless ConnectionConfig::adaptiveSendRate is set. Games can scale
+		 * how often they send low priority updates by this value, rather than have them dropped.
+		 */
+		float getSendRate() { std::lock_guard<std::mutex> lock(stateMutex); return sendRate; }
+#pragma endregion
+
+#pragma region Simulated Conditions
+		/** Which way traffic goes over a link, for setLinkConditions() */
+		enum class Direction {
+			/** What we send */
+			Outgoing,
+			/** What we receive */
+			Incoming,
+			/** Both ways */
+			Both
+		};
+
+		/**
+		 * Simulate conditions on every link that has none of its own.
+		 * 
+		 * Messages are delayed, lost, duplicated and reordered as RakNet would let them be over
+		 * such a link: a lost reliable message arrives a resend later instead, ordered messages
+		 * stay in order, and only unreliable messages are duplicated. Messages already held back
+		 * keep their timing. Round trip times in getStats() include the mean added delay, and
+		 * messages held back by the bandwidth cap count as queued.
+		 * 
+		 * Only received game data is lost, duplicated or reordered; connection events and
+		 * handshakes are only delayed. Requires ConnectionConfig::simulateConditions.
+		 * 
+		 * @param conditions Conditions to simulate; a default LinkConfig for a perfect link
+		 * @param direction Which way to simulate them
+		 * @return Whether conditions can be simulated on this connection
+		 */
+		bool setLinkConditions(const NetworkLoopback::LinkConfig& conditions, Direction direction = Direction::Both);
+
+		/**
+		 * Simulate conditions on the direct link to one player, as setLinkConditions() above.
+		 * 
+		 * These take the place of the conditions on every other link, for the given direction.
+		 * As client, the only direct link is to the host, plus any made with ConnectionConfig::mesh.
+		 * Conditions follow the player's address, so they are lost if the player reconnects.
+		 * 
+		 * @param playerID The player at the other end of the link
+		 * @param conditions Conditions to simulate
+		 * @param direction Which way to simulate them
+		 * @return Whether there is a direct link to the player, and conditions can be simulated
+		 */
+		bool setLinkConditions(uint8_t playerID, const NetworkLoopback::LinkConfig& conditions,
+			Direction direction = Direction::Both);
+
+		/** Stop simulating conditions on every link */
+		void clearLinkConditions();
+#pragma endregion
+
+#pragma region Session Clock
+		/**
+		 * Returns the current session time in seconds, shared by every player.
+		 * 
+		 * Session time is the host's clock, counting from when the host was created. Clients
+		 * estimate it by exchanging timestamps with the host in the background, so every player
+		 * reads (nearly) the same value at the same moment. Use it to timestamp snapshots and
+		 * events instead of spending round trips in game code.
+		 * 
+		 * The estimate is usually accurate to well under a millisecond on a steady connection,
+		 * and gets better the more often the connection is updated (the network thread helps).
+		 * Session time never goes backwards. Until isClockSynced() returns true, a client
+		 * returns its own local time instead.
+		 */
+		double getSessionTime();
+
+		/** Returns whether session time is available (always true for the host) */
+		bool isClockSynced();
+
+		/**
+		 * Returns how fast the host's clock runs compared to ours, in parts per million.
+		 * 
+		 * Positive means the host's clock runs fast. This is already corrected for in
+		 * getSessionTime(). Always 0 for the host.
+		 */
+		double getClockDrift();
+#pragma endregion
+
+#pragma region Handshake Timing
+		/**
+		 * When each step of the latest connection attempt finished.
+		 * 
+		 * Times are in seconds since the attempt started: when this connection was created, or
+		 * when the latest reconnection attempt began. Steps that have not happened yet, or that
+		 * do not apply to this side of the connection, are empty. Comparing consecutive steps
+		 * shows where time spent in NetStatus::Pending goes.
+		 */
+		struct HandshakeTimes {
+			/** Connected to the punchthrough server */
+			std::optional<double> serverConnected;
+			/** Host only: the room ID was assigned (in LAN mode, right away) */
+			std::optional<double> roomAssigned;
+			/** Client only: NAT punchthrough to the host succeeded (in LAN mode, the host answered) */
+			std::optional<double> punchSucceeded;
+			/** Client only: the direct connection to the host is up */
+			std::optional<double> hostConnected;
+			/** Status became NetStatus::Connected */
+			std::optional<double> connected;
+		};
+
+		/** Returns when each step of the latest connection attempt finished */
+		HandshakeTimes getHandshakeTimes();
 #pragma endregion
 
 	private:
 		/** Connection object */
-		std::unique_ptr<SLNet::RakPeerInterface> peer;
+		std::unique_ptr<NetworkTransport> peer;
+		/** Conditions simulated on each link, if ConnectionConfig::simulateConditions is set */
+		std::shared_ptr<NetworkImpairment> impairment;
 
 #pragma region State
 		/** Current status */
@@ -266,12 +803,56 @@ namespace cugl {
 		uint8_t maxPlayers;
 		/** Current player ID */
 		std::optional<uint8_t> playerID;
+		/** Player ID of the host */
+		uint8_t hostID;
 		/** Connected room ID */
 		std::string roomID;
 		/** Which players are active */
 		std::bitset<256> connectedPlayers;
 #pragma endregion
 
+#pragma region Statistics Tracking
+		/** Statistics RakNet does not track for us */
+		struct LinkStats {
+			/** Messages sent over this connection */
+			uint64_t messagesSent;
+			/** Messages received over this connection */
+			uint64_t messagesReceived;
+			/** Round trip time at the last ping, or -1 if none yet */
+			int lastRtt;
+			/** Smoothed difference between consecutive round trip times */
+			float jitter;
+		};
+
+		/** Statistics per connection, indexed by player ID */
+		std::array<LinkStats, 256> linkStats;
+		/** When to next ping every connection */
+		std::chrono::steady_clock::time_point nextPing;
+
+		/**
+		 * Returns the address of the direct connection to the given player, if there is one.
+		 * 
+		 * Must be called with the state lock held (or from the network thread).
+		 */
+		std::optional<SLNet::SystemAddress> addressOf(uint8_t playerID);
+
+		/** Record that n messages were sent to every connected player except the given one and ourselves */
+		void countSent(size_t n, std::optional<uint8_t> except = std::nullopt);
+
+		/**
+		 * Call fn with the player ID and address of every direct connection.
+		 * 
+		 * Must be called with the state lock held (or from the network thread).
+		 */
+		void forEachLink(const std::function<void(uint8_t, const SLNet::SystemAddress&)>& fn);
+
+		/** Clear the statistics for a connection that was just established */
+		void resetLinkStats(uint8_t playerID);
+
+		/** Sample round trip times and ping every connection, if a second has passed since the last time */
+		void pingPeers();
+#pragma endregion
+
 #pragma region Punchthrough
 		/** Address of punchthrough server */
 		std::unique_ptr<SLNet::SystemAddress> natPunchServerAddress;
@@ -289,6 +870,8 @@ namespace cugl {
 			std::vector<std::unique_ptr<SLNet::SystemAddress>> peers;
 			/** Addresses of all players to reject */
 			std::unordered_set<std::string> toReject;
+			/** Addresses players with a session to resume were lost from; they identify themselves by token */
+			std::unordered_set<std::string> dropped;
 
 			HostPeers() : started(false), maxPlayers(6) {
 				for (uint8_t i = 0; i < 5; i++) {
@@ -306,6 +889,16 @@ namespace cugl {
 		struct ClientPeer {
 			std::unique_ptr<SLNet::SystemAddress> addr;
 			std::string room;
+			/** Addresses of other clients connected directly, by player ID (mesh only) */
+			std::unordered_map<uint8_t, SLNet::SystemAddress> mesh;
+			/** Player IDs of clients we are trying to connect to directly, by GUID (mesh only) */
+			std::unordered_map<uint64_t, uint8_t> meshPending;
+			/** Addresses of every other client, as the host sees them (mesh or host migration only) */
+			std::unordered_map<uint8_t, SLNet::SystemAddress> directory;
+			/** Whether the host has started the game */
+			bool started = false;
+			/** Whether the host is a NetworkServer, which must be told which room we want */
+			bool server = false;
 
 			explicit ClientPeer(std::string roomID) { room = std::move(roomID); }
 		};
@@ -327,9 +920,371 @@ namespace cugl {
 			PlayerJoined,
 			PlayerLeft,
 			StartGame,
-			DirectToHost
+			DirectToHost,
+			// Several Standard messages packed together
+			StandardBatch,
+			// Several DirectToHost messages packed together
+			DirectToHostBatch,
+			// Client timestamp, for clock synchronization
+			ClockPing,
+			// Client timestamp echoed back with the host's
+			ClockPong,
+			// Address and GUID of other clients to connect to directly
+			MeshPeers,
+			// Standard message (or batch) for the host to relay to clients the sender could not reach
+			MeshRelay,
+			// Secret a client presents to resume its session
+			SessionToken,
+			// Player ID and session token of a client resuming its session
+			Resume,
+			// Room ID a client wants to join, sent to a NetworkServer once connected
+			RoomRequest
+		};
+
+#pragma region Network Thread
+		/** A message received on the network thread, waiting for the game thread */
+		struct InboundMessage {
+			std::vector<uint8_t> data;
+			uint8_t sender;
+			MessageType type;
+		};
+
+		/** A message sent on the game thread, waiting for the network thread */
+		struct OutboundMessage {
+			std::vector<uint8_t> data;
+			CustomDataPackets packetType;
+			uint8_t options;
+			/** If set, this is not a message; the network thread should flush batches here instead */
+			bool flush;
+		};
+
+		/** Background thread that owns the peer, if ConnectionConfig::networkThread is set */
+		std::thread netThread;
+		/** Whether the network thread should keep running */
+		std::atomic<bool> netThreadRunning{ false };
+		/**
+		 * Guards all connection state against the network thread.
+		 * 
+		 * Held by the network thread while it processes packets, and by the public getters.
+		 * Never held while waiting on the game thread.
+		 */
+		std::mutex stateMutex;
+		/** Messages for the game thread (network thread produces, game thread consumes) */
+		std::unique_ptr<NetworkQueue<InboundMessage>> inbound;
+		/** Messages for the network (game thread produces, network thread consumes) */
+		std::unique_ptr<NetworkQueue<OutboundMessage>> outbound;
+		/** Received messages that did not fit in the inbound queue; only touched by the network thread */
+		std::vector<InboundMessage> inboundOverflow;
+
+		/** Start the network thread if the config asks for one */
+		void startNetworkThread();
+
+		/** Body of the network thread */
+		void netThreadLoop();
+
+		/**
+		 * Queue a message for the network thread to send.
+		 * 
+		 * @returns False if there is no network thread and the caller should send directly
+		 */
+		bool queueOutbound(const std::vector<uint8_t>& msg, CustomDataPackets packetType, uint8_t options);
+
+		/**
+		 * Process all packets waiting on the peer: run the handshake, relay messages as host,
+		 * and pass user messages to the dispatcher.
+		 * 
+		 * This is the body of receive() when there is no network thread.
+		 */
+		void pump(const std::function<void(const uint8_t*, size_t, uint8_t, MessageType)>& dispatcher);
+
+		/** Body of startGame(), without taking the state lock */
+		void markGameStarted();
+#pragma endregion
+
+#pragma region Batching
+		/** Messages with the same packet type and send options, waiting to be sent together */
+		struct Batch {
+			/** StandardBatch or DirectToHostBatch */
+			CustomDataPackets packetType;
+			/** Packed send options shared by every message in the batch */
+			uint8_t options;
+			/** Each message as a varint length followed by its bytes */
+			std::vector<uint8_t> data;
+		};
+
+		/** Open batches; there is at most one per packet type and set of options */
+		std::vector<Batch> batches;
+
+		/**
+		 * Add a message to the matching batch, if batching applies to it.
+		 * 
+		 * Sends the batch first if the message would not fit. Messages too large for any
+		 * batch are not batched, but the matching batch is still sent first to keep them in order.
+		 * 
+		 * @returns False if the caller should send the message directly
+		 */
+		bool addToBatch(const std::vector<uint8_t>& msg, CustomDataPackets packetType, uint8_t options);
+
+		/** Send every open batch */
+		void flushBatches();
+
+		/** Whether a packet type carries the routing prefix (send options and sender) */
+		static bool hasRoutingPrefix(CustomDataPackets packetType) {
+			return packetType == Standard || packetType == StandardBatch || packetType == MeshRelay;
+		}
+
+		/**
+		 * Returns whether a received packet is game data, setting how it was sent from its routing prefix.
+		 * 
+		 * Tells simulated conditions what they may lose, duplicate or reorder.
+		 */
+		static bool isGameData(const SLNet::Packet* packet, PacketReliability& reliability, uint8_t& channel);
+#pragma endregion
+
+#pragma region Send Rate Control
+		/** A reliable Priority::Low message held back while the connection is congested */
+		struct DeferredMessage {
+			std::vector<uint8_t> data;
+			CustomDataPackets packetType;
+			uint8_t options;
+		};
+
+		/** Fraction of Priority::Low messages to send */
+		float sendRate;
+		/** Accumulates sendRate per Priority::Low message; a message may go out once it reaches 1 */
+		float sendCredit;
+		/** Reliable Priority::Low messages waiting for the connection to recover, oldest first */
+		std::deque<DeferredMessage> deferred;
+		/** Whether deferred has overflowed since it was last empty, so the drop is logged once */
+		bool deferredOverflow;
+		/** When to next check for congestion */
+		std::chrono::steady_clock::time_point nextRateUpdate;
+		/** When sendRate was last lowered */
+		std::chrono::steady_clock::time_point lastRateDecrease;
+
+		/**
+		 * Decide whether a user message may be sent now.
+		 * 
+		 * Messages that may not are dropped (if unreliable) or deferred (if reliable).
+		 * 
+		 * @returns Whether the caller should send the message
+		 */
+		bool admit(const std::vector<uint8_t>& msg, CustomDataPackets packetType, uint8_t options);
+
+		/** Hold back a reliable message, dropping the oldest one if too many are waiting */
+		void defer(const std::vector<uint8_t>& msg, CustomDataPackets packetType, uint8_t options);
+
+		/** Check every link for congestion, adjust sendRate, and release deferred messages */
+		void updateSendRate();
+#pragma endregion
+
+#pragma region Relevance Filtering
+		/** Decides who gets each message, or nullptr to send everything to everyone */
+		RelevanceFilter relevanceFilter;
+		/** Messages seen per sender, recipient and channel, for Relevance::interval */
+		std::unordered_map<uint32_t, uint32_t> relevanceCounts;
+		/** Per recipient batches, reused by sendRelevant() */
+		std::vector<Batch> relevantBatches;
+
+		/** Whether messages go through relevanceFilter instead of being broadcast */
+		bool isFiltering() const { return relevanceFilter && std::holds_alternative<HostPeers>(remotePeer); }
+
+		/** Ask relevanceFilter how to deliver a message, and return its options, or empty to skip it */
+		std::optional<uint8_t> relevantOptions(const uint8_t* msg, size_t length, uint8_t options,
+			uint8_t sender, uint8_t recipient);
+
+		/**
+		 * Send a Standard or StandardBatch payload to each player relevanceFilter allows.
+		 * 
+		 * Batches are split up and each recipient gets a batch of just the messages meant for it.
+		 * 
+		 * PRECONDITION: This player MUST be the host
+		 * 
+		 * @param h The host's peers
+		 * @param msg Start of the payload
+		 * @param length Length of the payload
+		 * @param packetType Standard or StandardBatch
+		 * @param options Packed send options of the payload
+		 * @param sender Player ID of the original sender, who never gets it back
+		 * @param skip Other players who already have the message
+		 */
+		void sendRelevant(HostPeers& h, const uint8_t* msg, size_t length, CustomDataPackets packetType,
+			uint8_t options, uint8_t sender, const std::bitset<256>& skip = {});
+#pragma endregion
+
+#pragma region Mesh
+		/** Reusable buffer for MeshRelay payloads */
+		std::vector<uint8_t> meshBuffer;
+
+		/**
+		 * Introduce a newly verified client and every other client to each other.
+		 * 
+		 * Both sides start connecting at once, so each opens a hole in its own NAT for the other.
+		 * 
+		 * PRECONDITION: This player MUST be the host
+		 */
+		void introduceMeshPeer(HostPeers& h, uint8_t playerID);
+
+		/** Start connecting to every client listed in a MeshPeers packet */
+		void connectMesh(ClientPeer& c, const std::vector<uint8_t>& msgConverted);
+
+		/**
+		 * Record a new connection as a direct link, if it is to a client we were introduced to.
+		 * 
+		 * @returns Whether the connection was to such a client
+		 */
+		bool linkMesh(ClientPeer& c, SLNet::Packet* packet);
+
+		/** Forget a direct link; messages to that client go through the host again */
+		void unlinkMesh(ClientPeer& c, uint8_t playerID);
+
+		/** Returns the player ID of the directly linked client at an address, or empty */
+		static std::optional<uint8_t> meshPlayer(ClientPeer& c, const SLNet::SystemAddress& addr);
+
+		/**
+		 * Send a Standard message or batch directly to every linked client, and to the host as
+		 * a MeshRelay, listing who already has it.
+		 */
+		void sendMesh(ClientPeer& c, const std::vector<uint8_t>& msg, CustomDataPackets packetType, uint8_t options);
+#pragma endregion
+
+#pragma region Host Migration
+		/** Whether we are reconnecting to a new host, rather than the original one */
+		bool migrating;
+
+		/**
+		 * The host is gone: pick the connected client with the lowest ID as the new host, and
+		 * either become the host or start reconnecting to it.
+		 * 
+		 * PRECONDITION: This player MUST be a client
+		 */
+		void migrateHost();
+
+		/**
+		 * Turn this client into the host, keeping player IDs and the session clock, and let
+		 * every other client reconnect through the usual handshake.
+		 * 
+		 * PRECONDITION: This player MUST be a client
+		 */
+		void promoteToHost();
+
+		/**
+		 * Start migrating if room data arrives from someone other than the host, because the
+		 * new host found us before we noticed the old one was gone.
+		 */
+		void checkHostChange(SLNet::Packet* packet);
+#pragma endregion
+
+#pragma region LAN Discovery
+		/** Whether we are still looking for the host on the local network (clients only) */
+		bool lanSearching;
+		/** When to next broadcast a query for our room */
+		std::chrono::steady_clock::time_point nextLanQuery;
+		/** Answers LAN queries on lanPort for a host that took over, and so listens on another port */
+		std::unique_ptr<NetworkTransport> lanBeacon;
+
+		/** Make up a room ID and answer queries for it (host only) */
+		void advertiseLan();
+
+		/** Start answering LAN queries on lanPort, for a host that took over */
+		void openLanBeacon();
+
+		/** Broadcast a query for our room, if it is time to, or give up if it has been too long */
+		void queryLan();
+
+		/** A host answered a query; connect to it if it has our room, or if it is a NetworkServer */
+		void foundLanHost(ClientPeer& c, SLNet::Packet* packet);
+#pragma endregion
+
+#pragma region Session Resumption
+		/** A reliable message the host sent (or would have sent) to clients */
+		struct ReplayEntry {
+			/** Standard or StandardBatch */
+			CustomDataPackets packetType;
+			/** Packed send options */
+			uint8_t options;
+			/** Player ID of the original sender */
+			uint8_t sender;
+			/** The payload */
+			std::vector<uint8_t> data;
+			/** Players who have not acknowledged it, including those who were away when it was sent */
+			std::bitset<256> pending;
+			/** RakNet receipt numbers it was sent with */
+			std::vector<uint32_t> receipts;
 		};
 
+		/** Unacknowledged messages, oldest first (host only) */
+		std::deque<ReplayEntry> replay;
+		/** Sequence number of the front of replay; each entry is one more than the last */
+		uint64_t replayBase;
+		/** Total payload bytes in replay */
+		size_t replayBytes;
+		/** Sequence number of the message each outstanding receipt belongs to */
+		std::unordered_map<uint32_t, uint64_t> receipts;
+		/** Session token of each player, or 0 if none (host only) */
+		std::array<uint64_t, 256> sessionTokens;
+		/** Players who dropped but may still resume (host only) */
+		std::bitset<256> away;
+		/** When each away player dropped */
+		std::array<time_t, 256> awaySince;
+		/** Our own session token, or 0 if none (clients only) */
+		uint64_t sessionToken;
+		/** Whether we are trying to reconnect straight to the host's address (clients only) */
+		bool resuming;
+		/** When to give up resuming and reconnect as usual */
+		std::chrono::steady_clock::time_point resumeDeadline;
+
+		/** Give a newly verified client a fresh session token */
+		void issueToken(HostPeers& h, uint8_t playerID);
+
+		/**
+		 * Keep a copy of a message the host is about to send to clients, if it may need replaying.
+		 * 
+		 * The entry starts out pending for every away player but the sender. Mark each player it
+		 * is actually sent to with sentReplay().
+		 * 
+		 * @returns The entry's sequence number, or empty if the message will never be replayed
+		 */
+		std::optional<uint64_t> recordReplay(const uint8_t* msg, size_t length, CustomDataPackets packetType,
+			uint8_t options, uint8_t sender);
+
+		/** Note that an entry from recordReplay() was sent to the given players with the given receipt */
+		void sentReplay(std::optional<uint64_t> seq, const std::bitset<256>& recipients, uint32_t receipt);
+
+		/** A client acknowledged the message with the given receipt */
+		void acknowledgeReplay(uint8_t playerID, uint32_t receipt);
+
+		/** Drop acknowledged messages from the front of the replay buffer, and anything over the limit */
+		void trimReplay();
+
+		/** Forget everything about a player's session */
+		void endSession(uint8_t playerID);
+
+		/** Resend everything a returning player missed */
+		void replayMissed(HostPeers& h, uint8_t playerID);
+
+		/** End the sessions of players who have been gone too long */
+		void expireSessions();
+
+		/** Check a client's session token and, if it is good, let it back in */
+		void resumeSession(HostPeers& h, const SLNet::SystemAddress& addr, const std::vector<uint8_t>& msgConverted);
+#pragma endregion
+
+#pragma region Clock Synchronization
+		/** When this connection was created; local time counts from here */
+		std::chrono::steady_clock::time_point epoch;
+		/** Host clock estimate (clients only) */
+		std::unique_ptr<NetworkClock> hostClock;
+		/** When to next send a ClockPing */
+		std::chrono::steady_clock::time_point nextClockPing;
+
+		/** Microseconds since this connection was created */
+		int64_t localTime() const;
+
+		/** As client, send a ClockPing to the host if it is time to */
+		void syncClock();
+#pragma endregion
+
 #pragma region Connection Handshake
 		ConnectionConfig config;
 
@@ -342,6 +1297,7 @@ namespace cugl {
 				====		===================			======
 		c0		Connect ------------->
 		ch1		  <--------- Conn Req Accepted
+				Find port stride
 				  <--------- Room ID Assigned
 		ch2		Accept Req
 
@@ -350,15 +1306,29 @@ namespace cugl {
 		cc1							 <----------------- Try connect to host
 				  <--------- Punch Succeeded -------------->
 		cc2												Save host address
+				  <------------------------------------ Connect
 		cc3		Check hasRoom
 				Connect ----------------------------------->
 		cc4		  <------------------------------------ Incoming connection
 		cc5		Request Accepted -------------------------->
 		cc6												Join Room
 		
+		Steps overlap wherever they do not depend on each other. The host works out how its
+		router assigns ports while it waits for its room ID, rather than when the first client
+		punches through. After punchthrough, both sides connect at once; whichever request gets
+		through first carries the game, and the host sees it at cc5 either as its own request
+		being accepted or as an incoming connection.
 		*/
 
-		/** Step 0: Connect to punchthrough server (both client and host) */
+		/** When the current connection attempt started */
+		std::chrono::steady_clock::time_point handshakeStart;
+		/** When each step of the current connection attempt finished */
+		HandshakeTimes handshakeTimes;
+
+		/** Record that a step of the handshake just finished, unless it already had */
+		void markPhase(std::optional<double> HandshakeTimes::* phase);
+
+		/** Step 0: Connect to punchthrough server (both client and host), or in LAN mode, skip straight to step 2 */
 		void c0StartupConn();
 
 		/** Host Step 1: Server connection established */
@@ -375,12 +1345,20 @@ namespace cugl {
 		/** Client Step 4: Client received direct connection request from host */
 		void cc4ClientReceiveHostConnection(ClientPeer& c, SLNet::Packet* packet);
 		/** Client Step 5: Host received confirmation of connection from client */
-		void cc5HostConfirmClient(HostPeers& h, SLNet::Packet* packet);
+		void cc5HostConfirmClient(HostPeers& h, const SLNet::SystemAddress& addr);
 		/** Client Step 6: Client received player ID from host and API */
 		void cc6ClientAssignedID(ClientPeer& c, const std::vector<uint8_t>& msgConverted);
 		/** Client Step 7: Host received confirmation of game data from client; connection finished */
 		void cc7HostGetClientData(HostPeers& h, SLNet::Packet* packet, const std::vector<uint8_t>& msgConverted);
 
+		/**
+		 * Game data the host sends a client in step 5: player counts, the client's ID, the API
+		 * version, and then the IDs of every connected player.
+		 */
+		std::vector<uint8_t> joinInfo(uint8_t playerID);
+		/** Fill in connectedPlayers from the game data sent by joinInfo() */
+		void readRoster(const std::vector<uint8_t>& msgConverted);
+
 		/** Reconnect Step 1: Picks up after client step 5; host sent reconn data to client */
 		void cr1ClientReceivedInfo(ClientPeer& c, const std::vector<uint8_t>& msgConverted);
 		/** Reconnect Step 2: Host received confirmation of game data from client */
@@ -398,9 +1376,54 @@ namespace cugl {
 		 * @param ignore The address to not send to
 		 */
 		void broadcast(const std::vector<uint8_t>& msg, SLNet::SystemAddress& ignore,
-			CustomDataPackets packetType = Standard);
+			CustomDataPackets packetType = Standard, uint8_t options = DEFAULT_OPTIONS);
+
+		/**
+		 * Broadcast a message to everyone except the specified connection, without copying it first.
+		 *
+		 * PRECONDITION: This player MUST be the host
+		 *
+		 * @param msg Start of the message to send
+		 * @param length Length of the message
+		 * @param ignore The address to not send to
+		 * @param packetType Packet type from RakNet
+		 * @param options Packed send options; see packOptions()
+		 */
+		void broadcast(const uint8_t* msg, size_t length, const SLNet::SystemAddress& ignore,
+			CustomDataPackets packetType, uint8_t options);
+
+		/**
+		 * Send a message to everyone (as host) or to the host (as client).
+		 * 
+		 * @param msg The message to send
+		 * @param packetType The type of custom data packet
+		 * @param options Packed send options; see packOptions()
+		 */
+		void send(const std::vector<uint8_t>& msg, CustomDataPackets packetType, uint8_t options = DEFAULT_OPTIONS);
 
-		void send(const std::vector<uint8_t>& msg, CustomDataPackets packetType);
+		/**
+		 * Send a message that has already been through admit(), batching it if enabled.
+		 * 
+		 * @param msg The message to send
+		 * @param packetType The type of custom data packet
+		 * @param options Packed send options; see packOptions()
+		 */
+		void transmit(const std::vector<uint8_t>& msg, CustomDataPackets packetType, uint8_t options);
+
+		/**
+		 * Forward a Standard packet from a client to every other client, exactly as received.
+		 * 
+		 * The packet already carries its send options and (once stamped by the caller) its
+		 * sender, so it is handed straight back to RakNet without being decoded or re-framed.
+		 * 
+		 * PRECONDITION: This player MUST be the host, and the sender ID in the packet must
+		 * already be set to the real sender.
+		 * 
+		 * @param packet The packet to forward
+		 * @param msg The payload inside the packet, kept in case it needs replaying
+		 * @param length Length of the payload
+		 */
+		void relay(SLNet::Packet* packet, const uint8_t* msg, size_t length);
 
 		/**
 		 * Send a message to just one connection.
@@ -411,6 +1434,27 @@ namespace cugl {
 		 */
 		void directSend(const std::vector<uint8_t>& msg, CustomDataPackets packetType, SLNet::SystemAddress dest);
 
+		/**
+		 * Pack delivery, priority and channel into the single options byte that
+		 * travels with Standard packets, so the host can relay them the same way.
+		 */
+		static uint8_t packOptions(Delivery delivery, Priority priority, uint8_t channel);
+
+		/** Returns whether a channel is one send() accepts, logging an error if not */
+		static bool checkChannel(uint8_t channel);
+
+		/** Options used for all internal packets and for send(msg): reliable, medium priority, channel 1 */
+		static const uint8_t DEFAULT_OPTIONS;
+
+		/**
+		 * Look up the player ID of a connected client by address.
+		 * 
+		 * @param h The host's peers
+		 * @param addr Address of the client
+		 * @returns The player ID, or empty if the address is not a known player
+		 */
+		static std::optional<uint8_t> findPlayer(HostPeers& h, const SLNet::SystemAddress& addr);
+
 		/** Last reconnection attempt time, or none if n/a */
 		std::optional<time_t> lastReconnAttempt;
 		/** Time when disconnected, or none if connected */
@@ -0,0 +1,175 @@
+//
+// CUNetworkDelta.h
+//
+// Delta compression for state snapshots sent over a NetworkConnection.
+//
+// NetworkDeltaEncoder XORs each serialized snapshot against the newest one every
+// receiver has acknowledged and run-length codes the result. NetworkDeltaDecoder
+// turns that back into the original bytes.
+//
+// Author: agent
+// Version: 10/17/2026
+//
+#ifndef CU_NETWORK_DELTA_H
+#define CU_NETWORK_DELTA_H
+
+#include <cstdint>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+namespace cugl {
+	/**
+	 * Helper class that delta compresses repeated state snapshots.
+	 *
+	 * Intended for use with cugl::NetworkConnection and cugl::NetworkSerializer.
+	 *
+	 * Serialize your world state with NetworkSerializer as usual, then pass the serialized
+	 * bytes to encode() instead of sending them directly. Send the result. Each receiver
+	 * decodes it with a NetworkDeltaDecoder, which gives back the original serialized bytes
+	 * to load into a NetworkDeserializer.
+	 *
+	 * Snapshots are XORed against a baseline that every receiver is known to have, and the
+	 * (mostly zero) result is run-length coded. A state that is 90% unchanged from the baseline
+	 * therefore costs roughly 10% of its full size.
+	 *
+	 * For this to work, receivers must acknowledge what they decoded: send the value of
+	 * NetworkDeltaDecoder::getSequence() back to the encoder (for example with sendOnlyToHost())
+	 * and pass it to acknowledge(). The baseline is the newest snapshot acknowledged by every
+	 * peer. If any peer has not acknowledged anything recent (for example, because packets were
+	 * lost), the encoder falls back to sending a full snapshot.
+	 *
+	 * Call addPeer() when a player joins and removePeer() when they leave, so that a new player
+	 * gets a full snapshot and a departed player does not hold the baseline back.
+	 */
+	class NetworkDeltaEncoder {
+	public:
+		/**
+		 * Number of past snapshots remembered on each side.
+		 *
+		 * Acknowledgements older than this many snapshots are ignored, and force a full snapshot.
+		 */
+		static constexpr uint32_t HISTORY = 32;
+
+		NetworkDeltaEncoder();
+
+		/**
+		 * Encode a serialized state for sending.
+		 *
+		 * Produces a delta against the newest snapshot every peer has acknowledged, or a
+		 * full snapshot if there is no such baseline.
+		 *
+		 * The returned reference stays valid until the next call to encode().
+		 *
+		 * @param state Serialized state, such as the result of NetworkSerializer::serialize()
+		 * @returns A byte vector to send to every peer
+		 */
+		const std::vector<uint8_t>& encode(const std::vector<uint8_t>& state);
+
+		/**
+		 * Record that a peer has decoded the given snapshot.
+		 *
+		 * Acknowledgements may arrive out of order; older ones are ignored.
+		 *
+		 * @param peer The player ID of the peer
+		 * @param sequence The value of NetworkDeltaDecoder::getSequence() on that peer
+		 */
+		void acknowledge(uint8_t peer, uint32_t sequence);
+
+		/**
+		 * Start tracking a peer. Snapshots are sent in full until it acknowledges one.
+		 *
+		 * @param peer The player ID of the peer
+		 */
+		void addPeer(uint8_t peer);
+
+		/**
+		 * Stop tracking a peer, so it no longer holds back the baseline.
+		 *
+		 * @param peer The player ID of the peer
+		 */
+		void removePeer(uint8_t peer);
+
+		/** Forget all history and peers; the next snapshot will be sent in full */
+		void reset();
+
+	private:
+		/** A snapshot that was sent, kept as a potential baseline */
+		struct Snapshot {
+			uint32_t sequence;
+			bool valid;
+			std::vector<uint8_t> state;
+		};
+
+		/** Sequence number of the next snapshot */
+		uint32_t nextSequence;
+		/** The last HISTORY snapshots, indexed by sequence % HISTORY */
+		std::vector<Snapshot> history;
+		/** Newest acknowledged sequence per peer; empty if the peer has not acknowledged anything */
+		std::unordered_map<uint8_t, std::optional<uint32_t>> acks;
+		/** Output buffer */
+		std::vector<uint8_t> output;
+	};
+
+	/**
+	 * Helper class that reconstructs states encoded by NetworkDeltaEncoder.
+	 *
+	 * Use one decoder per sender.
+	 */
+	class NetworkDeltaDecoder {
+	public:
+		NetworkDeltaDecoder();
+
+		/**
+		 * Decode a snapshot from a NetworkDeltaEncoder.
+		 *
+		 * On success, the reconstructed state is available from getState() and should be
+		 * acknowledged to the sender with getSequence().
+		 *
+		 * Fails if the message is malformed, older than the last decoded snapshot, or a delta
+		 * against a baseline this decoder no longer has. The sender will switch to a full
+		 * snapshot once it stops getting acknowledgements, so simply skip that update.
+		 *
+		 * @param msg Start of the received message
+		 * @param length Length of the received message
+		 * @returns Whether the snapshot could be decoded
+		 */
+		bool decode(const uint8_t* msg, size_t length);
+
+		/**
+		 * Decode a snapshot from a NetworkDeltaEncoder.
+		 *
+		 * @param msg The received message
+		 * @returns Whether the snapshot could be decoded
+		 */
+		bool decode(const std::vector<uint8_t>& msg) { return decode(msg.data(), msg.size()); }
+
+		/** The serialized state from the last successful decode(); pass it to NetworkDeserializer */
+		const std::vector<uint8_t>& getState() const;
+
+		/** The sequence number from the last successful decode(); send it back to be acknowledged */
+		uint32_t getSequence() const { return lastSequence; }
+
+		/** Forget all history */
+		void reset();
+
+	private:
+		/** A snapshot that was decoded, kept as a potential baseline */
+		struct Snapshot {
+			uint32_t sequence;
+			bool valid;
+			std::vector<uint8_t> state;
+		};
+
+		/** The last NetworkDeltaEncoder::HISTORY snapshots, indexed by sequence % HISTORY */
+		std::vector<Snapshot> history;
+		/** Sequence number of the last successful decode */
+		uint32_t lastSequence;
+		/** Whether anything has been decoded since the last reset */
+		bool hasState;
+		/** Buffer the next state is built in, so the baseline slot can be reused */
+		std::vector<uint8_t> scratch;
+	};
+}
+
+#endif // CU_NETWORK_DELTA_H
@@ -0,0 +1,216 @@
+//
+// CUNetworkInterpolator.h
+//
+// Client side buffer that plays back state snapshots a short delay behind the
+// sender, interpolating between them to hide network jitter.
+//
+// Author: agent
+// Version: 10/17/2026
+//
+#ifndef CU_NETWORK_INTERPOLATOR_H
+#define CU_NETWORK_INTERPOLATOR_H
+
+#include <algorithm>
+#include <cmath>
+#include <deque>
+#include <functional>
+#include <iterator>
+#include <optional>
+
+namespace cugl {
+	/**
+	 * Client side snapshot buffer that smooths out network jitter.
+	 *
+	 * Intended for use with cugl::NetworkConnection. Applying each state update as soon as it
+	 * arrives makes every hiccup in the network visible as stutter. Instead, add each snapshot
+	 * to this buffer along with the session time it was sent at, and sample() it every frame.
+	 * The buffer plays snapshots back a short delay behind the sender, interpolating between
+	 * them, so a 20 Hz state stream can be presented smoothly at 60 fps.
+	 *
+	 * The sender should include NetworkConnection::getSessionTime() in each snapshot. The delay
+	 * adapts to the connection: it covers the measured one way latency, the interval between
+	 * snapshots and a margin for jitter, and drifts slowly towards its target so playback never
+	 * jumps. If a snapshot is late anyway, the buffer briefly extrapolates from the last two.
+	 *
+	 * @tparam T Snapshot type
+	 */
+	template <typename T>
+	class NetworkInterpolator {
+	public:
+		/**
+		 * Blend between two snapshots.
+		 *
+		 * Called with t in [0, 1] to interpolate, and t > 1 to extrapolate past b.
+		 */
+		using Lerp = std::function<T(const T& a, const T& b, double t)>;
+
+		/** Most snapshots held at once */
+		static constexpr size_t CAPACITY = 64;
+
+		/**
+		 * Create an empty buffer.
+		 *
+		 * @param lerp How to blend between snapshots
+		 */
+		explicit NetworkInterpolator(Lerp lerp)
+			: lerp(std::move(lerp)), maxExtrapolation(0.1), minDelay(0), maxDelay(1),
+			delay(-1), transit(0), jitter(0), interval(0), lastSample(0), lastTime(0) {}
+
+		/**
+		 * Limit how far past the newest snapshot to extrapolate.
+		 *
+		 * @param seconds Longest extrapolation, in seconds; 0 to disable (default 0.1)
+		 */
+		void setExtrapolationLimit(double seconds) { maxExtrapolation = seconds; }
+
+		/**
+		 * Limit the playout delay.
+		 *
+		 * @param minSeconds Shortest delay (default 0)
+		 * @param maxSeconds Longest delay (default 1)
+		 */
+		void setDelayLimits(double minSeconds, double maxSeconds) {
+			minDelay = minSeconds;
+			maxDelay = maxSeconds;
+		}
+
+		/**
+		 * Add a received snapshot.
+		 *
+		 * Snapshots may be added out of order. Snapshots older than what has already been played
+		 * back, or sent at the same time as one already buffered, are ignored.
+		 *
+		 * @param sent Session time the snapshot was sent at
+		 * @param state The snapshot
+		 * @param now Current session time (NetworkConnection::getSessionTime())
+		 */
+		void add(double sent, T state, double now) {
+			if (sent <= lastTime && !snapshots.empty()) {
+				return;
+			}
+			auto it = std::upper_bound(snapshots.begin(), snapshots.end(), sent,
+				[](double time, const Snapshot& s) { return time < s.time; });
+			if (it != snapshots.begin() && std::prev(it)->time == sent) {
+				// A duplicated message; two snapshots at one time cannot be interpolated between
+				return;
+			}
+
+			// Jitter as in RFC 3550: smoothed change in transit time between packets
+			double t = now - sent;
+			if (delay < 0) {
+				transit = t;
+				delay = std::clamp(t, minDelay, maxDelay);
+			} else {
+				jitter += (std::abs(t - transit) - jitter) * GAIN;
+				transit += (t - transit) * GAIN;
+			}
+
+			if (it != snapshots.begin() && it == snapshots.end()) {
+				double gap = sent - snapshots.back().time;
+				interval = interval == 0 ? gap : interval + (gap - interval) * GAIN;
+			}
+			snapshots.insert(it, { sent, std::move(state) });
+			if (snapshots.size() > CAPACITY) {
+				snapshots.pop_front();
+			}
+		}
+
+		/**
+		 * Returns the state to present now, or empty if nothing has arrived yet.
+		 *
+		 * Call this once per frame.
+		 *
+		 * @param now Current session time (NetworkConnection::getSessionTime())
+		 */
+		std::optional<T> sample(double now) {
+			if (snapshots.empty()) {
+				return std::nullopt;
+			}
+
+			// Ease towards the target delay, never faster than ADJUST_RATE, so playback speed
+			// changes imperceptibly instead of jumping
+			double target = std::clamp(transit + interval + JITTER_MARGIN * jitter, minDelay, maxDelay);
+			double step = ADJUST_RATE * std::max(0.0, now - lastSample);
+			delay += std::clamp(target - delay, -step, step);
+			lastSample = now;
+
+			double render = std::max(now - delay, lastTime);
+			lastTime = render;
+
+			// Drop snapshots we have fully played past, keeping one behind render time
+			while (snapshots.size() > 2 && snapshots[1].time <= render) {
+				snapshots.pop_front();
+			}
+
+			const Snapshot& a = snapshots.front();
+			if (render <= a.time || snapshots.size() == 1) {
+				return a.state;
+			}
+			const Snapshot& b = snapshots[1];
+			if (b.time <= a.time) {
+				return b.state;
+			}
+			double t = (render - a.time) / (b.time - a.time);
+			if (t > 1) {
+				// Late snapshot: extrapolate, but not too far
+				double past = std::min(render - b.time, maxExtrapolation);
+				t = 1 + past / (b.time - a.time);
+			}
+			return lerp(a.state, b.state, t);
+		}
+
+		/** Returns the current playout delay, in seconds */
+		double getDelay() const { return std::max(delay, 0.0); }
+
+		/** Returns the smoothed jitter in snapshot arrival times, in seconds */
+		double getJitter() const { return jitter; }
+
+		/** Returns the number of buffered snapshots */
+		size_t size() const { return snapshots.size(); }
+
+		/** Remove all snapshots and start adapting from scratch */
+		void clear() {
+			snapshots.clear();
+			delay = -1;
+			transit = jitter = interval = 0;
+			lastSample = lastTime = 0;
+		}
+
+	private:
+		/** Weight of each new measurement in the smoothed statistics */
+		static constexpr double GAIN = 1.0 / 16;
+		/** How many multiples of the jitter to add to the delay */
+		static constexpr double JITTER_MARGIN = 3;
+		/** Fastest change in delay, in seconds of delay per second */
+		static constexpr double ADJUST_RATE = 0.1;
+
+		/** A buffered snapshot */
+		struct Snapshot {
+			double time;
+			T state;
+		};
+
+		/** Blend function */
+		Lerp lerp;
+		/** Buffered snapshots, oldest first */
+		std::deque<Snapshot> snapshots;
+		/** Longest extrapolation */
+		double maxExtrapolation;
+		/** Delay limits */
+		double minDelay, maxDelay;
+		/** Current playout delay, or negative before the first snapshot */
+		double delay;
+		/** Smoothed transit time (one way latency plus clock error) */
+		double transit;
+		/** Smoothed jitter */
+		double jitter;
+		/** Smoothed interval between snapshots */
+		double interval;
+		/** Session time of the last call to sample() */
+		double lastSample;
+		/** Render time of the last call to sample(); playback never goes backwards */
+		double lastTime;
+	};
+}
+
+#endif // CU_NETWORK_INTERPOLATOR_H
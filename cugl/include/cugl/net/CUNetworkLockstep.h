@@ -0,0 +1,170 @@
+//
+// CUNetworkLockstep.h
+//
+// Deterministic lockstep on top of a NetworkConnection.
+//
+// Players exchange only their inputs, and each frame is released to the
+// simulation once every active player's input for it has arrived.
+//
+// Author: agent
+// Version: 10/17/2026
+//
+#ifndef CU_NETWORK_LOCKSTEP_H
+#define CU_NETWORK_LOCKSTEP_H
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include <cugl/net/CUNetworkConnection.h>
+
+namespace cugl {
+	/**
+	 * Deterministic lockstep session on top of a NetworkConnection.
+	 *
+	 * Instead of broadcasting game state, every player sends only their inputs, and every
+	 * player runs the same deterministic simulation on the same inputs. Frames are numbered
+	 * from 0, and a frame is only released to the simulation once every active player's
+	 * input for it has arrived.
+	 *
+	 * Each frame, call update() to process the network, then addInput() with this player's
+	 * input, and then call advance() until it returns false, simulating one frame each time
+	 * it returns true. Local input is scheduled inputDelay frames ahead, so that it has time
+	 * to reach the other players before they need it; with a delay at least as long as the
+	 * one way latency, the simulation never waits.
+	 *
+	 * Inputs are sent unreliably, and every packet repeats the last few inputs, so a lost
+	 * packet is covered by the next one instead of stalling on a resend. Packets also go back
+	 * as far as the slowest player still needs, so a burst of losses cannot stall the game.
+	 *
+	 * Once a lockstep session is created, it owns the connection's receive(). Call
+	 * update() instead, and send any other game messages with send() on this class.
+	 * Create the session after the game has started, when the player list is settled.
+	 */
+	class NetworkLockstep {
+	public:
+		/** Default number of recent inputs each packet repeats */
+		static constexpr uint32_t DEFAULT_REDUNDANCY = 4;
+
+		/**
+		 * Start a lockstep session.
+		 *
+		 * @param net The connection to run on; must already have a player ID
+		 * @param inputDelay How many frames ahead local input is scheduled
+		 * @param redundancy How many of the most recent inputs each packet carries
+		 * @param lead How many more frames past inputDelay local input may run ahead of the next
+		 *             released frame (for callers that simulate ahead, like NetworkRollback)
+		 */
+		NetworkLockstep(std::shared_ptr<NetworkConnection> net, uint32_t inputDelay = 3, uint32_t redundancy = DEFAULT_REDUNDANCY,
+			uint32_t lead = 0);
+
+		/**
+		 * Process incoming network messages.
+		 *
+		 * Call this once per frame, in place of NetworkConnection::receive().
+		 *
+		 * @param dispatcher Called with every message sent through send() on this class, along
+		 * with the player ID of the sender. The pointer is only valid during the call.
+		 */
+		void update(const std::function<void(const uint8_t*, size_t, uint8_t)>& dispatcher);
+
+		/**
+		 * Schedule this player's input for the next frame that does not have one yet.
+		 *
+		 * Input is accepted up to inputDelay (plus lead) frames past the next frame to be released,
+		 * so call this once for every time advance() returns true. The input is sent right away.
+		 *
+		 * @param input This player's input; may be empty
+		 * @returns False if the simulation is too far behind to accept more input
+		 */
+		bool addInput(const std::vector<uint8_t>& input);
+
+		/** Returns whether every active player's input for the next frame has arrived */
+		bool isReady();
+
+		/**
+		 * Release the next frame to the simulation.
+		 *
+		 * If this returns true, getFrame() and getInput() describe the frame to simulate.
+		 *
+		 * @returns False if not every active player's input for the frame has arrived yet
+		 */
+		bool advance();
+
+		/** Returns the frame most recently released by advance() */
+		uint32_t getFrame() const { return frame - 1; }
+
+		/**
+		 * Returns a player's input for the frame most recently released by advance().
+		 *
+		 * Empty for players who were not active, and for the first inputDelay frames.
+		 *
+		 * @param playerID The player
+		 */
+		const std::vector<uint8_t>& getInput(uint8_t playerID) const;
+
+		/**
+		 * Send a message to every other player through the connection.
+		 *
+		 * Other players receive it through the dispatcher given to update().
+		 *
+		 * @param msg The message to send
+		 */
+		void send(const std::vector<uint8_t>& msg);
+
+	private:
+		/** Number of frames of input kept per player; must exceed inputDelay + lead + 1 */
+		static constexpr uint32_t WINDOW = 128;
+
+		/** One player's input for one frame */
+		struct Slot {
+			uint32_t frame;
+			bool valid;
+			std::vector<uint8_t> data;
+		};
+
+		/** The underlying connection */
+		std::shared_ptr<NetworkConnection> net;
+		/** How many frames ahead local input is scheduled */
+		uint32_t inputDelay;
+		/** How many recent inputs each packet repeats */
+		uint32_t redundancy;
+		/** Extra frames local input may run ahead */
+		uint32_t lead;
+		/** This player's ID */
+		uint8_t playerID;
+		/** Next frame to release */
+		uint32_t frame;
+		/** Next frame to schedule local input for */
+		uint32_t inputFrame;
+		/** Inputs per player, indexed by frame % WINDOW */
+		std::unordered_map<uint8_t, std::vector<Slot>> inputs;
+		/** Next frame each other player needs to simulate, as last reported by them */
+		std::unordered_map<uint8_t, uint32_t> peerFrames;
+		/** Whether inputs were sent since the last update() */
+		bool sentInputs;
+		/** Reusable message buffer */
+		std::vector<uint8_t> buffer;
+
+		/** Returns a player's input slot for a frame, or nullptr if it has not arrived */
+		const Slot* find(uint8_t playerID, uint32_t frame) const;
+
+		/** Store a player's input for a frame */
+		void store(uint8_t playerID, uint32_t frame, const uint8_t* data, size_t length);
+
+		/** Read an input packet from another player */
+		void readInputs(const uint8_t* msg, size_t length, uint8_t sender);
+
+		/**
+		 * Send this player's recent inputs.
+		 *
+		 * Each packet repeats at least the last few inputs, and goes back as far as the
+		 * furthest behind player needs, so no input is ever lost for good.
+		 */
+		void sendInputs();
+	};
+}
+
+#endif // CU_NETWORK_LOCKSTEP_H
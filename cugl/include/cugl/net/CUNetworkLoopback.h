@@ -0,0 +1,240 @@
+//
+// CUNetworkLoopback.h
+//
+// Simulated network for running several NetworkConnections inside one process.
+//
+// Packets pass through an in-memory queue that adds latency, jitter, loss,
+// duplication, reordering and a bandwidth limit, so tests and benchmarks can
+// exercise the real connection code without sockets.
+//
+// Author: agent
+// Version: 10/17/2026
+//
+#ifndef CU_NETWORK_LOOPBACK_H
+#define CU_NETWORK_LOOPBACK_H
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+#include <slikenet/types.h>
+
+namespace cugl {
+	class LoopbackTransport;
+
+	/**
+	 * Simulated network linking connections inside one process.
+	 *
+	 * Give the same NetworkLoopback to the ConnectionConfig of several NetworkConnections,
+	 * and they reach each other through it instead of through UDP sockets. They find each other
+	 * as they would on a LAN (see ConnectionConfig::lan), so no punchthrough server is needed.
+	 * Every packet is held back by the simulated latency and jitter, may be lost, duplicated or
+	 * overtaken, and queues behind the sender's bandwidth, so the connection behaves much as it would across a real
+	 * network, but without other traffic, and with only the random number generator (seeded in
+	 * the constructor) deciding what is lost and delayed.
+	 *
+	 * Delivery follows RakNet's rules. Reliable messages always arrive, a lost copy costing a
+	 * resend timeout; ordered ones wait for every earlier message on their channel; sequenced
+	 * ones are dropped if a newer one got there first. Priorities are ignored.
+	 *
+	 * Nothing runs in the background. Packets move whenever any connection on the network
+	 * receives. All methods are safe to call from any thread.
+	 */
+	class NetworkLoopback {
+	public:
+		/**
+		 * Conditions on a link.
+		 *
+		 * Used for every link in a NetworkLoopback, and for the links of a NetworkConnection
+		 * with ConnectionConfig::simulateConditions (see NetworkConnection::setLinkConditions).
+		 */
+		struct LinkConfig {
+			/** Delay added to every packet (ms) */
+			double latency;
+			/** Most extra random delay (ms); each packet draws uniformly up to this much more */
+			double jitter;
+			/** Chance that a packet is lost, from 0 to MAX_LOSS */
+			double loss;
+			/** Chance that an unreliable, unsequenced packet arrives twice, from 0 to 1 */
+			double duplicate;
+			/**
+			 * Chance that a packet is held back an extra trip (at least REORDER_DELAY), from 0 to 1.
+			 *
+			 * Packets sent after it may then overtake it, where the reliability allows. On an ordered
+			 * channel everything behind it waits too; on a sequenced one it is dropped instead,
+			 * as a newer packet gets there first.
+			 */
+			double reorder;
+			/** Most bytes each connection sends per second; packets past that queue up. 0 for no limit */
+			double bandwidth;
+
+			LinkConfig() {
+				this->latency = 0;
+				this->jitter = 0;
+				this->loss = 0;
+				this->duplicate = 0;
+				this->reorder = 0;
+				this->bandwidth = 0;
+			}
+		};
+
+		/** Highest loss allowed; any more and reliable messages would be resent forever */
+		static constexpr double MAX_LOSS = 0.9;
+		/** Bytes every packet costs on the wire, besides its payload (UDP, IP and RakNet headers) */
+		static constexpr uint32_t PACKET_OVERHEAD = 40;
+		/** Least extra delay on a packet held back by LinkConfig::reorder (ms) */
+		static constexpr double REORDER_DELAY = 5;
+
+		/**
+		 * Create an empty network.
+		 *
+		 * @param config Conditions on every link
+		 * @param seed Seed for every random choice; the same seed gives the same choices
+		 */
+		explicit NetworkLoopback(LinkConfig config = LinkConfig(), uint32_t seed = 0);
+
+		/** Change the conditions on every link; packets already in flight keep their timing */
+		void setLinkConfig(LinkConfig config);
+
+		/** Returns the conditions on every link */
+		LinkConfig getLinkConfig();
+
+		/**
+		 * Cut every open connection without notice, as if the network went down for a moment.
+		 *
+		 * Nothing more gets through on those connections, and each side reports it lost once its
+		 * own timeout passes. New connections work as usual.
+		 */
+		void dropConnections();
+
+	private:
+		friend class LoopbackTransport;
+
+		/** What a datagram is for */
+		enum class Kind : uint8_t {
+			/** A message from the game */
+			Data,
+			/** Asks to open a connection */
+			Request,
+			/** Accepts a connection */
+			Accept,
+			/** Turns down a connection because the receiver is full */
+			Refuse,
+			/** Stands for a request that reached nobody; delivered when the attempt times out */
+			Fail,
+			/** Closes a connection */
+			Disconnect,
+			/** Stands for a connection closed without notice; delivered when it times out */
+			Lost,
+			/** Measures round trip time over a connection */
+			Ping,
+			/** Answers a Ping */
+			Pong,
+			/** LAN query (RakNet's unconnected ping) */
+			Query,
+			/** Answers a Query with the offline ping response */
+			Answer,
+			/** Acknowledges a message sent with a receipt */
+			Receipt,
+			/** Reports that an unreliable message sent with a receipt was lost */
+			ReceiptLoss
+		};
+
+		/** A packet on its way */
+		struct Datagram {
+			/** When it arrives (microseconds) */
+			int64_t arrival;
+			/** Tiebreaker that keeps datagrams arriving at the same time in sending order */
+			uint64_t order;
+			/** What it is for */
+			Kind kind;
+			/** Port of the sender */
+			uint16_t from;
+			/** Port of the receiver */
+			uint16_t to;
+			/** The connection it belongs to */
+			uint64_t link;
+			/** Reliability of a Data datagram */
+			uint8_t reliability;
+			/** Ordering channel of a Data datagram */
+			uint8_t channel;
+			/** Sequence number of a sequenced Data datagram */
+			uint32_t sequence;
+			/** Receipt number, for Data, Receipt and ReceiptLoss */
+			uint32_t receipt;
+			/** When it was sent, for Ping, Pong and Query (microseconds) */
+			int64_t sent;
+			/** Payload, starting with the RakNet message ID */
+			std::vector<uint8_t> data;
+		};
+
+		/** Orders the queue by arrival time */
+		struct Later {
+			bool operator()(const Datagram& a, const Datagram& b) const {
+				return a.arrival != b.arrival ? a.arrival > b.arrival : a.order > b.order;
+			}
+		};
+
+		/** Guards everything below */
+		std::mutex mutex;
+		/** Conditions on every link */
+		LinkConfig config;
+		/** Decides loss, jitter, duplication and reordering */
+		std::mt19937 rng;
+		/** Every started transport, by port */
+		std::unordered_map<uint16_t, LoopbackTransport*> endpoints;
+		/** Datagrams on their way, as a heap ordered by Later */
+		std::vector<Datagram> queue;
+		/** Payload buffers not in use, kept to reuse their capacity */
+		std::vector<std::vector<uint8_t>> spare;
+		/** Next Datagram::order */
+		uint64_t nextOrder;
+		/** Next connection ID */
+		uint64_t nextLink;
+		/** Next GUID to give a transport */
+		uint64_t nextGuid;
+		/** Next port to try for a transport that does not ask for one */
+		uint16_t nextPort;
+
+		/** Microseconds on the steady clock */
+		static int64_t now();
+
+		/** Returns an empty payload buffer */
+		std::vector<uint8_t> takeBuffer();
+
+		/** Keep a payload buffer for reuse */
+		void giveBuffer(std::vector<uint8_t>&& buffer);
+
+		/** Returns a datagram of the given kind between two ports, with an empty payload */
+		Datagram makeDatagram(Kind kind, uint16_t from, uint16_t to, uint64_t link);
+
+		/** Returns how long a packet takes to cross a link (microseconds), drawing the jitter */
+		int64_t transit();
+
+		/** Returns whether a packet is lost, drawing from the loss rate */
+		bool lose();
+
+		/** Returns true with the given chance, from 0 to 1 */
+		bool chance(double p);
+
+		/** Returns the extra delay on a packet held back for reordering (microseconds) */
+		int64_t holdBack();
+
+		/** Put a datagram on its way, to arrive after the given delay (microseconds) */
+		void post(Datagram&& datagram, int64_t delay);
+
+		/** Put a datagram on its way, to arrive at the given time (microseconds) */
+		void postAt(Datagram&& datagram, int64_t arrival);
+
+		/** Deliver every datagram whose time has come */
+		void pump();
+
+		/** Act on one datagram arriving */
+		void arrive(Datagram& datagram);
+	};
+}
+
+#endif // CU_NETWORK_LOOPBACK_H
@@ -0,0 +1,140 @@
+//
+// CUNetworkPunchServer.h
+//
+// Punchthrough server that NetworkConnection hosts and clients can meet
+// through, small enough to embed in tools and tests.
+//
+// Author: agent
+// Version: 10/17/2026
+//
+#ifndef CU_NETWORK_PUNCH_SERVER_H
+#define CU_NETWORK_PUNCH_SERVER_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <thread>
+#include <unordered_map>
+
+#include <slikenet/NatPunchthroughServer.h>
+
+#include <cugl/net/CUNetworkConnection.h>
+
+namespace cugl {
+	/**
+	 * Punchthrough server for NetworkConnection hosts and clients to meet through.
+	 *
+	 * This speaks the same protocol as the standalone server at
+	 * https://github.com/mt-xing/nat-punchthrough-server, so it can stand in for it anywhere
+	 * ConnectionConfig::punchthroughServerAddr and punchthroughServerPort point. It is meant
+	 * to be embedded in tools and tests: a load test can run the server and hundreds of
+	 * connections in one process, without anything else running on the machine.
+	 *
+	 * Every connection is given a room ID as it arrives. Hosts keep theirs as the room clients
+	 * join with; clients ignore theirs. A client asking to be punched through to a room is
+	 * sent on to that room's host by SLikeNet's NatPunchthroughServer, which then coordinates
+	 * the punchthrough as usual. A room ID is free again once its host disconnects.
+	 *
+	 * By default the server only listens on localhost, so nothing outside the machine can reach it.
+	 */
+	class NetworkPunchServer {
+	public:
+		/** Basic data needed to run a server */
+		struct ServerConfig {
+			/** UDP port to listen on; connections set ConnectionConfig::punchthroughServerPort to this */
+			uint16_t port;
+			/** Address to listen on (default "127.0.0.1"); nullptr for every address */
+			const char* address;
+			/** Most connections at once, hosts and clients together (at most 100000, the number of room IDs) */
+			uint32_t maxConnections;
+
+			ServerConfig(uint16_t port) {
+				this->port = port;
+				this->address = "127.0.0.1";
+				this->maxConnections = 1024;
+			}
+		};
+
+		/** Counts of what the server has done since it started */
+		struct Stats {
+			/** Room IDs handed out, one per connection */
+			uint64_t roomsAssigned;
+			/** Punchthrough requests sent on to a room's host */
+			uint64_t punchthroughs;
+			/** Punchthrough requests for a room that is not open */
+			uint64_t roomsNotFound;
+		};
+
+		/**
+		 * Start a server.
+		 *
+		 * The server listens right away. Check getStatus() to see whether the port could be opened.
+		 *
+		 * @param config Server config
+		 */
+		explicit NetworkPunchServer(ServerConfig config);
+
+		/** Disconnect everyone and stop the server */
+		~NetworkPunchServer();
+
+		/** Returns Connected if the server is listening, or GenericError if it could not start */
+		NetworkConnection::NetStatus getStatus() const { return status; }
+
+		/** Returns the number of connections holding a room ID. Safe to call from any thread. */
+		size_t getNumRooms();
+
+		/** Returns what the server has done so far. Safe to call from any thread. */
+		Stats getStats() const;
+
+	private:
+		/** Plugin that points punchthrough requests for a room at its host; defined in the cpp */
+		class RoomDirectory;
+
+		/** Server config */
+		ServerConfig config;
+		/** Whether the server is listening */
+		NetworkConnection::NetStatus status;
+		/** The peer everyone connects to */
+		std::unique_ptr<SLNet::RakPeerInterface> peer;
+		/** Coordinates punchthrough between a client and a host */
+		SLNet::NatPunchthroughServer natPunchthroughServer;
+		/** Rewrites punchthrough requests before natPunchthroughServer sees them */
+		std::unique_ptr<RoomDirectory> directory;
+
+		/** Guards the room tables */
+		std::mutex roomMutex;
+		/** GUID of the connection holding each room ID, by room number */
+		std::unordered_map<uint32_t, uint64_t> hosts;
+		/** Room number held by each connection, by GUID */
+		std::unordered_map<uint64_t, uint32_t> rooms;
+		/** Picks room IDs */
+		std::mt19937 rng;
+
+		/** Counts for getStats() */
+		std::atomic<uint64_t> roomsAssigned{ 0 };
+		std::atomic<uint64_t> punchthroughs{ 0 };
+		std::atomic<uint64_t> roomsNotFound{ 0 };
+
+		/** Runs the peer */
+		std::thread netThread;
+		/** Whether netThread should keep running */
+		std::atomic<bool> netRunning{ false };
+
+		/** Network thread: receive packets until stopped */
+		void netThreadLoop();
+
+		/** Network thread: give a new connection a room ID */
+		void assignRoom(const SLNet::RakNetGUID& guid);
+
+		/** Network thread: free the room ID of a connection that is gone */
+		void releaseRoom(const SLNet::RakNetGUID& guid);
+
+		/** Network thread: returns the GUID of the connection holding a room, if any */
+		std::optional<uint64_t> findHost(uint32_t room);
+	};
+}
+
+#endif // CU_NETWORK_PUNCH_SERVER_H
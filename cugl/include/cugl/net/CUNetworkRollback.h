@@ -0,0 +1,161 @@
+//
+// CUNetworkRollback.h
+//
+// Rollback netcode on top of a NetworkConnection.
+//
+// The simulation predicts remote inputs instead of waiting for them, and when
+// a prediction turns out wrong, it loads the state saved at that frame and
+// simulates forward again.
+//
+// Author: agent
+// Version: 10/17/2026
+//
+#ifndef CU_NETWORK_ROLLBACK_H
+#define CU_NETWORK_ROLLBACK_H
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include <cugl/net/CUNetworkLockstep.h>
+
+namespace cugl {
+	/**
+	 * Rollback (predict and resimulate) session on top of a NetworkConnection.
+	 *
+	 * Like NetworkLockstep, every player sends only their inputs and runs the same deterministic
+	 * simulation. Unlike lockstep, the simulation never waits for remote inputs: it predicts
+	 * that every other player is still doing whatever they did last, and carries on. When the
+	 * real inputs arrive and turn out different, the session loads the state saved at that
+	 * frame and quickly resimulates every frame since, all within one update().
+	 *
+	 * Local input is applied immediately (or after inputDelay frames, if set), so the game
+	 * feels like it has no network latency, as long as the round trip fits in the prediction
+	 * window. If remote inputs fall more than maxPrediction frames behind, advance() stalls
+	 * until they catch up.
+	 *
+	 * The game only supplies three callbacks: save its state, load a saved state, and advance
+	 * the simulation by one frame. The advance callback reads inputs with getInput(). Since
+	 * frames may be simulated more than once, it must be deterministic and should not play
+	 * sounds or effects for frames that may be rolled back (see isPredicted()).
+	 *
+	 * Each frame, call update() and then advance() with this player's input. As with
+	 * NetworkLockstep, the session owns the connection's receive(), and other game messages
+	 * should go through send() on this class.
+	 */
+	class NetworkRollback {
+	public:
+		/** Game hooks for a rollback session */
+		struct Callbacks {
+			/** Write the full game state into the given buffer (which may hold an older state) */
+			std::function<void(std::vector<uint8_t>&)> save;
+			/** Restore the game state from a buffer written by save */
+			std::function<void(const std::vector<uint8_t>&)> load;
+			/** Simulate the given frame, reading each player's input with getInput() */
+			std::function<void(uint32_t)> advance;
+		};
+
+		/**
+		 * Start a rollback session.
+		 *
+		 * Create it after the game has started, when the player list is settled.
+		 *
+		 * @param net The connection to run on; must already have a player ID
+		 * @param callbacks Game hooks
+		 * @param maxPrediction Most frames to simulate past the last frame with every input
+		 * @param inputDelay How many frames local input is delayed by (trades latency for fewer rollbacks)
+		 */
+		NetworkRollback(std::shared_ptr<NetworkConnection> net, Callbacks callbacks,
+			uint32_t maxPrediction = 10, uint32_t inputDelay = 0);
+
+		/**
+		 * Process incoming network messages, and roll back if any prediction was wrong.
+		 *
+		 * Call this once per frame, in place of NetworkConnection::receive(). This may call
+		 * the load and advance callbacks several times.
+		 *
+		 * @param dispatcher Called with every message sent through send() on this class, along
+		 * with the player ID of the sender. The pointer is only valid during the call.
+		 */
+		void update(const std::function<void(const uint8_t*, size_t, uint8_t)>& dispatcher);
+
+		/**
+		 * Simulate the next frame with this player's input.
+		 *
+		 * @param input This player's input; may be empty
+		 * @returns False (without simulating) if remote inputs are too far behind to predict further
+		 */
+		bool advance(const std::vector<uint8_t>& input);
+
+		/** Returns the number of frames simulated so far (the next frame to simulate) */
+		uint32_t getFrame() const { return frame; }
+
+		/** Returns the number of frames for which every player's input is known */
+		uint32_t getConfirmedFrame() const { return confirmed; }
+
+		/** Returns whether the frame being simulated uses predicted inputs, and so may be rolled back */
+		bool isPredicted() const { return current >= confirmed; }
+
+		/**
+		 * Returns a player's input for the frame being simulated.
+		 *
+		 * Only meaningful inside the advance callback. Empty for inactive players.
+		 *
+		 * @param playerID The player
+		 */
+		const std::vector<uint8_t>& getInput(uint8_t playerID) const;
+
+		/**
+		 * Send a message to every other player through the connection.
+		 *
+		 * @param msg The message to send
+		 */
+		void send(const std::vector<uint8_t>& msg) { lockstep.send(msg); }
+
+	private:
+		/** Inputs used for one frame, one per player in players */
+		using FrameInputs = std::vector<std::vector<uint8_t>>;
+
+		/** Input exchange and confirmation */
+		NetworkLockstep lockstep;
+		/** Game hooks */
+		Callbacks callbacks;
+		/** Most frames to simulate past confirmed */
+		uint32_t maxPrediction;
+		/** How many frames local input is delayed */
+		uint32_t inputDelay;
+		/** This player's ID */
+		uint8_t playerID;
+		/** Players in the session */
+		std::vector<uint8_t> players;
+		/** Index of this player in players */
+		size_t self;
+
+		/** Next frame to simulate */
+		uint32_t frame;
+		/** Frames before this have every input confirmed */
+		uint32_t confirmed;
+		/** Frame being simulated (valid inside the advance callback) */
+		uint32_t current;
+
+		/** State at the start of each frame, indexed by frame % window */
+		std::vector<std::vector<uint8_t>> states;
+		/** Inputs each frame was (last) simulated with, indexed by frame % window */
+		std::vector<FrameInputs> used;
+		/** Confirmed inputs, indexed by frame % window */
+		std::vector<FrameInputs> known;
+		/** Local inputs, indexed by frame % window */
+		std::vector<std::vector<uint8_t>> local;
+		/** Latest confirmed input per player, used as the prediction */
+		FrameInputs latest;
+
+		/** Ring size: enough for every unconfirmed frame plus the local input delay */
+		size_t window() const { return states.size(); }
+
+		/** Save the state, pick inputs, and simulate one frame */
+		void simulate(uint32_t f);
+	};
+}
+
+#endif // CU_NETWORK_ROLLBACK_H
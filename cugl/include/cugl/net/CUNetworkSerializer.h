@@ -149,6 +149,19 @@ void write(std::vector<T> v);
 		 */
 		void receive(const std::vector<uint8_t>& msg);
 
+		/**
+		 * Load a new message to read from a raw byte buffer.
+		 * 
+		 * This is the same as receive(msg), but takes the pointer and length handed out
+		 * by the zero-copy NetworkConnection::receive. The bytes are copied into this
+		 * object's buffer, which is reused between messages, so the source buffer does not
+		 * need to outlive this call.
+		 * 
+		 * @param msg The first byte of a message serialized by NetworkSerializer
+		 * @param length The length of the message
+		 */
+		void receive(const uint8_t* msg, size_t length);
+
 		/**
 		 * Read the next unreturned value or vector from the currently loaded byte vector.
 		 * 
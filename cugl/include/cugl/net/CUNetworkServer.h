@@ -0,0 +1,343 @@
+//
+// CUNetworkServer.h
+//
+// Dedicated server that hosts many NetworkConnection rooms on one port, with
+// the game code for each room running on a small pool of worker threads.
+//
+// Author: agent
+// Version: 10/17/2026
+//
+#ifndef CU_NETWORK_SERVER_H
+#define CU_NETWORK_SERVER_H
+
+#include <atomic>
+#include <bitset>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <cugl/net/CUNetworkConnection.h>
+
+namespace cugl {
+	/**
+	 * Dedicated server hosting many rooms at once on a single port.
+	 *
+	 * Where a NetworkConnection host is one player's device running one room over its own
+	 * RakNet peer, this runs hundreds of rooms in one process over one peer. Each room behaves
+	 * like a NetworkConnection host as far as its clients can tell: they get player IDs from 1,
+	 * see each other join and leave, and receive everything the others send. The server itself
+	 * is player 0 in every room, so sendOnlyToHost() reaches the server's game code.
+	 *
+	 * Clients are ordinary NetworkConnection clients in LAN mode, with lanAddress and lanPort
+	 * set to the server. They skip the punchthrough server, connect straight to this one, and
+	 * ask for their room by ID. Host migration, meshes and session resumption are not
+	 * available against a server; clients that drop reconnect through the usual handshake.
+	 *
+	 * Incoming packets are routed to their room through a table indexed by connection, and
+	 * relayed to the rest of the room right away on the network thread. The game code for
+	 * each room then runs on one of a few worker threads, through the callbacks: every room is
+	 * owned by one worker, which makes every callback for that room, in order. Rooms are
+	 * preallocated, and an open room costs a few hundred bytes plus whatever the game keeps.
+	 */
+	class NetworkServer {
+	public:
+		/** Basic data needed to run a server */
+		struct ServerConfig {
+			/** UDP port to listen on; clients set ConnectionConfig::lanPort to this */
+			uint16_t port;
+			/** API version number; clients with a different version are turned away */
+			uint8_t apiVersion;
+			/** Most rooms open at once (at most 100000, the number of room IDs) */
+			uint32_t maxRooms;
+			/** Most clients in each room; the server itself is player 0 and does not count */
+			uint32_t maxPlayersPerRoom;
+			/** Most clients connected at once, across every room */
+			uint32_t maxConnections;
+			/** Number of worker threads that run the room callbacks */
+			uint32_t workers;
+			/** How often each room's update callback runs (ms); 0 to never call it */
+			uint32_t tickInterval;
+
+			ServerConfig(uint16_t port, uint8_t apiVer) {
+				this->port = port;
+				this->apiVersion = apiVer;
+				this->maxRooms = 1024;
+				this->maxPlayersPerRoom = 8;
+				this->maxConnections = 1024;
+				this->workers = 2;
+				this->tickInterval = 50;
+			}
+		};
+
+		/**
+		 * Game code for every room.
+		 *
+		 * Every callback is given the room it is for, and runs on that room's worker thread.
+		 * Any of them may be left empty.
+		 */
+		struct Callbacks {
+			/** A room was opened with openRoom() */
+			std::function<void(uint32_t room)> open;
+			/** A client finished joining (or rejoining) a room */
+			std::function<void(uint32_t room, uint8_t playerID)> join;
+			/** A client left a room or lost its connection */
+			std::function<void(uint32_t room, uint8_t playerID)> leave;
+			/**
+			 * A client sent a message. Messages sent with send() have already been relayed to
+			 * the rest of the room. The pointer is only valid during the call.
+			 */
+			std::function<void(uint32_t room, const uint8_t* msg, size_t length, uint8_t sender,
+				NetworkConnection::MessageType type)> message;
+			/** Called every tickInterval for every open room */
+			std::function<void(uint32_t room)> update;
+			/** A room was closed with closeRoom(); its clients are already gone */
+			std::function<void(uint32_t room)> close;
+		};
+
+		/**
+		 * Start a server.
+		 *
+		 * The server listens right away. Check getStatus() to see whether the port could be opened.
+		 *
+		 * @param config Server config
+		 * @param callbacks Game code for every room
+		 */
+		NetworkServer(ServerConfig config, Callbacks callbacks);
+
+		/** Disconnect every client and stop the server. No close callbacks are made. */
+		~NetworkServer();
+
+		/** Returns Connected if the server is listening, or GenericError if it could not start */
+		NetworkConnection::NetStatus getStatus() const { return status; }
+
+#pragma region Rooms
+		/**
+		 * Open a new room.
+		 *
+		 * Clients may join as soon as this returns. Safe to call from any thread.
+		 *
+		 * @returns The new room, or empty if maxRooms are already open
+		 */
+		std::optional<uint32_t> openRoom();
+
+		/**
+		 * Returns the room ID clients join a room with, or the empty string if it is not open.
+		 *
+		 * Safe to call from any thread.
+		 */
+		std::string getRoomID(uint32_t room);
+
+		/**
+		 * Close a room and disconnect everyone in it.
+		 *
+		 * Safe to call from any thread.
+		 *
+		 * @returns False if the room was not open
+		 */
+		bool closeRoom(uint32_t room);
+
+		/** Returns the number of open rooms. Safe to call from any thread. */
+		size_t getNumRooms();
+#pragma endregion
+
+#pragma region Sending
+		/**
+		 * Send a message to every client in a room, as player 0.
+		 *
+		 * Clients receive it through receive() exactly as if the host had called send().
+		 * May only be called from the room's own callbacks.
+		 *
+		 * @param room The room
+		 * @param msg The message to send
+		 * @param delivery Reliability and ordering guarantees for this message
+		 * @param priority Send priority for this message
+		 * @param channel Ordering channel, from 0 to NetworkConnection::NUM_CHANNELS - 1; the message is dropped for any other
+		 */
+		void send(uint32_t room, const std::vector<uint8_t>& msg,
+			NetworkConnection::Delivery delivery = NetworkConnection::Delivery::Reliable,
+			NetworkConnection::Priority priority = NetworkConnection::Priority::Medium, uint8_t channel = 1);
+
+		/**
+		 * Send a message to one client in a room, as player 0.
+		 *
+		 * May only be called from the room's own callbacks.
+		 *
+		 * @param room The room
+		 * @param playerID The client to send to
+		 * @param msg The message to send
+		 * @param delivery Reliability and ordering guarantees for this message
+		 * @param priority Send priority for this message
+		 * @param channel Ordering channel, from 0 to NetworkConnection::NUM_CHANNELS - 1; the message is dropped for any other
+		 */
+		void sendTo(uint32_t room, uint8_t playerID, const std::vector<uint8_t>& msg,
+			NetworkConnection::Delivery delivery = NetworkConnection::Delivery::Reliable,
+			NetworkConnection::Priority priority = NetworkConnection::Priority::Medium, uint8_t channel = 1);
+
+		/**
+		 * Mark a room's game as started, as NetworkConnection::startGame() does for a host.
+		 *
+		 * Afterwards, only clients rejoining the game may join. May only be called from the
+		 * room's own callbacks.
+		 */
+		void startGame(uint32_t room);
+#pragma endregion
+
+	private:
+		/** One room; owned by the network thread */
+		struct Room {
+			/** Whether clients may join */
+			bool open;
+			/** Whether the game has started */
+			bool started;
+			/** Room ID clients join with, or empty if closed (guarded by roomMutex) */
+			std::string code;
+			/** Number of players connected, including the server */
+			uint8_t numPlayers;
+			/** Number of players when the game started, or so far if it has not */
+			uint8_t maxPlayers;
+			/** Which players are connected */
+			std::bitset<256> connected;
+			/** Address of each client, indexed by player ID - 1 */
+			std::vector<SLNet::SystemAddress> players;
+		};
+
+		/** Where a connection's packets go; indexed by RakNet system index */
+		struct Route {
+			/** GUID of the connection, to tell a reused index from the old connection */
+			uint64_t guid;
+			/** Room the connection is in, or NO_ROOM */
+			uint32_t room;
+			/** Player ID of the connection in that room */
+			uint8_t playerID;
+		};
+
+		/** A worker thread and the queues to and from it; defined in the cpp */
+		struct Shard;
+
+		/** Route::room of a connection that is not in a room */
+		static constexpr uint32_t NO_ROOM = UINT32_MAX;
+
+		/** Server config */
+		ServerConfig config;
+		/** Game code */
+		Callbacks callbacks;
+		/** Whether the server is listening */
+		NetworkConnection::NetStatus status;
+		/** The one peer every room shares */
+		std::unique_ptr<SLNet::RakPeerInterface> peer;
+		/** When the server started; session time counts from here */
+		std::chrono::steady_clock::time_point epoch;
+
+		/** Every room, open or not */
+		std::vector<Room> rooms;
+		/** Route of each connection */
+		std::vector<Route> routes;
+		/** Worker threads */
+		std::vector<std::unique_ptr<Shard>> shards;
+
+		/** Guards codes, freeRooms, pendingRooms, rng and Room::code */
+		std::mutex roomMutex;
+		/** Makes up room IDs */
+		std::mt19937 rng;
+		/** Room of each open room ID */
+		std::unordered_map<std::string, uint32_t> codes;
+		/** Rooms that may be opened */
+		std::vector<uint32_t> freeRooms;
+		/** Rooms opened (true) or closed (false) that the network thread has not seen yet */
+		std::vector<std::pair<uint32_t, bool>> pendingRooms;
+
+		/** Network thread */
+		std::thread netThread;
+		/** Whether the network thread should keep running */
+		std::atomic<bool> netRunning{ false };
+		/** Whether the worker threads should keep running; they stop first, as they may wait on the network thread */
+		std::atomic<bool> workersRunning{ false };
+
+		/** Microseconds since the server started */
+		int64_t localTime() const;
+
+		/** Body of the network thread */
+		void netThreadLoop();
+
+		/** Body of the given worker thread */
+		void workerLoop(Shard& shard);
+
+		/** The worker that owns a room */
+		Shard& shardOf(uint32_t room) { return *shards[room % shards.size()]; }
+
+		/** Open and close the rooms openRoom() and closeRoom() asked for */
+		void applyRoomChanges();
+
+		/** Carry out everything the workers asked for */
+		void runCommands(Shard& shard);
+
+		/** Handle one packet from the peer */
+		void handlePacket(SLNet::Packet* packet);
+
+		/** Returns the route of the connection a packet came from, or nullptr if it is not in a room */
+		Route* routeOf(SLNet::Packet* packet);
+
+		/** A client asked to join a room; give it a player ID, or turn it away */
+		void joinRoom(SLNet::Packet* packet, const uint8_t* msg, size_t length);
+
+		/** A client confirmed its player ID; it is now in the room */
+		void confirmPlayer(Route& route, SLNet::Packet* packet, const uint8_t* msg, size_t length);
+
+		/** A connection is gone; take it out of its room */
+		void removePlayer(SLNet::Packet* packet);
+
+		/**
+		 * Send a message to one connection, as player 0.
+		 *
+		 * @param addr Address of the connection
+		 * @param msg Start of the payload
+		 * @param length Length of the payload
+		 * @param packetType The type of custom data packet
+		 * @param options Packed send options
+		 */
+		void sendDirect(const SLNet::SystemAddress& addr, const uint8_t* msg, size_t length,
+			NetworkConnection::CustomDataPackets packetType, uint8_t options = NetworkConnection::DEFAULT_OPTIONS);
+
+		/**
+		 * Send a message to every client in a room, as player 0.
+		 *
+		 * Like a host's broadcast, this includes clients still joining, so a client that has
+		 * not confirmed its player ID yet still hears about everyone who joins after it.
+		 *
+		 * @param room The room
+		 * @param msg Start of the payload
+		 * @param length Length of the payload
+		 * @param packetType The type of custom data packet
+		 * @param options Packed send options
+		 * @param skip Player who should not get it, or 0 for nobody
+		 */
+		void sendRoom(Room& room, const uint8_t* msg, size_t length,
+			NetworkConnection::CustomDataPackets packetType, uint8_t options = NetworkConnection::DEFAULT_OPTIONS,
+			uint8_t skip = 0);
+
+		/**
+		 * Forward a Standard packet from a client to the rest of its room, exactly as received.
+		 *
+		 * As with NetworkConnection::relay(), the sender ID in the packet must already be set.
+		 */
+		void relay(Room& room, SLNet::Packet* packet, uint8_t sender);
+
+		/** Hand a client message to the room's worker */
+		void postMessage(const Route& route, const uint8_t* msg, size_t length,
+			NetworkConnection::CustomDataPackets packetType);
+
+		/** Make sure the caller is the worker that owns a room */
+		void checkWorker(uint32_t room);
+	};
+}
+
+#endif // CU_NETWORK_SERVER_H
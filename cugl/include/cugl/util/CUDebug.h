@@ -7,6 +7,11 @@
 //  more lightweight.  However, you can still access the SDL functionality
 //  by setting the alter level to paranoid (assert level 3).
 //
+//  Defining CU_HEADLESS replaces the SDL log with a minimal shim that writes
+//  to standard error, uses standard C++ asserts, and drops the OpenGL helpers.
+//  This is for servers and tools that build only the networking module, without
+//  SDL or a display.
+//
 //  CUGL MIT License:
 //      This software is provided 'as-is', without any express or implied
 //      warranty.  In no event will the authors be held liable for any damages
@@ -32,12 +37,42 @@
 #ifndef __CU_DEBUG_H__
 #define __CU_DEBUG_H__
 
+#if !defined(CU_HEADLESS)
 #include <SDL/SDL.h>
 #include <cugl/math/CUMathBase.h>
+#else
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#endif
 #include <cassert>
+#include <string>
 
 namespace cugl {
 
+#if defined(CU_HEADLESS)
+/**
+ * Writes a message to standard error, in the same format as the SDL log.
+ *
+ * This is the logging shim for headless builds, which do not link SDL. It is
+ * only meant to be called through the logging macros below.  The message is
+ * formatted first and written with a single call, so that lines logged from
+ * different threads do not interleave.
+ *
+ * @param tag       The priority of the message, like "INFO"
+ * @param format    The message to display
+ * @param ...       Formatting arguments for printf
+ */
+inline void __cu_headless_log__(const char* tag, const char* format, ...) {
+    char buffer[1024];
+    va_list args;
+    va_start(args, format);
+    std::vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    std::fprintf(stderr, "%s: %s\n", tag, buffer);
+}
+#endif
+
 /**
  * @def CULog(msg,args...)
  *
@@ -50,7 +85,9 @@ namespace cugl {
  * @param msg       The message to display
  * @param args...   Formatting arguments for printf
  */
-#if defined(__WINDOWS__)
+#if defined(CU_HEADLESS)
+#define CULog(msg,...)		cugl::__cu_headless_log__("INFO",msg, ##__VA_ARGS__)
+#elif defined(__WINDOWS__)
 #define CULog(msg,...)			SDL_LogMessage(SDL_LOG_CATEGORY_APPLICATION,SDL_LOG_PRIORITY_INFO,msg, ##__VA_ARGS__)
 #else
 #define CULog(msg,args...)		SDL_LogMessage(SDL_LOG_CATEGORY_APPLICATION,SDL_LOG_PRIORITY_INFO,msg, ##args)
@@ -68,7 +105,9 @@ namespace cugl {
  * @param msg       The message to display
  * @param args...   Formatting arguments for printf
  */
-#if defined(__WINDOWS__)
+#if defined(CU_HEADLESS)
+#define CULogError(msg,...)		cugl::__cu_headless_log__("ERROR",msg, ##__VA_ARGS__)
+#elif defined(__WINDOWS__)
 #define CULogError(msg,...)		SDL_LogMessage(SDL_LOG_CATEGORY_APPLICATION,SDL_LOG_PRIORITY_ERROR,msg, ##__VA_ARGS__)
 #else
 #define CULogError(msg,args...)		SDL_LogMessage(SDL_LOG_CATEGORY_APPLICATION,SDL_LOG_PRIORITY_ERROR,msg, ##args)
@@ -87,7 +126,9 @@ namespace cugl {
  * @param msg       The message to display
  * @param args...   Formatting arguments for printf
  */
-#if defined(__WINDOWS__)
+#if defined(CU_HEADLESS)
+#define CULogCritical(msg,...)		cugl::__cu_headless_log__("CRITICAL",msg, ##__VA_ARGS__)
+#elif defined(__WINDOWS__)
 #define CULogCritical(msg,...)		SDL_LogMessage(SDL_LOG_CATEGORY_APPLICATION,SDL_LOG_PRIORITY_CRITICAL,msg, ##__VA_ARGS__)
 #else
 #define CULogCritical(msg,args...)	SDL_LogMessage(SDL_LOG_CATEGORY_APPLICATION,SDL_LOG_PRIORITY_CRITICAL,msg, ##args)
@@ -106,7 +147,9 @@ namespace cugl {
  * @param msg       The message to display
  * @param args...   Formatting arguments for printf
  */
-#if defined(__WINDOWS__)
+#if defined(CU_HEADLESS)
+#define CUWarn(msg,...)		cugl::__cu_headless_log__("WARN",msg, ##__VA_ARGS__)
+#elif defined(__WINDOWS__)
 #define CUWarn(msg,...)		SDL_LogMessage(SDL_LOG_CATEGORY_APPLICATION,SDL_LOG_PRIORITY_WARN,msg,##__VA_ARGS__)
 #else
 #define CUWarn(msg,args...)		SDL_LogMessage(SDL_LOG_CATEGORY_APPLICATION,SDL_LOG_PRIORITY_WARN,msg, ##args)
@@ -120,6 +163,16 @@ namespace cugl {
         }                                       \
     } while (0)
 
+#if defined(CU_HEADLESS)
+/* Internal assert code for headless builds, which halts even when NDEBUG is defined */
+#define __cu_assert_always__(condition,msg,...)  do {  \
+        if (!(condition)) {                            \
+            CULogError(msg, ##__VA_ARGS__);            \
+            std::abort();                              \
+        }                                              \
+    } while (0)
+#endif
+
 
 // Let's Doxgen the functions before the variable block.
 
@@ -195,7 +248,17 @@ namespace cugl {
  * @param args...   Formatting arguments for printf
  */
 
-#if SDL_ASSERT_LEVEL == 0   /* assertions disabled */
+#if defined(CU_HEADLESS) && defined(NDEBUG)  /* headless release, without SDL */
+#   define CUAssert(condition)                      do { (void)sizeof(condition); } while (0)
+#   define CUAssertLog(condition,msg,...)           do { (void)sizeof(condition); } while (0)
+#   define CUAssertAlways(condition)                __cu_assert_always__(condition,"Assertion failed: %s",#condition)
+#   define CUAssertAlwaysLog(condition,msg,...)     __cu_assert_always__(condition,msg, ##__VA_ARGS__)
+#elif defined(CU_HEADLESS)  /* headless debug, without SDL */
+#   define CUAssert(condition)                      assert(condition)
+#   define CUAssertLog(condition,msg,...)           __cu_assert__(condition,msg, ##__VA_ARGS__)
+#   define CUAssertAlways(condition)                assert(condition)
+#   define CUAssertAlwaysLog(condition,msg,...)     __cu_assert__(condition,msg, ##__VA_ARGS__)
+#elif SDL_ASSERT_LEVEL == 0   /* assertions disabled */
 #   define CUAssert(condition)                      SDL_disabled_assert(condition)
 #   define CUAssertLog(condition,msg,args...)       SDL_disabled_assert(condition)
 #   define CUAssertAlways(condition)                SDL_disabled_assert(condition)
@@ -226,6 +289,7 @@ namespace cugl {
  *
  * @return a string description of an OpenGL error type
  */
+#if !defined(CU_HEADLESS)
 std::string gl_error_name(GLenum error);
 
 /**
@@ -236,6 +300,7 @@ std::string gl_error_name(GLenum error);
  * @return a string description of an OpenGL data type
  */
 std::string gl_type_name(GLenum error);
+#endif
 
 }
 
@@ -0,0 +1,154 @@
+//
+// CUNetworkClock.h
+//
+// Clock offset estimator used by NetworkConnection to share the host's clock
+// with its clients.
+//
+// Clients periodically send the host their local time, and the host echoes it
+// back along with its own time. As in NTP, each exchange gives an estimate of
+// the offset between the two clocks that is off by at most half the round trip
+// time, so the estimator trusts the exchange with the shortest round trip out of
+// a recent window. Drift is fitted over a longer window, using only the quarter
+// of exchanges with the shortest round trips.
+//
+// All times are in microseconds.
+//
+// This header is an internal header. It is not accessible by general users
+// of the CUGL API.
+//
+// Author: agent
+// Version: 10/17/2026
+//
+#ifndef CU_NETWORK_CLOCK_H
+#define CU_NETWORK_CLOCK_H
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <deque>
+
+namespace cugl {
+	/**
+	 * Estimates the offset and drift between a local clock and a remote one.
+	 */
+	class NetworkClock {
+	public:
+		/** Number of recent exchanges to pick the shortest round trip from */
+		static constexpr size_t SAMPLE_WINDOW = 16;
+
+		/** Number of exchanges to fit the drift over */
+		static constexpr size_t DRIFT_WINDOW = 64;
+
+		/** Largest believable drift (as a fraction); real clocks are within about 100 ppm */
+		static constexpr double MAX_DRIFT = 500e-6;
+
+		NetworkClock() : offset(0), drift(0), offsetTime(0), lastTime(0) {}
+
+		/**
+		 * Record a completed exchange.
+		 *
+		 * @param sent Local time the request was sent
+		 * @param remote Remote time the request was answered
+		 * @param received Local time the reply arrived
+		 */
+		void addSample(int64_t sent, int64_t remote, int64_t received) {
+			if (received < sent) {
+				return;
+			}
+			samples.push_back({ received - sent, remote - (sent + received) / 2, received });
+			if (samples.size() > DRIFT_WINDOW) {
+				samples.pop_front();
+			}
+			fitDrift();
+
+			const Sample* best = &samples.back();
+			for (size_t i = recent(); i < samples.size(); i++) {
+				if (samples[i].rtt < best->rtt) {
+					best = &samples[i];
+				}
+			}
+			offset = best->offset;
+			offsetTime = best->time;
+		}
+
+		/** Whether any exchange has completed */
+		bool isSynced() const { return !samples.empty(); }
+
+		/** The number of exchanges in the sample window (at most SAMPLE_WINDOW) */
+		size_t getSampleCount() const { return samples.size() - recent(); }
+
+		/** How fast the remote clock gains on the local one, in parts per million */
+		double getDrift() const { return drift * 1e6; }
+
+		/**
+		 * Convert a local time to remote time.
+		 *
+		 * The result never goes backwards between calls, even when a new estimate
+		 * moves the offset back.
+		 *
+		 * @param local The local time
+		 */
+		int64_t toRemote(int64_t local) {
+			int64_t remote = local + offset + static_cast<int64_t>(drift * static_cast<double>(local - offsetTime));
+			lastTime = std::max(lastTime, remote);
+			return lastTime;
+		}
+
+	private:
+		/** One exchange with the remote clock */
+		struct Sample {
+			/** Round trip time */
+			int64_t rtt;
+			/** Remote time minus local time, assuming the reply took half the round trip */
+			int64_t offset;
+			/** Local time the exchange completed */
+			int64_t time;
+		};
+
+		/** The last DRIFT_WINDOW exchanges */
+		std::deque<Sample> samples;
+		/** Best current offset estimate */
+		int64_t offset;
+		/** Drift as a fraction (microseconds gained per microsecond) */
+		double drift;
+		/** Local time the offset was estimated at */
+		int64_t offsetTime;
+		/** Last value returned by toRemote */
+		int64_t lastTime;
+
+		/** Index of the first exchange in the sample window */
+		size_t recent() const { return samples.size() > SAMPLE_WINDOW ? samples.size() - SAMPLE_WINDOW : 0; }
+
+		/** Least squares fit of offset against time, over the exchanges with the shortest round trips */
+		void fitDrift() {
+			std::array<int64_t, DRIFT_WINDOW> rtts;
+			for (size_t i = 0; i < samples.size(); i++) {
+				rtts[i] = samples[i].rtt;
+			}
+			size_t quartile = samples.size() / 4;
+			std::nth_element(rtts.begin(), rtts.begin() + quartile, rtts.begin() + samples.size());
+			int64_t cutoff = rtts[quartile];
+
+			double n = 0;
+			double t0 = static_cast<double>(samples.front().time);
+			double o0 = static_cast<double>(samples.front().offset);
+			double st = 0, so = 0, stt = 0, sto = 0;
+			for (const auto& e : samples) {
+				if (e.rtt > cutoff) {
+					continue;
+				}
+				n++;
+				double t = static_cast<double>(e.time) - t0;
+				double o = static_cast<double>(e.offset) - o0;
+				st += t;
+				so += o;
+				stt += t * t;
+				sto += t * o;
+			}
+			double denom = n * stt - st * st;
+			drift = denom > 0 ? std::clamp((n * sto - st * so) / denom, -MAX_DRIFT, MAX_DRIFT) : 0;
+		}
+	};
+}
+
+#endif // CU_NETWORK_CLOCK_H
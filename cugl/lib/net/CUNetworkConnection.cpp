@@ -1,7 +1,13 @@
 #include <cugl/net/CUNetworkConnection.h>
 
-#include <cugl/cugl.h>
-
+#include <cugl/util/CUDebug.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <sstream>
 #include <utility>
 
 
@@ -29,10 +35,27 @@ typedef SOCKET socket_t;
 #endif
 
 #include <slikenet/peerinterface.h>
+#include <slikenet/statistics.h>
 
+#include "CUNetworkClock.h"
+#include "CUNetworkFraming.h"
+#include "CUNetworkImpairment.h"
+#include "CUNetworkQueue.h"
+#include "CUNetworkTransport.h"
 
 
 using namespace cugl;
+using netframing::ROOM_LENGTH;
+using netframing::LAN_TAG;
+using netframing::SERVER_ROOM;
+using netframing::LAN_PORT_MARK;
+using netframing::STANDARD_PREFIX;
+using netframing::SENDER_OFFSET;
+using netframing::toReliability;
+using netframing::toPriority;
+using netframing::toChannel;
+using netframing::writeTime;
+using netframing::readTime;
 
 template <class... Fs>
 struct overload;
@@ -63,9 +86,6 @@ auto make_visitor(Fs... fs)
 /** How long to block on shutdown */
 constexpr unsigned int SHUTDOWN_BLOCK = 10;
 
-/** Length of room IDs */
-constexpr uint8_t ROOM_LENGTH = 5;
-
 /** How long to wait before considering ourselves disconnected (ms) */
 constexpr size_t DISCONN_TIME = 5000;
 
@@ -75,86 +95,378 @@ constexpr size_t RECONN_GAP = 3;
 /** How long to wait before giving up on reconnection (seconds) */
 constexpr size_t RECONN_TIMEOUT = 15;
 
+/** Bytes the host sends before the roster in JoinRoom and Reconnect: players, max players, player ID, API version */
+constexpr size_t JOIN_INFO_SIZE = 4;
+
+/** Bytes a client answers JoinRoom and Reconnect with: its player ID and whether it accepts */
+constexpr size_t JOIN_REPLY_SIZE = 2;
+
+/** Number of messages the network thread queues in each direction */
+constexpr size_t NET_QUEUE_SIZE = 1024;
+
+/** How long the network thread sleeps between polls of the peer (ms) */
+constexpr unsigned int NET_THREAD_SLEEP = 1;
+
+/** Largest batch of messages to pack into one packet; keeps batches within a typical datagram */
+constexpr size_t BATCH_SIZE = 1200;
+
+/** How often to ping every connection to refresh round trip times (ms) */
+constexpr long long PING_INTERVAL = 1000;
+
+/** Weight of each new sample in the smoothed jitter (as in RFC 3550) */
+constexpr float JITTER_GAIN = 1.0f / 16;
+
+/** How often to check for congestion when adapting the send rate (ms) */
+constexpr long long RATE_INTERVAL = 100;
+
+/** Minimum time between send rate decreases, so one congestion event is not counted twice (ms) */
+constexpr long long RATE_DECREASE_GAP = 500;
+
+/** A link with more than this many bytes waiting to be sent is congested */
+constexpr double RATE_QUEUE_LIMIT = 16384;
+
+/** A link losing more than this fraction of packets is congested */
+constexpr float RATE_LOSS_LIMIT = 0.05f;
+
+/** A link resending more than this fraction of what it sends is congested */
+constexpr double RATE_RESEND_LIMIT = 0.1;
+
+/** Lowest fraction of Priority::Low messages to send */
+constexpr float MIN_SEND_RATE = 1.0f / 16;
+
+/** How much the send rate recovers each uncongested interval */
+constexpr float RATE_INCREASE = 0.05f;
+
+/** Most deferred messages to release each uncongested interval at full send rate */
+constexpr size_t DEFERRED_RELEASE = 64;
+
+/** Most reliable Priority::Low messages to hold back; beyond this the oldest are dropped */
+constexpr size_t DEFERRED_LIMIT = 256;
+
+/** How often clients exchange timestamps with the host once the clock has settled (ms) */
+constexpr long long CLOCK_INTERVAL = 1000;
+
+/** How often clients exchange timestamps with the host while filling the first sample window (ms) */
+constexpr long long CLOCK_FAST_INTERVAL = 100;
+
+/** How long a client tries to reach the host's last known address before going through the punchthrough server (ms) */
+constexpr long long RESUME_TIMEOUT = 2000;
+
+/** Most payload bytes the host keeps for replaying to clients that drop */
+constexpr size_t REPLAY_LIMIT = 1 << 20;
+
+/** How often clients broadcast a query for their room in LAN mode (ms) */
+constexpr long long LAN_QUERY_INTERVAL = 250;
+
+/** How long a client looks for its room in LAN mode before giving up (ms) */
+constexpr long long LAN_SEARCH_TIMEOUT = 5000;
+
+/** Seed for simulated conditions, so every run makes the same sequence of choices */
+constexpr uint32_t IMPAIRMENT_SEED = 0;
+
 NetworkConnection::NetworkConnection(ConnectionConfig config)
-	: status(NetStatus::Pending), apiVer(config.apiVersion), numPlayers(1), maxPlayers(1), playerID(0), config(config) {
-	c0StartupConn();
+	: status(NetStatus::Pending), apiVer(config.apiVersion), numPlayers(1), maxPlayers(1), playerID(0), hostID(0),
+	config(config) {
+	linkStats.fill({ 0, 0, -1, 0 });
+	sendRate = 1;
+	sendCredit = 0;
+	deferredOverflow = false;
+	migrating = false;
+	replayBase = 0;
+	replayBytes = 0;
+	sessionTokens.fill(0);
+	awaySince.fill(0);
+	sessionToken = 0;
+	resuming = false;
+	lanSearching = false;
+	epoch = std::chrono::steady_clock::now();
 	remotePeer = HostPeers(config.maxNumPlayers);
+	c0StartupConn();
+	if (config.sessionResume) {
+		// Clients resuming a session connect to us directly
+		peer->SetMaximumIncomingConnections(config.maxNumPlayers);
+	}
+	startNetworkThread();
 }
 
 NetworkConnection::NetworkConnection(ConnectionConfig config, std::string roomID)
-	: status(NetStatus::Pending), apiVer(config.apiVersion), numPlayers(1), maxPlayers(0), config(config) {
-	c0StartupConn();
+	: status(NetStatus::Pending), apiVer(config.apiVersion), numPlayers(1), maxPlayers(0), hostID(0), config(config) {
+	linkStats.fill({ 0, 0, -1, 0 });
+	sendRate = 1;
+	sendCredit = 0;
+	deferredOverflow = false;
+	migrating = false;
+	replayBase = 0;
+	replayBytes = 0;
+	sessionTokens.fill(0);
+	awaySince.fill(0);
+	sessionToken = 0;
+	resuming = false;
+	lanSearching = false;
+	epoch = std::chrono::steady_clock::now();
+	hostClock = std::make_unique<NetworkClock>();
 	remotePeer = ClientPeer(std::move(roomID));
-	peer->SetMaximumIncomingConnections(1);
+	c0StartupConn();
+	// With a mesh, other clients connect to us as well as the host
+	peer->SetMaximumIncomingConnections(config.mesh ? config.maxNumPlayers : 1);
+	startNetworkThread();
 }
 
 NetworkConnection::~NetworkConnection() {
+	if (netThread.joinable()) {
+		netThreadRunning = false;
+		netThread.join();
+	}
 	peer->Shutdown(SHUTDOWN_BLOCK);
-	SLNet::RakPeerInterface::DestroyInstance(peer.release());
+	peer.reset();
+}
+
+/**
+ * Locate the payload of a packet without copying it.
+ *
+ * Only works if the packet was encoded in the standard format used by this class.
+ *
+ * @param packet The packet to read
+ * @param prefixSize Size of the routing prefix this packet type carries
+ * @param msg Set to the start of the payload inside the packet buffer
+ * @param length Set to the length of the payload
+ * @returns Whether the header was well formed
+ */
+bool readView(const SLNet::Packet* packet, size_t prefixSize, const uint8_t*& msg, size_t& length) {
+	size_t headerSize;
+	if (!netframing::readHeader(packet->data, packet->length, headerSize, length, prefixSize)) {
+		CULogError("Received malformed message of type %d; ignoring", packet->data[0]);
+		return false;
+	}
+	msg = packet->data + headerSize;
+	return true;
+}
+
+/**
+ * Pass each message in a batch to the dispatcher.
+ *
+ * @param batch Start of the batch payload
+ * @param length Length of the batch payload
+ * @param sender Player ID of the sender
+ * @param type Message type reported for every message in the batch
+ * @param dispatcher Receive dispatcher
+ * @returns The number of messages dispatched
+ */
+size_t dispatchBatch(const uint8_t* batch, size_t length, uint8_t sender, NetworkConnection::MessageType type,
+	const std::function<void(const uint8_t*, size_t, uint8_t, NetworkConnection::MessageType)>& dispatcher) {
+	size_t count = 0;
+	if (!netframing::readBatch(batch, length, [&](const uint8_t* msg, size_t size) {
+		dispatcher(msg, size, sender, type);
+		count++;
+	})) {
+		CULogError("Received malformed batch; dropping the rest of it");
+	}
+	return count;
 }
 
 /**
  * Read the message from a bitstream into a byte vector.
  *
- * Only works if the BitStream was encoded in the standard format used by this clas.
+ * Only works if the BitStream was encoded in the standard format used by this class.
+ * Returns an empty vector if the header is malformed.
+ *
+ * @param bts The packet to read
+ * @param prefixSize Size of the routing prefix this packet type carries
  */
-std::vector<uint8_t> readBs(SLNet::BitStream& bts) {
-	uint8_t ignored;
-	bts.Read(ignored);
-	uint8_t length;
-	bts.Read(length);
+std::vector<uint8_t> readBs(SLNet::BitStream& bts, size_t prefixSize = 0) {
+	const uint8_t* data = bts.GetData();
+	size_t headerSize;
+	size_t length;
+	if (!netframing::readHeader(data, bts.GetNumberOfBytesUsed(), headerSize, length, prefixSize)) {
+		CULogError("Received malformed message of type %d; ignoring", data[0]);
+		return {};
+	}
+
+	return std::vector<uint8_t>(data + headerSize, data + headerSize + length);
+}
 
-	std::vector<uint8_t> msgConverted;
-	msgConverted.resize(length, 0);
+/** The same reliability, but with an ID_SND_RECEIPT_ACKED once the remote system has the message */
+inline PacketReliability withReceipt(PacketReliability reliability) {
+	switch (reliability) {
+	case RELIABLE:
+		return RELIABLE_WITH_ACK_RECEIPT;
+	case RELIABLE_ORDERED:
+		return RELIABLE_ORDERED_WITH_ACK_RECEIPT;
+	default:
+		return reliability;
+	}
+}
+
+/** Bits of the packed send options that hold the priority */
+constexpr uint8_t PRIORITY_MASK = 0x3 << 2;
+
+uint8_t NetworkConnection::packOptions(Delivery delivery, Priority priority, uint8_t channel) {
+	CUAssertLog(channel < NUM_CHANNELS, "Channel %d out of range", channel);
+	return static_cast<uint8_t>(
+		static_cast<uint8_t>(delivery) | (static_cast<uint8_t>(priority) << 2) | (channel << 4));
+}
+
+bool NetworkConnection::checkChannel(uint8_t channel) {
+	if (channel >= NUM_CHANNELS) {
+		CULogError("Channel %d out of range; dropping message", channel);
+		return false;
+	}
+	return true;
+}
 
-	bts.ReadAlignedBytes(msgConverted.data(), length);
-	return msgConverted;
+const uint8_t NetworkConnection::DEFAULT_OPTIONS =
+	NetworkConnection::packOptions(Delivery::Reliable, Priority::Medium, 1);
+
+/**
+ * Send a message with the given packed send options, logging if it is too large.
+ *
+ * @param peer The peer to send from
+ * @param msg Start of the message to send
+ * @param length Length of the message
+ * @param messageID RakNet message ID (ID_USER_PACKET_ENUM + packet type)
+ * @param options Packed send options (see NetworkConnection::packOptions)
+ * @param sender For Standard packets, the player ID of the original sender; these are put
+ *               on the wire along with the options. Empty for packets without a routing prefix.
+ * @param dest Destination address (or address to skip if broadcasting)
+ * @param broadcast Whether to send to all connections except dest
+ * @param receipt If not null, ask RakNet to acknowledge delivery of this (reliable) message,
+ *                and set this to the receipt number the acknowledgements will carry
+ */
+void sendFramed(NetworkTransport* peer, const uint8_t* msg, size_t length, uint8_t messageID,
+	uint8_t options, std::optional<uint8_t> sender, const SLNet::SystemAddress& dest, bool broadcast,
+	uint32_t* receipt = nullptr) {
+	uint8_t prefix[STANDARD_PREFIX] = { options, sender.value_or(0) };
+	PacketReliability reliability = receipt != nullptr ? withReceipt(toReliability(options)) : toReliability(options);
+	if (!netframing::sendFramed(peer, messageID, msg, length,
+		toPriority(options), reliability, toChannel(options),
+		dest, broadcast, prefix, sender.has_value() ? STANDARD_PREFIX : 0, receipt)) {
+		CULogError("Message of %zu bytes exceeds maximum size of %zu; dropping",
+			length, netframing::MAX_MESSAGE_SIZE);
+	}
+}
+
+/** Vector convenience wrapper for sendFramed */
+void sendFramed(NetworkTransport* peer, const std::vector<uint8_t>& msg, uint8_t messageID,
+	uint8_t options, std::optional<uint8_t> sender, const SLNet::SystemAddress& dest, bool broadcast,
+	uint32_t* receipt = nullptr) {
+	sendFramed(peer, msg.data(), msg.size(), messageID, options, sender, dest, broadcast, receipt);
 }
 
 #pragma region Connection Handshake
 
+/** Log how long each step of the handshake took, in milliseconds (-1 if it never happened) */
+void logHandshake(const NetworkConnection::HandshakeTimes& t) {
+	auto ms = [](const std::optional<double>& time) { return time.has_value() ? *time * 1000 : -1.0; };
+	CULog("Connected in %.0f ms (punchthrough server %.0f, room %.0f, punchthrough %.0f, host %.0f)",
+		ms(t.connected), ms(t.serverConnected), ms(t.roomAssigned), ms(t.punchSucceeded), ms(t.hostConnected));
+}
+
 void NetworkConnection::c0StartupConn() {
-	peer = std::unique_ptr<SLNet::RakPeerInterface>(SLNet::RakPeerInterface::GetInstance());
+	handshakeStart = std::chrono::steady_clock::now();
+	handshakeTimes = HandshakeTimes();
+	if (config.loopback) {
+		// A simulated network has no punchthrough server, so players find each other as on a LAN
+		config.lan = true;
+		peer = openLoopback(config.loopback);
+	} else {
+		peer = std::make_unique<RakNetTransport>();
+	}
+	if (config.simulateConditions) {
+		// Made once, so conditions carry over when the connection starts over
+		if (!impairment) {
+			impairment = std::make_shared<NetworkImpairment>();
+		}
+		peer = std::make_unique<ImpairedTransport>(std::move(peer), impairment, isGameData, IMPAIRMENT_SEED);
+	}
 
 	peer->SetTimeoutTime(DISCONN_TIME, SLNet::UNASSIGNED_SYSTEM_ADDRESS);
 
 	peer->AttachPlugin(&(natPunchthroughClient));
-	natPunchServerAddress = std::make_unique<SLNet::SystemAddress>(
-		SLNet::SystemAddress(config.punchthroughServerAddr, config.punchthroughServerPort));
+	if (config.lan) {
+		// Never matches a real address, so nothing is mistaken for the server
+		natPunchServerAddress = std::make_unique<SLNet::SystemAddress>(SLNet::UNASSIGNED_SYSTEM_ADDRESS);
+	} else {
+		natPunchServerAddress = std::make_unique<SLNet::SystemAddress>(
+			SLNet::SystemAddress(config.punchthroughServerAddr, config.punchthroughServerPort));
+	}
 
 	// Use the default socket descriptor
 	// This will make the OS assign us a random port.
 	SLNet::SocketDescriptor socketDescriptor;
+	bool lanHost = config.lan && std::holds_alternative<HostPeers>(remotePeer);
+	if (lanHost) {
+		// Clients need to know where to find us
+		socketDescriptor.port = config.lanPort;
+	}
 	// Allow connections for each player and one for the NAT server.
-	peer->Startup(config.maxNumPlayers, &socketDescriptor, 1);
+	if (peer->Startup(config.maxNumPlayers, &socketDescriptor, 1) != SLNet::RAKNET_STARTED) {
+		CULogError("Could not start networking%s", lanHost ? "; is the LAN port in use?" : "");
+		status = NetStatus::GenericError;
+		return;
+	}
 
 	CULog("Your GUID is: %s",
 		peer->GetGuidFromSystemAddress(SLNet::UNASSIGNED_SYSTEM_ADDRESS).ToString());
 
+	if (config.lan) {
+		std::visit(make_visitor(
+			[&](HostPeers& /*h*/) {
+				advertiseLan();
+				connectedPlayers.set(hostID);
+				status = NetStatus::Connected;
+				markPhase(&HandshakeTimes::roomAssigned);
+				markPhase(&HandshakeTimes::connected);
+				logHandshake(handshakeTimes);
+			},
+			[&](ClientPeer& c) {
+				CULog("Looking for room %s on the local network", c.room.c_str());
+				lanSearching = true;
+				nextLanQuery = handshakeStart;
+			}), remotePeer);
+		return;
+	}
+
 	// Connect to the NAT Punchthrough server
 	CULog("Connecting to punchthrough server");
 	peer->Connect(this->natPunchServerAddress->ToString(false),
 		this->natPunchServerAddress->GetPort(), nullptr, 0);
 }
 
+void cugl::NetworkConnection::markPhase(std::optional<double> HandshakeTimes::* phase) {
+	if (!(handshakeTimes.*phase).has_value()) {
+		handshakeTimes.*phase = std::chrono::duration<double>(std::chrono::steady_clock::now() - handshakeStart).count();
+	}
+}
+
 void cugl::NetworkConnection::ch1HostConnServer(HostPeers& h) {
 	CULog("Connected to punchthrough server; awaiting room ID");
+	markPhase(&HandshakeTimes::serverConnected);
+	// Otherwise this happens when the first client punches through, on their critical path
+	natPunchthroughClient.FindRouterPortStride(*natPunchServerAddress);
 }
 
 void cugl::NetworkConnection::ch2HostGetRoomID(HostPeers& h, SLNet::BitStream& bts) {
 	auto msgConverted = readBs(bts);
+	if (msgConverted.size() < ROOM_LENGTH) {
+		CULogError("Received malformed room ID; ignoring");
+		return;
+	}
 	std::stringstream newRoomId;
 	for (size_t i = 0; i < ROOM_LENGTH; i++) {
 		newRoomId << static_cast<char>(msgConverted[i]);
 	}
-	connectedPlayers.set(0);
+	connectedPlayers.set(hostID);
 	roomID = newRoomId.str();
 	CULog("Got room ID: %s; Accepting Connections Now", roomID.c_str());
 	status = NetStatus::Connected;
+	markPhase(&HandshakeTimes::roomAssigned);
+	markPhase(&HandshakeTimes::connected);
+	logHandshake(handshakeTimes);
 }
 
 void cugl::NetworkConnection::cc1ClientConnServer(ClientPeer& c) {
 	CULog("Connected to punchthrough server");
+	markPhase(&HandshakeTimes::serverConnected);
 	CULog("Trying to connect to %s", c.room.c_str());
 	SLNet::RakNetGUID remote;
 	remote.FromString(c.room.c_str());
@@ -163,7 +475,10 @@ void cugl::NetworkConnection::cc1ClientConnServer(ClientPeer& c) {
 }
 
 void cugl::NetworkConnection::cc2ClientPunchSuccess(ClientPeer& c, SLNet::Packet* packet) {
+	markPhase(&HandshakeTimes::punchSucceeded);
 	c.addr = std::make_unique<SLNet::SystemAddress>(packet->systemAddress);
+	// Race the host's connection to us (cc3); whichever gets through first is used
+	peer->Connect(c.addr->ToString(false), c.addr->GetPort(), nullptr, 0);
 }
 
 void cugl::NetworkConnection::cc3HostReceivedPunch(HostPeers& h, SLNet::Packet* packet) {
@@ -175,9 +490,14 @@ void cugl::NetworkConnection::cc3HostReceivedPunch(HostPeers& h, SLNet::Packet*
 	bool hasRoom = false;
 	if (!h.started || numPlayers < maxPlayers) {
 		for (uint8_t i = 0; i < h.peers.size(); i++) {
-			if (h.peers.at(i) == nullptr) {
+			// After a host migration, the host's own slot is empty but not free
+			if (h.peers.at(i) == nullptr && i + 1 != hostID) {
 				hasRoom = true;
 				h.peers.at(i) = std::make_unique<SLNet::SystemAddress>(p);
+				if (!h.started) {
+					// A new player; nothing of the last one in this slot carries over
+					endSession(i + 1);
+				}
 				break;
 			}
 		}
@@ -191,6 +511,11 @@ void cugl::NetworkConnection::cc3HostReceivedPunch(HostPeers& h, SLNet::Packet*
 		CULog("Client attempted to join but room was full");
 	}
 
+	if (peer->GetConnectionState(p) == SLNet::IS_CONNECTED) {
+		// The client's own request got here before we heard punchthrough succeeded
+		cc5HostConfirmClient(h, p);
+		return;
+	}
 	CULog("Connecting to client now");
 	peer->Connect(p.ToString(false), p.GetPort(), nullptr, 0);
 }
@@ -198,39 +523,36 @@ void cugl::NetworkConnection::cc3HostReceivedPunch(HostPeers& h, SLNet::Packet*
 void cugl::NetworkConnection::cc4ClientReceiveHostConnection(ClientPeer& c, SLNet::Packet* packet) {
 	if (packet->systemAddress == *c.addr) {
 		CULog("Connected to host :D");
+		markPhase(&HandshakeTimes::hostConnected);
 	}
 }
 
-void cugl::NetworkConnection::cc5HostConfirmClient(HostPeers& h, SLNet::Packet* packet) {
+void cugl::NetworkConnection::cc5HostConfirmClient(HostPeers& h, const SLNet::SystemAddress& addr) {
 
-	if (h.toReject.count(packet->systemAddress.ToString()) > 0) {
+	if (h.toReject.count(addr.ToString()) > 0) {
 		CULog("Rejecting player connection - bye :(");
 
-		h.toReject.erase(packet->systemAddress.ToString());
+		h.toReject.erase(addr.ToString());
 
-		directSend({}, JoinRoomFail, packet->systemAddress);
+		directSend({}, JoinRoomFail, addr);
 
-		peer->CloseConnection(packet->systemAddress, true);
+		peer->CloseConnection(addr, true);
 		return;
 	}
 
 	for (uint8_t i = 0; i < h.peers.size(); i++) {
-		if (*h.peers.at(i) == packet->systemAddress) {
+		if (h.peers.at(i) != nullptr && *h.peers.at(i) == addr) {
 			uint8_t pID = i + 1;
 			CULog("Player %d accepted connection request", pID);
 
 			if (h.started) {
 				// Reconnection attempt
-				directSend({ static_cast<uint8_t>(numPlayers + 1), maxPlayers, pID, apiVer }, Reconnect, packet->systemAddress);
+				directSend(joinInfo(pID), Reconnect, addr);
 			}
 			else {
 				// New player connection
 				maxPlayers++;
-				directSend(
-					{ static_cast<uint8_t>(numPlayers + 1), maxPlayers, pID, apiVer },
-					JoinRoom,
-					packet->systemAddress
-				);
+				directSend(joinInfo(pID), JoinRoom, addr);
 			}
 			break;
 		}
@@ -240,6 +562,10 @@ void cugl::NetworkConnection::cc5HostConfirmClient(HostPeers& h, SLNet::Packet*
 }
 
 void cugl::NetworkConnection::cc6ClientAssignedID(ClientPeer& c, const std::vector<uint8_t>& msgConverted) {
+	if (msgConverted.size() < JOIN_INFO_SIZE) {
+		CULogError("Received malformed join info from host; ignoring");
+		return;
+	}
 	bool apiMatch = msgConverted[3] == apiVer;
 	if (!apiMatch) {
 		CULogError("API version mismatch; currently %d but host was %d", apiVer,
@@ -249,7 +575,13 @@ void cugl::NetworkConnection::cc6ClientAssignedID(ClientPeer& c, const std::vect
 		numPlayers = msgConverted[0];
 		maxPlayers = msgConverted[1];
 		playerID = msgConverted[2];
+		readRoster(msgConverted);
 		status = NetStatus::Connected;
+		migrating = false;
+		resuming = false;
+		resetLinkStats(hostID);
+		markPhase(&HandshakeTimes::connected);
+		logHandshake(handshakeTimes);
 	}
 
 	peer->CloseConnection(*natPunchServerAddress, true);
@@ -257,12 +589,38 @@ void cugl::NetworkConnection::cc6ClientAssignedID(ClientPeer& c, const std::vect
 	directSend({ *playerID, (uint8_t)(apiMatch ? 1 : 0) }, JoinRoom, *c.addr);
 }
 
+std::vector<uint8_t> cugl::NetworkConnection::joinInfo(uint8_t pID) {
+	// The host comes first, so clients know who it is even after a migration
+	std::vector<uint8_t> info = { static_cast<uint8_t>(numPlayers + 1), maxPlayers, pID, apiVer, hostID };
+	for (size_t i = 0; i < connectedPlayers.size(); i++) {
+		if (connectedPlayers.test(i) && i != hostID) {
+			info.push_back(static_cast<uint8_t>(i));
+		}
+	}
+	return info;
+}
+
+void cugl::NetworkConnection::readRoster(const std::vector<uint8_t>& msgConverted) {
+	hostID = msgConverted.size() > 4 ? msgConverted[4] : 0;
+	connectedPlayers.reset();
+	connectedPlayers.set(hostID);
+	connectedPlayers.set(*playerID);
+	for (size_t i = 4; i < msgConverted.size(); i++) {
+		connectedPlayers.set(msgConverted[i]);
+	}
+}
+
 void cugl::NetworkConnection::cc7HostGetClientData(
 	HostPeers& h, SLNet::Packet* packet, const std::vector<uint8_t>& msgConverted
 ) {
+	if (msgConverted.size() < JOIN_REPLY_SIZE) {
+		CULogError("Received malformed connection info; disconnecting");
+		peer->CloseConnection(packet->systemAddress, true);
+		return;
+	}
 
 	for (uint8_t i = 0; i < h.peers.size(); i++) {
-		if (*h.peers.at(i) == packet->systemAddress) {
+		if (h.peers.at(i) != nullptr && *h.peers.at(i) == packet->systemAddress) {
 			uint8_t pID = i + 1;
 			CULog("Host verifying player %d connection info", pID);
 
@@ -280,9 +638,20 @@ void cugl::NetworkConnection::cc7HostGetClientData(
 
 			CULog("Player id %d was successfully verified; connection handshake complete", pID);
 			connectedPlayers.set(pID);
+			resetLinkStats(pID);
 			std::vector<uint8_t> joinMsg = { pID };
 			broadcast(joinMsg, packet->systemAddress, PlayerJoined);
 			numPlayers++;
+			if (config.mesh || config.hostMigration) {
+				introduceMeshPeer(h, pID);
+			}
+			if (config.sessionResume) {
+				issueToken(h, pID);
+				if (away.test(pID)) {
+					replayMissed(h, pID);
+					away.reset(pID);
+				}
+			}
 
 			return;
 		}
@@ -297,8 +666,10 @@ void cugl::NetworkConnection::cc7HostGetClientData(
 void cugl::NetworkConnection::cr1ClientReceivedInfo(ClientPeer& c, const std::vector<uint8_t>& msgConverted) {
 
 	CULog("Reconnection Progress: Received data from host");
-
-	
+	if (msgConverted.size() < JOIN_INFO_SIZE) {
+		CULogError("Received malformed reconnection info from host; ignoring");
+		return;
+	}
 
 	bool success = msgConverted[3] == apiVer;
 	if (!success) {
@@ -318,7 +689,14 @@ void cugl::NetworkConnection::cr1ClientReceivedInfo(ClientPeer& c, const std::ve
 		numPlayers = msgConverted[0];
 		maxPlayers = msgConverted[1];
 		playerID = msgConverted[2];
+		readRoster(msgConverted);
 		status = NetStatus::Connected;
+		migrating = false;
+		resuming = false;
+		c.started = true;
+		resetLinkStats(hostID);
+		markPhase(&HandshakeTimes::connected);
+		logHandshake(handshakeTimes);
 
 		lastReconnAttempt.reset();
 		disconnTime.reset();
@@ -341,50 +719,118 @@ void cugl::NetworkConnection::cr2HostGetClientResp(
 #pragma endregion
 
 void NetworkConnection::broadcast(const std::vector<uint8_t>& msg, SLNet::SystemAddress& ignore,
-	CustomDataPackets packetType) {
-	SLNet::BitStream bs;
-	bs.Write(static_cast<uint8_t>(ID_USER_PACKET_ENUM + packetType));
-	bs.Write(static_cast<uint8_t>(msg.size()));
-	bs.WriteAlignedBytes(msg.data(), static_cast<unsigned int>(msg.size()));
-	peer->Send(&bs, MEDIUM_PRIORITY, RELIABLE, 1, ignore, true);
+	CustomDataPackets packetType, uint8_t options) {
+	broadcast(msg.data(), msg.size(), ignore, packetType, options);
+}
+
+void NetworkConnection::broadcast(const uint8_t* msg, size_t length, const SLNet::SystemAddress& ignore,
+	CustomDataPackets packetType, uint8_t options) {
+	// Only the host broadcasts, so it is always the sender
+	sendFramed(peer.get(), msg, length, static_cast<uint8_t>(ID_USER_PACKET_ENUM + packetType),
+		options, hasRoutingPrefix(packetType) ? std::optional<uint8_t>(hostID) : std::nullopt, ignore, true);
+}
+
+void NetworkConnection::relay(SLNet::Packet* packet, const uint8_t* msg, size_t length) {
+	uint8_t options = packet->data[1];
+	uint8_t sender = packet->data[SENDER_OFFSET];
+	auto packetType = static_cast<CustomDataPackets>(packet->data[0] - ID_USER_PACKET_ENUM);
+	auto seq = recordReplay(msg, length, packetType, options, sender);
+	uint32_t receipt = peer->Send(reinterpret_cast<const char*>(packet->data), static_cast<int>(packet->length),
+		toPriority(options), seq.has_value() ? withReceipt(toReliability(options)) : toReliability(options),
+		toChannel(options), packet->systemAddress, true);
+
+	std::bitset<256> recipients = connectedPlayers;
+	recipients.reset(hostID);
+	recipients.reset(sender);
+	sentReplay(seq, recipients, receipt);
+}
+
+void NetworkConnection::send(const std::vector<uint8_t>& msg) {
+	send(msg, Delivery::Reliable, Priority::Medium, 1);
 }
 
-void NetworkConnection::send(const std::vector<uint8_t>& msg) { send(msg, Standard); }
+void NetworkConnection::send(const std::vector<uint8_t>& msg, Delivery delivery, Priority priority, uint8_t channel) {
+	if (!checkChannel(channel)) {
+		return;
+	}
+	uint8_t options = packOptions(delivery, priority, channel);
+	if (!queueOutbound(msg, Standard, options)) {
+		send(msg, Standard, options);
+	}
+}
 
 void cugl::NetworkConnection::sendOnlyToHost(const std::vector<uint8_t>& msg) {
-	std::visit(make_visitor(
-		[&](HostPeers& /*h*/) {},
-		[&](ClientPeer& c) {
-			send(msg, DirectToHost);
-		}), remotePeer);
+	sendOnlyToHost(msg, Delivery::Reliable, Priority::Medium, 1);
+}
+
+void cugl::NetworkConnection::sendOnlyToHost(const std::vector<uint8_t>& msg,
+	Delivery delivery, Priority priority, uint8_t channel) {
+	if (!checkChannel(channel)) {
+		return;
+	}
+	uint8_t options = packOptions(delivery, priority, channel);
+	if (!queueOutbound(msg, DirectToHost, options)) {
+		send(msg, DirectToHost, options);
+	}
+}
+
+void NetworkConnection::send(const std::vector<uint8_t>& msg, CustomDataPackets packetType, uint8_t options) {
+	// Checked here rather than in sendOnlyToHost(), since a client can become the host
+	if (packetType == DirectToHost && std::holds_alternative<HostPeers>(remotePeer)) {
+		return;
+	}
+	if ((packetType == Standard || packetType == DirectToHost) && !admit(msg, packetType, options)) {
+		return;
+	}
+	transmit(msg, packetType, options);
 }
 
-void NetworkConnection::send(const std::vector<uint8_t>& msg, CustomDataPackets packetType) {
-	SLNet::BitStream bs;
-	bs.Write(static_cast<uint8_t>(ID_USER_PACKET_ENUM + packetType));
-	bs.Write(static_cast<uint8_t>(msg.size()));
-	bs.WriteAlignedBytes(msg.data(), static_cast<unsigned int>(msg.size()));
+void NetworkConnection::transmit(const std::vector<uint8_t>& msg, CustomDataPackets packetType, uint8_t options) {
+	// Filtered messages are counted per recipient when they are actually sent
+	if ((packetType == Standard || packetType == DirectToHost) && !isFiltering()) {
+		countSent(1);
+	}
+	if (addToBatch(msg, packetType, options)) {
+		return;
+	}
+
+	auto messageID = static_cast<uint8_t>(ID_USER_PACKET_ENUM + packetType);
+	// The host overwrites the sender when relaying, so this is only a hint from clients
+	auto sender = hasRoutingPrefix(packetType) ? std::optional<uint8_t>(playerID.value_or(0)) : std::nullopt;
 
 	std::visit(make_visitor(
-		[&](HostPeers& /*h*/) {
-			peer->Send(&bs, MEDIUM_PRIORITY, RELIABLE, 1, *natPunchServerAddress, true);
+		[&](HostPeers& h) {
+			if (hasRoutingPrefix(packetType) && isFiltering()) {
+				sendRelevant(h, msg.data(), msg.size(), packetType, options, hostID);
+				return;
+			}
+			auto seq = recordReplay(msg.data(), msg.size(), packetType, options, hostID);
+			uint32_t receipt = 0;
+			sendFramed(peer.get(), msg, messageID, options, sender, *natPunchServerAddress, true,
+				seq.has_value() ? &receipt : nullptr);
+
+			std::bitset<256> recipients = connectedPlayers;
+			recipients.reset(hostID);
+			sentReplay(seq, recipients, receipt);
 		},
 		[&](ClientPeer& c) {
 			if (c.addr == nullptr) {
 				return;
 			}
-			peer->Send(&bs, MEDIUM_PRIORITY, RELIABLE, 1, *c.addr, false);
+			if (hasRoutingPrefix(packetType) && !c.mesh.empty()) {
+				sendMesh(c, msg, packetType, options);
+				return;
+			}
+			sendFramed(peer.get(), msg, messageID, options, sender, *c.addr, false);
 		}), remotePeer);
 }
 
 void cugl::NetworkConnection::directSend(
 	const std::vector<uint8_t>& msg, CustomDataPackets packetType, SLNet::SystemAddress dest
 ) {
-	SLNet::BitStream bs;
-	bs.Write(static_cast<uint8_t>(ID_USER_PACKET_ENUM + packetType));
-	bs.Write(static_cast<uint8_t>(msg.size()));
-	bs.WriteAlignedBytes(msg.data(), static_cast<unsigned int>(msg.size()));
-	peer->Send(&bs, MEDIUM_PRIORITY, RELIABLE, 1, dest, false);
+	sendFramed(peer.get(), msg, static_cast<uint8_t>(ID_USER_PACKET_ENUM + packetType),
+		DEFAULT_OPTIONS, hasRoutingPrefix(packetType) ? std::optional<uint8_t>(playerID.value_or(0)) : std::nullopt,
+		dest, false);
 }
 
 void cugl::NetworkConnection::attemptReconnect() {
@@ -407,135 +853,1358 @@ void cugl::NetworkConnection::attemptReconnect() {
 	CULog("Attempting reconnection");
 
 	peer->Shutdown(0);
-	SLNet::RakPeerInterface::DestroyInstance(peer.release());
+	peer.reset();
 	
 	lastReconnAttempt = now;
 	peer = nullptr;
 
+	std::visit(make_visitor(
+		[&](HostPeers& /*h*/) {},
+		[&](ClientPeer& c) {
+			// Direct links die with the old peer; the host introduces us again once we are back
+			c.mesh.clear();
+			c.meshPending.clear();
+		}), remotePeer);
+
 	c0StartupConn();
-	peer->SetMaximumIncomingConnections(1);
+	peer->SetMaximumIncomingConnections(config.mesh ? config.maxNumPlayers : 1);
 }
 
 
 void NetworkConnection::receive(
 	const std::function<void(const std::vector<uint8_t>&)>& dispatcher) {
+	receive([&](const uint8_t* msg, size_t length) {
+		dispatcher(std::vector<uint8_t>(msg, msg + length));
+	});
+}
 
-	switch (status) {
-	case NetStatus::Reconnecting:
-		attemptReconnect();
-		if (peer == nullptr) {
-			CULog("Peer null");
-			return;
+void NetworkConnection::receive(
+	const std::function<void(const uint8_t*, size_t)>& dispatcher) {
+	receive([&](const uint8_t* msg, size_t length, uint8_t /*sender*/, MessageType /*type*/) {
+		dispatcher(msg, length);
+	});
+}
+
+std::optional<uint8_t> NetworkConnection::findPlayer(HostPeers& h, const SLNet::SystemAddress& addr) {
+	for (uint8_t i = 0; i < h.peers.size(); i++) {
+		if (h.peers.at(i) != nullptr && *h.peers.at(i) == addr) {
+			return static_cast<uint8_t>(i + 1);
 		}
-		break;
-	case NetStatus::Disconnected:
-	case NetStatus::GenericError:
-	case NetStatus::ApiMismatch:
-	case NetStatus::RoomNotFound:
-		return;
-	case NetStatus::Connected:
-	case NetStatus::Pending:
-		break;
 	}
+	return std::nullopt;
+}
 
+#pragma region Network Thread
 
-	SLNet::Packet* packet = nullptr;
-	for (packet = peer->Receive(); packet != nullptr;
-		peer->DeallocatePacket(packet), packet = peer->Receive()) {
-		SLNet::BitStream bts(packet->data, packet->length, false);
+void NetworkConnection::startNetworkThread() {
+	if (!config.networkThread) {
+		return;
+	}
+	inbound = std::make_unique<NetworkQueue<InboundMessage>>(NET_QUEUE_SIZE);
+	outbound = std::make_unique<NetworkQueue<OutboundMessage>>(NET_QUEUE_SIZE);
+	netThreadRunning = true;
+	netThread = std::thread([this] { netThreadLoop(); });
+}
 
-		switch (packet->data[0]) {
-		case ID_CONNECTION_REQUEST_ACCEPTED:
-			// Connected to some remote server
-			if (packet->systemAddress == *(this->natPunchServerAddress)) {
-				// Punchthrough server
-				std::visit(make_visitor(
-					[&](HostPeers& h) { ch1HostConnServer(h); },
-					[&](ClientPeer& c) { cc1ClientConnServer(c); }), remotePeer);
+void NetworkConnection::netThreadLoop() {
+	auto enqueue = [&](const uint8_t* msg, size_t length, uint8_t sender, MessageType type) {
+		InboundMessage* slot = inboundOverflow.empty() ? inbound->prepare() : nullptr;
+		if (slot == nullptr) {
+			// Game thread is behind; hold on to the message rather than block the network
+			inboundOverflow.push_back({ std::vector<uint8_t>(msg, msg + length), sender, type });
+			return;
+		}
+		slot->data.assign(msg, msg + length);
+		slot->sender = sender;
+		slot->type = type;
+		inbound->commit();
+	};
+
+	size_t overflowed = 0;
+	while (netThreadRunning) {
+		// Move anything that overflowed last time into the queue first, to keep ordering
+		for (; overflowed < inboundOverflow.size(); overflowed++) {
+			InboundMessage* slot = inbound->prepare();
+			if (slot == nullptr) {
+				break;
 			}
-			else {
-				std::visit(make_visitor(
-					[&](HostPeers& h) { cc5HostConfirmClient(h, packet); },
-					[&](ClientPeer& /*c*/) {
-						CULogError(
-							"A connection request you sent was accepted despite being client?");
-					}), remotePeer);
+			std::swap(*slot, inboundOverflow[overflowed]);
+			inbound->commit();
+		}
+		if (overflowed == inboundOverflow.size()) {
+			inboundOverflow.clear();
+			overflowed = 0;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(stateMutex);
+			for (OutboundMessage* m = outbound->front(); m != nullptr; m = outbound->front()) {
+				if (m->flush) {
+					flushBatches();
+				} else {
+					send(m->data, m->packetType, m->options);
+				}
+				outbound->pop();
 			}
-			break;
-		case ID_NEW_INCOMING_CONNECTION: // Someone connected to you
-			CULog("A peer connected");
-			std::visit(make_visitor(
-				[&](HostPeers& /*h*/) { CULogError("How did that happen? You're the host"); },
-				[&](ClientPeer& c) { cc4ClientReceiveHostConnection(c, packet); }), remotePeer);
-			break;
-		case ID_NAT_PUNCHTHROUGH_SUCCEEDED: // Punchthrough succeeded
-			CULog("Punchthrough success");
+			pump(enqueue);
+		}
 
-			std::visit(make_visitor(
-				[&](HostPeers& h) { cc3HostReceivedPunch(h, packet); },
-				[&](ClientPeer& c) { cc2ClientPunchSuccess(c, packet); }), remotePeer);
-			break;
-		case ID_NAT_TARGET_NOT_CONNECTED:
-			status = NetStatus::GenericError;
-			break;
-		case ID_REMOTE_DISCONNECTION_NOTIFICATION:
-		case ID_REMOTE_CONNECTION_LOST:
-		case ID_DISCONNECTION_NOTIFICATION:
-		case ID_CONNECTION_LOST:
-			CULog("Received disconnect notification");
-			std::visit(make_visitor(
-				[&](HostPeers& h) {
-					for (uint8_t i = 0; i < h.peers.size(); i++) {
-						if (h.peers.at(i) == nullptr) {
-							continue;
-						}
-						if (*h.peers.at(i) == packet->systemAddress) {
-							uint8_t pID = i + 1;
-							CULog("Lost connection to player %d", pID);
-							std::vector<uint8_t> disconnMsg{ pID };
-							h.peers.at(i) = nullptr;
-							if (connectedPlayers.test(pID)) {
-								numPlayers--;
-								connectedPlayers.reset(pID);
-							}
-							send(disconnMsg, PlayerLeft);
+		std::this_thread::sleep_for(std::chrono::milliseconds(NET_THREAD_SLEEP));
+	}
+}
 
-							if (peer->GetConnectionState(packet->systemAddress) == SLNet::IS_CONNECTED) {
-								peer->CloseConnection(packet->systemAddress, true);
-							}
-							return;
-						}
-					}
-				},
-				[&](ClientPeer& c) {
-					if (packet->systemAddress == *natPunchServerAddress) {
-						CULog("Successfully disconnected from Punchthrough server");
-					}
-					if (packet->systemAddress == *c.addr) {
-						CULog("Lost connection to host");
-						connectedPlayers.reset(0);
-						switch (status) {
-						case NetStatus::Pending:
-							status = NetStatus::GenericError;
-							return;
-						case NetStatus::Connected:
-							status = NetStatus::Reconnecting;
-							disconnTime = time(nullptr);
-							return;
-						case NetStatus::Reconnecting:
-						case NetStatus::Disconnected:
-						case NetStatus::RoomNotFound:
-						case NetStatus::ApiMismatch:
-						case NetStatus::GenericError:
-							return;
-						}
-					}
-				}), remotePeer);
+bool NetworkConnection::queueOutbound(const std::vector<uint8_t>& msg, CustomDataPackets packetType, uint8_t options) {
+	if (!netThread.joinable()) {
+		return false;
+	}
+	OutboundMessage* slot;
+	while ((slot = outbound->prepare()) == nullptr) {
+		// Network thread never waits on us, so it will free a slot shortly
+		std::this_thread::yield();
+	}
+	slot->data.assign(msg.begin(), msg.end());
+	slot->packetType = packetType;
+	slot->options = options;
+	slot->flush = false;
+	outbound->commit();
+	return true;
+}
 
+#pragma endregion
+
+void NetworkConnection::receive(
+	const std::function<void(const uint8_t*, size_t, uint8_t, MessageType)>& dispatcher) {
+	if (!netThread.joinable()) {
+		pump(dispatcher);
+	} else {
+		for (InboundMessage* m = inbound->front(); m != nullptr; m = inbound->front()) {
+			dispatcher(m->data.data(), m->data.size(), m->sender, m->type);
+			inbound->pop();
+		}
+	}
+
+	if (config.batchSends && config.flushOnReceive) {
+		flush();
+	}
+}
+
+#pragma region Statistics
+
+std::optional<SLNet::SystemAddress> NetworkConnection::addressOf(uint8_t pID) {
+	return std::visit(make_visitor(
+		[&](HostPeers& h) -> std::optional<SLNet::SystemAddress> {
+			if (pID == 0 || pID > h.peers.size() || h.peers.at(pID - 1) == nullptr || !connectedPlayers.test(pID)) {
+				return std::nullopt;
+			}
+			return *h.peers.at(pID - 1);
+		},
+		[&](ClientPeer& c) -> std::optional<SLNet::SystemAddress> {
+			if (c.addr == nullptr || status != NetStatus::Connected) {
+				return std::nullopt;
+			}
+			if (pID == hostID) {
+				return *c.addr;
+			}
+			auto it = c.mesh.find(pID);
+			return it == c.mesh.end() ? std::nullopt : std::optional<SLNet::SystemAddress>(it->second);
+		}), remotePeer);
+}
+
+void NetworkConnection::countSent(size_t n, std::optional<uint8_t> except) {
+	std::visit(make_visitor(
+		[&](HostPeers& h) {
+			for (uint8_t i = 0; i < h.peers.size(); i++) {
+				uint8_t pID = i + 1;
+				if (h.peers[i] != nullptr && connectedPlayers.test(pID) && pID != except) {
+					linkStats[pID].messagesSent += n;
+				}
+			}
+		},
+		[&](ClientPeer& c) {
+			// Linked clients get the message directly, as well as through the host
+			linkStats[hostID].messagesSent += n;
+			for (auto& link : c.mesh) {
+				linkStats[link.first].messagesSent += n;
+			}
+		}), remotePeer);
+}
+
+void NetworkConnection::resetLinkStats(uint8_t pID) {
+	linkStats[pID] = { 0, 0, -1, 0 };
+}
+
+void NetworkConnection::pingPeers() {
+	auto now = std::chrono::steady_clock::now();
+	if (now < nextPing) {
+		return;
+	}
+	nextPing = now + std::chrono::milliseconds(PING_INTERVAL);
+
+	forEachLink([&](uint8_t pID, const SLNet::SystemAddress& addr) {
+		// The reply to the previous ping has had a full interval to arrive
+		LinkStats& link = linkStats[pID];
+		int rtt = peer->GetLastPing(addr);
+		if (rtt >= 0) {
+			if (link.lastRtt >= 0) {
+				link.jitter += (static_cast<float>(std::abs(rtt - link.lastRtt)) - link.jitter) * JITTER_GAIN;
+			}
+			link.lastRtt = rtt;
+		}
+		peer->Ping(addr);
+	});
+}
+
+void NetworkConnection::forEachLink(const std::function<void(uint8_t, const SLNet::SystemAddress&)>& fn) {
+	auto visit = [&](uint8_t pID) {
+		auto addr = addressOf(pID);
+		if (addr.has_value()) {
+			fn(pID, *addr);
+		}
+	};
+	std::visit(make_visitor(
+		[&](HostPeers& h) {
+			for (uint8_t i = 0; i < h.peers.size(); i++) {
+				visit(i + 1);
+			}
+		},
+		[&](ClientPeer& c) {
+			visit(hostID);
+			for (auto& link : c.mesh) {
+				visit(link.first);
+			}
+		}), remotePeer);
+}
+
+std::optional<NetworkConnection::PeerStats> NetworkConnection::getStats(uint8_t pID) {
+	std::lock_guard<std::mutex> lock(stateMutex);
+	auto addr = addressOf(pID);
+	if (!addr.has_value()) {
+		return std::nullopt;
+	}
+
+	SLNet::RakNetStatistics rns;
+	if (peer->GetStatistics(*addr, &rns) == nullptr) {
+		return std::nullopt;
+	}
+
+	const LinkStats& link = linkStats[pID];
+	PeerStats stats;
+	stats.rtt = peer->GetAveragePing(*addr);
+	stats.lastRtt = peer->GetLastPing(*addr);
+	stats.jitter = link.jitter;
+	stats.bytesSent = rns.runningTotal[SLNet::ACTUAL_BYTES_SENT];
+	stats.bytesReceived = rns.runningTotal[SLNet::ACTUAL_BYTES_RECEIVED];
+	stats.bytesSentPerSecond = rns.valueOverLastSecond[SLNet::ACTUAL_BYTES_SENT];
+	stats.bytesReceivedPerSecond = rns.valueOverLastSecond[SLNet::ACTUAL_BYTES_RECEIVED];
+	stats.messagesSent = link.messagesSent;
+	stats.messagesReceived = link.messagesReceived;
+	stats.bytesResent = rns.runningTotal[SLNet::USER_MESSAGE_BYTES_RESENT];
+	stats.sendQueueMessages = 0;
+	stats.sendQueueBytes = 0;
+	for (int i = 0; i < NUMBER_OF_PRIORITIES; i++) {
+		stats.sendQueueMessages += rns.messageInSendBuffer[i];
+		stats.sendQueueBytes += static_cast<uint64_t>(rns.bytesInSendBuffer[i]);
+	}
+	stats.unackedMessages = rns.messagesInResendBuffer;
+	stats.packetLoss = rns.packetlossLastSecond;
+	stats.packetLossTotal = rns.packetlossTotal;
+	return stats;
+}
+
+bool NetworkConnection::setLinkConditions(const NetworkLoopback::LinkConfig& conditions, Direction direction) {
+	if (!impairment) {
+		CULogError("Network conditions can only be simulated with ConnectionConfig::simulateConditions");
+		return false;
+	}
+	if (direction != Direction::Incoming) {
+		impairment->set(NetworkImpairment::Outgoing, conditions);
+	}
+	if (direction != Direction::Outgoing) {
+		impairment->set(NetworkImpairment::Incoming, conditions);
+	}
+	return true;
+}
+
+bool NetworkConnection::setLinkConditions(uint8_t pID, const NetworkLoopback::LinkConfig& conditions,
+	Direction direction) {
+	if (!impairment) {
+		CULogError("Network conditions can only be simulated with ConnectionConfig::simulateConditions");
+		return false;
+	}
+	std::lock_guard<std::mutex> lock(stateMutex);
+	auto addr = addressOf(pID);
+	if (!addr.has_value()) {
+		return false;
+	}
+	if (direction != Direction::Incoming) {
+		impairment->set(*addr, NetworkImpairment::Outgoing, conditions);
+	}
+	if (direction != Direction::Outgoing) {
+		impairment->set(*addr, NetworkImpairment::Incoming, conditions);
+	}
+	return true;
+}
+
+void NetworkConnection::clearLinkConditions() {
+	if (impairment) {
+		impairment->clear();
+	}
+}
+
+bool NetworkConnection::isGameData(const SLNet::Packet* packet, PacketReliability& reliability, uint8_t& channel) {
+	if (packet->length < 2 || packet->data[0] < ID_USER_PACKET_ENUM
+		|| !hasRoutingPrefix(static_cast<CustomDataPackets>(packet->data[0] - ID_USER_PACKET_ENUM))) {
+		return false;
+	}
+	reliability = toReliability(packet->data[1]);
+	channel = static_cast<uint8_t>(toChannel(packet->data[1]));
+	return true;
+}
+
+#pragma endregion
+
+#pragma region Clock Synchronization
+
+int64_t NetworkConnection::localTime() const {
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - epoch).count();
+}
+
+void NetworkConnection::syncClock() {
+	if (hostClock == nullptr || status != NetStatus::Connected) {
+		return;
+	}
+	auto now = std::chrono::steady_clock::now();
+	if (now < nextClockPing) {
+		return;
+	}
+	bool settled = hostClock->getSampleCount() >= NetworkClock::SAMPLE_WINDOW;
+	nextClockPing = now + std::chrono::milliseconds(settled ? CLOCK_INTERVAL : CLOCK_FAST_INTERVAL);
+
+	auto addr = addressOf(0);
+	if (!addr.has_value()) {
+		return;
+	}
+	uint8_t ping[sizeof(int64_t)];
+	writeTime(ping, localTime());
+	sendFramed(peer.get(), ping, sizeof(ping), static_cast<uint8_t>(ID_USER_PACKET_ENUM + ClockPing),
+		packOptions(Delivery::Unreliable, Priority::Immediate, 0), std::nullopt, *addr, false);
+}
+
+double NetworkConnection::getSessionTime() {
+	std::lock_guard<std::mutex> lock(stateMutex);
+	int64_t now = localTime();
+	if (hostClock != nullptr && hostClock->isSynced()) {
+		now = hostClock->toRemote(now);
+	}
+	return static_cast<double>(now) / 1e6;
+}
+
+bool NetworkConnection::isClockSynced() {
+	std::lock_guard<std::mutex> lock(stateMutex);
+	return hostClock == nullptr || hostClock->isSynced();
+}
+
+double NetworkConnection::getClockDrift() {
+	std::lock_guard<std::mutex> lock(stateMutex);
+	return hostClock == nullptr ? 0 : hostClock->getDrift();
+}
+
+#pragma endregion
+
+#pragma region Handshake Timing
+
+NetworkConnection::HandshakeTimes NetworkConnection::getHandshakeTimes() {
+	std::lock_guard<std::mutex> lock(stateMutex);
+	return handshakeTimes;
+}
+
+#pragma endregion
+
+#pragma region Send Rate Control
+
+bool NetworkConnection::admit(const std::vector<uint8_t>& msg, CustomDataPackets packetType, uint8_t options) {
+	if (!config.adaptiveSendRate || toPriority(options) != LOW_PRIORITY) {
+		return true;
+	}
+
+	bool reliable = toReliability(options) == RELIABLE || toReliability(options) == RELIABLE_ORDERED;
+	if (reliable && !deferred.empty()) {
+		// Stay behind the messages already held back, so nothing is reordered
+		defer(msg, packetType, options);
+		return false;
+	}
+
+	sendCredit = std::min(1.0f, sendCredit + sendRate);
+	if (sendCredit >= 1) {
+		sendCredit -= 1;
+		return true;
+	}
+	if (reliable) {
+		defer(msg, packetType, options);
+	}
+	return false;
+}
+
+void NetworkConnection::defer(const std::vector<uint8_t>& msg, CustomDataPackets packetType, uint8_t options) {
+	if (deferred.size() >= DEFERRED_LIMIT) {
+		if (!deferredOverflow) {
+			CULog("Connection congested; dropping the oldest held back low priority messages");
+			deferredOverflow = true;
+		}
+		deferred.pop_front();
+	}
+	deferred.push_back({ msg, packetType, options });
+}
+
+void NetworkConnection::updateSendRate() {
+	if (!config.adaptiveSendRate) {
+		return;
+	}
+	auto now = std::chrono::steady_clock::now();
+	if (now < nextRateUpdate) {
+		return;
+	}
+	nextRateUpdate = now + std::chrono::milliseconds(RATE_INTERVAL);
+
+	bool congested = false;
+	forEachLink([&](uint8_t /*pID*/, const SLNet::SystemAddress& addr) {
+		SLNet::RakNetStatistics rns;
+		if (peer->GetStatistics(addr, &rns) == nullptr) {
+			return;
+		}
+		double queued = 0;
+		for (int i = 0; i < NUMBER_OF_PRIORITIES; i++) {
+			queued += rns.bytesInSendBuffer[i];
+		}
+		double sent = static_cast<double>(rns.valueOverLastSecond[SLNet::USER_MESSAGE_BYTES_SENT]);
+		double resent = static_cast<double>(rns.valueOverLastSecond[SLNet::USER_MESSAGE_BYTES_RESENT]);
+		if (queued > RATE_QUEUE_LIMIT || rns.packetlossLastSecond > RATE_LOSS_LIMIT
+			|| resent > sent * RATE_RESEND_LIMIT) {
+			congested = true;
+		}
+	});
+
+	if (congested) {
+		if (now - lastRateDecrease >= std::chrono::milliseconds(RATE_DECREASE_GAP)) {
+			sendRate = std::max(MIN_SEND_RATE, sendRate / 2);
+			lastRateDecrease = now;
+			CULog("Connection congested; sending %.0f%% of low priority messages", sendRate * 100);
+		}
+		return;
+	}
+
+	sendRate = std::min(1.0f, sendRate + RATE_INCREASE);
+	size_t release = std::max<size_t>(1, static_cast<size_t>(sendRate * DEFERRED_RELEASE));
+	for (; release > 0 && !deferred.empty(); release--) {
+		transmit(deferred.front().data, deferred.front().packetType, deferred.front().options);
+		deferred.pop_front();
+	}
+	if (deferred.empty()) {
+		deferredOverflow = false;
+	}
+}
+
+#pragma endregion
+
+#pragma region Relevance Filtering
+
+void NetworkConnection::setRelevanceFilter(RelevanceFilter filter) {
+	std::lock_guard<std::mutex> lock(stateMutex);
+	relevanceFilter = std::move(filter);
+	relevanceCounts.clear();
+}
+
+std::optional<uint8_t> NetworkConnection::relevantOptions(const uint8_t* msg, size_t length, uint8_t options,
+	uint8_t sender, uint8_t recipient) {
+	if (!relevanceFilter) {
+		return options;
+	}
+	Relevance r = relevanceFilter(msg, length, sender, recipient);
+	if (!r.deliver) {
+		return std::nullopt;
+	}
+	if (r.interval > 1) {
+		uint32_t key = (static_cast<uint32_t>(sender) << 16) | (static_cast<uint32_t>(recipient) << 8)
+			| static_cast<uint8_t>(toChannel(options));
+		if (relevanceCounts[key]++ % r.interval != 0) {
+			return std::nullopt;
+		}
+	}
+	if (r.priority.has_value()) {
+		options = static_cast<uint8_t>((options & ~PRIORITY_MASK) | (static_cast<uint8_t>(*r.priority) << 2));
+	}
+	return options;
+}
+
+void NetworkConnection::sendRelevant(HostPeers& h, const uint8_t* msg, size_t length, CustomDataPackets packetType,
+	uint8_t options, uint8_t sender, const std::bitset<256>& skip) {
+	auto seq = recordReplay(msg, length, packetType, options, sender);
+	for (uint8_t i = 0; i < h.peers.size(); i++) {
+		uint8_t pID = i + 1;
+		if (pID == sender || skip.test(pID) || h.peers[i] == nullptr || !connectedPlayers.test(pID)) {
+			continue;
+		}
+
+		if (packetType == Standard) {
+			auto sendOptions = relevantOptions(msg, length, options, sender, pID);
+			if (sendOptions.has_value()) {
+				uint32_t receipt = 0;
+				sendFramed(peer.get(), msg, length, static_cast<uint8_t>(ID_USER_PACKET_ENUM + Standard),
+					*sendOptions, sender, *h.peers[i], false, seq.has_value() ? &receipt : nullptr);
+				sentReplay(seq, std::bitset<256>().set(pID), receipt);
+				linkStats[pID].messagesSent++;
+			}
+			continue;
+		}
+
+		// Rebuild the batch with only the messages for this player, regrouped by priority
+		relevantBatches.clear();
+		size_t pos = 0;
+		while (pos < length) {
+			uint32_t size;
+			size_t read = netframing::readVarint(msg + pos, length - pos, size);
+			if (read == 0 || size > length - pos - read) {
+				CULogError("Received malformed batch; dropping the rest of it");
+				break;
+			}
+			auto sendOptions = relevantOptions(msg + pos + read, size, options, sender, pID);
+			if (sendOptions.has_value()) {
+				auto it = std::find_if(relevantBatches.begin(), relevantBatches.end(),
+					[&](const Batch& b) { return b.options == *sendOptions; });
+				if (it == relevantBatches.end()) {
+					relevantBatches.push_back({ StandardBatch, *sendOptions, {} });
+					it = relevantBatches.end() - 1;
+				}
+				it->data.insert(it->data.end(), msg + pos, msg + pos + read + size);
+				linkStats[pID].messagesSent++;
+			}
+			pos += read + size;
+		}
+		for (auto& b : relevantBatches) {
+			uint32_t receipt = 0;
+			sendFramed(peer.get(), b.data, static_cast<uint8_t>(ID_USER_PACKET_ENUM + StandardBatch),
+				b.options, sender, *h.peers[i], false, seq.has_value() ? &receipt : nullptr);
+			sentReplay(seq, std::bitset<256>().set(pID), receipt);
+		}
+	}
+}
+
+#pragma endregion
+
+#pragma region Mesh
+
+/**
+ * Append one client to a MeshPeers packet: player ID, then its address and GUID as
+ * length prefixed strings.
+ */
+void writeMeshEntry(std::vector<uint8_t>& out, uint8_t pID, const SLNet::SystemAddress& addr, SLNet::RakNetGUID guid) {
+	std::string address = addr.ToString(true, '|');
+	std::string id = guid.ToString();
+	out.push_back(pID);
+	out.push_back(static_cast<uint8_t>(address.size()));
+	out.insert(out.end(), address.begin(), address.end());
+	out.push_back(static_cast<uint8_t>(id.size()));
+	out.insert(out.end(), id.begin(), id.end());
+}
+
+/** Read a length prefixed string written by writeMeshEntry, or return false if it is truncated */
+bool readMeshString(const std::vector<uint8_t>& in, size_t& pos, std::string& out) {
+	if (pos >= in.size() || in[pos] > in.size() - pos - 1) {
+		return false;
+	}
+	out.assign(in.begin() + pos + 1, in.begin() + pos + 1 + in[pos]);
+	pos += 1 + in[pos];
+	return true;
+}
+
+void NetworkConnection::introduceMeshPeer(HostPeers& h, uint8_t pID) {
+	const SLNet::SystemAddress& addr = *h.peers.at(pID - 1);
+	std::vector<uint8_t> newcomer;
+	writeMeshEntry(newcomer, pID, addr, peer->GetGuidFromSystemAddress(addr));
+
+	std::vector<uint8_t> others;
+	for (uint8_t i = 0; i < h.peers.size(); i++) {
+		uint8_t other = i + 1;
+		if (other == pID || h.peers[i] == nullptr || !connectedPlayers.test(other)) {
+			continue;
+		}
+		writeMeshEntry(others, other, *h.peers[i], peer->GetGuidFromSystemAddress(*h.peers[i]));
+		directSend(newcomer, MeshPeers, *h.peers[i]);
+	}
+	if (!others.empty()) {
+		directSend(others, MeshPeers, addr);
+	}
+}
+
+void NetworkConnection::connectMesh(ClientPeer& c, const std::vector<uint8_t>& msgConverted) {
+	size_t pos = 0;
+	while (pos < msgConverted.size()) {
+		uint8_t pID = msgConverted[pos++];
+		std::string address, id;
+		if (!readMeshString(msgConverted, pos, address) || !readMeshString(msgConverted, pos, id)) {
+			CULogError("Received malformed mesh peers");
+			return;
+		}
+		SLNet::SystemAddress addr;
+		SLNet::RakNetGUID guid;
+		if (pID == playerID || !addr.FromString(address.c_str(), '|') || !guid.FromString(id.c_str())) {
+			continue;
+		}
+		c.directory[pID] = addr;
+		if (!config.mesh) {
+			continue;
+		}
+
+		auto it = c.mesh.find(pID);
+		if (it != c.mesh.end() && peer->GetGuidFromSystemAddress(it->second) == guid) {
+			// Already linked; a new host is just introducing everyone again
+			continue;
+		}
+		if (it != c.mesh.end()) {
+			// Player reconnected; the old link is dead
+			peer->CloseConnection(it->second, false);
+			unlinkMesh(c, pID);
+		}
+		// They are connecting to us at the same moment, which opens both NATs
+		CULog("Connecting directly to player %d", pID);
+		c.meshPending[guid.g] = pID;
+		peer->Connect(addr.ToString(false), addr.GetPort(), nullptr, 0);
+	}
+}
+
+bool NetworkConnection::linkMesh(ClientPeer& c, SLNet::Packet* packet) {
+	auto it = c.meshPending.find(packet->guid.g);
+	if (it == c.meshPending.end()) {
+		return false;
+	}
+	uint8_t pID = it->second;
+	c.meshPending.erase(it);
+	if (c.mesh.count(pID) == 0) {
+		CULog("Direct link to player %d established", pID);
+		c.mesh.emplace(pID, packet->systemAddress);
+		resetLinkStats(pID);
+	}
+	return true;
+}
+
+void NetworkConnection::unlinkMesh(ClientPeer& c, uint8_t pID) {
+	c.mesh.erase(pID);
+	resetLinkStats(pID);
+}
+
+std::optional<uint8_t> NetworkConnection::meshPlayer(ClientPeer& c, const SLNet::SystemAddress& addr) {
+	for (auto& link : c.mesh) {
+		if (link.second == addr) {
+			return link.first;
+		}
+	}
+	return std::nullopt;
+}
+
+void NetworkConnection::sendMesh(ClientPeer& c, const std::vector<uint8_t>& msg, CustomDataPackets packetType,
+	uint8_t options) {
+	auto messageID = static_cast<uint8_t>(ID_USER_PACKET_ENUM + packetType);
+	meshBuffer.clear();
+	meshBuffer.push_back(packetType == StandardBatch ? 1 : 0);
+	meshBuffer.push_back(static_cast<uint8_t>(c.mesh.size()));
+	for (auto& link : c.mesh) {
+		sendFramed(peer.get(), msg, messageID, options, playerID.value_or(0), link.second, false);
+		meshBuffer.push_back(link.first);
+	}
+	meshBuffer.insert(meshBuffer.end(), msg.begin(), msg.end());
+
+	// The host still sees everything, and relays it to whoever we could not reach
+	sendFramed(peer.get(), meshBuffer, static_cast<uint8_t>(ID_USER_PACKET_ENUM + MeshRelay),
+		options, playerID.value_or(0), *c.addr, false);
+}
+
+bool NetworkConnection::hasDirectLink(uint8_t pID) {
+	std::lock_guard<std::mutex> lock(stateMutex);
+	return std::visit(make_visitor(
+		[&](HostPeers& /*h*/) { return pID != hostID && connectedPlayers.test(pID); },
+		[&](ClientPeer& c) { return pID == hostID ? c.addr != nullptr : c.mesh.count(pID) > 0; }), remotePeer);
+}
+
+#pragma endregion
+
+#pragma region Host Migration
+
+void NetworkConnection::migrateHost() {
+	ClientPeer& c = std::get<ClientPeer>(remotePeer);
+	connectedPlayers.reset(hostID);
+	if (c.addr != nullptr) {
+		peer->CloseConnection(*c.addr, false);
+	}
+
+	// Every client has the same player list, so they all pick the same successor
+	std::optional<uint8_t> successor;
+	for (size_t i = 0; i < connectedPlayers.size(); i++) {
+		if (connectedPlayers.test(i)) {
+			successor = static_cast<uint8_t>(i);
+			break;
+		}
+	}
+	if (!successor.has_value()) {
+		status = NetStatus::Disconnected;
+		return;
+	}
+
+	CULog("Host %d lost; player %d is taking over", hostID, *successor);
+	hostID = *successor;
+	numPlayers = static_cast<uint8_t>(connectedPlayers.count());
+	if (!migrating) {
+		disconnTime = time(nullptr);
+	}
+	migrating = true;
+	status = NetStatus::Reconnecting;
+
+	if (*successor == playerID) {
+		promoteToHost();
+		return;
+	}
+
+	auto link = c.mesh.find(*successor);
+	if (link != c.mesh.end()) {
+		// Already connected; this link now carries everything
+		c.addr = std::make_unique<SLNet::SystemAddress>(link->second);
+		c.mesh.erase(link);
+	} else {
+		auto entry = c.directory.find(*successor);
+		if (entry == c.directory.end()) {
+			CULogError("No address for player %d; cannot follow the new host", *successor);
+			status = NetStatus::Disconnected;
+			return;
+		}
+		// The new host connects to us at the same moment, which opens both NATs
+		c.addr = std::make_unique<SLNet::SystemAddress>(entry->second);
+		peer->Connect(c.addr->ToString(false), c.addr->GetPort(), nullptr, 0);
+	}
+	resetLinkStats(hostID);
+}
+
+void NetworkConnection::promoteToHost() {
+	ClientPeer& c = std::get<ClientPeer>(remotePeer);
+	HostPeers h(config.maxNumPlayers);
+	h.started = c.started;
+
+	std::vector<SLNet::SystemAddress> linked;
+	for (size_t i = 0; i < connectedPlayers.size(); i++) {
+		auto pID = static_cast<uint8_t>(i);
+		if (!connectedPlayers.test(pID) || pID == playerID || pID > h.peers.size()) {
+			continue;
+		}
+		auto link = c.mesh.find(pID);
+		auto entry = c.directory.find(pID);
+		if (link != c.mesh.end()) {
+			linked.push_back(link->second);
+			h.peers[pID - 1] = std::make_unique<SLNet::SystemAddress>(link->second);
+		} else if (entry != c.directory.end()) {
+			h.peers[pID - 1] = std::make_unique<SLNet::SystemAddress>(entry->second);
+			peer->Connect(entry->second.ToString(false), entry->second.GetPort(), nullptr, 0);
+		}
+	}
+
+	// Carry on the old host's session time, so nothing jumps
+	if (hostClock->isSynced()) {
+		int64_t local = localTime();
+		epoch -= std::chrono::microseconds(hostClock->toRemote(local) - local);
+	}
+	hostClock.reset();
+
+	// Everyone else rejoins through the usual handshake
+	remotePeer = std::move(h);
+	connectedPlayers.reset();
+	connectedPlayers.set(hostID);
+	numPlayers = 1;
+	if (!std::get<HostPeers>(remotePeer).started) {
+		maxPlayers = 1;
+	}
+	status = NetStatus::Connected;
+	migrating = false;
+	disconnTime.reset();
+	CULog("Now hosting the game as player %d", hostID);
+
+	for (auto& addr : linked) {
+		cc5HostConfirmClient(std::get<HostPeers>(remotePeer), addr);
+	}
+
+	// Register a room of our own, for anyone who joins later
+	peer->SetMaximumIncomingConnections(config.maxNumPlayers);
+	if (config.lan) {
+		// We listen on a port of our own, so something else has to answer on the usual one
+		openLanBeacon();
+		advertiseLan();
+	} else {
+		peer->Connect(natPunchServerAddress->ToString(false), natPunchServerAddress->GetPort(), nullptr, 0);
+	}
+}
+
+void NetworkConnection::checkHostChange(SLNet::Packet* packet) {
+	auto* c = std::get_if<ClientPeer>(&remotePeer);
+	if (c == nullptr || !config.hostMigration || migrating || status != NetStatus::Connected
+		|| c->addr == nullptr || packet->systemAddress == *c->addr) {
+		return;
+	}
+	// The new host found us before we noticed the old one was gone
+	migrateHost();
+}
+
+#pragma endregion
+
+#pragma region LAN Discovery
+
+void NetworkConnection::advertiseLan() {
+	std::random_device rd;
+	std::stringstream newRoomId;
+	for (size_t i = 0; i < ROOM_LENGTH; i++) {
+		newRoomId << static_cast<char>('0' + rd() % 10);
+	}
+	roomID = newRoomId.str();
+
+	std::string answer(LAN_TAG, sizeof(LAN_TAG));
+	answer += roomID;
+	if (lanBeacon != nullptr) {
+		// Queries reach the beacon; send joiners on to where we actually listen
+		answer += LAN_PORT_MARK + std::to_string(peer->GetMyBoundAddress().GetPort());
+		lanBeacon->SetOfflinePingResponse(answer.data(), static_cast<unsigned int>(answer.size()));
+	} else {
+		peer->SetOfflinePingResponse(answer.data(), static_cast<unsigned int>(answer.size()));
+	}
+	peer->SetMaximumIncomingConnections(config.maxNumPlayers);
+	CULog("Hosting room %s on the local network, port %d", roomID.c_str(), config.lanPort);
+}
+
+void NetworkConnection::openLanBeacon() {
+	if (config.loopback) {
+		lanBeacon = openLoopback(config.loopback);
+	} else {
+		lanBeacon = std::make_unique<RakNetTransport>();
+	}
+	SLNet::SocketDescriptor socketDescriptor;
+	socketDescriptor.port = config.lanPort;
+	if (lanBeacon->Startup(1, &socketDescriptor, 1) != SLNet::RAKNET_STARTED) {
+		CULogError("Could not answer on the LAN port; nobody new can find this room");
+		lanBeacon.reset();
+		return;
+	}
+	// Only answers queries; everyone connects to the port we already listen on
+	lanBeacon->SetMaximumIncomingConnections(0);
+}
+
+void NetworkConnection::queryLan() {
+	if (!lanSearching) {
+		return;
+	}
+	auto now = std::chrono::steady_clock::now();
+	if (now < nextLanQuery) {
+		return;
+	}
+	if (status == NetStatus::Pending && now - handshakeStart > std::chrono::milliseconds(LAN_SEARCH_TIMEOUT)) {
+		// While reconnecting, attemptReconnect() decides when to give up instead
+		CULog("No host on the local network answered for our room");
+		lanSearching = false;
+		status = NetStatus::RoomNotFound;
+		return;
+	}
+	nextLanQuery = now + std::chrono::milliseconds(LAN_QUERY_INTERVAL);
+	peer->Ping(config.lanAddress, config.lanPort, false);
+}
+
+void NetworkConnection::foundLanHost(ClientPeer& c, SLNet::Packet* packet) {
+	// Message ID and the time the query was sent come before the host's answer
+	size_t offset = sizeof(SLNet::MessageID) + sizeof(SLNet::TimeMS);
+	if (!lanSearching || packet->length < offset + sizeof(LAN_TAG)
+		|| std::memcmp(packet->data + offset, LAN_TAG, sizeof(LAN_TAG)) != 0) {
+		return;
+	}
+	offset += sizeof(LAN_TAG);
+	std::string room(reinterpret_cast<const char*>(packet->data + offset), packet->length - offset);
+	size_t mark = room.find(LAN_PORT_MARK);
+	int port = 0;
+	if (mark != std::string::npos) {
+		port = std::atoi(room.c_str() + mark + 1);
+		room.resize(mark);
+		if (port <= 0 || port > UINT16_MAX) {
+			return;
+		}
+	}
+	c.server = room == SERVER_ROOM;
+	if (room != c.room && !c.server) {
+		return;
+	}
+	if (port != 0) {
+		// A host that took over listens on another port than the one that answered
+		packet->systemAddress.SetPortHostOrder(static_cast<uint16_t>(port));
+	}
+
+	if (c.server) {
+		CULog("Found a room server at %s", packet->systemAddress.ToString());
+	} else {
+		CULog("Found room %s at %s", room.c_str(), packet->systemAddress.ToString());
+	}
+	lanSearching = false;
+	// From here on, exactly as if punchthrough had just succeeded
+	cc2ClientPunchSuccess(c, packet);
+}
+
+#pragma endregion
+
+#pragma region Session Resumption
+
+void NetworkConnection::issueToken(HostPeers& h, uint8_t pID) {
+	std::random_device rd;
+	uint64_t token = 0;
+	while (token == 0) {
+		token = (static_cast<uint64_t>(rd()) << 32) | rd();
+	}
+	sessionTokens[pID] = token;
+
+	// Same encoding as a timestamp
+	std::vector<uint8_t> msg(sizeof(uint64_t));
+	writeTime(msg.data(), static_cast<int64_t>(token));
+	directSend(msg, SessionToken, *h.peers.at(pID - 1));
+}
+
+std::optional<uint64_t> NetworkConnection::recordReplay(const uint8_t* msg, size_t length,
+	CustomDataPackets packetType, uint8_t options, uint8_t sender) {
+	if (!config.sessionResume || (packetType != Standard && packetType != StandardBatch)) {
+		return std::nullopt;
+	}
+	PacketReliability reliability = toReliability(options);
+	if (reliability != RELIABLE && reliability != RELIABLE_ORDERED) {
+		return std::nullopt;
+	}
+
+	trimReplay();
+	ReplayEntry entry{ packetType, options, sender, std::vector<uint8_t>(msg, msg + length), away, {} };
+	entry.pending.reset(sender);
+	replay.push_back(std::move(entry));
+	replayBytes += length;
+	return replayBase + replay.size() - 1;
+}
+
+void NetworkConnection::sentReplay(std::optional<uint64_t> seq, const std::bitset<256>& recipients, uint32_t receipt) {
+	if (!seq.has_value() || *seq < replayBase || receipt == 0) {
+		return;
+	}
+	ReplayEntry& entry = replay[*seq - replayBase];
+	entry.pending |= recipients;
+	entry.receipts.push_back(receipt);
+	receipts[receipt] = *seq;
+}
+
+void NetworkConnection::acknowledgeReplay(uint8_t pID, uint32_t receipt) {
+	auto it = receipts.find(receipt);
+	if (it == receipts.end() || it->second < replayBase) {
+		return;
+	}
+	replay[it->second - replayBase].pending.reset(pID);
+	trimReplay();
+}
+
+void NetworkConnection::trimReplay() {
+	while (!replay.empty() && (replay.front().pending.none() || replayBytes > REPLAY_LIMIT)) {
+		ReplayEntry& entry = replay.front();
+		std::bitset<256> lost = entry.pending & away;
+		for (size_t i = 0; i < lost.size(); i++) {
+			if (lost.test(i)) {
+				CULog("Player %zu missed too much to resume their session", i);
+				endSession(static_cast<uint8_t>(i));
+			}
+		}
+		for (uint32_t r : entry.receipts) {
+			receipts.erase(r);
+		}
+		replayBytes -= entry.data.size();
+		replay.pop_front();
+		replayBase++;
+	}
+}
+
+void NetworkConnection::endSession(uint8_t pID) {
+	sessionTokens[pID] = 0;
+	away.reset(pID);
+	for (auto& entry : replay) {
+		entry.pending.reset(pID);
+	}
+}
+
+void NetworkConnection::replayMissed(HostPeers& h, uint8_t pID) {
+	const SLNet::SystemAddress& addr = *h.peers.at(pID - 1);
+	size_t count = 0;
+	for (size_t i = 0; i < replay.size(); i++) {
+		ReplayEntry& entry = replay[i];
+		if (!entry.pending.test(pID)) {
+			continue;
+		}
+		uint32_t receipt = 0;
+		sendFramed(peer.get(), entry.data, static_cast<uint8_t>(ID_USER_PACKET_ENUM + entry.packetType),
+			entry.options, entry.sender, addr, false, &receipt);
+		if (receipt != 0) {
+			entry.receipts.push_back(receipt);
+			receipts[receipt] = replayBase + i;
+		}
+		count++;
+	}
+	CULog("Replayed %zu missed messages to player %d", count, pID);
+}
+
+void NetworkConnection::expireSessions() {
+	if (away.none()) {
+		return;
+	}
+	time_t now = time(nullptr);
+	for (size_t i = 0; i < away.size(); i++) {
+		if (away.test(i) && now - awaySince[i] > static_cast<time_t>(RECONN_TIMEOUT)) {
+			CULog("Session of player %zu expired", i);
+			endSession(static_cast<uint8_t>(i));
+		}
+	}
+	trimReplay();
+}
+
+void NetworkConnection::resumeSession(HostPeers& h, const SLNet::SystemAddress& addr,
+	const std::vector<uint8_t>& msgConverted) {
+	h.dropped.erase(addr.ToString());
+	uint8_t pID = msgConverted.size() == 1 + sizeof(uint64_t) ? msgConverted[0] : 0;
+	if (pID == 0 || pID > h.peers.size() || sessionTokens[pID] == 0
+		|| static_cast<uint64_t>(readTime(msgConverted.data() + 1)) != sessionTokens[pID]) {
+		CULog("Rejecting session resume with a bad token");
+		directSend({}, JoinRoomFail, addr);
+		peer->CloseConnection(addr, true);
+		return;
+	}
+
+	auto& slot = h.peers.at(pID - 1);
+	if (connectedPlayers.test(pID)) {
+		// We have not noticed the old connection drop yet
+		CULog("Lost connection to player %d", pID);
+		connectedPlayers.reset(pID);
+		numPlayers--;
+		send({ pID }, PlayerLeft);
+		away.set(pID);
+		awaySince[pID] = time(nullptr);
+		if (slot != nullptr && *slot != addr) {
+			peer->CloseConnection(*slot, false);
+		}
+	}
+
+	CULog("Player %d is resuming their session", pID);
+	slot = std::make_unique<SLNet::SystemAddress>(addr);
+	cc5HostConfirmClient(h, addr);
+}
+
+#pragma endregion
+
+#pragma region Batching
+
+void NetworkConnection::flush() {
+	if (!config.batchSends) {
+		return;
+	}
+	if (!netThread.joinable()) {
+		flushBatches();
+		return;
+	}
+
+	// Flush at this point in the outbound stream, after everything sent so far
+	OutboundMessage* slot;
+	while ((slot = outbound->prepare()) == nullptr) {
+		std::this_thread::yield();
+	}
+	slot->data.clear();
+	slot->flush = true;
+	outbound->commit();
+}
+
+bool NetworkConnection::addToBatch(const std::vector<uint8_t>& msg, CustomDataPackets packetType, uint8_t options) {
+	if (!config.batchSends || (packetType != Standard && packetType != DirectToHost)) {
+		return false;
+	}
+	if (toPriority(options) == IMMEDIATE_PRIORITY) {
+		// Priority::Immediate promises not to wait, so it never waits for a flush either
+		return false;
+	}
+
+	CustomDataPackets batchType = packetType == Standard ? StandardBatch : DirectToHostBatch;
+	Batch* batch = nullptr;
+	for (auto& b : batches) {
+		if (b.packetType == batchType && b.options == options) {
+			batch = &b;
+			break;
+		}
+	}
+
+	bool fits = msg.size() + netframing::MAX_LENGTH_BYTES <= BATCH_SIZE;
+	if (batch != nullptr && (!fits || batch->data.size() + msg.size() + netframing::MAX_LENGTH_BYTES > BATCH_SIZE)) {
+		send(batch->data, batch->packetType, batch->options);
+		batch->data.clear();
+	}
+	if (!fits) {
+		return false;
+	}
+
+	if (batch == nullptr) {
+		batches.push_back({ batchType, options, {} });
+		batch = &batches.back();
+		batch->data.reserve(BATCH_SIZE);
+	}
+
+	uint8_t length[netframing::MAX_LENGTH_BYTES];
+	size_t lengthSize = netframing::writeVarint(length, static_cast<uint32_t>(msg.size()));
+	batch->data.insert(batch->data.end(), length, length + lengthSize);
+	batch->data.insert(batch->data.end(), msg.begin(), msg.end());
+	return true;
+}
+
+void NetworkConnection::flushBatches() {
+	for (auto& b : batches) {
+		if (!b.data.empty()) {
+			send(b.data, b.packetType, b.options);
+			b.data.clear();
+		}
+	}
+}
+
+#pragma endregion
+
+void NetworkConnection::pump(
+	const std::function<void(const uint8_t*, size_t, uint8_t, MessageType)>& dispatcher) {
+
+	switch (status) {
+	case NetStatus::Reconnecting:
+		if (migrating) {
+			if (time(nullptr) - *disconnTime > static_cast<time_t>(RECONN_TIMEOUT)) {
+				CULog("Host migration timed out; giving up");
+				status = NetStatus::Disconnected;
+				return;
+			}
+			break;
+		}
+		if (resuming) {
+			if (std::chrono::steady_clock::now() < resumeDeadline) {
+				break;
+			}
+			CULog("Could not resume session; reconnecting as a returning player");
+			resuming = false;
+		}
+		attemptReconnect();
+		if (peer == nullptr) {
+			CULog("Peer null");
+			return;
+		}
+		break;
+	case NetStatus::Disconnected:
+	case NetStatus::GenericError:
+	case NetStatus::ApiMismatch:
+	case NetStatus::RoomNotFound:
+		return;
+	case NetStatus::Connected:
+	case NetStatus::Pending:
+		break;
+	}
+
+	pingPeers();
+	updateSendRate();
+	syncClock();
+	expireSessions();
+	queryLan();
+	if (lanBeacon != nullptr) {
+		// It answers queries by itself; nothing it receives needs handling
+		for (SLNet::Packet* p = lanBeacon->Receive(); p != nullptr; p = lanBeacon->Receive()) {
+			lanBeacon->DeallocatePacket(p);
+		}
+	}
+
+	SLNet::Packet* packet = nullptr;
+	bool hostLost = false;
+	for (packet = peer->Receive(); packet != nullptr;
+		peer->DeallocatePacket(packet), packet = peer->Receive()) {
+		SLNet::BitStream bts(packet->data, packet->length, false);
+
+		switch (packet->data[0]) {
+		case ID_CONNECTION_REQUEST_ACCEPTED:
+			// Connected to some remote server
+			if (packet->systemAddress == *(this->natPunchServerAddress)) {
+				// Punchthrough server
+				std::visit(make_visitor(
+					[&](HostPeers& h) { ch1HostConnServer(h); },
+					[&](ClientPeer& c) { cc1ClientConnServer(c); }), remotePeer);
+			}
+			else {
+				std::visit(make_visitor(
+					[&](HostPeers& h) { cc5HostConfirmClient(h, packet->systemAddress); },
+					[&](ClientPeer& c) {
+						if (c.addr != nullptr && packet->systemAddress == *c.addr && resuming) {
+							CULog("Reconnected to host; resuming session");
+							std::vector<uint8_t> resume(1 + sizeof(uint64_t));
+							resume[0] = playerID.value_or(0);
+							writeTime(resume.data() + 1, static_cast<int64_t>(sessionToken));
+							directSend(resume, Resume, *c.addr);
+						} else if (c.addr != nullptr && packet->systemAddress == *c.addr) {
+							CULog("Connected to host");
+							markPhase(&HandshakeTimes::hostConnected);
+							if (c.server) {
+								// A server hosts many rooms; it answers with the usual JoinRoom
+								directSend(std::vector<uint8_t>(c.room.begin(), c.room.end()), RoomRequest, *c.addr);
+							}
+						} else if (!linkMesh(c, packet)) {
+							CULogError(
+								"A connection request you sent was accepted despite being client?");
+						}
+					}), remotePeer);
+			}
+			break;
+		case ID_NEW_INCOMING_CONNECTION: // Someone connected to you
+			CULog("A peer connected");
+			std::visit(make_visitor(
+				[&](HostPeers& h) {
+					// After a migration, clients we connect to may connect to us at the same time
+					// Clients also connect to us right after punchthrough, racing our own request
+					auto pID = findPlayer(h, packet->systemAddress);
+					if ((pID.has_value() && !connectedPlayers.test(*pID))
+						|| h.toReject.count(packet->systemAddress.ToString()) > 0) {
+						cc5HostConfirmClient(h, packet->systemAddress);
+					} else if (config.lan && !pID.has_value() && h.dropped.count(packet->systemAddress.ToString()) == 0) {
+						// No punchthrough on a LAN; the client connects straight to us
+						cc3HostReceivedPunch(h, packet);
+					} else {
+						// Either its punchthrough success has not reached us yet (cc3 picks it up
+						// from there), or it is resuming a session and will send its token
+						CULog("Waiting for the new connection to identify itself");
+					}
+				},
+				[&](ClientPeer& c) {
+					if (!linkMesh(c, packet)) {
+						cc4ClientReceiveHostConnection(c, packet);
+					}
+				}), remotePeer);
+			break;
+		case ID_NAT_PUNCHTHROUGH_SUCCEEDED: // Punchthrough succeeded
+			CULog("Punchthrough success");
+
+			std::visit(make_visitor(
+				[&](HostPeers& h) { cc3HostReceivedPunch(h, packet); },
+				[&](ClientPeer& c) { cc2ClientPunchSuccess(c, packet); }), remotePeer);
+			break;
+		case ID_NAT_TARGET_NOT_CONNECTED:
+			status = NetStatus::GenericError;
+			break;
+		case ID_REMOTE_DISCONNECTION_NOTIFICATION:
+		case ID_REMOTE_CONNECTION_LOST:
+		case ID_DISCONNECTION_NOTIFICATION:
+		case ID_CONNECTION_LOST:
+			CULog("Received disconnect notification");
+			hostLost = false;
+			std::visit(make_visitor(
+				[&](HostPeers& h) {
+					for (uint8_t i = 0; i < h.peers.size(); i++) {
+						if (h.peers.at(i) == nullptr) {
+							continue;
+						}
+						if (*h.peers.at(i) == packet->systemAddress) {
+							uint8_t pID = i + 1;
+							CULog("Lost connection to player %d", pID);
+							std::vector<uint8_t> disconnMsg{ pID };
+							h.peers.at(i) = nullptr;
+							if (connectedPlayers.test(pID)) {
+								numPlayers--;
+								connectedPlayers.reset(pID);
+							}
+							send(disconnMsg, PlayerLeft);
+							if (sessionTokens[pID] != 0 && !away.test(pID)) {
+								away.set(pID);
+								awaySince[pID] = time(nullptr);
+								h.dropped.insert(packet->systemAddress.ToString());
+							}
+
+							if (peer->GetConnectionState(packet->systemAddress) == SLNet::IS_CONNECTED) {
+								peer->CloseConnection(packet->systemAddress, true);
+							}
+							return;
+						}
+					}
+				},
+				[&](ClientPeer& c) {
+					if (packet->systemAddress == *natPunchServerAddress) {
+						CULog("Successfully disconnected from Punchthrough server");
+					}
+					auto linked = meshPlayer(c, packet->systemAddress);
+					if (linked.has_value()) {
+						CULog("Lost direct link to player %d; relaying through host", *linked);
+						unlinkMesh(c, *linked);
+						return;
+					}
+					if (c.addr != nullptr && packet->systemAddress == *c.addr) {
+						CULog("Lost connection to host");
+						connectedPlayers.reset(hostID);
+						switch (status) {
+						case NetStatus::Pending:
+							status = NetStatus::GenericError;
+							return;
+						case NetStatus::Connected:
+							if (config.hostMigration) {
+								hostLost = true;
+								return;
+							}
+							status = NetStatus::Reconnecting;
+							disconnTime = time(nullptr);
+							if (config.sessionResume && sessionToken != 0) {
+								// Try the host's last known address before starting over
+								resuming = true;
+								resumeDeadline = std::chrono::steady_clock::now()
+									+ std::chrono::milliseconds(RESUME_TIMEOUT);
+								peer->Connect(c.addr->ToString(false), c.addr->GetPort(), nullptr, 0);
+							}
+							return;
+						case NetStatus::Reconnecting:
+							// The player taking over is gone too; try the next one
+							hostLost = migrating;
+							return;
+						case NetStatus::Disconnected:
+						case NetStatus::RoomNotFound:
+						case NetStatus::ApiMismatch:
+						case NetStatus::GenericError:
+							return;
+						}
+					}
+				}), remotePeer);
+
+			// Outside the visit, since the client may turn into the host
+			if (hostLost) {
+				migrateHost();
+			}
 			break;
 		case ID_NAT_PUNCHTHROUGH_FAILED:
 		case ID_CONNECTION_ATTEMPT_FAILED:
 		case ID_NAT_TARGET_UNRESPONSIVE: {
+			auto* c = std::get_if<ClientPeer>(&remotePeer);
+			if (migrating) {
+				// Waiting for the new host to reach us instead
+				break;
+			}
+			if (resuming) {
+				CULog("Host is not reachable directly; reconnecting as a returning player");
+				resuming = false;
+				break;
+			}
+			if (c != nullptr && status != NetStatus::Connected && c->addr != nullptr
+				&& packet->data[0] == ID_CONNECTION_ATTEMPT_FAILED && packet->systemAddress == *c->addr) {
+				if (config.lan) {
+					CULog("Could not connect to host; looking for it again");
+					lanSearching = true;
+					break;
+				}
+				// Our side of the race after punchthrough; the host is connecting to us as well
+				CULog("Could not connect to host directly; waiting for the host to connect");
+				break;
+			}
+			if (c != nullptr && status == NetStatus::Connected && c->addr != nullptr
+				&& packet->systemAddress != *c->addr && packet->systemAddress != *natPunchServerAddress) {
+				// Only a direct link to another client failed; the host still relays for them
+				CULog("Could not connect directly to %s; relaying through host", packet->systemAddress.ToString());
+				break;
+			}
 			CULogError("Punchthrough failure %d", packet->data[0]);
 
 			status = NetStatus::GenericError;
@@ -546,27 +2215,155 @@ void NetworkConnection::receive(
 			CULogError("Attempted punchthrough to GUID %s failed", recipientGuid.ToString());
 			break;
 		}
+		case ID_UNCONNECTED_PING:
+			// A LAN query; RakNet has already answered it
+			break;
+		case ID_UNCONNECTED_PONG:
+			std::visit(make_visitor(
+				[&](HostPeers& /*h*/) {},
+				[&](ClientPeer& c) { foundLanHost(c, packet); }), remotePeer);
+			break;
+		case ID_ALREADY_CONNECTED:
+			// Lost a race to connect to someone who was connecting to us at the same time
+			break;
 		case ID_NO_FREE_INCOMING_CONNECTIONS:
+			if (!config.lan) {
+				// Our side of the race after punchthrough; hosts do not take connections, they make them
+				break;
+			}
 			status = NetStatus::RoomNotFound;
 			break;
 
 		// Begin Non-SLikeNet Reported Codes
 		case ID_USER_PACKET_ENUM + Standard: {
-			auto msgConverted = readBs(bts);
-			dispatcher(msgConverted);
+			const uint8_t* msg;
+			size_t length;
+			if (!readView(packet, STANDARD_PREFIX, msg, length)) {
+				break;
+			}
+
+			std::visit(make_visitor(
+				[&](HostPeers& h) {
+					auto sender = findPlayer(h, packet->systemAddress);
+					if (!sender.has_value()) {
+						CULogError("Received message from unknown connection; ignoring");
+						return;
+					}
+					// Forward before the game sees it, so dispatch time never adds relay latency
+					if (isFiltering()) {
+						sendRelevant(h, msg, length, Standard, packet->data[1], *sender);
+					} else {
+						packet->data[SENDER_OFFSET] = *sender;
+						relay(packet, msg, length);
+						countSent(1, sender);
+					}
+					linkStats[*sender].messagesReceived++;
+					dispatcher(msg, length, *sender, MessageType::Standard);
+				},
+				[&](ClientPeer& c) {
+					if (c.addr != nullptr && packet->systemAddress == *c.addr) {
+						if (resuming) {
+							// Sent before the host took us back, so it replays this once it has
+							return;
+						}
+						linkStats[hostID].messagesReceived++;
+						dispatcher(msg, length, packet->data[SENDER_OFFSET], MessageType::Standard);
+						return;
+					}
+					auto linked = meshPlayer(c, packet->systemAddress);
+					if (linked.has_value()) {
+						linkStats[*linked].messagesReceived++;
+						dispatcher(msg, length, *linked, MessageType::Standard);
+					}
+				}), remotePeer);
+
+			break;
+		}
+		case ID_USER_PACKET_ENUM + StandardBatch: {
+			const uint8_t* msg;
+			size_t length;
+			if (!readView(packet, STANDARD_PREFIX, msg, length)) {
+				break;
+			}
+
+			std::visit(make_visitor(
+				[&](HostPeers& h) {
+					auto sender = findPlayer(h, packet->systemAddress);
+					if (!sender.has_value()) {
+						CULogError("Received message from unknown connection; ignoring");
+						return;
+					}
+					// Batches are relayed whole, exactly like single messages, unless they need filtering
+					bool filtering = isFiltering();
+					if (filtering) {
+						sendRelevant(h, msg, length, StandardBatch, packet->data[1], *sender);
+					} else {
+						packet->data[SENDER_OFFSET] = *sender;
+						relay(packet, msg, length);
+					}
+					size_t count = dispatchBatch(msg, length, *sender, MessageType::Standard, dispatcher);
+					if (!filtering) {
+						countSent(count, sender);
+					}
+					linkStats[*sender].messagesReceived += count;
+				},
+				[&](ClientPeer& c) {
+					if (c.addr != nullptr && packet->systemAddress == *c.addr) {
+						if (resuming) {
+							return;
+						}
+						linkStats[hostID].messagesReceived +=
+							dispatchBatch(msg, length, packet->data[SENDER_OFFSET], MessageType::Standard, dispatcher);
+						return;
+					}
+					auto linked = meshPlayer(c, packet->systemAddress);
+					if (linked.has_value()) {
+						linkStats[*linked].messagesReceived +=
+							dispatchBatch(msg, length, *linked, MessageType::Standard, dispatcher);
+					}
+				}), remotePeer);
+
+			break;
+		}
+		case ID_USER_PACKET_ENUM + DirectToHostBatch: {
+			const uint8_t* msg;
+			size_t length;
+			if (!readView(packet, 0, msg, length)) {
+				break;
+			}
 
 			std::visit(make_visitor(
-				[&](HostPeers& /*h*/) { broadcast(msgConverted, packet->systemAddress); },
-				[&](ClientPeer& c) {}), remotePeer);
+				[&](HostPeers& h) {
+					auto sender = findPlayer(h, packet->systemAddress);
+					if (!sender.has_value()) {
+						CULogError("Received message from unknown connection; ignoring");
+						return;
+					}
+					linkStats[*sender].messagesReceived +=
+						dispatchBatch(msg, length, *sender, MessageType::DirectToHost, dispatcher);
+				},
+				[&](ClientPeer& /*c*/) {
+					CULogError("Received direct to host message as client");
+				}), remotePeer);
 
 			break;
 		}
 		case ID_USER_PACKET_ENUM + DirectToHost: {
-			auto msgConverted = readBs(bts);
+			const uint8_t* msg;
+			size_t length;
+			if (!readView(packet, 0, msg, length)) {
+				break;
+			}
 
 			std::visit(make_visitor(
-				[&](HostPeers& /*h*/) {
-					dispatcher(msgConverted);
+				[&](HostPeers& h) {
+					auto sender = findPlayer(h, packet->systemAddress);
+					if (!sender.has_value()) {
+						CULogError("Received message from unknown connection; ignoring");
+						return;
+					}
+					linkStats[*sender].messagesReceived++;
+					dispatcher(msg, length, *sender, MessageType::DirectToHost);
 				},
 				[&](ClientPeer& c) {
 					CULogError("Received direct to host message as client");
@@ -584,24 +2381,39 @@ void NetworkConnection::receive(
 		}
 		case ID_USER_PACKET_ENUM + JoinRoom: {
 			auto msgConverted = readBs(bts);
+			checkHostChange(packet);
 
 			std::visit(make_visitor(
 				[&](HostPeers& h) { cc7HostGetClientData(h, packet, msgConverted); },
-				[&](ClientPeer& c) { cc6ClientAssignedID(c, msgConverted); }
+				[&](ClientPeer& c) {
+					if (c.addr != nullptr && packet->systemAddress == *c.addr) {
+						cc6ClientAssignedID(c, msgConverted);
+					}
+				}
 			), remotePeer);
 			break;
 		}
 		case ID_USER_PACKET_ENUM + JoinRoomFail: {
+			if (resuming) {
+				CULog("Host refused to resume our session; reconnecting as a returning player");
+				resuming = false;
+				break;
+			}
 			CULog("Failed to join room");
 			status = NetStatus::RoomNotFound;
 			break;
 		}
 		case ID_USER_PACKET_ENUM + Reconnect: {
 			auto msgConverted = readBs(bts);
+			checkHostChange(packet);
 
 			std::visit(make_visitor(
 				[&](HostPeers& h) { cr2HostGetClientResp(h, packet, msgConverted); },
-				[&](ClientPeer& c) { cr1ClientReceivedInfo(c, msgConverted); }), remotePeer);
+				[&](ClientPeer& c) {
+					if (c.addr != nullptr && packet->systemAddress == *c.addr) {
+						cr1ClientReceivedInfo(c, msgConverted);
+					}
+				}), remotePeer);
 
 			break;
 		}
@@ -611,6 +2423,10 @@ void NetworkConnection::receive(
 			std::visit(make_visitor(
 				[&](HostPeers& h) { CULogError("Received player joined message as host"); },
 				[&](ClientPeer& c) {
+					if (msgConverted.empty()) {
+						CULogError("Received malformed player joined message; ignoring");
+						return;
+					}
 					connectedPlayers.set(msgConverted[0]);
 					numPlayers++;
 					maxPlayers++;
@@ -624,15 +2440,144 @@ void NetworkConnection::receive(
 			std::visit(make_visitor(
 				[&](HostPeers& h) { CULogError("Received player left message as host"); },
 				[&](ClientPeer& c) {
+					if (msgConverted.empty()) {
+						CULogError("Received malformed player left message; ignoring");
+						return;
+					}
 					connectedPlayers.reset(msgConverted[0]);
 					numPlayers--;
+					auto it = c.mesh.find(msgConverted[0]);
+					if (it != c.mesh.end()) {
+						peer->CloseConnection(it->second, true);
+						unlinkMesh(c, msgConverted[0]);
+					}
 				}), remotePeer);
 			break;
 		}
 		case ID_USER_PACKET_ENUM + StartGame: {
-			startGame();
+			markGameStarted();
+			break;
+		}
+		case ID_USER_PACKET_ENUM + MeshPeers: {
+			auto msgConverted = readBs(bts);
+
+			std::visit(make_visitor(
+				[&](HostPeers& /*h*/) { CULogError("Received mesh peers as host"); },
+				[&](ClientPeer& c) { connectMesh(c, msgConverted); }), remotePeer);
+			break;
+		}
+		case ID_USER_PACKET_ENUM + MeshRelay: {
+			const uint8_t* msg;
+			size_t length;
+			if (!readView(packet, STANDARD_PREFIX, msg, length)) {
+				break;
+			}
+
+			std::visit(make_visitor(
+				[&](HostPeers& h) {
+					auto sender = findPlayer(h, packet->systemAddress);
+					if (!sender.has_value()) {
+						CULogError("Received message from unknown connection; ignoring");
+						return;
+					}
+					// Batch flag, count, then the players the sender already reached directly
+					if (length < 2 || length - 2 < msg[1]) {
+						CULogError("Received malformed mesh relay from player %d", *sender);
+						return;
+					}
+					bool batch = msg[0] != 0;
+					std::bitset<256> reached;
+					for (uint8_t i = 0; i < msg[1]; i++) {
+						reached.set(msg[2 + i]);
+					}
+					size_t skip = 2 + static_cast<size_t>(msg[1]);
+					msg += skip;
+					length -= skip;
+
+					sendRelevant(h, msg, length, batch ? StandardBatch : Standard, packet->data[1], *sender, reached);
+					if (batch) {
+						linkStats[*sender].messagesReceived +=
+							dispatchBatch(msg, length, *sender, MessageType::Standard, dispatcher);
+					} else {
+						linkStats[*sender].messagesReceived++;
+						dispatcher(msg, length, *sender, MessageType::Standard);
+					}
+				},
+				[&](ClientPeer& /*c*/) { CULogError("Received mesh relay as client"); }), remotePeer);
+			break;
+		}
+		case ID_USER_PACKET_ENUM + ClockPing: {
+			const uint8_t* msg;
+			size_t length;
+			if (!readView(packet, 0, msg, length) || length != sizeof(int64_t)) {
+				break;
+			}
+
+			std::visit(make_visitor(
+				[&](HostPeers& /*h*/) {
+					// Answer immediately and unreliably; a late reply is worse than none
+					uint8_t reply[2 * sizeof(int64_t)];
+					std::memcpy(reply, msg, sizeof(int64_t));
+					writeTime(reply + sizeof(int64_t), localTime());
+					sendFramed(peer.get(), reply, sizeof(reply), static_cast<uint8_t>(ID_USER_PACKET_ENUM + ClockPong),
+						packOptions(Delivery::Unreliable, Priority::Immediate, 0), std::nullopt, packet->systemAddress, false);
+				},
+				[&](ClientPeer& /*c*/) { CULogError("Received clock ping as client"); }), remotePeer);
+			break;
+		}
+		case ID_USER_PACKET_ENUM + ClockPong: {
+			const uint8_t* msg;
+			size_t length;
+			if (!readView(packet, 0, msg, length) || length != 2 * sizeof(int64_t)) {
+				break;
+			}
+
+			std::visit(make_visitor(
+				[&](HostPeers& /*h*/) { CULogError("Received clock pong as host"); },
+				[&](ClientPeer& /*c*/) {
+					hostClock->addSample(readTime(msg), readTime(msg + sizeof(int64_t)), localTime());
+				}), remotePeer);
+			break;
+		}
+		case ID_USER_PACKET_ENUM + SessionToken: {
+			auto msgConverted = readBs(bts);
+
+			std::visit(make_visitor(
+				[&](HostPeers& /*h*/) { CULogError("Received session token as host"); },
+				[&](ClientPeer& c) {
+					if (msgConverted.size() == sizeof(uint64_t) && c.addr != nullptr && packet->systemAddress == *c.addr) {
+						sessionToken = static_cast<uint64_t>(readTime(msgConverted.data()));
+					}
+				}), remotePeer);
+			break;
+		}
+		case ID_USER_PACKET_ENUM + Resume: {
+			auto msgConverted = readBs(bts);
+
+			std::visit(make_visitor(
+				[&](HostPeers& h) { resumeSession(h, packet->systemAddress, msgConverted); },
+				[&](ClientPeer& /*c*/) { CULogError("Received session resume as client"); }), remotePeer);
+			break;
+		}
+		case ID_USER_PACKET_ENUM + RoomRequest:
+			CULogError("Received room request, but only a NetworkServer hosts more than one room");
+			break;
+		case ID_SND_RECEIPT_ACKED: {
+			auto* h = std::get_if<HostPeers>(&remotePeer);
+			if (h == nullptr || packet->length < 1 + sizeof(uint32_t)) {
+				break;
+			}
+			auto pID = findPlayer(*h, packet->systemAddress);
+			if (pID.has_value()) {
+				uint32_t receipt;
+				std::memcpy(&receipt, packet->data + 1, sizeof(receipt));
+				acknowledgeReplay(*pID, receipt);
+			}
 			break;
 		}
+		case ID_SND_RECEIPT_LOSS:
+			// Only sent for unreliable messages, which are never replayed
+			break;
 		default:
 			CULog("Received unknown message: %d", packet->data[0]);
 			break;
@@ -641,14 +2586,20 @@ void NetworkConnection::receive(
 }
 
 void NetworkConnection::startGame() {
+	std::lock_guard<std::mutex> lock(stateMutex);
+	markGameStarted();
+}
+
+void NetworkConnection::markGameStarted() {
 	CULog("Starting Game");
 	std::visit(make_visitor([&](HostPeers& h) {
 		h.started = true;
 		broadcast({}, const_cast<SLNet::SystemAddress&>(SLNet::UNASSIGNED_SYSTEM_ADDRESS), StartGame);
-		}, [&](ClientPeer& c) {}), remotePeer);
+		}, [&](ClientPeer& c) { c.started = true; }), remotePeer);
 	maxPlayers = numPlayers;
 }
 
 cugl::NetworkConnection::NetStatus cugl::NetworkConnection::getStatus() {
+	std::lock_guard<std::mutex> lock(stateMutex);
 	return status;
 }
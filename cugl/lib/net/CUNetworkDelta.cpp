@@ -0,0 +1,256 @@
+#include <cugl/net/CUNetworkDelta.h>
+
+#include "CUNetworkFraming.h"
+
+using namespace cugl;
+using namespace cugl::netframing;
+
+/** Snapshot message kinds (first byte of an encoded snapshot) */
+enum SnapshotKind : uint8_t {
+	// The state bytes follow as-is
+	Full,
+	// XOR against a baseline, run-length coded
+	Delta
+};
+
+/** A zero run shorter than this is folded into the surrounding literal run */
+constexpr size_t MIN_ZERO_RUN = 2;
+
+/** Wraparound-safe check that sequence a is newer than sequence b */
+inline bool newer(uint32_t a, uint32_t b) {
+	return static_cast<int32_t>(a - b) > 0;
+}
+
+/** Byte i of a baseline, treating bytes past its end as zero */
+inline uint8_t baseAt(const std::vector<uint8_t>& base, size_t i) {
+	return i < base.size() ? base[i] : 0;
+}
+
+/**
+ * Append the XOR of state and base to out, as (zero run, literal run, literal bytes) triples.
+ *
+ * @returns False if the result would be at least as large as the full state
+ */
+bool writeDelta(const std::vector<uint8_t>& state, const std::vector<uint8_t>& base, std::vector<uint8_t>& out) {
+	size_t start = out.size();
+	size_t limit = start + state.size();
+	uint8_t varint[MAX_LENGTH_BYTES];
+
+	size_t i = 0;
+	while (i < state.size()) {
+		size_t zeros = 0;
+		while (i < state.size() && state[i] == baseAt(base, i)) {
+			zeros++;
+			i++;
+		}
+
+		size_t lit = i;
+		while (lit < state.size()) {
+			size_t run = 0;
+			while (lit + run < state.size() && run < MIN_ZERO_RUN && state[lit + run] == baseAt(base, lit + run)) {
+				run++;
+			}
+			if (run == MIN_ZERO_RUN || lit + run == state.size()) {
+				break;
+			}
+			lit += run + 1;
+		}
+
+		size_t n = writeVarint(varint, static_cast<uint32_t>(zeros));
+		out.insert(out.end(), varint, varint + n);
+		n = writeVarint(varint, static_cast<uint32_t>(lit - i));
+		out.insert(out.end(), varint, varint + n);
+		for (; i < lit; i++) {
+			out.push_back(state[i] ^ baseAt(base, i));
+		}
+
+		if (out.size() >= limit) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * Rebuild a state from a baseline and the triples written by writeDelta.
+ *
+ * @returns False if the delta is malformed
+ */
+bool readDelta(const uint8_t* data, size_t length, const std::vector<uint8_t>& base, std::vector<uint8_t>& out) {
+	size_t pos = 0;
+	size_t i = 0;
+	while (i < out.size()) {
+		uint32_t zeros, lit;
+		size_t n = readVarint(data + pos, length - pos, zeros);
+		if (n == 0) {
+			return false;
+		}
+		pos += n;
+		n = readVarint(data + pos, length - pos, lit);
+		if (n == 0 || zeros > out.size() - i || lit > out.size() - i - zeros || lit > length - pos - n) {
+			return false;
+		}
+		pos += n;
+
+		for (size_t end = i + zeros; i < end; i++) {
+			out[i] = baseAt(base, i);
+		}
+		for (size_t end = i + lit; i < end; i++) {
+			out[i] = baseAt(base, i) ^ data[pos++];
+		}
+	}
+	return pos == length;
+}
+
+#pragma region Encoder
+
+NetworkDeltaEncoder::NetworkDeltaEncoder() : nextSequence(0), history(HISTORY) {}
+
+const std::vector<uint8_t>& NetworkDeltaEncoder::encode(const std::vector<uint8_t>& state) {
+	uint32_t sequence = nextSequence++;
+
+	// The baseline is the oldest of the newest acknowledgements, so every peer has it
+	std::optional<uint32_t> baseline;
+	for (auto& [peer, ack] : acks) {
+		if (!ack.has_value()) {
+			baseline.reset();
+			break;
+		}
+		if (!baseline.has_value() || newer(*baseline, *ack)) {
+			baseline = ack;
+		}
+	}
+
+	const Snapshot* base = nullptr;
+	if (baseline.has_value()) {
+		const Snapshot& slot = history[*baseline % HISTORY];
+		if (slot.valid && slot.sequence == *baseline) {
+			base = &slot;
+		}
+	}
+
+	uint8_t varint[MAX_LENGTH_BYTES];
+	bool delta = false;
+	if (base != nullptr) {
+		output.clear();
+		output.push_back(Delta);
+		size_t n = writeVarint(varint, sequence);
+		output.insert(output.end(), varint, varint + n);
+		n = writeVarint(varint, base->sequence);
+		output.insert(output.end(), varint, varint + n);
+		n = writeVarint(varint, static_cast<uint32_t>(state.size()));
+		output.insert(output.end(), varint, varint + n);
+		delta = writeDelta(state, base->state, output);
+	}
+
+	if (!delta) {
+		output.clear();
+		output.push_back(Full);
+		size_t n = writeVarint(varint, sequence);
+		output.insert(output.end(), varint, varint + n);
+		output.insert(output.end(), state.begin(), state.end());
+	}
+
+	// Written last, since the baseline may live in the same slot
+	Snapshot& slot = history[sequence % HISTORY];
+	slot.sequence = sequence;
+	slot.valid = true;
+	slot.state = state;
+	return output;
+}
+
+void NetworkDeltaEncoder::acknowledge(uint8_t peer, uint32_t sequence) {
+	// Ignore acknowledgements for snapshots we never sent
+	if (!newer(nextSequence, sequence)) {
+		return;
+	}
+	auto& ack = acks[peer];
+	if (!ack.has_value() || newer(sequence, *ack)) {
+		ack = sequence;
+	}
+}
+
+void NetworkDeltaEncoder::addPeer(uint8_t peer) {
+	acks[peer].reset();
+}
+
+void NetworkDeltaEncoder::removePeer(uint8_t peer) {
+	acks.erase(peer);
+}
+
+void NetworkDeltaEncoder::reset() {
+	for (auto& slot : history) {
+		slot.valid = false;
+	}
+	acks.clear();
+}
+
+#pragma endregion
+
+#pragma region Decoder
+
+NetworkDeltaDecoder::NetworkDeltaDecoder() : history(NetworkDeltaEncoder::HISTORY), lastSequence(0), hasState(false) {}
+
+bool NetworkDeltaDecoder::decode(const uint8_t* msg, size_t length) {
+	if (length < 2 || (msg[0] != Full && msg[0] != Delta)) {
+		return false;
+	}
+	size_t pos = 1;
+	uint32_t sequence;
+	size_t n = readVarint(msg + pos, length - pos, sequence);
+	if (n == 0) {
+		return false;
+	}
+	pos += n;
+
+	if (hasState && !newer(sequence, lastSequence)) {
+		// Stale or duplicate snapshot
+		return false;
+	}
+
+	if (msg[0] == Full) {
+		scratch.assign(msg + pos, msg + length);
+	} else {
+		uint32_t baseline, size;
+		n = readVarint(msg + pos, length - pos, baseline);
+		if (n == 0) {
+			return false;
+		}
+		pos += n;
+		n = readVarint(msg + pos, length - pos, size);
+		if (n == 0 || size > MAX_MESSAGE_SIZE) {
+			return false;
+		}
+		pos += n;
+
+		const Snapshot& base = history[baseline % NetworkDeltaEncoder::HISTORY];
+		if (!base.valid || base.sequence != baseline) {
+			return false;
+		}
+		scratch.resize(size);
+		if (!readDelta(msg + pos, length - pos, base.state, scratch)) {
+			return false;
+		}
+	}
+
+	Snapshot& slot = history[sequence % NetworkDeltaEncoder::HISTORY];
+	slot.sequence = sequence;
+	slot.valid = true;
+	std::swap(slot.state, scratch);
+	lastSequence = sequence;
+	hasState = true;
+	return true;
+}
+
+const std::vector<uint8_t>& NetworkDeltaDecoder::getState() const {
+	return history[lastSequence % NetworkDeltaEncoder::HISTORY].state;
+}
+
+void NetworkDeltaDecoder::reset() {
+	for (auto& slot : history) {
+		slot.valid = false;
+	}
+	hasState = false;
+}
+
+#pragma endregion
@@ -0,0 +1,268 @@
+//
+// CUNetworkFraming.h
+//
+// Wire framing shared by the NetworkConnection send and receive paths.
+//
+// Every message NetworkConnection puts on the wire starts with a one byte
+// RakNet message ID followed by the payload length as an unsigned LEB128
+// varint. Messages under 128 bytes therefore pay the same two byte header
+// they always did, while larger messages are no longer capped at 255 bytes.
+//
+// Some packet types carry a small fixed-size routing prefix between the
+// message ID and the length (for example, the send options the host needs
+// to relay a message the same way it was sent, and the original sender). The prefix size is implied
+// by the message ID, so both ends pass it in explicitly.
+//
+// Both NetworkConnection and NetworkServer speak this format, so the helpers
+// for send options, batches and room IDs that they share live here too.
+//
+// This header is an internal header. It is not accessible by general users
+// of the CUGL API.
+//
+// Author: agent
+// Version: 10/17/2026
+//
+#ifndef CU_NETWORK_FRAMING_H
+#define CU_NETWORK_FRAMING_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include <slikenet/peerinterface.h>
+#include <slikenet/PacketPriority.h>
+
+namespace cugl {
+	namespace netframing {
+		/** Maximum number of bytes in a varint encoded 32 bit length */
+		constexpr size_t MAX_LENGTH_BYTES = 5;
+
+		/** Maximum size of a routing prefix */
+		constexpr size_t MAX_PREFIX_SIZE = 2;
+
+		/** Maximum size of a message header (message ID, prefix and length) */
+		constexpr size_t MAX_HEADER_SIZE = 1 + MAX_PREFIX_SIZE + MAX_LENGTH_BYTES;
+
+		/**
+		 * Largest payload we will send or accept (16 MB).
+		 *
+		 * RakNet splits and reassembles anything larger than the MTU on its own,
+		 * so this only exists to reject garbage lengths from a corrupt packet.
+		 */
+		constexpr size_t MAX_MESSAGE_SIZE = 1 << 24;
+
+		/**
+		 * Write a varint to the given buffer.
+		 *
+		 * @param out Buffer with room for at least MAX_LENGTH_BYTES bytes
+		 * @param value The value to encode
+		 * @returns The number of bytes written
+		 */
+		inline size_t writeVarint(uint8_t* out, uint32_t value) {
+			size_t i = 0;
+			while (value >= 0x80) {
+				out[i++] = static_cast<uint8_t>(value | 0x80);
+				value >>= 7;
+			}
+			out[i++] = static_cast<uint8_t>(value);
+			return i;
+		}
+
+		/**
+		 * Read a varint from the given buffer.
+		 *
+		 * @param data Start of the varint
+		 * @param length Number of readable bytes at data
+		 * @param value Set to the decoded value on success
+		 * @returns The number of bytes read, or 0 if the varint is truncated or malformed
+		 */
+		inline size_t readVarint(const uint8_t* data, size_t length, uint32_t& value) {
+			value = 0;
+			for (size_t i = 0; i < length && i < MAX_LENGTH_BYTES; i++) {
+				value |= static_cast<uint32_t>(data[i] & 0x7F) << (7 * i);
+				if ((data[i] & 0x80) == 0) {
+					return i + 1;
+				}
+			}
+			return 0;
+		}
+
+		/**
+		 * Write a message header for a payload of the given length.
+		 *
+		 * @param header Buffer with room for at least MAX_HEADER_SIZE bytes
+		 * @param messageID The RakNet message ID (ID_USER_PACKET_ENUM + packet type)
+		 * @param length Length of the payload that will follow the header
+		 * @param prefix Routing prefix to write after the message ID, if any
+		 * @param prefixSize Size of the routing prefix
+		 * @returns The number of header bytes written
+		 */
+		inline size_t writeHeader(uint8_t* header, uint8_t messageID, size_t length,
+			const uint8_t* prefix = nullptr, size_t prefixSize = 0) {
+			header[0] = messageID;
+			for (size_t i = 0; i < prefixSize; i++) {
+				header[1 + i] = prefix[i];
+			}
+			return 1 + prefixSize + writeVarint(header + 1 + prefixSize, static_cast<uint32_t>(length));
+		}
+
+		/**
+		 * Parse a message header and validate it against the packet length.
+		 *
+		 * On success, the payload is the msgSize bytes starting at data + headerSize.
+		 * The routing prefix (if any) starts at data + 1.
+		 *
+		 * @param data Start of the packet (including the message ID)
+		 * @param length Length of the packet in bytes
+		 * @param headerSize Set to the number of header bytes
+		 * @param msgSize Set to the number of payload bytes
+		 * @param prefixSize Size of the routing prefix this message ID carries
+		 * @returns Whether the header was well formed
+		 */
+		inline bool readHeader(const uint8_t* data, size_t length, size_t& headerSize, size_t& msgSize,
+			size_t prefixSize = 0) {
+			if (length < 2 + prefixSize) {
+				return false;
+			}
+			uint32_t size;
+			size_t start = 1 + prefixSize;
+			size_t read = readVarint(data + start, length - start, size);
+			if (read == 0 || size > MAX_MESSAGE_SIZE || size > length - start - read) {
+				return false;
+			}
+			headerSize = start + read;
+			msgSize = size;
+			return true;
+		}
+
+		/**
+		 * Call fn(msg, length) for each message in a batch.
+		 *
+		 * A batch is each message as a varint length followed by its bytes.
+		 *
+		 * @param batch Start of the batch payload
+		 * @param length Length of the batch payload
+		 * @param fn Called with each message; the pointer points into the batch
+		 * @returns False if the batch was malformed, in which case the rest of it was skipped
+		 */
+		template <typename F>
+		bool readBatch(const uint8_t* batch, size_t length, F&& fn) {
+			size_t pos = 0;
+			while (pos < length) {
+				uint32_t size;
+				size_t read = readVarint(batch + pos, length - pos, size);
+				if (read == 0 || size > length - pos - read) {
+					return false;
+				}
+				pos += read;
+				fn(batch + pos, static_cast<size_t>(size));
+				pos += size;
+			}
+			return true;
+		}
+
+		/** RakNet reliability for each NetworkConnection::Delivery, in declaration order */
+		constexpr PacketReliability RELIABILITIES[] = {
+			UNRELIABLE, UNRELIABLE_SEQUENCED, RELIABLE, RELIABLE_ORDERED
+		};
+
+		/** RakNet priority for each NetworkConnection::Priority, in declaration order */
+		constexpr PacketPriority PRIORITIES[] = {
+			IMMEDIATE_PRIORITY, HIGH_PRIORITY, MEDIUM_PRIORITY, LOW_PRIORITY
+		};
+
+		/** Size of the routing prefix (packed send options, then sender player ID) on Standard packets */
+		constexpr size_t STANDARD_PREFIX = 2;
+
+		/** Offset of the sender player ID in a Standard packet */
+		constexpr size_t SENDER_OFFSET = 2;
+
+		/** RakNet reliability for a set of packed send options */
+		inline PacketReliability toReliability(uint8_t options) { return RELIABILITIES[options & 0x3]; }
+
+		/** RakNet priority for a set of packed send options */
+		inline PacketPriority toPriority(uint8_t options) { return PRIORITIES[(options >> 2) & 0x3]; }
+
+		/** RakNet ordering channel for a set of packed send options */
+		inline char toChannel(uint8_t options) { return static_cast<char>(options >> 4); }
+
+		/** Write a timestamp as 8 little endian bytes */
+		inline void writeTime(uint8_t* out, int64_t time) {
+			auto t = static_cast<uint64_t>(time);
+			for (size_t i = 0; i < sizeof(int64_t); i++) {
+				out[i] = static_cast<uint8_t>(t >> (8 * i));
+			}
+		}
+
+		/** Read a timestamp written by writeTime */
+		inline int64_t readTime(const uint8_t* in) {
+			uint64_t t = 0;
+			for (size_t i = 0; i < sizeof(int64_t); i++) {
+				t |= static_cast<uint64_t>(in[i]) << (8 * i);
+			}
+			return static_cast<int64_t>(t);
+		}
+
+		/** Length of room IDs */
+		constexpr uint8_t ROOM_LENGTH = 5;
+
+		/** Start of every LAN query answer, so answers from other RakNet programs are ignored */
+		constexpr char LAN_TAG[] = { 'C', 'U', 'G', 'L' };
+
+		/** What a NetworkServer answers LAN queries with after LAN_TAG, since it hosts every room at once */
+		constexpr char SERVER_ROOM[] = "*";
+
+		/**
+		 * Separates the room ID in a LAN query answer from the port the host listens on.
+		 *
+		 * Only present when the host answers on lanPort but listens elsewhere, as after a migration.
+		 */
+		constexpr char LAN_PORT_MARK = '@';
+
+		/**
+		 * Frame a message and hand it to RakNet.
+		 *
+		 * The header and payload are passed to RakNet as a list, so they are gathered directly
+		 * into the buffer RakNet keeps for resends instead of being staged in a BitStream first.
+		 * Messages larger than the MTU are split and reassembled by the RakNet reliability layer.
+		 *
+		 * @param peer The peer to send from; a RakPeer, or anything else with the same SendList()
+		 * @param messageID RakNet message ID (ID_USER_PACKET_ENUM + packet type)
+		 * @param msg Start of the payload
+		 * @param length Length of the payload
+		 * @param priority RakNet send priority
+		 * @param reliability RakNet reliability mode
+		 * @param channel RakNet ordering channel
+		 * @param dest Destination address (or address to skip if broadcasting)
+		 * @param broadcast Whether to send to all connections except dest
+		 * @param prefix Routing prefix to write after the message ID, if any
+		 * @param prefixSize Size of the routing prefix
+		 * @param receipt If not null, set to the receipt number RakNet assigned to the send
+		 * @returns False if the payload is larger than MAX_MESSAGE_SIZE and was not sent
+		 */
+		template <typename Peer>
+		bool sendFramed(Peer* peer, uint8_t messageID, const uint8_t* msg, size_t length,
+			PacketPriority priority, PacketReliability reliability, char channel,
+			const SLNet::AddressOrGUID& dest, bool broadcast,
+			const uint8_t* prefix = nullptr, size_t prefixSize = 0, uint32_t* receipt = nullptr) {
+			if (length > MAX_MESSAGE_SIZE) {
+				return false;
+			}
+
+			uint8_t header[MAX_HEADER_SIZE];
+			size_t headerSize = writeHeader(header, messageID, length, prefix, prefixSize);
+
+			const char* data[2] = {
+				reinterpret_cast<const char*>(header),
+				reinterpret_cast<const char*>(msg)
+			};
+			const int lengths[2] = { static_cast<int>(headerSize), static_cast<int>(length) };
+			uint32_t number = peer->SendList(data, lengths, 2, priority, reliability, channel, dest, broadcast);
+			if (receipt != nullptr) {
+				*receipt = number;
+			}
+			return true;
+		}
+	}
+}
+
+#endif // CU_NETWORK_FRAMING_H
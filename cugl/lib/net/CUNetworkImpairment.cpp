@@ -0,0 +1,649 @@
+#include "CUNetworkImpairment.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <limits>
+
+#include <slikenet/MessageIdentifiers.h>
+
+using namespace cugl;
+
+/** Returns whether conditions describe a perfect link, so add nothing */
+static bool isClear(const NetworkLoopback::LinkConfig& config) {
+	return config.latency <= 0 && config.jitter <= 0 && config.loss <= 0 && config.duplicate <= 0
+		&& config.reorder <= 0 && config.bandwidth <= 0;
+}
+
+/** Returns the conditions with every chance brought into range */
+static NetworkLoopback::LinkConfig clamped(NetworkLoopback::LinkConfig config) {
+	config.loss = std::clamp(config.loss, 0.0, NetworkLoopback::MAX_LOSS);
+	config.duplicate = std::clamp(config.duplicate, 0.0, 1.0);
+	config.reorder = std::clamp(config.reorder, 0.0, 1.0);
+	return config;
+}
+
+#pragma region Conditions
+
+void NetworkImpairment::set(Direction direction, const LinkConfig& config) {
+	std::lock_guard<std::mutex> lock(mutex);
+	defaults[direction] = clamped(config);
+	refresh();
+}
+
+void NetworkImpairment::set(const SLNet::SystemAddress& address, Direction direction, const LinkConfig& config) {
+	std::lock_guard<std::mutex> lock(mutex);
+	links[address][direction] = clamped(config);
+	refresh();
+}
+
+void NetworkImpairment::clear() {
+	std::lock_guard<std::mutex> lock(mutex);
+	defaults = {};
+	links.clear();
+	refresh();
+}
+
+NetworkImpairment::LinkConfig NetworkImpairment::get(const SLNet::SystemAddress& address, Direction direction) {
+	std::lock_guard<std::mutex> lock(mutex);
+	auto it = links.find(address);
+	if (it != links.end() && it->second[direction].has_value()) {
+		return *it->second[direction];
+	}
+	return defaults[direction];
+}
+
+void NetworkImpairment::refresh() {
+	bool any = !isClear(defaults[Outgoing]) || !isClear(defaults[Incoming]);
+	for (const auto& link : links) {
+		for (const auto& config : link.second) {
+			any = any || (config.has_value() && !isClear(*config));
+		}
+	}
+	anyActive.store(any, std::memory_order_relaxed);
+}
+
+#pragma endregion
+
+#pragma region Transport
+
+void ImpairedTransport::LossMeter::roll(int64_t now) {
+	if (now - start < 1000000) {
+		return;
+	}
+	bool gap = now - start >= 2000000;
+	lastPackets = gap ? 0 : currentPackets;
+	lastLost = gap ? 0 : currentLost;
+	currentPackets = currentLost = 0;
+	start = now;
+}
+
+void ImpairedTransport::LossMeter::add(int64_t now, bool wasLost) {
+	roll(now);
+	packets++;
+	currentPackets++;
+	if (wasLost) {
+		lost++;
+		currentLost++;
+	}
+}
+
+ImpairedTransport::ImpairedTransport(std::unique_ptr<NetworkTransport> inner,
+	std::shared_ptr<NetworkImpairment> conditions, Classifier classify, uint32_t seed)
+	: inner(std::move(inner)), conditions(std::move(conditions)), classify(std::move(classify)), rng(seed),
+	receipt(0), nextOrder(0) {}
+
+ImpairedTransport::~ImpairedTransport() {
+	std::lock_guard<std::mutex> lock(mutex);
+	for (auto& in : inbound) {
+		dispose(in.packet);
+	}
+	for (auto* packet : ready) {
+		dispose(packet);
+	}
+	for (auto* packet : owned) {
+		delete[] packet->data;
+		delete packet;
+	}
+}
+
+int64_t ImpairedTransport::now() {
+	return std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+bool ImpairedTransport::chance(double p) {
+	return p > 0 && std::uniform_real_distribution<double>(0, 1)(rng) < p;
+}
+
+int64_t ImpairedTransport::transit(const LinkConfig& config) {
+	double ms = config.latency;
+	if (config.jitter > 0) {
+		ms += std::uniform_real_distribution<double>(0, config.jitter)(rng);
+	}
+	return static_cast<int64_t>(ms * 1000);
+}
+
+int64_t ImpairedTransport::holdBack(const LinkConfig& config) {
+	return std::max(transit(config), static_cast<int64_t>(NetworkLoopback::REORDER_DELAY * 1000));
+}
+
+int ImpairedTransport::addedRoundTrip(const SLNet::SystemAddress& address) const {
+	auto out = conditions->get(address, Direction::Outgoing);
+	auto in = conditions->get(address, Direction::Incoming);
+	return static_cast<int>(out.latency + out.jitter / 2 + in.latency + in.jitter / 2);
+}
+
+SLNet::SystemAddress ImpairedTransport::resolve(const SLNet::AddressOrGUID& target) const {
+	if (target.rakNetGuid == SLNet::UNASSIGNED_RAKNET_GUID) {
+		return target.systemAddress;
+	}
+	for (const auto& link : connected) {
+		if (link.second == target.rakNetGuid) {
+			return link.first;
+		}
+	}
+	return SLNet::UNASSIGNED_SYSTEM_ADDRESS;
+}
+
+SLNet::StartupResult ImpairedTransport::Startup(unsigned int maxConnections,
+	SLNet::SocketDescriptor* socketDescriptors, unsigned socketDescriptorCount) {
+	return inner->Startup(maxConnections, socketDescriptors, socketDescriptorCount);
+}
+
+void ImpairedTransport::Shutdown(unsigned int blockDuration) {
+	std::lock_guard<std::mutex> lock(mutex);
+	// Whatever is held back still goes out, as RakNet sends what it has before closing
+	releaseOutbound(std::numeric_limits<int64_t>::max());
+	inner->Shutdown(blockDuration);
+	for (auto& in : inbound) {
+		dispose(in.packet);
+	}
+	inbound.clear();
+	for (auto* packet : ready) {
+		dispose(packet);
+	}
+	ready.clear();
+	paths.clear();
+	connected.clear();
+	receipts.clear();
+}
+
+void ImpairedTransport::SetMaximumIncomingConnections(unsigned short numberAllowed) {
+	inner->SetMaximumIncomingConnections(numberAllowed);
+}
+
+void ImpairedTransport::SetTimeoutTime(SLNet::TimeMS timeMS, const SLNet::SystemAddress& target) {
+	inner->SetTimeoutTime(timeMS, target);
+}
+
+void ImpairedTransport::SetOfflinePingResponse(const char* data, const unsigned int length) {
+	inner->SetOfflinePingResponse(data, length);
+}
+
+void ImpairedTransport::AttachPlugin(SLNet::PluginInterface2* plugin) {
+	inner->AttachPlugin(plugin);
+}
+
+#pragma endregion
+
+#pragma region Connections
+
+SLNet::ConnectionAttemptResult ImpairedTransport::Connect(const char* host, unsigned short remotePort,
+	const char* passwordData, int passwordDataLength) {
+	return inner->Connect(host, remotePort, passwordData, passwordDataLength);
+}
+
+void ImpairedTransport::CloseConnection(const SLNet::AddressOrGUID target, bool sendDisconnectionNotification) {
+	std::lock_guard<std::mutex> lock(mutex);
+	auto address = resolve(target);
+	if (address != SLNet::UNASSIGNED_SYSTEM_ADDRESS) {
+		releaseOutbound(std::numeric_limits<int64_t>::max(), address);
+		forget(address);
+	}
+	inner->CloseConnection(target, sendDisconnectionNotification);
+}
+
+SLNet::ConnectionState ImpairedTransport::GetConnectionState(const SLNet::AddressOrGUID systemIdentifier) {
+	return inner->GetConnectionState(systemIdentifier);
+}
+
+unsigned short ImpairedTransport::NumberOfConnections() const {
+	return inner->NumberOfConnections();
+}
+
+const SLNet::RakNetGUID& ImpairedTransport::GetGuidFromSystemAddress(const SLNet::SystemAddress input) const {
+	return inner->GetGuidFromSystemAddress(input);
+}
+
+SLNet::SystemAddress ImpairedTransport::GetMyBoundAddress() {
+	return inner->GetMyBoundAddress();
+}
+
+void ImpairedTransport::forget(const SLNet::SystemAddress& address) {
+	connected.erase(address);
+	paths.erase(address);
+	for (auto it = receipts.begin(); it != receipts.end();) {
+		it = it->second.second == address ? receipts.erase(it) : std::next(it);
+	}
+	auto gone = std::remove_if(outbound.begin(), outbound.end(),
+		[&](const Outbound& o) { return o.to == address; });
+	if (gone != outbound.end()) {
+		outbound.erase(gone, outbound.end());
+		std::make_heap(outbound.begin(), outbound.end(), Later());
+	}
+}
+
+#pragma endregion
+
+#pragma region Sending
+
+uint32_t ImpairedTransport::Send(const char* data, const int length, PacketPriority priority,
+	PacketReliability reliability, char orderingChannel,
+	const SLNet::AddressOrGUID systemIdentifier, bool broadcast) {
+	return SendList(&data, &length, 1, priority, reliability, orderingChannel, systemIdentifier, broadcast);
+}
+
+uint32_t ImpairedTransport::SendList(const char** data, const int* lengths, const int numParameters,
+	PacketPriority priority, PacketReliability reliability, char orderingChannel,
+	const SLNet::AddressOrGUID systemIdentifier, bool broadcast) {
+	std::lock_guard<std::mutex> lock(mutex);
+	releaseOutbound(now());
+	// Receipts always go through here, so their numbers never clash with the inner transport's
+	if (!wantsReceipt(reliability) && !conditions->active() && outbound.empty()) {
+		return inner->SendList(data, lengths, numParameters, priority, reliability, orderingChannel,
+			systemIdentifier, broadcast);
+	}
+	if (numParameters <= 0) {
+		return 0;
+	}
+
+	if (++receipt == 0) {
+		receipt = 1;
+	}
+	uint32_t number = wantsReceipt(reliability) ? receipt : 0;
+	auto channel = static_cast<uint8_t>(static_cast<uint8_t>(orderingChannel) % NUM_STREAMS);
+	if (broadcast) {
+		// Each link has its own conditions, so a broadcast goes out one message per link
+		auto skip = resolve(systemIdentifier);
+		for (const auto& link : connected) {
+			if (link.first != skip) {
+				schedule(link.first, data, lengths, numParameters, priority, reliability, channel, number);
+			}
+		}
+	} else {
+		auto to = resolve(systemIdentifier);
+		if (to != SLNet::UNASSIGNED_SYSTEM_ADDRESS) {
+			schedule(to, data, lengths, numParameters, priority, reliability, channel, number);
+		}
+	}
+	releaseOutbound(now());
+	return receipt;
+}
+
+void ImpairedTransport::schedule(const SLNet::SystemAddress& to, const char** data, const int* lengths, int count,
+	PacketPriority priority, PacketReliability reliability, uint8_t channel, uint32_t number) {
+	LinkConfig config = conditions->get(to, Direction::Outgoing);
+	Path& path = paths[to][Direction::Outgoing];
+	int64_t time = now();
+
+	Outbound o;
+	o.order = nextOrder++;
+	o.to = to;
+	for (int i = 0; i < count; i++) {
+		o.data.insert(o.data.end(), data[i], data[i] + lengths[i]);
+	}
+	o.priority = priority;
+	o.reliability = reliability;
+	o.channel = channel;
+	o.receipt = number;
+
+	int64_t queued = 0;
+	if (config.bandwidth > 0) {
+		// Wait for everything sent earlier to leave first
+		size_t wire = o.data.size() + NetworkLoopback::PACKET_OVERHEAD;
+		path.free = std::max(path.free, time) + static_cast<int64_t>(wire * 1000000.0 / config.bandwidth);
+		queued = path.free - time;
+	}
+	int64_t delay = queued + transit(config);
+	bool reliable = isReliable(reliability);
+	while (chance(config.loss)) {
+		path.meter.add(time, true);
+		if (!reliable) {
+			if (number != 0) {
+				// The sender still hears that it never arrived
+				uint8_t loss[1 + sizeof(uint32_t)];
+				loss[0] = ID_SND_RECEIPT_LOSS;
+				std::memcpy(loss + 1, &number, sizeof(number));
+				inbound.push_back({ time + delay, nextOrder++, makePacket(to, loss, sizeof(loss)), false, 0 });
+				std::push_heap(inbound.begin(), inbound.end(), Later());
+			}
+			return;
+		}
+		// Resent once the first copy is overdue
+		delay += 2 * transit(config) + MIN_RESEND;
+	}
+	path.meter.add(time, false);
+
+	if (chance(config.reorder)) {
+		if (isSequenced(reliability)) {
+			// A newer message gets there first, so the receiver would throw this one away
+			return;
+		}
+		delay += holdBack(config);
+	}
+	if ((reliability == UNRELIABLE || reliability == UNRELIABLE_WITH_ACK_RECEIPT) && chance(config.duplicate)) {
+		// The copy makes its own way there, and asks for no receipt of its own
+		Outbound copy = o;
+		copy.release = time + queued + transit(config);
+		copy.order = nextOrder++;
+		copy.reliability = UNRELIABLE;
+		copy.receipt = 0;
+		outbound.push_back(std::move(copy));
+		std::push_heap(outbound.begin(), outbound.end(), Later());
+	}
+
+	o.release = time + delay;
+	if (isOrdered(reliability)) {
+		// Held back until every earlier message on the channel is out
+		o.release = std::max(o.release, path.ordered[channel]);
+		path.ordered[channel] = o.release;
+	}
+	path.latest = std::max(path.latest, o.release);
+	outbound.push_back(std::move(o));
+	std::push_heap(outbound.begin(), outbound.end(), Later());
+}
+
+void ImpairedTransport::releaseOutbound(int64_t time, const SLNet::SystemAddress& only) {
+	if (only == SLNet::UNASSIGNED_SYSTEM_ADDRESS) {
+		while (!outbound.empty() && outbound.front().release <= time) {
+			std::pop_heap(outbound.begin(), outbound.end(), Later());
+			Outbound o = std::move(outbound.back());
+			outbound.pop_back();
+			transmit(o);
+		}
+		return;
+	}
+
+	// Everything for one address goes now, in the order it was due
+	std::sort(outbound.begin(), outbound.end(), [](const Outbound& a, const Outbound& b) { return Later()(b, a); });
+	std::vector<Outbound> rest;
+	for (auto& o : outbound) {
+		if (o.to == only) {
+			transmit(o);
+		} else {
+			rest.push_back(std::move(o));
+		}
+	}
+	outbound = std::move(rest);
+	std::make_heap(outbound.begin(), outbound.end(), Later());
+}
+
+void ImpairedTransport::transmit(Outbound& o) {
+	if (isSequenced(o.reliability)) {
+		auto it = paths.find(o.to);
+		if (it != paths.end()) {
+			uint64_t& newest = it->second[Direction::Outgoing].sequenced[o.channel];
+			if (o.order < newest) {
+				// A newer message already went out, so the receiver would throw this one away
+				return;
+			}
+			newest = o.order + 1;
+		}
+	}
+	uint32_t sent = inner->Send(reinterpret_cast<const char*>(o.data.data()), static_cast<int>(o.data.size()),
+		o.priority, o.reliability, static_cast<char>(o.channel), o.to, false);
+	if (o.receipt != 0 && sent != 0) {
+		receipts[sent] = { o.receipt, o.to };
+	}
+}
+
+void ImpairedTransport::Ping(const SLNet::SystemAddress& target) {
+	inner->Ping(target);
+}
+
+bool ImpairedTransport::Ping(const char* host, unsigned short remotePort, bool onlyReplyOnAcceptingConnections) {
+	return inner->Ping(host, remotePort, onlyReplyOnAcceptingConnections);
+}
+
+#pragma endregion
+
+#pragma region Receiving
+
+SLNet::Packet* ImpairedTransport::Receive() {
+	std::lock_guard<std::mutex> lock(mutex);
+	releaseOutbound(now());
+	if (!conditions->active() && inbound.empty() && ready.empty()) {
+		// Nothing to simulate, so packets go straight through
+		for (SLNet::Packet* packet = inner->Receive(); packet != nullptr; packet = inner->Receive()) {
+			if (observe(packet)) {
+				settle(packet);
+				return packet;
+			}
+			dispose(packet);
+		}
+		return nullptr;
+	}
+
+	for (SLNet::Packet* packet = inner->Receive(); packet != nullptr; packet = inner->Receive()) {
+		if (observe(packet)) {
+			admit(packet);
+		} else {
+			dispose(packet);
+		}
+	}
+	releaseInbound(now());
+	if (ready.empty()) {
+		return nullptr;
+	}
+	SLNet::Packet* packet = ready.front();
+	ready.pop_front();
+	return packet;
+}
+
+void ImpairedTransport::DeallocatePacket(SLNet::Packet* packet) {
+	if (packet == nullptr) {
+		return;
+	}
+	std::lock_guard<std::mutex> lock(mutex);
+	dispose(packet);
+}
+
+bool ImpairedTransport::observe(SLNet::Packet* packet) {
+	if (packet->length == 0) {
+		return true;
+	}
+	switch (packet->data[0]) {
+	case ID_NEW_INCOMING_CONNECTION:
+	case ID_CONNECTION_REQUEST_ACCEPTED:
+		connected[packet->systemAddress] = packet->guid;
+		return true;
+	case ID_SND_RECEIPT_ACKED:
+	case ID_SND_RECEIPT_LOSS: {
+		if (packet->length < 1 + sizeof(uint32_t)) {
+			return true;
+		}
+		uint32_t number;
+		std::memcpy(&number, packet->data + 1, sizeof(number));
+		auto it = receipts.find(number);
+		if (it == receipts.end()) {
+			// Nobody here asked for it, as for the copy of a duplicated message
+			return false;
+		}
+		std::memcpy(packet->data + 1, &it->second.first, sizeof(it->second.first));
+		receipts.erase(it);
+		return true;
+	}
+	default:
+		return true;
+	}
+}
+
+void ImpairedTransport::admit(SLNet::Packet* packet) {
+	SLNet::SystemAddress from = packet->systemAddress;
+	LinkConfig config = conditions->get(from, Direction::Incoming);
+	Path& path = paths[from][Direction::Incoming];
+	int64_t time = now();
+
+	Inbound in = { 0, nextOrder++, packet, false, 0 };
+	int64_t queued = 0;
+	if (config.bandwidth > 0) {
+		size_t wire = packet->length + NetworkLoopback::PACKET_OVERHEAD;
+		path.free = std::max(path.free, time) + static_cast<int64_t>(wire * 1000000.0 / config.bandwidth);
+		queued = path.free - time;
+	}
+	int64_t delay = queued + transit(config);
+
+	PacketReliability reliability = RELIABLE_ORDERED;
+	uint8_t channel = 0;
+	if (!classify(packet, reliability, channel)) {
+		// Connection events overtake nothing, and nothing overtakes them
+		in.release = std::max(time + delay, path.latest);
+		path.barrier = in.release;
+	} else {
+		channel %= NUM_STREAMS;
+		bool reliable = isReliable(reliability);
+		while (chance(config.loss)) {
+			path.meter.add(time, true);
+			if (!reliable) {
+				dispose(packet);
+				return;
+			}
+			delay += 2 * transit(config) + MIN_RESEND;
+		}
+		path.meter.add(time, false);
+
+		if (chance(config.reorder)) {
+			if (isSequenced(reliability)) {
+				dispose(packet);
+				return;
+			}
+			delay += holdBack(config);
+		}
+		if (reliability == UNRELIABLE && chance(config.duplicate)) {
+			Inbound copy = { std::max(time + queued + transit(config), path.barrier), nextOrder++,
+				makePacket(from, packet->data, packet->length), false, channel };
+			copy.packet->guid = packet->guid;
+			path.latest = std::max(path.latest, copy.release);
+			inbound.push_back(copy);
+			std::push_heap(inbound.begin(), inbound.end(), Later());
+		}
+
+		in.release = std::max(time + delay, path.barrier);
+		if (isOrdered(reliability)) {
+			in.release = std::max(in.release, path.ordered[channel]);
+			path.ordered[channel] = in.release;
+		}
+		in.sequenced = isSequenced(reliability);
+		in.channel = channel;
+	}
+	path.latest = std::max(path.latest, in.release);
+	inbound.push_back(in);
+	std::push_heap(inbound.begin(), inbound.end(), Later());
+}
+
+void ImpairedTransport::releaseInbound(int64_t time) {
+	while (!inbound.empty() && inbound.front().release <= time) {
+		std::pop_heap(inbound.begin(), inbound.end(), Later());
+		Inbound in = inbound.back();
+		inbound.pop_back();
+		if (in.sequenced) {
+			auto it = paths.find(in.packet->systemAddress);
+			if (it != paths.end()) {
+				uint64_t& newest = it->second[Direction::Incoming].sequenced[in.channel];
+				if (in.order < newest) {
+					dispose(in.packet);
+					continue;
+				}
+				newest = in.order + 1;
+			}
+		}
+		settle(in.packet);
+		ready.push_back(in.packet);
+	}
+}
+
+void ImpairedTransport::settle(SLNet::Packet* packet) {
+	if (packet->length > 0 && (packet->data[0] == ID_DISCONNECTION_NOTIFICATION
+		|| packet->data[0] == ID_CONNECTION_LOST)) {
+		// Everything from it before this has been returned already
+		forget(packet->systemAddress);
+	}
+}
+
+SLNet::Packet* ImpairedTransport::makePacket(const SLNet::SystemAddress& from, const uint8_t* data, size_t length) {
+	auto* packet = new SLNet::Packet();
+	packet->systemAddress = from;
+	auto it = connected.find(from);
+	packet->guid = it != connected.end() ? it->second : SLNet::UNASSIGNED_RAKNET_GUID;
+	packet->data = new unsigned char[length];
+	std::memcpy(packet->data, data, length);
+	packet->length = static_cast<unsigned int>(length);
+	packet->bitSize = packet->length * 8;
+	packet->deleteData = false;
+	packet->wasGeneratedLocally = true;
+	owned.insert(packet);
+	return packet;
+}
+
+void ImpairedTransport::dispose(SLNet::Packet* packet) {
+	if (owned.erase(packet) > 0) {
+		delete[] packet->data;
+		delete packet;
+	} else {
+		inner->DeallocatePacket(packet);
+	}
+}
+
+int ImpairedTransport::GetAveragePing(const SLNet::AddressOrGUID systemIdentifier) {
+	int ping = inner->GetAveragePing(systemIdentifier);
+	if (ping < 0) {
+		return ping;
+	}
+	std::lock_guard<std::mutex> lock(mutex);
+	return ping + addedRoundTrip(resolve(systemIdentifier));
+}
+
+int ImpairedTransport::GetLastPing(const SLNet::AddressOrGUID systemIdentifier) const {
+	int ping = inner->GetLastPing(systemIdentifier);
+	if (ping < 0) {
+		return ping;
+	}
+	std::lock_guard<std::mutex> lock(mutex);
+	return ping + addedRoundTrip(resolve(systemIdentifier));
+}
+
+SLNet::RakNetStatistics* ImpairedTransport::GetStatistics(const SLNet::SystemAddress systemAddress,
+	SLNet::RakNetStatistics* rns) {
+	if (inner->GetStatistics(systemAddress, rns) == nullptr) {
+		return nullptr;
+	}
+	std::lock_guard<std::mutex> lock(mutex);
+	// Messages held back here count as waiting to be sent, as they would in RakNet's own queue
+	for (const auto& o : outbound) {
+		if (o.to == systemAddress) {
+			rns->messageInSendBuffer[MEDIUM_PRIORITY]++;
+			rns->bytesInSendBuffer[MEDIUM_PRIORITY] += static_cast<double>(o.data.size());
+		}
+	}
+	LinkConfig config = conditions->get(systemAddress, Direction::Outgoing);
+	if (config.bandwidth > 0) {
+		rns->isLimitedByOutgoingBandwidthLimit = true;
+		rns->BPSLimitByOutgoingBandwidthLimit = static_cast<uint64_t>(config.bandwidth);
+	}
+	auto it = paths.find(systemAddress);
+	if (it != paths.end()) {
+		LossMeter& meter = it->second[Direction::Outgoing].meter;
+		meter.roll(now());
+		if (meter.lastPackets > 0) {
+			rns->packetlossLastSecond = std::max(rns->packetlossLastSecond,
+				static_cast<float>(meter.lastLost) / meter.lastPackets);
+		}
+		if (meter.packets > 0) {
+			rns->packetlossTotal = std::max(rns->packetlossTotal, static_cast<float>(meter.lost) / meter.packets);
+		}
+	}
+	return rns;
+}
+
+#pragma endregion
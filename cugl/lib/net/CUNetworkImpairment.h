@@ -0,0 +1,315 @@
+//
+// CUNetworkImpairment.h
+//
+// Simulated network conditions on top of any transport.
+//
+// ImpairedTransport wraps the transport NetworkConnection would otherwise
+// use, RakNet over UDP or a NetworkLoopback, and delays, drops, duplicates
+// and reorders messages on their way through it. Each direction of each
+// link has its own conditions, which can change at any time. It works on
+// whole messages above RakNet's reliability layer, so what the game sees is
+// what RakNet would hand it over such a link: a lost reliable message still
+// arrives, a resend later, and ordered messages still arrive in order.
+//
+// This header is an internal header. It is not accessible by general users
+// of the CUGL API.
+//
+// Author: agent
+// Version: 10/17/2026
+//
+#ifndef CU_NETWORK_IMPAIRMENT_H
+#define CU_NETWORK_IMPAIRMENT_H
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <cugl/net/CUNetworkLoopback.h>
+
+#include "CUNetworkTransport.h"
+
+namespace cugl {
+	/** Hashes a SystemAddress by its IP address and port */
+	struct AddressHash {
+		size_t operator()(const SLNet::SystemAddress& address) const {
+			return SLNet::SystemAddress::ToInteger(address);
+		}
+	};
+
+	/**
+	 * Conditions on each direction of each link, for ImpairedTransport.
+	 *
+	 * Kept apart from the transport, so they outlast it when a connection starts over
+	 * with a new one. All methods are safe to call from any thread.
+	 */
+	class NetworkImpairment {
+	public:
+		using LinkConfig = NetworkLoopback::LinkConfig;
+
+		/** Which way traffic goes, as an index into the arrays below */
+		enum Direction : uint8_t { Outgoing = 0, Incoming = 1 };
+
+		/** Set the conditions on one direction of every link without conditions of its own */
+		void set(Direction direction, const LinkConfig& config);
+
+		/** Set the conditions on one direction of the link to the given remote system */
+		void set(const SLNet::SystemAddress& address, Direction direction, const LinkConfig& config);
+
+		/** Remove every condition on every link */
+		void clear();
+
+		/** Returns the conditions on one direction of the link to the given remote system */
+		LinkConfig get(const SLNet::SystemAddress& address, Direction direction);
+
+		/** Returns whether any link has any conditions */
+		bool active() const { return anyActive.load(std::memory_order_relaxed); }
+
+	private:
+		/** Guards everything but anyActive */
+		std::mutex mutex;
+		/** Conditions on links without their own, by direction */
+		std::array<LinkConfig, 2> defaults;
+		/** Conditions on particular links, by direction; a direction without any follows the defaults */
+		std::unordered_map<SLNet::SystemAddress, std::array<std::optional<LinkConfig>, 2>, AddressHash> links;
+		/** Whether anything above is not a perfect link */
+		std::atomic<bool> anyActive{ false };
+
+		/** Update anyActive, with the mutex held */
+		void refresh();
+	};
+
+	/**
+	 * A transport that puts another one through simulated network conditions.
+	 *
+	 * Sent messages wait here until their conditions let them go, then go out through the
+	 * wrapped transport; received ones likewise wait before Receive() returns them. Loss
+	 * follows the reliability: an unreliable message is dropped, while a reliable one is
+	 * held back another round trip and a resend timeout. Only unreliable, unsequenced messages
+	 * are duplicated, as RakNet throws away copies of anything else.
+	 *
+	 * Received packets do not say how they were sent, so a classifier supplied by the owner
+	 * looks at each one. Packets it does not recognize as game data (connection events,
+	 * handshakes and the like) are never lost or reordered, and nothing received after them
+	 * overtakes them.
+	 *
+	 * Everything moves when Send(), SendList() or Receive() is called. While no link has
+	 * any conditions, and nothing is held back, every call goes straight through.
+	 */
+	class ImpairedTransport : public NetworkTransport {
+	public:
+		/**
+		 * Returns whether a received packet is game data, and if so how it was sent.
+		 *
+		 * The arguments are the packet, and the reliability and ordering channel to set.
+		 */
+		using Classifier = std::function<bool(const SLNet::Packet*, PacketReliability&, uint8_t&)>;
+
+		/**
+		 * Wrap a transport.
+		 *
+		 * @param inner The transport to send and receive through
+		 * @param conditions Conditions on each link, which may change at any time
+		 * @param classify Tells which received packets are game data
+		 * @param seed Seed for loss, jitter, duplication and reordering
+		 */
+		ImpairedTransport(std::unique_ptr<NetworkTransport> inner, std::shared_ptr<NetworkImpairment> conditions,
+			Classifier classify, uint32_t seed);
+		~ImpairedTransport() override;
+
+		SLNet::StartupResult Startup(unsigned int maxConnections,
+			SLNet::SocketDescriptor* socketDescriptors, unsigned socketDescriptorCount) override;
+		void Shutdown(unsigned int blockDuration) override;
+		void SetMaximumIncomingConnections(unsigned short numberAllowed) override;
+		void SetTimeoutTime(SLNet::TimeMS timeMS, const SLNet::SystemAddress& target) override;
+		void SetOfflinePingResponse(const char* data, const unsigned int length) override;
+		void AttachPlugin(SLNet::PluginInterface2* plugin) override;
+
+		SLNet::ConnectionAttemptResult Connect(const char* host, unsigned short remotePort,
+			const char* passwordData, int passwordDataLength) override;
+		void CloseConnection(const SLNet::AddressOrGUID target, bool sendDisconnectionNotification) override;
+		SLNet::ConnectionState GetConnectionState(const SLNet::AddressOrGUID systemIdentifier) override;
+		unsigned short NumberOfConnections() const override;
+		const SLNet::RakNetGUID& GetGuidFromSystemAddress(const SLNet::SystemAddress input) const override;
+		SLNet::SystemAddress GetMyBoundAddress() override;
+
+		uint32_t Send(const char* data, const int length, PacketPriority priority,
+			PacketReliability reliability, char orderingChannel,
+			const SLNet::AddressOrGUID systemIdentifier, bool broadcast) override;
+		uint32_t SendList(const char** data, const int* lengths, const int numParameters,
+			PacketPriority priority, PacketReliability reliability, char orderingChannel,
+			const SLNet::AddressOrGUID systemIdentifier, bool broadcast) override;
+		SLNet::Packet* Receive() override;
+		void DeallocatePacket(SLNet::Packet* packet) override;
+
+		void Ping(const SLNet::SystemAddress& target) override;
+		bool Ping(const char* host, unsigned short remotePort, bool onlyReplyOnAcceptingConnections) override;
+		int GetAveragePing(const SLNet::AddressOrGUID systemIdentifier) override;
+		int GetLastPing(const SLNet::AddressOrGUID systemIdentifier) const override;
+		SLNet::RakNetStatistics* GetStatistics(const SLNet::SystemAddress systemAddress,
+			SLNet::RakNetStatistics* rns) override;
+
+	private:
+		using LinkConfig = NetworkLoopback::LinkConfig;
+		using Direction = NetworkImpairment::Direction;
+
+		/** A sent message waiting to go out */
+		struct Outbound {
+			/** When it goes out (us) */
+			int64_t release;
+			/** Tiebreaker that keeps messages due at the same time in sending order */
+			uint64_t order;
+			/** Where it goes */
+			SLNet::SystemAddress to;
+			/** The message, starting with its message ID */
+			std::vector<uint8_t> data;
+			PacketPriority priority;
+			PacketReliability reliability;
+			uint8_t channel;
+			/** Receipt number handed back to the sender, or 0 for none */
+			uint32_t receipt;
+		};
+
+		/** A received packet waiting to be returned */
+		struct Inbound {
+			/** When Receive() may return it (us) */
+			int64_t release;
+			/** Tiebreaker that keeps packets due at the same time in arrival order */
+			uint64_t order;
+			/** The packet */
+			SLNet::Packet* packet;
+			/** Whether it was sent sequenced, so is dropped once a newer one is returned */
+			bool sequenced;
+			/** Its ordering channel, if it is game data */
+			uint8_t channel;
+		};
+
+		/** Orders a queue so the front is released first */
+		struct Later {
+			template <typename T>
+			bool operator()(const T& a, const T& b) const {
+				return a.release != b.release ? a.release > b.release : a.order > b.order;
+			}
+		};
+
+		/** Packets lost on one direction of a link, in RakNet's terms */
+		struct LossMeter {
+			/** Packets and losses since the link opened */
+			uint64_t packets = 0, lost = 0;
+			/** Packets and losses this second, and the last */
+			uint64_t currentPackets = 0, currentLost = 0, lastPackets = 0, lastLost = 0;
+			/** When the current second started (us) */
+			int64_t start = 0;
+
+			/** Move on to a new second if this one is over */
+			void roll(int64_t now);
+
+			/** Count a packet, and whether it was lost */
+			void add(int64_t now, bool wasLost);
+		};
+
+		/** One direction of one link */
+		struct Path {
+			/** When everything queued behind the bandwidth limit will have gone (us) */
+			int64_t free = 0;
+			/** Release time of the last packet that nothing may overtake (us) */
+			int64_t barrier = 0;
+			/** Latest release time of anything so far (us) */
+			int64_t latest = 0;
+			/** Release time of the last ordered message on each channel (us) */
+			std::array<int64_t, NUM_STREAMS> ordered{};
+			/** Order of the newest sequenced message released on each channel, plus one */
+			std::array<uint64_t, NUM_STREAMS> sequenced{};
+			/** Simulated losses */
+			LossMeter meter;
+		};
+
+		/** Guards everything below */
+		mutable std::mutex mutex;
+		/** The real transport */
+		std::unique_ptr<NetworkTransport> inner;
+		/** Conditions on each link */
+		std::shared_ptr<NetworkImpairment> conditions;
+		/** Tells which received packets are game data */
+		Classifier classify;
+		/** Decides loss, jitter, duplication and reordering */
+		std::mt19937 rng;
+		/** Sent messages waiting, as a heap ordered by Later */
+		std::vector<Outbound> outbound;
+		/** Received packets waiting, as a heap ordered by Later */
+		std::vector<Inbound> inbound;
+		/** Received packets released, for Receive() to return */
+		std::deque<SLNet::Packet*> ready;
+		/** Packets made here, rather than by the inner transport */
+		std::unordered_set<SLNet::Packet*> owned;
+		/** Both directions of every link, by remote address */
+		std::unordered_map<SLNet::SystemAddress, std::array<Path, 2>, AddressHash> paths;
+		/** Every open connection, to send broadcasts to one by one */
+		std::unordered_map<SLNet::SystemAddress, SLNet::RakNetGUID, AddressHash> connected;
+		/** Our receipt number and the recipient, by the inner transport's receipt number */
+		std::unordered_map<uint32_t, std::pair<uint32_t, SLNet::SystemAddress>> receipts;
+		/** Last receipt number handed out */
+		uint32_t receipt;
+		/** Next Outbound::order or Inbound::order */
+		uint64_t nextOrder;
+
+		/** Microseconds on the steady clock */
+		static int64_t now();
+
+		/** Returns true with the given chance, from 0 to 1 */
+		bool chance(double p);
+
+		/** Returns the latency plus a draw of the jitter (us) */
+		int64_t transit(const LinkConfig& config);
+
+		/** Returns the extra delay on a message held back for reordering (us) */
+		int64_t holdBack(const LinkConfig& config);
+
+		/** Returns the mean delay the conditions add to a round trip (ms) */
+		int addedRoundTrip(const SLNet::SystemAddress& address) const;
+
+		/** Returns the address of a connection given by address or GUID, or UNASSIGNED_SYSTEM_ADDRESS */
+		SLNet::SystemAddress resolve(const SLNet::AddressOrGUID& target) const;
+
+		/** Queue a message to one remote system, deciding its fate */
+		void schedule(const SLNet::SystemAddress& to, const char** data, const int* lengths, int count,
+			PacketPriority priority, PacketReliability reliability, uint8_t channel, uint32_t number);
+
+		/** Queue a packet the inner transport received, deciding its fate */
+		void admit(SLNet::Packet* packet);
+
+		/** Returns a packet owned here, with a copy of the given data */
+		SLNet::Packet* makePacket(const SLNet::SystemAddress& from, const uint8_t* data, size_t length);
+
+		/** Send every message that is due, or every one to the given address if it is set */
+		void releaseOutbound(int64_t time, const SLNet::SystemAddress& only = SLNet::UNASSIGNED_SYSTEM_ADDRESS);
+
+		/** Hand a message to the inner transport, unless a newer sequenced one went first */
+		void transmit(Outbound& o);
+
+		/** Move every received packet that is due to ready */
+		void releaseInbound(int64_t time);
+
+		/** Keep track of connections and rewrite receipts as packets come in; returns false to drop one */
+		bool observe(SLNet::Packet* packet);
+
+		/** Forget the sender of a packet about to be returned, if the packet says it is gone */
+		void settle(SLNet::Packet* packet);
+
+		/** Forget a connection that is gone */
+		void forget(const SLNet::SystemAddress& address);
+
+		/** Give a packet back to whoever made it */
+		void dispose(SLNet::Packet* packet);
+	};
+}
+
+#endif // CU_NETWORK_IMPAIRMENT_H
@@ -0,0 +1,203 @@
+#include <cugl/net/CUNetworkLockstep.h>
+
+#include <cugl/util/CUDebug.h>
+
+#include <algorithm>
+
+#include "CUNetworkFraming.h"
+
+using namespace cugl;
+using namespace cugl::netframing;
+
+/** First byte of every message a lockstep session sends */
+enum LockstepTag : uint8_t {
+	// A game message from NetworkLockstep::send(); the payload follows
+	User,
+	// Next frame the sender needs to simulate, first frame, number of frames, then each input
+	// as a varint length and its bytes
+	Inputs
+};
+
+/** Empty input, for players with nothing to report */
+static const std::vector<uint8_t> NO_INPUT;
+
+NetworkLockstep::NetworkLockstep(std::shared_ptr<NetworkConnection> net, uint32_t inputDelay, uint32_t redundancy,
+	uint32_t lead)
+	: net(std::move(net)), inputDelay(inputDelay), redundancy(std::max<uint32_t>(1, redundancy)), lead(lead),
+	playerID(0), frame(0), inputFrame(inputDelay), sentInputs(false) {
+	CUAssertLog(inputDelay + lead + 1 < WINDOW, "Input delay %d is too long", inputDelay + lead);
+	auto id = this->net->getPlayerID();
+	CUAssertLog(id.has_value(), "Lockstep session started before connecting");
+	playerID = id.value_or(0);
+}
+
+const NetworkLockstep::Slot* NetworkLockstep::find(uint8_t pID, uint32_t f) const {
+	auto it = inputs.find(pID);
+	if (it == inputs.end()) {
+		return nullptr;
+	}
+	const Slot& slot = it->second[f % WINDOW];
+	return slot.valid && slot.frame == f ? &slot : nullptr;
+}
+
+void NetworkLockstep::store(uint8_t pID, uint32_t f, const uint8_t* data, size_t length) {
+	auto& ring = inputs[pID];
+	if (ring.empty()) {
+		ring.resize(WINDOW);
+	}
+	Slot& slot = ring[f % WINDOW];
+	if (slot.valid && slot.frame == f) {
+		// Already have it from an earlier packet
+		return;
+	}
+	slot.frame = f;
+	slot.valid = true;
+	slot.data.assign(data, data + length);
+}
+
+void NetworkLockstep::readInputs(const uint8_t* msg, size_t length, uint8_t sender) {
+	size_t pos = 0;
+	uint32_t needed, first, count;
+	size_t n = readVarint(msg, length, needed);
+	if (n == 0) {
+		return;
+	}
+	pos += n;
+	n = readVarint(msg + pos, length - pos, first);
+	if (n == 0) {
+		return;
+	}
+	pos += n;
+	n = readVarint(msg + pos, length - pos, count);
+	if (n == 0) {
+		return;
+	}
+	pos += n;
+
+	auto it = peerFrames.find(sender);
+	if (it == peerFrames.end() || needed > it->second) {
+		peerFrames[sender] = needed;
+	}
+
+	for (uint32_t i = 0; i < count; i++) {
+		uint32_t size;
+		n = readVarint(msg + pos, length - pos, size);
+		if (n == 0 || size > length - pos - n) {
+			CULogError("Received malformed lockstep input from player %d", sender);
+			return;
+		}
+		pos += n;
+		uint32_t f = first + i;
+		// Ignore frames already simulated, and frames too far ahead to hold
+		// (the slot for frame - 1 still holds the inputs getInput() returns)
+		if (f >= frame && f - frame < WINDOW - 1) {
+			store(sender, f, msg + pos, size);
+		}
+		pos += size;
+	}
+}
+
+void NetworkLockstep::update(const std::function<void(const uint8_t*, size_t, uint8_t)>& dispatcher) {
+	net->receive([&](const uint8_t* msg, size_t length, uint8_t sender, NetworkConnection::MessageType /*type*/) {
+		if (length == 0) {
+			return;
+		}
+		switch (msg[0]) {
+		case User:
+			dispatcher(msg + 1, length - 1, sender);
+			break;
+		case Inputs:
+			readInputs(msg + 1, length - 1, sender);
+			break;
+		default:
+			CULogError("Received unknown lockstep message from player %d", sender);
+			break;
+		}
+	});
+
+	// Nothing new was sent while we wait, so repeat our inputs in case the last packet was lost
+	if (!sentInputs && inputFrame > inputDelay && !isReady()) {
+		sendInputs();
+	}
+	sentInputs = false;
+}
+
+bool NetworkLockstep::addInput(const std::vector<uint8_t>& input) {
+	if (inputFrame > frame + inputDelay + lead) {
+		return false;
+	}
+	store(playerID, inputFrame, input.data(), input.size());
+	inputFrame++;
+	sendInputs();
+	return true;
+}
+
+void NetworkLockstep::sendInputs() {
+	// Always repeat the last few inputs, and go back further for anyone who still needs more
+	uint32_t first = inputFrame > redundancy ? inputFrame - redundancy : 0;
+	auto active = net->getActivePlayers();
+	for (uint32_t p = 0; p <= UINT8_MAX; p++) {
+		auto pID = static_cast<uint8_t>(p);
+		if (pID == playerID || !active.test(pID)) {
+			continue;
+		}
+		auto it = peerFrames.find(pID);
+		first = std::min(first, it == peerFrames.end() ? 0 : it->second);
+	}
+	first = std::max({ first, inputDelay, inputFrame + 2 > WINDOW ? inputFrame + 2 - WINDOW : 0 });
+
+	uint8_t varint[MAX_LENGTH_BYTES];
+	buffer.clear();
+	buffer.push_back(Inputs);
+	size_t n = writeVarint(varint, frame);
+	buffer.insert(buffer.end(), varint, varint + n);
+	n = writeVarint(varint, first);
+	buffer.insert(buffer.end(), varint, varint + n);
+	n = writeVarint(varint, inputFrame - first);
+	buffer.insert(buffer.end(), varint, varint + n);
+	for (uint32_t f = first; f < inputFrame; f++) {
+		const Slot* slot = find(playerID, f);
+		const std::vector<uint8_t>& data = slot != nullptr ? slot->data : NO_INPUT;
+		n = writeVarint(varint, static_cast<uint32_t>(data.size()));
+		buffer.insert(buffer.end(), varint, varint + n);
+		buffer.insert(buffer.end(), data.begin(), data.end());
+	}
+
+	net->send(buffer, NetworkConnection::Delivery::Unreliable, NetworkConnection::Priority::High, 0);
+	sentInputs = true;
+}
+
+bool NetworkLockstep::isReady() {
+	if (frame < inputDelay) {
+		// Nobody has input this early
+		return true;
+	}
+	auto active = net->getActivePlayers();
+	for (uint32_t p = 0; p <= UINT8_MAX; p++) {
+		auto pID = static_cast<uint8_t>(p);
+		if (active.test(pID) && find(pID, frame) == nullptr) {
+			return false;
+		}
+	}
+	return find(playerID, frame) != nullptr;
+}
+
+bool NetworkLockstep::advance() {
+	if (!isReady()) {
+		return false;
+	}
+	frame++;
+	return true;
+}
+
+const std::vector<uint8_t>& NetworkLockstep::getInput(uint8_t pID) const {
+	const Slot* slot = find(pID, getFrame());
+	return slot != nullptr ? slot->data : NO_INPUT;
+}
+
+void NetworkLockstep::send(const std::vector<uint8_t>& msg) {
+	buffer.clear();
+	buffer.push_back(User);
+	buffer.insert(buffer.end(), msg.begin(), msg.end());
+	net->send(buffer);
+}
@@ -0,0 +1,1005 @@
+#include <cugl/net/CUNetworkLoopback.h>
+
+#include <cugl/util/CUDebug.h>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <string>
+
+#include <slikenet/MessageIdentifiers.h>
+
+#include "CUNetworkTransport.h"
+
+using namespace cugl;
+
+/** How long a connection attempt to nobody takes to fail (us), as RakNet's retries would */
+constexpr int64_t CONNECT_TIMEOUT = 2000000;
+/** First port given to a transport that does not ask for one */
+constexpr uint16_t FIRST_PORT = 49152;
+/** Timeout before a connection closed without notice is noticed (ms), RakNet's default */
+constexpr SLNet::TimeMS DEFAULT_TIMEOUT = 10000;
+/** Where every transport appears to be */
+const char* const LOOPBACK_HOST = "127.0.0.1";
+
+namespace cugl {
+	/**
+	 * One connection's end of a NetworkLoopback.
+	 *
+	 * All state is guarded by the network's mutex. The public methods take it; everything
+	 * else runs with it held.
+	 */
+	class LoopbackTransport : public NetworkTransport {
+	public:
+		explicit LoopbackTransport(std::shared_ptr<NetworkLoopback> network);
+		~LoopbackTransport() override;
+
+		SLNet::StartupResult Startup(unsigned int maxConnections,
+			SLNet::SocketDescriptor* socketDescriptors, unsigned socketDescriptorCount) override;
+		void Shutdown(unsigned int blockDuration) override;
+		void SetMaximumIncomingConnections(unsigned short numberAllowed) override;
+		void SetTimeoutTime(SLNet::TimeMS timeMS, const SLNet::SystemAddress& target) override;
+		void SetOfflinePingResponse(const char* data, const unsigned int length) override;
+		void AttachPlugin(SLNet::PluginInterface2* /*plugin*/) override {}
+
+		SLNet::ConnectionAttemptResult Connect(const char* host, unsigned short remotePort,
+			const char* passwordData, int passwordDataLength) override;
+		void CloseConnection(const SLNet::AddressOrGUID target, bool sendDisconnectionNotification) override;
+		SLNet::ConnectionState GetConnectionState(const SLNet::AddressOrGUID systemIdentifier) override;
+		unsigned short NumberOfConnections() const override;
+		const SLNet::RakNetGUID& GetGuidFromSystemAddress(const SLNet::SystemAddress input) const override;
+		SLNet::SystemAddress GetMyBoundAddress() override;
+
+		uint32_t Send(const char* data, const int length, PacketPriority priority,
+			PacketReliability reliability, char orderingChannel,
+			const SLNet::AddressOrGUID systemIdentifier, bool broadcast) override;
+		uint32_t SendList(const char** data, const int* lengths, const int numParameters,
+			PacketPriority priority, PacketReliability reliability, char orderingChannel,
+			const SLNet::AddressOrGUID systemIdentifier, bool broadcast) override;
+		SLNet::Packet* Receive() override;
+		void DeallocatePacket(SLNet::Packet* packet) override;
+
+		void Ping(const SLNet::SystemAddress& target) override;
+		bool Ping(const char* host, unsigned short remotePort, bool onlyReplyOnAcceptingConnections) override;
+		int GetAveragePing(const SLNet::AddressOrGUID systemIdentifier) override;
+		int GetLastPing(const SLNet::AddressOrGUID systemIdentifier) const override;
+		SLNet::RakNetStatistics* GetStatistics(const SLNet::SystemAddress systemAddress,
+			SLNet::RakNetStatistics* rns) override;
+
+	private:
+		friend class NetworkLoopback;
+		using Kind = NetworkLoopback::Kind;
+		using Datagram = NetworkLoopback::Datagram;
+
+		/** A received packet, whose buffer is kept for reuse */
+		struct LoopbackPacket : SLNet::Packet {
+			std::vector<uint8_t> storage;
+		};
+
+		/** Traffic over one link, in RakNet's terms */
+		struct Meter {
+			/** Totals since the link opened, by RNSPerSecondMetrics */
+			uint64_t total[SLNet::RNS_PER_SECOND_METRICS_COUNT] = {};
+			/** Totals for the second so far */
+			uint64_t current[SLNet::RNS_PER_SECOND_METRICS_COUNT] = {};
+			/** Totals for the last full second */
+			uint64_t last[SLNet::RNS_PER_SECOND_METRICS_COUNT] = {};
+			/** Packets sent and lost since the link opened */
+			uint64_t packets = 0, lost = 0;
+			/** Packets sent and lost this second, and the last */
+			uint64_t currentPackets = 0, currentLost = 0, lastPackets = 0, lastLost = 0;
+			/** When the current second started (us) */
+			int64_t start = 0;
+
+			/** Move on to a new second if this one is over */
+			void roll(int64_t now) {
+				if (now - start < 1000000) {
+					return;
+				}
+				bool gap = now - start >= 2000000;
+				for (int i = 0; i < SLNet::RNS_PER_SECOND_METRICS_COUNT; i++) {
+					last[i] = gap ? 0 : current[i];
+					current[i] = 0;
+				}
+				lastPackets = gap ? 0 : currentPackets;
+				lastLost = gap ? 0 : currentLost;
+				currentPackets = currentLost = 0;
+				start = now;
+			}
+
+			/** Count bytes for a metric */
+			void add(int64_t now, SLNet::RNSPerSecondMetrics metric, uint64_t bytes) {
+				roll(now);
+				total[metric] += bytes;
+				current[metric] += bytes;
+			}
+
+			/** Count a packet sent, and whether it was lost */
+			void addPacket(int64_t now, bool wasLost) {
+				roll(now);
+				packets++;
+				currentPackets++;
+				if (wasLost) {
+					lost++;
+					currentLost++;
+				}
+			}
+		};
+
+		/** A connection to another transport, opened or being opened */
+		struct Link {
+			/** Whether the connection is open, or still waiting for an answer */
+			bool connected;
+			/** Whether the other side opened it */
+			bool incoming;
+			/** Whether NetworkLoopback::dropConnections() cut it; only its loss still arrives */
+			bool severed;
+			/** Connection ID; both sides agree once it is open */
+			uint64_t id;
+			/** GUID of the other side, once known */
+			SLNet::RakNetGUID guid;
+			/** Slot of the connection, as RakNet's SystemAddress::systemIndex */
+			SLNet::SystemIndex index;
+			/** When the connection opened (us) */
+			int64_t connectedAt;
+			/** Arrival time of the last ordered message sent on each channel */
+			std::array<int64_t, NUM_STREAMS> ordered;
+			/** Last sequence number sent on each channel */
+			std::array<uint32_t, NUM_STREAMS> sequenceSent;
+			/** Last sequence number delivered on each channel */
+			std::array<uint32_t, NUM_STREAMS> sequenceSeen;
+			/** Reliable messages sent that have not arrived yet */
+			unsigned int unacked;
+			/** When the other side learns the connection is open (us); nothing sent overtakes that */
+			int64_t settled;
+			/** When the last reliable message sent arrives (us); a disconnect waits for it */
+			int64_t drained;
+			/** Round trip times (ms), or -1 before the first */
+			int lastPing, averagePing;
+			/** Traffic */
+			Meter meter;
+		};
+
+		/** The network */
+		std::shared_ptr<NetworkLoopback> network;
+		/** Whether Startup() succeeded and Shutdown() has not been called since */
+		bool started;
+		/** Port this transport is bound to */
+		uint16_t port;
+		/** GUID of this transport */
+		SLNet::RakNetGUID guid;
+		/** Most connections at once */
+		unsigned int maxConnections;
+		/** Most connections at once that others opened */
+		unsigned short maxIncoming;
+		/** How long before a silent connection is given up on (ms) */
+		SLNet::TimeMS timeout;
+		/** Answer to LAN queries */
+		std::vector<uint8_t> offlineResponse;
+		/** Connections, by the port of the other side */
+		std::unordered_map<uint16_t, Link> links;
+		/** Which connection slots are taken */
+		std::vector<bool> slots;
+		/** Packets waiting for Receive() */
+		std::deque<LoopbackPacket*> inbox;
+		/** Packets given back through DeallocatePacket(), to reuse */
+		std::vector<LoopbackPacket*> pool;
+		/** Last receipt number handed out */
+		uint32_t receipt;
+		/** When everything sent so far will have left, with a bandwidth limit (us) */
+		int64_t uplinkFree;
+		/** When each packet still queued behind the bandwidth limit leaves (us), oldest first */
+		std::deque<int64_t> departures;
+
+		/** Returns the address of a port on the network */
+		static SLNet::SystemAddress addressOf(uint16_t port);
+
+		/** Returns the connection to an address or GUID, or links.end() */
+		std::unordered_map<uint16_t, Link>::iterator find(const SLNet::AddressOrGUID& target);
+
+		/** Returns the connection to an address or GUID, or links.end() */
+		std::unordered_map<uint16_t, Link>::const_iterator find(const SLNet::AddressOrGUID& target) const;
+
+		/** Add a connection to another port, taking a slot */
+		Link& open(uint16_t remote, uint64_t id, bool connected, bool incoming);
+
+		/** Remove a connection, freeing its slot */
+		void close(std::unordered_map<uint16_t, Link>::iterator it);
+
+		/** Returns the number of open connections that others opened */
+		unsigned short numIncoming() const;
+
+		/** Returns how long until a control datagram arrives (us), resending it past any losses */
+		int64_t controlDelay();
+
+		/**
+		 * Send a control datagram to another port, returning when it arrives (us).
+		 *
+		 * It arrives no earlier than notBefore, as RakNet keeps its own messages in order with the game's.
+		 */
+		int64_t control(Kind kind, uint16_t to, uint64_t link, int64_t notBefore = 0);
+
+		/** Send a message from the game over one connection */
+		void transmit(uint16_t remote, Link& link, const char** data, const int* lengths, int count,
+			uint8_t reliability, uint8_t channel, uint32_t number);
+
+		/** Add a packet for Receive(), taking the payload from a buffer */
+		void deliver(std::vector<uint8_t>& payload, uint16_t from, const Link* link);
+
+		/** Add a packet for Receive() with just a message ID */
+		void notify(uint8_t messageID, uint16_t from, const Link* link);
+
+		/** Act on a datagram that arrived */
+		void arrive(Datagram& datagram);
+
+		/** Stop, closing every connection, with the network's mutex held */
+		void stop(bool notifyRemote);
+	};
+}
+
+#pragma region Network
+
+NetworkLoopback::NetworkLoopback(LinkConfig config, uint32_t seed)
+	: config(config), rng(seed), nextOrder(0), nextLink(1), nextGuid(1), nextPort(FIRST_PORT) {
+	this->config.loss = std::clamp(config.loss, 0.0, MAX_LOSS);
+	this->config.duplicate = std::clamp(config.duplicate, 0.0, 1.0);
+	this->config.reorder = std::clamp(config.reorder, 0.0, 1.0);
+}
+
+void NetworkLoopback::setLinkConfig(LinkConfig config) {
+	std::lock_guard<std::mutex> lock(mutex);
+	this->config = config;
+	this->config.loss = std::clamp(config.loss, 0.0, MAX_LOSS);
+	this->config.duplicate = std::clamp(config.duplicate, 0.0, 1.0);
+	this->config.reorder = std::clamp(config.reorder, 0.0, 1.0);
+}
+
+NetworkLoopback::LinkConfig NetworkLoopback::getLinkConfig() {
+	std::lock_guard<std::mutex> lock(mutex);
+	return config;
+}
+
+void NetworkLoopback::dropConnections() {
+	std::lock_guard<std::mutex> lock(mutex);
+	for (auto& endpoint : endpoints) {
+		LoopbackTransport* transport = endpoint.second;
+		for (auto& link : transport->links) {
+			if (!link.second.connected || link.second.severed) {
+				continue;
+			}
+			link.second.severed = true;
+			// Stands in for the silence this side eventually gives up on
+			post(makeDatagram(Kind::Lost, link.first, transport->port, link.second.id),
+				static_cast<int64_t>(transport->timeout) * 1000);
+		}
+	}
+}
+
+int64_t NetworkLoopback::now() {
+	return std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+std::vector<uint8_t> NetworkLoopback::takeBuffer() {
+	if (spare.empty()) {
+		return std::vector<uint8_t>();
+	}
+	std::vector<uint8_t> buffer = std::move(spare.back());
+	spare.pop_back();
+	buffer.clear();
+	return buffer;
+}
+
+void NetworkLoopback::giveBuffer(std::vector<uint8_t>&& buffer) {
+	if (buffer.capacity() > 0) {
+		spare.push_back(std::move(buffer));
+	}
+}
+
+NetworkLoopback::Datagram NetworkLoopback::makeDatagram(Kind kind, uint16_t from, uint16_t to, uint64_t link) {
+	Datagram d;
+	d.arrival = 0;
+	d.order = 0;
+	d.kind = kind;
+	d.from = from;
+	d.to = to;
+	d.link = link;
+	d.reliability = UNRELIABLE;
+	d.channel = 0;
+	d.sequence = 0;
+	d.receipt = 0;
+	d.sent = now();
+	d.data = takeBuffer();
+	return d;
+}
+
+int64_t NetworkLoopback::transit() {
+	double ms = config.latency;
+	if (config.jitter > 0) {
+		ms += std::uniform_real_distribution<double>(0, config.jitter)(rng);
+	}
+	return static_cast<int64_t>(ms * 1000);
+}
+
+bool NetworkLoopback::lose() {
+	return chance(config.loss);
+}
+
+bool NetworkLoopback::chance(double p) {
+	return p > 0 && std::uniform_real_distribution<double>(0, 1)(rng) < p;
+}
+
+int64_t NetworkLoopback::holdBack() {
+	return std::max(transit(), static_cast<int64_t>(REORDER_DELAY * 1000));
+}
+
+void NetworkLoopback::post(Datagram&& datagram, int64_t delay) {
+	postAt(std::move(datagram), now() + delay);
+}
+
+void NetworkLoopback::postAt(Datagram&& datagram, int64_t arrival) {
+	datagram.arrival = arrival;
+	datagram.order = nextOrder++;
+	queue.push_back(std::move(datagram));
+	std::push_heap(queue.begin(), queue.end(), Later());
+}
+
+void NetworkLoopback::pump() {
+	int64_t time = now();
+	while (!queue.empty() && queue.front().arrival <= time) {
+		std::pop_heap(queue.begin(), queue.end(), Later());
+		Datagram d = std::move(queue.back());
+		queue.pop_back();
+		arrive(d);
+		giveBuffer(std::move(d.data));
+	}
+}
+
+void NetworkLoopback::arrive(Datagram& datagram) {
+	auto it = endpoints.find(datagram.to);
+	if (it != endpoints.end()) {
+		it->second->arrive(datagram);
+	} else if (datagram.kind == Kind::Request) {
+		// Nobody is there; the sender finds out when its attempt times out
+		post(makeDatagram(Kind::Fail, datagram.to, datagram.from, datagram.link), CONNECT_TIMEOUT);
+	}
+}
+
+#pragma endregion
+
+#pragma region Transport
+
+std::unique_ptr<NetworkTransport> cugl::openLoopback(const std::shared_ptr<NetworkLoopback>& network) {
+	return std::make_unique<LoopbackTransport>(network);
+}
+
+LoopbackTransport::LoopbackTransport(std::shared_ptr<NetworkLoopback> network)
+	: network(std::move(network)), started(false), port(0), maxConnections(0), maxIncoming(0),
+	timeout(DEFAULT_TIMEOUT), receipt(0), uplinkFree(0) {
+	std::lock_guard<std::mutex> lock(this->network->mutex);
+	guid = SLNet::RakNetGUID(this->network->nextGuid++);
+}
+
+LoopbackTransport::~LoopbackTransport() {
+	std::lock_guard<std::mutex> lock(network->mutex);
+	stop(false);
+	for (auto* packet : pool) {
+		delete packet;
+	}
+}
+
+SLNet::SystemAddress LoopbackTransport::addressOf(uint16_t port) {
+	static const SLNet::SystemAddress base(LOOPBACK_HOST, 0);
+	SLNet::SystemAddress addr = base;
+	addr.SetPortHostOrder(port);
+	return addr;
+}
+
+SLNet::StartupResult LoopbackTransport::Startup(unsigned int maxConnections,
+	SLNet::SocketDescriptor* socketDescriptors, unsigned socketDescriptorCount) {
+	std::lock_guard<std::mutex> lock(network->mutex);
+	if (started) {
+		return SLNet::RAKNET_ALREADY_STARTED;
+	}
+	if (maxConnections == 0) {
+		return SLNet::INVALID_MAX_CONNECTIONS;
+	}
+	uint16_t wanted = socketDescriptorCount > 0 ? socketDescriptors[0].port : 0;
+	if (wanted != 0) {
+		if (network->endpoints.count(wanted) > 0) {
+			return SLNet::SOCKET_PORT_ALREADY_IN_USE;
+		}
+		port = wanted;
+	} else {
+		do {
+			port = network->nextPort++;
+			if (network->nextPort == 0) {
+				network->nextPort = FIRST_PORT;
+			}
+		} while (network->endpoints.count(port) > 0);
+	}
+
+	network->endpoints[port] = this;
+	this->maxConnections = maxConnections;
+	slots.assign(maxConnections, false);
+	started = true;
+	return SLNet::RAKNET_STARTED;
+}
+
+void LoopbackTransport::Shutdown(unsigned int blockDuration) {
+	std::lock_guard<std::mutex> lock(network->mutex);
+	stop(blockDuration > 0);
+}
+
+void LoopbackTransport::stop(bool notifyRemote) {
+	if (!started) {
+		return;
+	}
+	while (!links.empty()) {
+		auto it = links.begin();
+		control(notifyRemote ? Kind::Disconnect : Kind::Lost, it->first, it->second.id, it->second.drained);
+		close(it);
+	}
+	network->endpoints.erase(port);
+	for (auto* packet : inbox) {
+		pool.push_back(packet);
+	}
+	inbox.clear();
+	departures.clear();
+	started = false;
+}
+
+void LoopbackTransport::SetMaximumIncomingConnections(unsigned short numberAllowed) {
+	std::lock_guard<std::mutex> lock(network->mutex);
+	maxIncoming = numberAllowed;
+}
+
+void LoopbackTransport::SetTimeoutTime(SLNet::TimeMS timeMS, const SLNet::SystemAddress& /*target*/) {
+	std::lock_guard<std::mutex> lock(network->mutex);
+	timeout = timeMS;
+}
+
+void LoopbackTransport::SetOfflinePingResponse(const char* data, const unsigned int length) {
+	std::lock_guard<std::mutex> lock(network->mutex);
+	offlineResponse.assign(data, data + length);
+}
+
+#pragma endregion
+
+#pragma region Connections
+
+std::unordered_map<uint16_t, LoopbackTransport::Link>::iterator LoopbackTransport::find(
+	const SLNet::AddressOrGUID& target) {
+	if (target.rakNetGuid != SLNet::UNASSIGNED_RAKNET_GUID) {
+		return std::find_if(links.begin(), links.end(),
+			[&](const auto& link) { return link.second.guid == target.rakNetGuid; });
+	}
+	if (target.systemAddress == SLNet::UNASSIGNED_SYSTEM_ADDRESS) {
+		return links.end();
+	}
+	return links.find(target.systemAddress.GetPort());
+}
+
+std::unordered_map<uint16_t, LoopbackTransport::Link>::const_iterator LoopbackTransport::find(
+	const SLNet::AddressOrGUID& target) const {
+	return const_cast<LoopbackTransport*>(this)->find(target);
+}
+
+LoopbackTransport::Link& LoopbackTransport::open(uint16_t remote, uint64_t id, bool connected, bool incoming) {
+	Link& link = links[remote];
+	link.connected = connected;
+	link.incoming = incoming;
+	link.severed = false;
+	link.id = id;
+	link.guid = SLNet::UNASSIGNED_RAKNET_GUID;
+	auto peer = network->endpoints.find(remote);
+	if (peer != network->endpoints.end()) {
+		link.guid = peer->second->guid;
+	}
+	auto slot = std::find(slots.begin(), slots.end(), false);
+	link.index = static_cast<SLNet::SystemIndex>(slot - slots.begin());
+	*slot = true;
+	link.guid.systemIndex = link.index;
+	link.connectedAt = NetworkLoopback::now();
+	link.ordered.fill(0);
+	link.sequenceSent.fill(0);
+	link.sequenceSeen.fill(0);
+	link.unacked = 0;
+	link.settled = link.drained = 0;
+	link.lastPing = link.averagePing = -1;
+	link.meter = Meter();
+	link.meter.start = link.connectedAt;
+	return link;
+}
+
+void LoopbackTransport::close(std::unordered_map<uint16_t, Link>::iterator it) {
+	slots[it->second.index] = false;
+	links.erase(it);
+}
+
+unsigned short LoopbackTransport::numIncoming() const {
+	return static_cast<unsigned short>(std::count_if(links.begin(), links.end(),
+		[](const auto& link) { return link.second.connected && link.second.incoming; }));
+}
+
+SLNet::ConnectionAttemptResult LoopbackTransport::Connect(const char* /*host*/, unsigned short remotePort,
+	const char* /*passwordData*/, int /*passwordDataLength*/) {
+	std::lock_guard<std::mutex> lock(network->mutex);
+	if (!started || remotePort == port) {
+		return SLNet::INVALID_PARAMETER;
+	}
+	auto it = links.find(remotePort);
+	if (it != links.end()) {
+		return it->second.connected ? SLNet::ALREADY_CONNECTED_TO_ENDPOINT
+			: SLNet::CONNECTION_ATTEMPT_ALREADY_IN_PROGRESS;
+	}
+	if (links.size() >= maxConnections) {
+		return SLNet::INVALID_PARAMETER;
+	}
+	Link& link = open(remotePort, network->nextLink++, false, false);
+	control(Kind::Request, remotePort, link.id);
+	return SLNet::CONNECTION_ATTEMPT_STARTED;
+}
+
+void LoopbackTransport::CloseConnection(const SLNet::AddressOrGUID target, bool sendDisconnectionNotification) {
+	std::lock_guard<std::mutex> lock(network->mutex);
+	auto it = find(target);
+	if (it == links.end()) {
+		return;
+	}
+	control(sendDisconnectionNotification ? Kind::Disconnect : Kind::Lost, it->first, it->second.id,
+		it->second.drained);
+	close(it);
+}
+
+SLNet::ConnectionState LoopbackTransport::GetConnectionState(const SLNet::AddressOrGUID systemIdentifier) {
+	std::lock_guard<std::mutex> lock(network->mutex);
+	auto it = find(systemIdentifier);
+	if (it == links.end()) {
+		return SLNet::IS_NOT_CONNECTED;
+	}
+	return it->second.connected ? SLNet::IS_CONNECTED : SLNet::IS_CONNECTING;
+}
+
+unsigned short LoopbackTransport::NumberOfConnections() const {
+	std::lock_guard<std::mutex> lock(network->mutex);
+	return static_cast<unsigned short>(std::count_if(links.begin(), links.end(),
+		[](const auto& link) { return link.second.connected; }));
+}
+
+const SLNet::RakNetGUID& LoopbackTransport::GetGuidFromSystemAddress(const SLNet::SystemAddress input) const {
+	std::lock_guard<std::mutex> lock(network->mutex);
+	if (input == SLNet::UNASSIGNED_SYSTEM_ADDRESS) {
+		return guid;
+	}
+	auto it = find(input);
+	return it == links.end() ? SLNet::UNASSIGNED_RAKNET_GUID : it->second.guid;
+}
+
+SLNet::SystemAddress LoopbackTransport::GetMyBoundAddress() {
+	std::lock_guard<std::mutex> lock(network->mutex);
+	return started ? addressOf(port) : SLNet::UNASSIGNED_SYSTEM_ADDRESS;
+}
+
+int64_t LoopbackTransport::controlDelay() {
+	// RakNet resends connection traffic until it gets through
+	int64_t delay = network->transit();
+	while (network->lose()) {
+		delay += 2 * network->transit() + MIN_RESEND;
+	}
+	return delay;
+}
+
+int64_t LoopbackTransport::control(Kind kind, uint16_t to, uint64_t link, int64_t notBefore) {
+	int64_t delay;
+	switch (kind) {
+	case Kind::Lost: {
+		// The other side only notices once its own timeout passes
+		auto peer = network->endpoints.find(to);
+		delay = static_cast<int64_t>(peer != network->endpoints.end() ? peer->second->timeout : timeout) * 1000;
+		break;
+	}
+	case Kind::Fail:
+		delay = CONNECT_TIMEOUT;
+		break;
+	default:
+		delay = controlDelay();
+		break;
+	}
+	int64_t arrival = std::max(NetworkLoopback::now() + delay, notBefore);
+	network->postAt(network->makeDatagram(kind, port, to, link), arrival);
+	return arrival;
+}
+
+#pragma endregion
+
+#pragma region Sending
+
+uint32_t LoopbackTransport::Send(const char* data, const int length, PacketPriority priority,
+	PacketReliability reliability, char orderingChannel,
+	const SLNet::AddressOrGUID systemIdentifier, bool broadcast) {
+	return SendList(&data, &length, 1, priority, reliability, orderingChannel, systemIdentifier, broadcast);
+}
+
+uint32_t LoopbackTransport::SendList(const char** data, const int* lengths, const int numParameters,
+	PacketPriority /*priority*/, PacketReliability reliability, char orderingChannel,
+	const SLNet::AddressOrGUID systemIdentifier, bool broadcast) {
+	std::lock_guard<std::mutex> lock(network->mutex);
+	if (!started || numParameters <= 0) {
+		return 0;
+	}
+	if (++receipt == 0) {
+		receipt = 1;
+	}
+	auto channel = static_cast<uint8_t>(static_cast<uint8_t>(orderingChannel) % NUM_STREAMS);
+	if (broadcast) {
+		auto skip = find(systemIdentifier);
+		for (auto it = links.begin(); it != links.end(); ++it) {
+			if (it != skip && it->second.connected) {
+				transmit(it->first, it->second, data, lengths, numParameters, reliability, channel, receipt);
+			}
+		}
+	} else {
+		auto it = find(systemIdentifier);
+		if (it != links.end() && it->second.connected) {
+			transmit(it->first, it->second, data, lengths, numParameters, reliability, channel, receipt);
+		}
+	}
+	return receipt;
+}
+
+void LoopbackTransport::transmit(uint16_t remote, Link& link, const char** data, const int* lengths, int count,
+	uint8_t reliability, uint8_t channel, uint32_t number) {
+	Datagram d = network->makeDatagram(Kind::Data, port, remote, link.id);
+	for (int i = 0; i < count; i++) {
+		d.data.insert(d.data.end(), data[i], data[i] + lengths[i]);
+	}
+	d.reliability = reliability;
+	d.channel = channel;
+	d.receipt = number;
+	if (isSequenced(reliability)) {
+		d.sequence = ++link.sequenceSent[channel];
+	}
+
+	int64_t time = NetworkLoopback::now();
+	size_t length = d.data.size();
+	size_t wire = length + NetworkLoopback::PACKET_OVERHEAD;
+	int64_t queued = 0;
+	double bandwidth = network->config.bandwidth;
+	if (bandwidth > 0) {
+		// Wait for everything sent earlier to leave first
+		uplinkFree = std::max(uplinkFree, time) + static_cast<int64_t>(wire * 1000000.0 / bandwidth);
+		queued = uplinkFree - time;
+		departures.push_back(uplinkFree);
+	}
+	int64_t delay = queued + network->transit();
+
+	Meter& meter = link.meter;
+	meter.add(time, SLNet::USER_MESSAGE_BYTES_PUSHED, length);
+	meter.add(time, SLNet::USER_MESSAGE_BYTES_SENT, length);
+	meter.add(time, SLNet::ACTUAL_BYTES_SENT, wire);
+	bool reliable = isReliable(reliability);
+	while (network->lose()) {
+		meter.addPacket(time, true);
+		if (!reliable) {
+			if (wantsReceipt(reliability)) {
+				Datagram loss = network->makeDatagram(Kind::ReceiptLoss, remote, port, link.id);
+				loss.receipt = number;
+				network->postAt(std::move(loss), time + delay);
+			}
+			network->giveBuffer(std::move(d.data));
+			return;
+		}
+		// Resent once the first copy is overdue
+		delay += 2 * network->transit() + MIN_RESEND;
+		meter.add(time, SLNet::USER_MESSAGE_BYTES_RESENT, length);
+		meter.add(time, SLNet::ACTUAL_BYTES_SENT, wire);
+	}
+	meter.addPacket(time, false);
+
+	if (network->chance(network->config.reorder)) {
+		if (isSequenced(reliability)) {
+			// A newer message gets there first, so this one is thrown away when it arrives
+			network->giveBuffer(std::move(d.data));
+			return;
+		}
+		delay += network->holdBack();
+	}
+	if ((reliability == UNRELIABLE || reliability == UNRELIABLE_WITH_ACK_RECEIPT)
+		&& network->chance(network->config.duplicate)) {
+		// The copy makes its own way there, and asks for no receipt of its own
+		Datagram copy = network->makeDatagram(Kind::Data, port, remote, link.id);
+		copy.data.assign(d.data.begin(), d.data.end());
+		copy.channel = channel;
+		network->postAt(std::move(copy), time + std::max(queued + network->transit(), link.settled - time));
+	}
+
+	// Nothing overtakes the handshake
+	delay = std::max(delay, link.settled - time);
+	if (reliable) {
+		link.unacked++;
+		link.drained = std::max(link.drained, time + delay);
+	}
+	if (isOrdered(reliability)) {
+		// Held back until every earlier message on the channel is in
+		delay = std::max(delay, link.ordered[channel] - time);
+		link.ordered[channel] = time + delay;
+	}
+	network->postAt(std::move(d), time + delay);
+}
+
+void LoopbackTransport::Ping(const SLNet::SystemAddress& target) {
+	std::lock_guard<std::mutex> lock(network->mutex);
+	auto it = find(target);
+	if (it == links.end() || !it->second.connected || network->lose()) {
+		return;
+	}
+	network->post(network->makeDatagram(Kind::Ping, port, it->first, it->second.id), network->transit());
+}
+
+bool LoopbackTransport::Ping(const char* /*host*/, unsigned short remotePort, bool onlyReplyOnAcceptingConnections) {
+	std::lock_guard<std::mutex> lock(network->mutex);
+	if (!started || remotePort == port) {
+		return false;
+	}
+	// Every transport is on the same host, so a broadcast and a direct query reach the same one
+	Datagram d = network->makeDatagram(Kind::Query, port, remotePort, 0);
+	d.data.push_back(onlyReplyOnAcceptingConnections ? 1 : 0);
+	if (network->lose()) {
+		network->giveBuffer(std::move(d.data));
+		return true;
+	}
+	network->post(std::move(d), network->transit());
+	return true;
+}
+
+#pragma endregion
+
+#pragma region Receiving
+
+SLNet::Packet* LoopbackTransport::Receive() {
+	std::lock_guard<std::mutex> lock(network->mutex);
+	network->pump();
+	if (inbox.empty()) {
+		return nullptr;
+	}
+	LoopbackPacket* packet = inbox.front();
+	inbox.pop_front();
+	return packet;
+}
+
+void LoopbackTransport::DeallocatePacket(SLNet::Packet* packet) {
+	if (packet == nullptr) {
+		return;
+	}
+	std::lock_guard<std::mutex> lock(network->mutex);
+	pool.push_back(static_cast<LoopbackPacket*>(packet));
+}
+
+void LoopbackTransport::deliver(std::vector<uint8_t>& payload, uint16_t from, const Link* link) {
+	LoopbackPacket* packet;
+	if (pool.empty()) {
+		packet = new LoopbackPacket();
+	} else {
+		packet = pool.back();
+		pool.pop_back();
+	}
+	// The packet keeps the payload, and the caller gets the packet's old buffer back
+	std::swap(packet->storage, payload);
+	packet->systemAddress = addressOf(from);
+	packet->guid = SLNet::UNASSIGNED_RAKNET_GUID;
+	if (link != nullptr) {
+		packet->guid = link->guid;
+	} else {
+		auto peer = network->endpoints.find(from);
+		if (peer != network->endpoints.end()) {
+			packet->guid = peer->second->guid;
+		}
+	}
+	packet->systemAddress.systemIndex = link != nullptr ? link->index : static_cast<SLNet::SystemIndex>(-1);
+	packet->guid.systemIndex = packet->systemAddress.systemIndex;
+	packet->length = static_cast<unsigned int>(packet->storage.size());
+	packet->bitSize = packet->length * 8;
+	packet->data = packet->storage.data();
+	packet->deleteData = false;
+	packet->wasGeneratedLocally = false;
+	inbox.push_back(packet);
+}
+
+void LoopbackTransport::notify(uint8_t messageID, uint16_t from, const Link* link) {
+	std::vector<uint8_t> payload = network->takeBuffer();
+	payload.push_back(messageID);
+	deliver(payload, from, link);
+	network->giveBuffer(std::move(payload));
+}
+
+SLNet::RakNetStatistics* LoopbackTransport::GetStatistics(const SLNet::SystemAddress systemAddress,
+	SLNet::RakNetStatistics* rns) {
+	std::lock_guard<std::mutex> lock(network->mutex);
+	auto it = find(systemAddress);
+	if (it == links.end() || !it->second.connected || rns == nullptr) {
+		return nullptr;
+	}
+	int64_t time = NetworkLoopback::now();
+	Link& link = it->second;
+	link.meter.roll(time);
+
+	*rns = SLNet::RakNetStatistics();
+	for (int i = 0; i < SLNet::RNS_PER_SECOND_METRICS_COUNT; i++) {
+		rns->valueOverLastSecond[i] = link.meter.last[i];
+		rns->runningTotal[i] = link.meter.total[i];
+	}
+	rns->connectionStartTime = static_cast<SLNet::TimeUS>(link.connectedAt);
+
+	// The bandwidth queue is shared by every link, as a socket's would be
+	double bandwidth = network->config.bandwidth;
+	while (!departures.empty() && departures.front() <= time) {
+		departures.pop_front();
+	}
+	rns->isLimitedByOutgoingBandwidthLimit = bandwidth > 0;
+	rns->BPSLimitByOutgoingBandwidthLimit = static_cast<uint64_t>(bandwidth);
+	rns->messageInSendBuffer[MEDIUM_PRIORITY] = static_cast<unsigned int>(departures.size());
+	rns->bytesInSendBuffer[MEDIUM_PRIORITY] = bandwidth > 0
+		? static_cast<double>(std::max<int64_t>(0, uplinkFree - time)) * bandwidth / 1000000 : 0;
+	rns->messagesInResendBuffer = link.unacked;
+
+	const Meter& m = link.meter;
+	rns->packetlossLastSecond = m.lastPackets > 0 ? static_cast<float>(m.lastLost) / m.lastPackets : 0;
+	rns->packetlossTotal = m.packets > 0 ? static_cast<float>(m.lost) / m.packets : 0;
+	return rns;
+}
+
+int LoopbackTransport::GetAveragePing(const SLNet::AddressOrGUID systemIdentifier) {
+	std::lock_guard<std::mutex> lock(network->mutex);
+	auto it = find(systemIdentifier);
+	return it == links.end() || !it->second.connected ? -1 : it->second.averagePing;
+}
+
+int LoopbackTransport::GetLastPing(const SLNet::AddressOrGUID systemIdentifier) const {
+	std::lock_guard<std::mutex> lock(network->mutex);
+	auto it = find(systemIdentifier);
+	return it == links.end() || !it->second.connected ? -1 : it->second.lastPing;
+}
+
+void LoopbackTransport::arrive(Datagram& d) {
+	auto it = links.find(d.from);
+	bool current = it != links.end() && it->second.connected && it->second.id == d.link;
+	int64_t time = NetworkLoopback::now();
+	if (current && it->second.severed && d.kind != Kind::Lost) {
+		return;
+	}
+
+	switch (d.kind) {
+	case Kind::Data: {
+		if (!current) {
+			return;
+		}
+		Link& link = it->second;
+		auto sender = network->endpoints.find(d.from);
+		if (isReliable(d.reliability) && sender != network->endpoints.end()) {
+			auto back = sender->second->links.find(port);
+			if (back != sender->second->links.end() && back->second.id == d.link && back->second.unacked > 0) {
+				back->second.unacked--;
+			}
+		}
+		if (wantsReceipt(d.reliability)) {
+			Datagram ack = network->makeDatagram(Kind::Receipt, port, d.from, d.link);
+			ack.receipt = d.receipt;
+			network->post(std::move(ack), controlDelay());
+		}
+		if (d.sequence != 0) {
+			// A newer sequenced message already got here
+			if (d.sequence <= link.sequenceSeen[d.channel]) {
+				return;
+			}
+			link.sequenceSeen[d.channel] = d.sequence;
+		}
+		link.meter.add(time, SLNet::ACTUAL_BYTES_RECEIVED, d.data.size() + NetworkLoopback::PACKET_OVERHEAD);
+		link.meter.add(time, SLNet::USER_MESSAGE_BYTES_RECEIVED_PROCESSED, d.data.size());
+		deliver(d.data, d.from, &link);
+		break;
+	}
+	case Kind::Request: {
+		if (current) {
+			// Our answer is still on its way
+			control(Kind::Accept, d.from, d.link);
+			return;
+		}
+		if (it != links.end() && !it->second.connected) {
+			// We asked each other at the same time; both sides settle on the same ID
+			it->second.connected = true;
+			it->second.id = std::min(it->second.id, d.link);
+			it->second.connectedAt = time;
+			notify(ID_CONNECTION_REQUEST_ACCEPTED, d.from, &it->second);
+			it->second.settled = control(Kind::Accept, d.from, it->second.id);
+			return;
+		}
+		if (it != links.end()) {
+			// The other side started over without us noticing it left
+			close(it);
+		}
+		if (numIncoming() >= maxIncoming || links.size() >= maxConnections) {
+			control(Kind::Refuse, d.from, d.link);
+			return;
+		}
+		Link& link = open(d.from, d.link, true, true);
+		notify(ID_NEW_INCOMING_CONNECTION, d.from, &link);
+		link.settled = control(Kind::Accept, d.from, d.link);
+		break;
+	}
+	case Kind::Accept:
+		if (it != links.end() && !it->second.connected) {
+			it->second.connected = true;
+			it->second.id = d.link;
+			it->second.connectedAt = time;
+			notify(ID_CONNECTION_REQUEST_ACCEPTED, d.from, &it->second);
+		}
+		break;
+	case Kind::Refuse:
+	case Kind::Fail:
+		if (it != links.end() && !it->second.connected && it->second.id == d.link) {
+			close(it);
+			notify(d.kind == Kind::Refuse ? ID_NO_FREE_INCOMING_CONNECTIONS : ID_CONNECTION_ATTEMPT_FAILED,
+				d.from, nullptr);
+		}
+		break;
+	case Kind::Disconnect:
+	case Kind::Lost:
+		if (current) {
+			Link link = it->second;
+			close(it);
+			notify(d.kind == Kind::Disconnect ? ID_DISCONNECTION_NOTIFICATION : ID_CONNECTION_LOST,
+				d.from, &link);
+		}
+		break;
+	case Kind::Ping:
+		if (current && !network->lose()) {
+			Datagram pong = network->makeDatagram(Kind::Pong, port, d.from, d.link);
+			pong.sent = d.sent;
+			network->post(std::move(pong), network->transit());
+		}
+		break;
+	case Kind::Pong:
+		if (current) {
+			Link& link = it->second;
+			link.lastPing = static_cast<int>((time - d.sent) / 1000);
+			link.averagePing = link.averagePing < 0 ? link.lastPing : (3 * link.averagePing + link.lastPing) / 4;
+		}
+		break;
+	case Kind::Query: {
+		bool onlyAccepting = !d.data.empty() && d.data[0] != 0;
+		if (onlyAccepting && numIncoming() >= maxIncoming) {
+			return;
+		}
+		if (network->lose()) {
+			return;
+		}
+		// What RakNet hands the querying game: message ID, query time, then our answer
+		Datagram answer = network->makeDatagram(Kind::Answer, port, d.from, 0);
+		auto sent = static_cast<SLNet::TimeMS>(d.sent / 1000);
+		answer.data.push_back(ID_UNCONNECTED_PONG);
+		answer.data.resize(1 + sizeof(sent));
+		std::memcpy(answer.data.data() + 1, &sent, sizeof(sent));
+		answer.data.insert(answer.data.end(), offlineResponse.begin(), offlineResponse.end());
+		network->post(std::move(answer), network->transit());
+		break;
+	}
+	case Kind::Answer:
+		deliver(d.data, d.from, it != links.end() && it->second.connected ? &it->second : nullptr);
+		break;
+	case Kind::Receipt:
+	case Kind::ReceiptLoss: {
+		std::vector<uint8_t> payload = network->takeBuffer();
+		payload.resize(1 + sizeof(d.receipt));
+		payload[0] = d.kind == Kind::Receipt ? ID_SND_RECEIPT_ACKED : ID_SND_RECEIPT_LOSS;
+		std::memcpy(payload.data() + 1, &d.receipt, sizeof(d.receipt));
+		deliver(payload, d.from, current ? &it->second : nullptr);
+		network->giveBuffer(std::move(payload));
+		break;
+	}
+	}
+}
+
+#pragma endregion
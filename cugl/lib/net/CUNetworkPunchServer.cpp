@@ -0,0 +1,170 @@
+#include <cugl/net/CUNetworkPunchServer.h>
+
+#include <cugl/util/CUDebug.h>
+
+#include <cstring>
+#include <string>
+
+#include <slikenet/BitStream.h>
+#include <slikenet/MessageIdentifiers.h>
+#include <slikenet/peerinterface.h>
+#include <slikenet/PluginInterface2.h>
+
+#include "CUNetworkFraming.h"
+
+using namespace cugl;
+using netframing::ROOM_LENGTH;
+
+/** How long to block on shutdown */
+constexpr unsigned int SHUTDOWN_BLOCK = 10;
+
+/** How long to wait before considering a connection gone (ms) */
+constexpr size_t DISCONN_TIME = 5000;
+
+/** How long the network thread sleeps between polls (ms) */
+constexpr unsigned int SERVER_SLEEP = 1;
+
+/** Number of distinct room IDs */
+constexpr uint32_t MAX_ROOMS = 100000;
+
+/**
+ * Points punchthrough requests for a room at the room's host.
+ *
+ * Clients ask to be punched through to the GUID their room ID spells, as the standalone
+ * server expects. Attached ahead of the NatPunchthroughServer, this swaps in the GUID of
+ * the host holding that room before the NatPunchthroughServer reads the request.
+ */
+class NetworkPunchServer::RoomDirectory : public SLNet::PluginInterface2 {
+public:
+	explicit RoomDirectory(NetworkPunchServer& server) : server(server) {}
+
+	SLNet::PluginReceiveResult OnReceive(SLNet::Packet* packet) override {
+		if (packet->data[0] != ID_NAT_PUNCHTHROUGH_REQUEST
+			|| packet->length < sizeof(SLNet::MessageID) + sizeof(uint64_t)) {
+			return SLNet::RR_CONTINUE_PROCESSING;
+		}
+		SLNet::BitStream in(packet->data, packet->length, false);
+		in.IgnoreBytes(sizeof(SLNet::MessageID));
+		SLNet::RakNetGUID room;
+		in.Read(room);
+
+		auto host = room.g < MAX_ROOMS ? server.findHost(static_cast<uint32_t>(room.g)) : std::nullopt;
+		if (!host.has_value()) {
+			// Left alone, so the client hears ID_NAT_TARGET_NOT_CONNECTED
+			server.roomsNotFound++;
+			return SLNet::RR_CONTINUE_PROCESSING;
+		}
+		SLNet::BitStream out;
+		out.Write(SLNet::RakNetGUID(*host));
+		std::memcpy(packet->data + sizeof(SLNet::MessageID), out.GetData(), sizeof(uint64_t));
+		server.punchthroughs++;
+		return SLNet::RR_CONTINUE_PROCESSING;
+	}
+
+private:
+	NetworkPunchServer& server;
+};
+
+NetworkPunchServer::NetworkPunchServer(ServerConfig config)
+	: config(config), status(NetworkConnection::NetStatus::Pending), rng(std::random_device()()) {
+	CUAssertLog(config.maxConnections <= MAX_ROOMS, "At most %u connections can have a room ID", MAX_ROOMS);
+
+	peer = std::unique_ptr<SLNet::RakPeerInterface>(SLNet::RakPeerInterface::GetInstance());
+	peer->SetTimeoutTime(DISCONN_TIME, SLNet::UNASSIGNED_SYSTEM_ADDRESS);
+	// Order matters: requests must be rewritten before the punchthrough server reads them
+	directory = std::make_unique<RoomDirectory>(*this);
+	peer->AttachPlugin(directory.get());
+	peer->AttachPlugin(&natPunchthroughServer);
+
+	SLNet::SocketDescriptor socketDescriptor(config.port, config.address);
+	if (peer->Startup(config.maxConnections, &socketDescriptor, 1) != SLNet::RAKNET_STARTED) {
+		CULogError("Could not start punchthrough server; is port %d in use?", config.port);
+		status = NetworkConnection::NetStatus::GenericError;
+		return;
+	}
+	peer->SetMaximumIncomingConnections(static_cast<unsigned short>(config.maxConnections));
+	status = NetworkConnection::NetStatus::Connected;
+	CULog("Punchthrough server listening on %s port %d",
+		config.address != nullptr ? config.address : "every address", config.port);
+
+	netRunning = true;
+	netThread = std::thread([this] { netThreadLoop(); });
+}
+
+NetworkPunchServer::~NetworkPunchServer() {
+	if (netThread.joinable()) {
+		netRunning = false;
+		netThread.join();
+	}
+	peer->Shutdown(SHUTDOWN_BLOCK);
+	SLNet::RakPeerInterface::DestroyInstance(peer.release());
+}
+
+size_t NetworkPunchServer::getNumRooms() {
+	std::lock_guard<std::mutex> lock(roomMutex);
+	return hosts.size();
+}
+
+NetworkPunchServer::Stats NetworkPunchServer::getStats() const {
+	return { roomsAssigned.load(), punchthroughs.load(), roomsNotFound.load() };
+}
+
+void NetworkPunchServer::netThreadLoop() {
+	while (netRunning) {
+		for (SLNet::Packet* packet = peer->Receive(); packet != nullptr;
+			peer->DeallocatePacket(packet), packet = peer->Receive()) {
+			switch (packet->data[0]) {
+			case ID_NEW_INCOMING_CONNECTION:
+				assignRoom(packet->guid);
+				break;
+			case ID_DISCONNECTION_NOTIFICATION:
+			case ID_CONNECTION_LOST:
+				releaseRoom(packet->guid);
+				break;
+			default:
+				// Punchthrough traffic is handled by the plugins
+				break;
+			}
+		}
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(SERVER_SLEEP));
+	}
+}
+
+void NetworkPunchServer::assignRoom(const SLNet::RakNetGUID& guid) {
+	uint32_t room;
+	{
+		std::lock_guard<std::mutex> lock(roomMutex);
+		if (rooms.count(guid.g) > 0) {
+			return;
+		}
+		do {
+			room = rng() % MAX_ROOMS;
+		} while (hosts.count(room) > 0);
+		hosts[room] = guid.g;
+		rooms[guid.g] = room;
+	}
+
+	std::string code = std::to_string(room);
+	code.insert(0, ROOM_LENGTH - code.size(), '0');
+	netframing::sendFramed(peer.get(), ID_USER_PACKET_ENUM + NetworkConnection::AssignedRoom,
+		reinterpret_cast<const uint8_t*>(code.data()), code.size(),
+		HIGH_PRIORITY, RELIABLE_ORDERED, 0, guid, false);
+	roomsAssigned++;
+}
+
+void NetworkPunchServer::releaseRoom(const SLNet::RakNetGUID& guid) {
+	std::lock_guard<std::mutex> lock(roomMutex);
+	auto it = rooms.find(guid.g);
+	if (it == rooms.end()) {
+		return;
+	}
+	hosts.erase(it->second);
+	rooms.erase(it);
+}
+
+std::optional<uint64_t> NetworkPunchServer::findHost(uint32_t room) {
+	std::lock_guard<std::mutex> lock(roomMutex);
+	auto it = hosts.find(room);
+	return it == hosts.end() ? std::nullopt : std::optional<uint64_t>(it->second);
+}
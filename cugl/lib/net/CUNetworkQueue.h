@@ -0,0 +1,94 @@
+//
+// CUNetworkQueue.h
+//
+// Fixed capacity single-producer/single-consumer ring buffer used to hand
+// messages between the game thread and the NetworkConnection I/O thread.
+//
+// Slots are filled and drained in place rather than pushed and popped by
+// value. When T owns a buffer (such as a byte vector), that buffer keeps its
+// capacity between uses, so steady state traffic performs no allocations.
+//
+// This header is an internal header. It is not accessible by general users
+// of the CUGL API.
+//
+// Author: agent
+// Version: 10/17/2026
+//
+#ifndef CU_NETWORK_QUEUE_H
+#define CU_NETWORK_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+namespace cugl {
+	/**
+	 * Lock-free single-producer/single-consumer ring buffer.
+	 *
+	 * Exactly one thread may call the producer methods (prepare/commit) and exactly
+	 * one other thread may call the consumer methods (front/pop).
+	 *
+	 * @tparam T Slot type; must be default constructible
+	 */
+	template <typename T>
+	class NetworkQueue {
+	public:
+		/**
+		 * Create a queue with the given capacity.
+		 *
+		 * @param capacity Number of slots; rounded up to a power of two
+		 */
+		explicit NetworkQueue(size_t capacity) : head(0), tail(0) {
+			size_t size = 1;
+			while (size < capacity) {
+				size <<= 1;
+			}
+			slots.resize(size);
+			mask = size - 1;
+		}
+
+		/**
+		 * Producer: returns the next free slot to fill, or nullptr if the queue is full.
+		 *
+		 * The slot is not visible to the consumer until commit() is called.
+		 */
+		T* prepare() {
+			size_t t = tail.load(std::memory_order_relaxed);
+			if (t - head.load(std::memory_order_acquire) > mask) {
+				return nullptr;
+			}
+			return &slots[t & mask];
+		}
+
+		/** Producer: publish the slot returned by the last call to prepare() */
+		void commit() {
+			tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+		}
+
+		/** Consumer: returns the oldest published slot, or nullptr if the queue is empty */
+		T* front() {
+			size_t h = head.load(std::memory_order_relaxed);
+			if (h == tail.load(std::memory_order_acquire)) {
+				return nullptr;
+			}
+			return &slots[h & mask];
+		}
+
+		/** Consumer: release the slot returned by the last call to front() back to the producer */
+		void pop() {
+			head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+		}
+
+	private:
+		/** Ring storage; size is a power of two */
+		std::vector<T> slots;
+		/** Slot count minus one, for wrapping indices */
+		size_t mask;
+		/** Index of the next slot to consume (only written by the consumer) */
+		std::atomic<size_t> head;
+		/** Index of the next slot to produce (only written by the producer) */
+		std::atomic<size_t> tail;
+	};
+}
+
+#endif // CU_NETWORK_QUEUE_H
@@ -0,0 +1,95 @@
+#include <cugl/net/CUNetworkRollback.h>
+
+#include <algorithm>
+
+using namespace cugl;
+
+/** Empty input, for players with nothing to report */
+static const std::vector<uint8_t> NO_INPUT;
+
+NetworkRollback::NetworkRollback(std::shared_ptr<NetworkConnection> net, Callbacks callbacks,
+	uint32_t maxPrediction, uint32_t inputDelay)
+	: lockstep(net, inputDelay, NetworkLockstep::DEFAULT_REDUNDANCY, std::max<uint32_t>(1, maxPrediction)),
+	callbacks(std::move(callbacks)), maxPrediction(std::max<uint32_t>(1, maxPrediction)), inputDelay(inputDelay),
+	playerID(0), self(0), frame(0), confirmed(0), current(0) {
+	playerID = net->getPlayerID().value_or(0);
+	for (uint32_t p = 0; p <= UINT8_MAX; p++) {
+		auto pID = static_cast<uint8_t>(p);
+		if (pID == playerID || net->isPlayerActive(pID)) {
+			if (pID == playerID) {
+				self = players.size();
+			}
+			players.push_back(pID);
+		}
+	}
+
+	size_t size = this->maxPrediction + inputDelay + 2;
+	states.resize(size);
+	used.resize(size, FrameInputs(players.size()));
+	known.resize(size, FrameInputs(players.size()));
+	local.resize(size);
+	latest.resize(players.size());
+}
+
+void NetworkRollback::update(const std::function<void(const uint8_t*, size_t, uint8_t)>& dispatcher) {
+	lockstep.update(dispatcher);
+
+	uint32_t rollbackTo = frame;
+	while (lockstep.advance()) {
+		uint32_t c = lockstep.getFrame();
+		FrameInputs& inputs = known[c % window()];
+		for (size_t i = 0; i < players.size(); i++) {
+			inputs[i] = lockstep.getInput(players[i]);
+			latest[i] = inputs[i];
+		}
+		if (c < frame && rollbackTo == frame && inputs != used[c % window()]) {
+			rollbackTo = c;
+		}
+		confirmed = c + 1;
+	}
+
+	if (rollbackTo < frame) {
+		callbacks.load(states[rollbackTo % window()]);
+		for (uint32_t f = rollbackTo; f < frame; f++) {
+			simulate(f);
+		}
+	}
+}
+
+bool NetworkRollback::advance(const std::vector<uint8_t>& input) {
+	if (frame >= confirmed + maxPrediction) {
+		return false;
+	}
+	local[(frame + inputDelay) % window()] = input;
+	lockstep.addInput(input);
+	simulate(frame);
+	frame++;
+	return true;
+}
+
+void NetworkRollback::simulate(uint32_t f) {
+	current = f;
+	callbacks.save(states[f % window()]);
+
+	FrameInputs& inputs = used[f % window()];
+	for (size_t i = 0; i < players.size(); i++) {
+		if (f < confirmed) {
+			inputs[i] = known[f % window()][i];
+		} else if (i == self) {
+			inputs[i] = f >= inputDelay ? local[f % window()] : NO_INPUT;
+		} else {
+			// Predict that the player is still doing what they last did
+			inputs[i] = latest[i];
+		}
+	}
+	callbacks.advance(f);
+}
+
+const std::vector<uint8_t>& NetworkRollback::getInput(uint8_t pID) const {
+	for (size_t i = 0; i < players.size(); i++) {
+		if (players[i] == pID) {
+			return used[current % window()][i];
+		}
+	}
+	return NO_INPUT;
+}
@@ -129,6 +129,11 @@ void cugl::NetworkDeserializer::receive(const std::vector<uint8_t>& msg) {
 	pos = 0;
 }
 
+void cugl::NetworkDeserializer::receive(const uint8_t* msg, size_t length) {
+	data.assign(msg, msg + length);
+	pos = 0;
+}
+
 #define DECODE_VEC(T, NAME) \
 case Array + NAME: { \
 	pos++; \
@@ -0,0 +1,686 @@
+#include <cugl/net/CUNetworkServer.h>
+
+#include <cugl/util/CUDebug.h>
+
+#include <algorithm>
+#include <cstring>
+
+#include <slikenet/peerinterface.h>
+
+#include "CUNetworkFraming.h"
+#include "CUNetworkQueue.h"
+
+using namespace cugl;
+using netframing::ROOM_LENGTH;
+using netframing::STANDARD_PREFIX;
+using netframing::SENDER_OFFSET;
+using netframing::toReliability;
+using netframing::toPriority;
+using netframing::toChannel;
+
+/** How long to block on shutdown */
+constexpr unsigned int SHUTDOWN_BLOCK = 10;
+
+/** How long to wait before considering a client disconnected (ms) */
+constexpr size_t DISCONN_TIME = 5000;
+
+/** Number of events and commands queued between the network thread and each worker */
+constexpr size_t SHARD_QUEUE_SIZE = 1024;
+
+/** How long the network and worker threads sleep between polls (ms) */
+constexpr unsigned int SERVER_SLEEP = 1;
+
+/** Number of distinct room IDs */
+constexpr uint32_t MAX_ROOMS = 100000;
+
+struct NetworkServer::Shard {
+	/** Something that happened to one of the worker's rooms */
+	struct Event {
+		enum Kind : uint8_t { Open, Close, Join, Leave, Message } kind;
+		uint32_t room;
+		uint8_t playerID;
+		NetworkConnection::MessageType type;
+		/** Whether data is a batch of messages rather than one message */
+		bool batch;
+		std::vector<uint8_t> data;
+	};
+
+	/** Something a worker wants the network thread to do */
+	struct Command {
+		enum Kind : uint8_t {
+			// Send data to one client, or the whole room if playerID is 0
+			Send,
+			StartGame,
+			// The worker is done with a closed room, so it may be opened again
+			Released
+		} kind;
+		uint32_t room;
+		uint8_t playerID;
+		uint8_t options;
+		std::vector<uint8_t> data;
+	};
+
+	/** The worker */
+	std::thread thread;
+	/** Events for the worker (network thread produces, worker consumes) */
+	NetworkQueue<Event> events;
+	/** Commands for the network thread (worker produces, network thread consumes) */
+	NetworkQueue<Command> commands;
+	/** Events that did not fit in the queue; only touched by the network thread */
+	std::vector<Event> overflow;
+	/** How many of overflow have been moved into the queue */
+	size_t overflowed;
+	/** Whether the slot from the last claimEvent() is in the queue rather than overflow */
+	bool queued;
+	/** Open rooms this worker owns; only touched by the worker */
+	std::vector<uint32_t> rooms;
+
+	Shard() : events(SHARD_QUEUE_SIZE), commands(SHARD_QUEUE_SIZE), overflowed(0), queued(false) {}
+
+	/**
+	 * Network thread: returns an event to fill in; call postEvent() once it is filled.
+	 *
+	 * Never blocks. If the worker is behind, the event waits in overflow instead.
+	 */
+	Event& claimEvent() {
+		Event* slot = overflow.empty() ? events.prepare() : nullptr;
+		queued = slot != nullptr;
+		if (slot == nullptr) {
+			overflow.emplace_back();
+			return overflow.back();
+		}
+		return *slot;
+	}
+
+	/** Network thread: hand the event from claimEvent() to the worker */
+	void postEvent() {
+		if (queued) {
+			events.commit();
+		}
+	}
+
+	/** Network thread: move events that overflowed into the queue, oldest first */
+	void drainOverflow() {
+		for (; overflowed < overflow.size(); overflowed++) {
+			Event* slot = events.prepare();
+			if (slot == nullptr) {
+				return;
+			}
+			std::swap(*slot, overflow[overflowed]);
+			events.commit();
+		}
+		overflow.clear();
+		overflowed = 0;
+	}
+
+	/** Worker: returns a command to fill in; call postCommand() once it is filled */
+	Command& claimCommand() {
+		Command* slot;
+		while ((slot = commands.prepare()) == nullptr) {
+			// Network thread never waits on us, so it will free a slot shortly
+			std::this_thread::yield();
+		}
+		return *slot;
+	}
+
+	/** Worker: hand the command from claimCommand() to the network thread */
+	void postCommand() { commands.commit(); }
+};
+
+NetworkServer::NetworkServer(ServerConfig config, Callbacks callbacks)
+	: config(config), callbacks(std::move(callbacks)), status(NetworkConnection::NetStatus::Pending),
+	epoch(std::chrono::steady_clock::now()), rng(std::random_device()()) {
+	CUAssertLog(config.maxRooms <= MAX_ROOMS, "At most %u rooms can have an ID", MAX_ROOMS);
+	CUAssertLog(config.maxPlayersPerRoom > 0 && config.maxPlayersPerRoom <= UINT8_MAX,
+		"Rooms must hold between 1 and %d clients", UINT8_MAX);
+
+	rooms.resize(std::min(config.maxRooms, MAX_ROOMS));
+	for (auto& room : rooms) {
+		room.open = false;
+		room.started = false;
+		room.numPlayers = 0;
+		room.maxPlayers = 0;
+		room.players.assign(std::min<uint32_t>(config.maxPlayersPerRoom, UINT8_MAX), SLNet::UNASSIGNED_SYSTEM_ADDRESS);
+	}
+	routes.assign(config.maxConnections, { 0, NO_ROOM, 0 });
+	// Hand out the lowest rooms first
+	for (auto i = static_cast<uint32_t>(rooms.size()); i > 0; i--) {
+		freeRooms.push_back(i - 1);
+	}
+
+	peer = std::unique_ptr<SLNet::RakPeerInterface>(SLNet::RakPeerInterface::GetInstance());
+	peer->SetTimeoutTime(DISCONN_TIME, SLNet::UNASSIGNED_SYSTEM_ADDRESS);
+	SLNet::SocketDescriptor socketDescriptor;
+	socketDescriptor.port = config.port;
+	if (peer->Startup(config.maxConnections, &socketDescriptor, 1) != SLNet::RAKNET_STARTED) {
+		CULogError("Could not start room server; is port %d in use?", config.port);
+		status = NetworkConnection::NetStatus::GenericError;
+		return;
+	}
+	peer->SetMaximumIncomingConnections(static_cast<unsigned short>(config.maxConnections));
+
+	// Clients look for us like a LAN host, but we answer for every room
+	std::string answer(netframing::LAN_TAG, sizeof(netframing::LAN_TAG));
+	answer += netframing::SERVER_ROOM;
+	peer->SetOfflinePingResponse(answer.data(), static_cast<unsigned int>(answer.size()));
+	status = NetworkConnection::NetStatus::Connected;
+	CULog("Room server listening on port %d", config.port);
+
+	for (uint32_t i = 0; i < std::max<uint32_t>(1, config.workers); i++) {
+		shards.push_back(std::make_unique<Shard>());
+	}
+	workersRunning = true;
+	netRunning = true;
+	for (auto& shard : shards) {
+		Shard* s = shard.get();
+		shard->thread = std::thread([this, s] { workerLoop(*s); });
+	}
+	netThread = std::thread([this] { netThreadLoop(); });
+}
+
+NetworkServer::~NetworkServer() {
+	if (netThread.joinable()) {
+		workersRunning = false;
+		for (auto& shard : shards) {
+			shard->thread.join();
+		}
+		netRunning = false;
+		netThread.join();
+	}
+	peer->Shutdown(SHUTDOWN_BLOCK);
+	SLNet::RakPeerInterface::DestroyInstance(peer.release());
+}
+
+int64_t NetworkServer::localTime() const {
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - epoch).count();
+}
+
+#pragma region Rooms
+
+std::optional<uint32_t> NetworkServer::openRoom() {
+	std::lock_guard<std::mutex> lock(roomMutex);
+	if (status != NetworkConnection::NetStatus::Connected || freeRooms.empty()) {
+		return std::nullopt;
+	}
+	uint32_t room = freeRooms.back();
+	freeRooms.pop_back();
+
+	std::string code;
+	do {
+		code = std::to_string(rng() % MAX_ROOMS);
+		code.insert(0, ROOM_LENGTH - code.size(), '0');
+	} while (codes.count(code) > 0);
+	codes[code] = room;
+	rooms[room].code = code;
+	pendingRooms.emplace_back(room, true);
+	CULog("Opened room %s", code.c_str());
+	return room;
+}
+
+std::string NetworkServer::getRoomID(uint32_t room) {
+	std::lock_guard<std::mutex> lock(roomMutex);
+	return room < rooms.size() ? rooms[room].code : "";
+}
+
+bool NetworkServer::closeRoom(uint32_t room) {
+	std::lock_guard<std::mutex> lock(roomMutex);
+	if (room >= rooms.size() || rooms[room].code.empty()) {
+		return false;
+	}
+	CULog("Closing room %s", rooms[room].code.c_str());
+	codes.erase(rooms[room].code);
+	rooms[room].code.clear();
+	pendingRooms.emplace_back(room, false);
+	return true;
+}
+
+size_t NetworkServer::getNumRooms() {
+	std::lock_guard<std::mutex> lock(roomMutex);
+	return codes.size();
+}
+
+void NetworkServer::applyRoomChanges() {
+	std::lock_guard<std::mutex> lock(roomMutex);
+	for (auto& change : pendingRooms) {
+		Room& room = rooms[change.first];
+		if (change.second) {
+			room.open = true;
+			room.started = false;
+			room.numPlayers = 1;
+			room.maxPlayers = 1;
+			room.connected.reset();
+			room.connected.set(0);
+		} else {
+			room.open = false;
+			room.connected.reset();
+			for (auto& addr : room.players) {
+				if (addr == SLNet::UNASSIGNED_SYSTEM_ADDRESS) {
+					continue;
+				}
+				if (addr.systemIndex < routes.size()) {
+					routes[addr.systemIndex].room = NO_ROOM;
+				}
+				peer->CloseConnection(addr, true);
+				addr = SLNet::UNASSIGNED_SYSTEM_ADDRESS;
+			}
+		}
+
+		Shard& shard = shardOf(change.first);
+		Shard::Event& e = shard.claimEvent();
+		e.kind = change.second ? Shard::Event::Open : Shard::Event::Close;
+		e.room = change.first;
+		shard.postEvent();
+	}
+	pendingRooms.clear();
+}
+
+#pragma endregion
+
+#pragma region Sending
+
+void NetworkServer::checkWorker(uint32_t room) {
+	CUAssertLog(room < rooms.size() && std::this_thread::get_id() == shardOf(room).thread.get_id(),
+		"Room %u may only be sent to from its own callbacks", room);
+}
+
+void NetworkServer::send(uint32_t room, const std::vector<uint8_t>& msg,
+	NetworkConnection::Delivery delivery, NetworkConnection::Priority priority, uint8_t channel) {
+	sendTo(room, 0, msg, delivery, priority, channel);
+}
+
+void NetworkServer::sendTo(uint32_t room, uint8_t playerID, const std::vector<uint8_t>& msg,
+	NetworkConnection::Delivery delivery, NetworkConnection::Priority priority, uint8_t channel) {
+	checkWorker(room);
+	if (!NetworkConnection::checkChannel(channel)) {
+		return;
+	}
+	Shard& shard = shardOf(room);
+	Shard::Command& c = shard.claimCommand();
+	c.kind = Shard::Command::Send;
+	c.room = room;
+	c.playerID = playerID;
+	c.options = NetworkConnection::packOptions(delivery, priority, channel);
+	c.data.assign(msg.begin(), msg.end());
+	shard.postCommand();
+}
+
+void NetworkServer::startGame(uint32_t room) {
+	checkWorker(room);
+	Shard& shard = shardOf(room);
+	Shard::Command& c = shard.claimCommand();
+	c.kind = Shard::Command::StartGame;
+	c.room = room;
+	shard.postCommand();
+}
+
+void NetworkServer::sendDirect(const SLNet::SystemAddress& addr, const uint8_t* msg, size_t length,
+	NetworkConnection::CustomDataPackets packetType, uint8_t options) {
+	// The server is player 0 in every room
+	uint8_t prefix[STANDARD_PREFIX] = { options, 0 };
+	if (!netframing::sendFramed(peer.get(), static_cast<uint8_t>(ID_USER_PACKET_ENUM + packetType), msg, length,
+		toPriority(options), toReliability(options), toChannel(options), addr, false,
+		prefix, NetworkConnection::hasRoutingPrefix(packetType) ? STANDARD_PREFIX : 0)) {
+		CULogError("Message of %zu bytes exceeds maximum size of %zu; dropping",
+			length, netframing::MAX_MESSAGE_SIZE);
+	}
+}
+
+void NetworkServer::sendRoom(Room& room, const uint8_t* msg, size_t length,
+	NetworkConnection::CustomDataPackets packetType, uint8_t options, uint8_t skip) {
+	for (size_t i = 0; i < room.players.size(); i++) {
+		auto pID = static_cast<uint8_t>(i + 1);
+		if (pID != skip && room.players[i] != SLNet::UNASSIGNED_SYSTEM_ADDRESS) {
+			sendDirect(room.players[i], msg, length, packetType, options);
+		}
+	}
+}
+
+void NetworkServer::relay(Room& room, SLNet::Packet* packet, uint8_t sender) {
+	uint8_t options = packet->data[1];
+	for (size_t i = 0; i < room.players.size(); i++) {
+		auto pID = static_cast<uint8_t>(i + 1);
+		if (pID != sender && room.players[i] != SLNet::UNASSIGNED_SYSTEM_ADDRESS) {
+			peer->Send(reinterpret_cast<const char*>(packet->data), static_cast<int>(packet->length),
+				toPriority(options), toReliability(options), toChannel(options), room.players[i], false);
+		}
+	}
+}
+
+void NetworkServer::runCommands(Shard& shard) {
+	for (Shard::Command* c = shard.commands.front(); c != nullptr; c = shard.commands.front()) {
+		Room& room = rooms[c->room];
+		switch (c->kind) {
+		case Shard::Command::Send:
+			// Anything sent before the worker heard the room closed goes nowhere
+			if (!room.open) {
+				break;
+			}
+			if (c->playerID == 0) {
+				sendRoom(room, c->data.data(), c->data.size(), NetworkConnection::Standard, c->options);
+			} else if (c->playerID <= room.players.size()
+				&& room.players[c->playerID - 1] != SLNet::UNASSIGNED_SYSTEM_ADDRESS) {
+				sendDirect(room.players[c->playerID - 1], c->data.data(), c->data.size(),
+					NetworkConnection::Standard, c->options);
+			}
+			break;
+		case Shard::Command::StartGame:
+			if (room.open && !room.started) {
+				room.started = true;
+				room.maxPlayers = room.numPlayers;
+				sendRoom(room, nullptr, 0, NetworkConnection::StartGame);
+			}
+			break;
+		case Shard::Command::Released: {
+			std::lock_guard<std::mutex> lock(roomMutex);
+			freeRooms.push_back(c->room);
+			break;
+		}
+		}
+		shard.commands.pop();
+	}
+}
+
+#pragma endregion
+
+#pragma region Threads
+
+void NetworkServer::netThreadLoop() {
+	while (netRunning) {
+		for (auto& shard : shards) {
+			shard->drainOverflow();
+		}
+		applyRoomChanges();
+		for (auto& shard : shards) {
+			runCommands(*shard);
+		}
+
+		for (SLNet::Packet* packet = peer->Receive(); packet != nullptr;
+			peer->DeallocatePacket(packet), packet = peer->Receive()) {
+			handlePacket(packet);
+		}
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(SERVER_SLEEP));
+	}
+}
+
+void NetworkServer::workerLoop(Shard& shard) {
+	auto interval = std::chrono::milliseconds(config.tickInterval);
+	auto nextTick = std::chrono::steady_clock::now() + interval;
+	while (workersRunning) {
+		for (Shard::Event* e = shard.events.front(); e != nullptr; e = shard.events.front()) {
+			switch (e->kind) {
+			case Shard::Event::Open:
+				shard.rooms.push_back(e->room);
+				if (callbacks.open) {
+					callbacks.open(e->room);
+				}
+				break;
+			case Shard::Event::Close: {
+				if (callbacks.close) {
+					callbacks.close(e->room);
+				}
+				shard.rooms.erase(std::find(shard.rooms.begin(), shard.rooms.end(), e->room));
+				Shard::Command& c = shard.claimCommand();
+				c.kind = Shard::Command::Released;
+				c.room = e->room;
+				shard.postCommand();
+				break;
+			}
+			case Shard::Event::Join:
+				if (callbacks.join) {
+					callbacks.join(e->room, e->playerID);
+				}
+				break;
+			case Shard::Event::Leave:
+				if (callbacks.leave) {
+					callbacks.leave(e->room, e->playerID);
+				}
+				break;
+			case Shard::Event::Message:
+				if (!callbacks.message) {
+					break;
+				}
+				if (!e->batch) {
+					callbacks.message(e->room, e->data.data(), e->data.size(), e->playerID, e->type);
+				} else if (!netframing::readBatch(e->data.data(), e->data.size(), [&](const uint8_t* msg, size_t length) {
+					callbacks.message(e->room, msg, length, e->playerID, e->type);
+				})) {
+					CULogError("Received malformed batch; dropping the rest of it");
+				}
+				break;
+			}
+			shard.events.pop();
+		}
+
+		auto now = std::chrono::steady_clock::now();
+		if (config.tickInterval > 0 && now >= nextTick) {
+			// Skip ticks rather than run a burst of them after a stall
+			nextTick = std::max(nextTick + interval, now);
+			if (callbacks.update) {
+				for (uint32_t room : shard.rooms) {
+					callbacks.update(room);
+				}
+			}
+		}
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(SERVER_SLEEP));
+	}
+}
+
+#pragma endregion
+
+#pragma region Packet Handling
+
+/**
+ * Locate the payload of a packet without copying it.
+ *
+ * @param packet The packet to read
+ * @param prefixSize Size of the routing prefix this packet type carries
+ * @param msg Set to the start of the payload inside the packet buffer
+ * @param length Set to the length of the payload
+ * @returns Whether the header was well formed
+ */
+static bool readPayload(const SLNet::Packet* packet, size_t prefixSize, const uint8_t*& msg, size_t& length) {
+	size_t headerSize;
+	if (!netframing::readHeader(packet->data, packet->length, headerSize, length, prefixSize)) {
+		CULogError("Received malformed message of type %d; ignoring", packet->data[0]);
+		return false;
+	}
+	msg = packet->data + headerSize;
+	return true;
+}
+
+NetworkServer::Route* NetworkServer::routeOf(SLNet::Packet* packet) {
+	SLNet::SystemIndex index = packet->systemAddress.systemIndex;
+	if (index >= routes.size() || routes[index].room == NO_ROOM || routes[index].guid != packet->guid.g) {
+		return nullptr;
+	}
+	return &routes[index];
+}
+
+void NetworkServer::joinRoom(SLNet::Packet* packet, const uint8_t* msg, size_t length) {
+	SLNet::SystemIndex index = packet->systemAddress.systemIndex;
+	if (index >= routes.size() || routeOf(packet) != nullptr) {
+		CULogError("Unexpected room request; ignoring");
+		return;
+	}
+
+	// Pick up rooms opened since the start of this loop, so they can be joined right away
+	applyRoomChanges();
+	std::string code(reinterpret_cast<const char*>(msg), length);
+	std::optional<uint32_t> slot;
+	{
+		std::lock_guard<std::mutex> lock(roomMutex);
+		auto it = codes.find(code);
+		if (it != codes.end()) {
+			slot = it->second;
+		}
+	}
+
+	std::optional<uint8_t> pID;
+	if (slot.has_value() && rooms[*slot].open
+		&& (!rooms[*slot].started || rooms[*slot].numPlayers < rooms[*slot].maxPlayers)) {
+		Room& room = rooms[*slot];
+		for (size_t i = 0; i < room.players.size(); i++) {
+			if (room.players[i] == SLNet::UNASSIGNED_SYSTEM_ADDRESS) {
+				pID = static_cast<uint8_t>(i + 1);
+				break;
+			}
+		}
+	}
+	if (!pID.has_value()) {
+		CULog("Client could not join room %s; it is closed or full", code.c_str());
+		sendDirect(packet->systemAddress, nullptr, 0, NetworkConnection::JoinRoomFail);
+		peer->CloseConnection(packet->systemAddress, true);
+		return;
+	}
+
+	Room& room = rooms[*slot];
+	room.players[*pID - 1] = packet->systemAddress;
+	routes[index] = { packet->guid.g, *slot, *pID };
+	if (!room.started) {
+		room.maxPlayers++;
+	}
+
+	// Same as NetworkConnection::joinInfo(), with the server as host
+	std::vector<uint8_t> info = { static_cast<uint8_t>(room.numPlayers + 1), room.maxPlayers, *pID,
+		config.apiVersion, 0 };
+	for (size_t i = 1; i < room.connected.size(); i++) {
+		if (room.connected.test(i)) {
+			info.push_back(static_cast<uint8_t>(i));
+		}
+	}
+	sendDirect(packet->systemAddress, info.data(), info.size(),
+		room.started ? NetworkConnection::Reconnect : NetworkConnection::JoinRoom);
+}
+
+void NetworkServer::confirmPlayer(Route& route, SLNet::Packet* packet, const uint8_t* msg, size_t length) {
+	if (length < 2 || msg[0] != route.playerID || msg[1] == 0) {
+		CULog("Client reported the wrong player ID or API version; disconnecting");
+		peer->CloseConnection(packet->systemAddress, true);
+		return;
+	}
+	Room& room = rooms[route.room];
+	uint8_t pID = route.playerID;
+	if (room.connected.test(pID)) {
+		return;
+	}
+
+	sendRoom(room, &pID, 1, NetworkConnection::PlayerJoined, NetworkConnection::DEFAULT_OPTIONS, pID);
+	room.connected.set(pID);
+	room.numPlayers++;
+
+	Shard& shard = shardOf(route.room);
+	Shard::Event& e = shard.claimEvent();
+	e.kind = Shard::Event::Join;
+	e.room = route.room;
+	e.playerID = pID;
+	shard.postEvent();
+}
+
+void NetworkServer::removePlayer(SLNet::Packet* packet) {
+	Route* route = routeOf(packet);
+	if (route == nullptr) {
+		return;
+	}
+	uint32_t slot = route->room;
+	uint8_t pID = route->playerID;
+	Room& room = rooms[slot];
+	room.players[pID - 1] = SLNet::UNASSIGNED_SYSTEM_ADDRESS;
+	route->room = NO_ROOM;
+	if (!room.connected.test(pID)) {
+		return;
+	}
+
+	room.connected.reset(pID);
+	room.numPlayers--;
+	sendRoom(room, &pID, 1, NetworkConnection::PlayerLeft);
+
+	Shard& shard = shardOf(slot);
+	Shard::Event& e = shard.claimEvent();
+	e.kind = Shard::Event::Leave;
+	e.room = slot;
+	e.playerID = pID;
+	shard.postEvent();
+}
+
+void NetworkServer::postMessage(const Route& route, const uint8_t* msg, size_t length,
+	NetworkConnection::CustomDataPackets packetType) {
+	Shard& shard = shardOf(route.room);
+	Shard::Event& e = shard.claimEvent();
+	e.kind = Shard::Event::Message;
+	e.room = route.room;
+	e.playerID = route.playerID;
+	e.type = packetType == NetworkConnection::Standard || packetType == NetworkConnection::StandardBatch
+		? NetworkConnection::MessageType::Standard : NetworkConnection::MessageType::DirectToHost;
+	e.batch = packetType == NetworkConnection::StandardBatch || packetType == NetworkConnection::DirectToHostBatch;
+	e.data.assign(msg, msg + length);
+	shard.postEvent();
+}
+
+void NetworkServer::handlePacket(SLNet::Packet* packet) {
+	const uint8_t* msg;
+	size_t length;
+	switch (packet->data[0]) {
+	case ID_NEW_INCOMING_CONNECTION:
+	case ID_UNCONNECTED_PING:
+		// Nothing to do until the client asks for a room; RakNet answers LAN queries itself
+		break;
+	case ID_DISCONNECTION_NOTIFICATION:
+	case ID_CONNECTION_LOST:
+		removePlayer(packet);
+		break;
+	case ID_USER_PACKET_ENUM + NetworkConnection::RoomRequest:
+		if (readPayload(packet, 0, msg, length)) {
+			joinRoom(packet, msg, length);
+		}
+		break;
+	case ID_USER_PACKET_ENUM + NetworkConnection::JoinRoom:
+	case ID_USER_PACKET_ENUM + NetworkConnection::Reconnect: {
+		Route* route = routeOf(packet);
+		if (route != nullptr && readPayload(packet, 0, msg, length)) {
+			confirmPlayer(*route, packet, msg, length);
+		}
+		break;
+	}
+	case ID_USER_PACKET_ENUM + NetworkConnection::Standard:
+	case ID_USER_PACKET_ENUM + NetworkConnection::StandardBatch:
+	case ID_USER_PACKET_ENUM + NetworkConnection::DirectToHost:
+	case ID_USER_PACKET_ENUM + NetworkConnection::DirectToHostBatch: {
+		auto packetType = static_cast<NetworkConnection::CustomDataPackets>(packet->data[0] - ID_USER_PACKET_ENUM);
+		bool standard = packetType == NetworkConnection::Standard || packetType == NetworkConnection::StandardBatch;
+		Route* route = routeOf(packet);
+		if (route == nullptr || !rooms[route->room].connected.test(route->playerID)) {
+			CULogError("Received message from unknown connection; ignoring");
+			break;
+		}
+		if (!readPayload(packet, standard ? STANDARD_PREFIX : 0, msg, length)) {
+			break;
+		}
+		if (standard) {
+			// Forward before the worker sees it, so game code never adds relay latency
+			packet->data[SENDER_OFFSET] = route->playerID;
+			relay(rooms[route->room], packet, route->playerID);
+		}
+		postMessage(*route, msg, length, packetType);
+		break;
+	}
+	case ID_USER_PACKET_ENUM + NetworkConnection::ClockPing: {
+		if (!readPayload(packet, 0, msg, length) || length != sizeof(int64_t)) {
+			break;
+		}
+		// Answer immediately and unreliably; a late reply is worse than none
+		uint8_t reply[2 * sizeof(int64_t)];
+		std::memcpy(reply, msg, sizeof(int64_t));
+		netframing::writeTime(reply + sizeof(int64_t), localTime());
+		sendDirect(packet->systemAddress, reply, sizeof(reply), NetworkConnection::ClockPong,
+			NetworkConnection::packOptions(NetworkConnection::Delivery::Unreliable, NetworkConnection::Priority::Immediate, 0));
+		break;
+	}
+	default:
+		CULog("Received unknown message: %d", packet->data[0]);
+		break;
+	}
+}
+
+#pragma endregion
@@ -0,0 +1,195 @@
+//
+// CUNetworkTransport.h
+//
+// The packet transport underneath NetworkConnection.
+//
+// NetworkConnection only ever uses a small part of SLNet::RakPeerInterface.
+// That part is gathered into an interface here, with the same method names,
+// arguments and results, so that the connection code reads the same whatever
+// carries its packets. RakNetTransport hands every call to a real RakPeer and
+// its UDP sockets. NetworkLoopback provides another implementation that
+// delivers packets between connections in the same process, and
+// ImpairedTransport (CUNetworkImpairment.h) wraps either one to simulate
+// latency, loss and the like on each link.
+//
+// This header is an internal header. It is not accessible by general users
+// of the CUGL API.
+//
+// Author: agent
+// Version: 10/17/2026
+//
+#ifndef CU_NETWORK_TRANSPORT_H
+#define CU_NETWORK_TRANSPORT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include <slikenet/peerinterface.h>
+#include <slikenet/PacketPriority.h>
+#include <slikenet/statistics.h>
+
+namespace cugl {
+	class NetworkLoopback;
+
+	/** Number of RakNet ordering channels */
+	constexpr size_t NUM_STREAMS = 32;
+
+	/** Least time before a lost reliable packet is resent (us), beyond a round trip */
+	constexpr int64_t MIN_RESEND = 20000;
+
+	/** Returns whether a reliability guarantees delivery */
+	inline bool isReliable(uint8_t reliability) {
+		switch (reliability) {
+		case RELIABLE:
+		case RELIABLE_ORDERED:
+		case RELIABLE_SEQUENCED:
+		case RELIABLE_WITH_ACK_RECEIPT:
+		case RELIABLE_ORDERED_WITH_ACK_RECEIPT:
+			return true;
+		default:
+			return false;
+		}
+	}
+
+	/** Returns whether a reliability keeps messages on a channel in the order they were sent */
+	inline bool isOrdered(uint8_t reliability) {
+		return reliability == RELIABLE_ORDERED || reliability == RELIABLE_ORDERED_WITH_ACK_RECEIPT;
+	}
+
+	/** Returns whether a reliability drops messages older than one already delivered on their channel */
+	inline bool isSequenced(uint8_t reliability) {
+		return reliability == UNRELIABLE_SEQUENCED || reliability == RELIABLE_SEQUENCED;
+	}
+
+	/** Returns whether a reliability asks for ID_SND_RECEIPT_ACKED */
+	inline bool wantsReceipt(uint8_t reliability) {
+		return reliability == UNRELIABLE_WITH_ACK_RECEIPT || reliability == RELIABLE_WITH_ACK_RECEIPT
+			|| reliability == RELIABLE_ORDERED_WITH_ACK_RECEIPT;
+	}
+
+	/**
+	 * Everything NetworkConnection needs from a RakPeer.
+	 *
+	 * Each method behaves as the method of the same name on SLNet::RakPeerInterface.
+	 * Implementations must allow Send() and SendList() from one thread while another
+	 * thread calls Receive(), as RakPeer does.
+	 */
+	class NetworkTransport {
+	public:
+		virtual ~NetworkTransport() = default;
+
+		virtual SLNet::StartupResult Startup(unsigned int maxConnections,
+			SLNet::SocketDescriptor* socketDescriptors, unsigned socketDescriptorCount) = 0;
+		virtual void Shutdown(unsigned int blockDuration) = 0;
+		virtual void SetMaximumIncomingConnections(unsigned short numberAllowed) = 0;
+		virtual void SetTimeoutTime(SLNet::TimeMS timeMS, const SLNet::SystemAddress& target) = 0;
+		virtual void SetOfflinePingResponse(const char* data, const unsigned int length) = 0;
+		virtual void AttachPlugin(SLNet::PluginInterface2* plugin) = 0;
+
+		virtual SLNet::ConnectionAttemptResult Connect(const char* host, unsigned short remotePort,
+			const char* passwordData, int passwordDataLength) = 0;
+		virtual void CloseConnection(const SLNet::AddressOrGUID target, bool sendDisconnectionNotification) = 0;
+		virtual SLNet::ConnectionState GetConnectionState(const SLNet::AddressOrGUID systemIdentifier) = 0;
+		virtual unsigned short NumberOfConnections() const = 0;
+		virtual const SLNet::RakNetGUID& GetGuidFromSystemAddress(const SLNet::SystemAddress input) const = 0;
+		virtual SLNet::SystemAddress GetMyBoundAddress() = 0;
+
+		virtual uint32_t Send(const char* data, const int length, PacketPriority priority,
+			PacketReliability reliability, char orderingChannel,
+			const SLNet::AddressOrGUID systemIdentifier, bool broadcast) = 0;
+		virtual uint32_t SendList(const char** data, const int* lengths, const int numParameters,
+			PacketPriority priority, PacketReliability reliability, char orderingChannel,
+			const SLNet::AddressOrGUID systemIdentifier, bool broadcast) = 0;
+		virtual SLNet::Packet* Receive() = 0;
+		virtual void DeallocatePacket(SLNet::Packet* packet) = 0;
+
+		virtual void Ping(const SLNet::SystemAddress& target) = 0;
+		virtual bool Ping(const char* host, unsigned short remotePort, bool onlyReplyOnAcceptingConnections) = 0;
+		virtual int GetAveragePing(const SLNet::AddressOrGUID systemIdentifier) = 0;
+		virtual int GetLastPing(const SLNet::AddressOrGUID systemIdentifier) const = 0;
+		virtual SLNet::RakNetStatistics* GetStatistics(const SLNet::SystemAddress systemAddress,
+			SLNet::RakNetStatistics* rns) = 0;
+	};
+
+	/** Transport over UDP, through a RakPeer of its own */
+	class RakNetTransport : public NetworkTransport {
+	public:
+		RakNetTransport() : peer(SLNet::RakPeerInterface::GetInstance()) {}
+		~RakNetTransport() override { SLNet::RakPeerInterface::DestroyInstance(peer); }
+
+		SLNet::StartupResult Startup(unsigned int maxConnections,
+			SLNet::SocketDescriptor* socketDescriptors, unsigned socketDescriptorCount) override {
+			return peer->Startup(maxConnections, socketDescriptors, socketDescriptorCount);
+		}
+		void Shutdown(unsigned int blockDuration) override { peer->Shutdown(blockDuration); }
+		void SetMaximumIncomingConnections(unsigned short numberAllowed) override {
+			peer->SetMaximumIncomingConnections(numberAllowed);
+		}
+		void SetTimeoutTime(SLNet::TimeMS timeMS, const SLNet::SystemAddress& target) override {
+			peer->SetTimeoutTime(timeMS, target);
+		}
+		void SetOfflinePingResponse(const char* data, const unsigned int length) override {
+			peer->SetOfflinePingResponse(data, length);
+		}
+		void AttachPlugin(SLNet::PluginInterface2* plugin) override { peer->AttachPlugin(plugin); }
+
+		SLNet::ConnectionAttemptResult Connect(const char* host, unsigned short remotePort,
+			const char* passwordData, int passwordDataLength) override {
+			return peer->Connect(host, remotePort, passwordData, passwordDataLength);
+		}
+		void CloseConnection(const SLNet::AddressOrGUID target, bool sendDisconnectionNotification) override {
+			peer->CloseConnection(target, sendDisconnectionNotification);
+		}
+		SLNet::ConnectionState GetConnectionState(const SLNet::AddressOrGUID systemIdentifier) override {
+			return peer->GetConnectionState(systemIdentifier);
+		}
+		unsigned short NumberOfConnections() const override { return peer->NumberOfConnections(); }
+		const SLNet::RakNetGUID& GetGuidFromSystemAddress(const SLNet::SystemAddress input) const override {
+			return peer->GetGuidFromSystemAddress(input);
+		}
+		SLNet::SystemAddress GetMyBoundAddress() override { return peer->GetMyBoundAddress(); }
+
+		uint32_t Send(const char* data, const int length, PacketPriority priority,
+			PacketReliability reliability, char orderingChannel,
+			const SLNet::AddressOrGUID systemIdentifier, bool broadcast) override {
+			return peer->Send(data, length, priority, reliability, orderingChannel, systemIdentifier, broadcast);
+		}
+		uint32_t SendList(const char** data, const int* lengths, const int numParameters,
+			PacketPriority priority, PacketReliability reliability, char orderingChannel,
+			const SLNet::AddressOrGUID systemIdentifier, bool broadcast) override {
+			return peer->SendList(data, lengths, numParameters, priority, reliability, orderingChannel,
+				systemIdentifier, broadcast);
+		}
+		SLNet::Packet* Receive() override { return peer->Receive(); }
+		void DeallocatePacket(SLNet::Packet* packet) override { peer->DeallocatePacket(packet); }
+
+		void Ping(const SLNet::SystemAddress& target) override { peer->Ping(target); }
+		bool Ping(const char* host, unsigned short remotePort, bool onlyReplyOnAcceptingConnections) override {
+			return peer->Ping(host, remotePort, onlyReplyOnAcceptingConnections);
+		}
+		int GetAveragePing(const SLNet::AddressOrGUID systemIdentifier) override {
+			return peer->GetAveragePing(systemIdentifier);
+		}
+		int GetLastPing(const SLNet::AddressOrGUID systemIdentifier) const override {
+			return peer->GetLastPing(systemIdentifier);
+		}
+		SLNet::RakNetStatistics* GetStatistics(const SLNet::SystemAddress systemAddress,
+			SLNet::RakNetStatistics* rns) override {
+			return peer->GetStatistics(systemAddress, rns);
+		}
+
+	private:
+		/** The real peer */
+		SLNet::RakPeerInterface* peer;
+	};
+
+	/**
+	 * Returns a transport that runs on the given simulated network instead of UDP.
+	 *
+	 * Defined alongside NetworkLoopback.
+	 */
+	std::unique_ptr<NetworkTransport> openLoopback(const std::shared_ptr<NetworkLoopback>& network);
+}
+
+#endif // CU_NETWORK_TRANSPORT_H
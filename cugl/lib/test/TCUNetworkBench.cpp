@@ -0,0 +1,273 @@
+#include "TCUNetworkBench.h"
+
+#include <cugl/net/CUNetworkConnection.h>
+#include <cugl/net/CUNetworkPunchServer.h>
+#include <cugl/util/CUDebug.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <vector>
+
+/** Messages each player may have in flight, per other player */
+constexpr size_t BENCH_WINDOW = 16;
+/** Bytes in each benchmark message: send time, then padding up to a typical game update */
+constexpr size_t BENCH_MESSAGE = 64;
+/** How long to run before measuring (ms) */
+constexpr long long BENCH_WARMUP = 500;
+/** How long to wait for everyone to join (ms) */
+constexpr long long BENCH_JOIN_TIMEOUT = 10000;
+/** Most latency samples kept per run, so recording them never allocates */
+constexpr size_t BENCH_SAMPLES = 1 << 22;
+/** How long the load test waits for every host, then every client, before giving up (ms) */
+constexpr long long LOAD_TIMEOUT = 60000;
+
+using namespace cugl;
+
+/** Microseconds on the steady clock */
+static int64_t benchNow() {
+	return std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/** Returns the given percentile of sorted samples (us), in ms */
+static double percentile(const std::vector<int64_t>& sorted, double p) {
+	if (sorted.empty()) {
+		return 0;
+	}
+	size_t i = std::min(sorted.size() - 1, static_cast<size_t>(p * sorted.size()));
+	return sorted[i] / 1000.0;
+}
+
+NetworkBenchResult cugl::benchmarkRelay(size_t players, const NetworkLoopback::LinkConfig& link, double seconds,
+	const std::function<uint64_t()>& allocations) {
+	NetworkBenchResult result = {};
+	result.players = players;
+
+	NetworkConnection::ConnectionConfig config("", 0, static_cast<uint32_t>(players), 0);
+	config.loopback = std::make_shared<NetworkLoopback>(link);
+	std::vector<std::unique_ptr<NetworkConnection>> nets;
+	nets.push_back(std::make_unique<NetworkConnection>(config));
+	for (size_t i = 1; i < players; i++) {
+		nets.push_back(std::make_unique<NetworkConnection>(config, nets[0]->getRoomID()));
+	}
+
+	// Messages each player has sent, and how many of those the others have received
+	std::vector<uint64_t> sent(players, 0);
+	std::vector<uint64_t> delivered(players, 0);
+	std::vector<int64_t> samples;
+	samples.reserve(BENCH_SAMPLES);
+	bool measuring = false;
+	uint64_t received = 0;
+
+	// Made once, as wrapping the lambda on every receive() would allocate
+	std::function<void(const uint8_t*, size_t, uint8_t, NetworkConnection::MessageType)> dispatcher =
+		[&](const uint8_t* msg, size_t length, uint8_t sender, NetworkConnection::MessageType /*type*/) {
+		if (length != BENCH_MESSAGE || sender >= players) {
+			return;
+		}
+		delivered[sender]++;
+		if (!measuring) {
+			return;
+		}
+		int64_t stamp;
+		std::memcpy(&stamp, msg, sizeof(stamp));
+		received++;
+		if (samples.size() < BENCH_SAMPLES) {
+			samples.push_back(benchNow() - stamp);
+		}
+	};
+	auto pump = [&] {
+		for (auto& net : nets) {
+			net->receive(dispatcher);
+		}
+	};
+
+	auto start = benchNow();
+	while (benchNow() - start < BENCH_JOIN_TIMEOUT * 1000) {
+		pump();
+		if (std::all_of(nets.begin(), nets.end(), [&](auto& net) {
+			return net->getStatus() == NetworkConnection::NetStatus::Connected && net->getNumPlayers() == players;
+		})) {
+			break;
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	if (nets[0]->getNumPlayers() != players) {
+		CULogError("Only %d of %zu players joined the benchmark", nets[0]->getNumPlayers(), players);
+		return result;
+	}
+
+	// Reused for every send, so the benchmark itself allocates nothing per message
+	std::vector<uint8_t> msg(BENCH_MESSAGE, 0);
+	auto run = [&](long long duration) {
+		auto end = benchNow() + duration;
+		while (benchNow() < end) {
+			for (size_t i = 0; i < players; i++) {
+				auto id = nets[i]->getPlayerID();
+				if (!id.has_value()) {
+					continue;
+				}
+				while (sent[*id] * (players - 1) - delivered[*id] < BENCH_WINDOW * (players - 1)) {
+					int64_t stamp = benchNow();
+					std::memcpy(msg.data(), &stamp, sizeof(stamp));
+					nets[i]->send(msg);
+					sent[*id]++;
+				}
+			}
+			pump();
+		}
+	};
+
+	run(BENCH_WARMUP * 1000);
+	uint64_t allocsBefore = allocations ? allocations() : 0;
+	uint64_t sentBefore = 0;
+	for (auto count : sent) {
+		sentBefore += count;
+	}
+	measuring = true;
+	auto duration = static_cast<long long>(seconds * 1000000);
+	run(duration);
+	measuring = false;
+	uint64_t allocsAfter = allocations ? allocations() : 0;
+	uint64_t sentDuring = 0;
+	for (auto count : sent) {
+		sentDuring += count;
+	}
+	sentDuring -= sentBefore;
+
+	std::sort(samples.begin(), samples.end());
+	result.messagesPerSecond = received / seconds;
+	result.p50 = percentile(samples, 0.5);
+	result.p90 = percentile(samples, 0.9);
+	result.p99 = percentile(samples, 0.99);
+	result.allocationsPerMessage = sentDuring > 0 && allocations
+		? static_cast<double>(allocsAfter - allocsBefore) / sentDuring : 0;
+	return result;
+}
+
+void cugl::networkBenchmark(const NetworkLoopback::LinkConfig& link, double seconds,
+	const std::function<uint64_t()>& allocations) {
+	CULog("Relay benchmark: latency %.1f ms, jitter %.1f ms, loss %.1f%%, bandwidth %.0f B/s, %.1f s per run",
+		link.latency, link.jitter, link.loss * 100, link.bandwidth, seconds);
+	CULog("players     msgs/s    p50 ms    p90 ms    p99 ms  allocs/msg");
+	for (size_t players : { 2, 4, 8, 16 }) {
+		auto r = benchmarkRelay(players, link, seconds, allocations);
+		CULog("%7zu %10.0f %9.2f %9.2f %9.2f %11.2f",
+			r.players, r.messagesPerSecond, r.p50, r.p90, r.p99, r.allocationsPerMessage);
+	}
+}
+
+/** Returns the given percentile of handshake times (s), in ms */
+static double handshakePercentile(std::vector<double>& times, double p) {
+	if (times.empty()) {
+		return 0;
+	}
+	std::sort(times.begin(), times.end());
+	return times[std::min(times.size() - 1, static_cast<size_t>(p * times.size()))] * 1000;
+}
+
+PunchLoadResult cugl::loadTestPunchServer(size_t pairs, uint16_t port) {
+	PunchLoadResult result = {};
+	result.pairs = pairs;
+
+	NetworkPunchServer::ServerConfig serverConfig(port);
+	serverConfig.maxConnections = static_cast<uint32_t>(2 * pairs);
+	NetworkPunchServer server(serverConfig);
+	if (server.getStatus() != NetworkConnection::NetStatus::Connected) {
+		return result;
+	}
+
+	NetworkConnection::ConnectionConfig config("127.0.0.1", port, 2, 0);
+	std::function<void(const uint8_t*, size_t, uint8_t, NetworkConnection::MessageType)> ignore =
+		[](const uint8_t*, size_t, uint8_t, NetworkConnection::MessageType) {};
+
+	// Receive on every connection until each is done one way or the other, returning how long that took (s)
+	auto settle = [&](std::vector<std::unique_ptr<NetworkConnection>>& nets, int64_t start,
+		const std::function<bool(NetworkConnection&)>& done) {
+		int64_t last = start;
+		std::vector<bool> settled(nets.size(), false);
+		size_t remaining = nets.size();
+		while (remaining > 0 && benchNow() - start < LOAD_TIMEOUT * 1000) {
+			for (size_t i = 0; i < nets.size(); i++) {
+				nets[i]->receive(ignore);
+				if (settled[i]) {
+					continue;
+				}
+				auto status = nets[i]->getStatus();
+				if (done(*nets[i]) || (status != NetworkConnection::NetStatus::Pending
+					&& status != NetworkConnection::NetStatus::Connected)) {
+					settled[i] = true;
+					remaining--;
+					last = benchNow();
+				}
+			}
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+		return (last - start) / 1000000.0;
+	};
+
+	std::vector<std::unique_ptr<NetworkConnection>> hosts;
+	int64_t start = benchNow();
+	for (size_t i = 0; i < pairs; i++) {
+		hosts.push_back(std::make_unique<NetworkConnection>(config));
+	}
+	double hosting = settle(hosts, start, [](NetworkConnection& net) {
+		return net.getStatus() == NetworkConnection::NetStatus::Connected;
+	});
+	std::vector<double> roomTimes;
+	for (auto& host : hosts) {
+		auto times = host->getHandshakeTimes();
+		if (host->getStatus() == NetworkConnection::NetStatus::Connected && times.roomAssigned.has_value()) {
+			roomTimes.push_back(*times.roomAssigned);
+		}
+	}
+	result.hosted = roomTimes.size();
+	result.roomsPerSecond = hosting > 0 ? result.hosted / hosting : 0;
+	result.roomP50 = handshakePercentile(roomTimes, 0.5);
+	result.roomP99 = handshakePercentile(roomTimes, 0.99);
+
+	std::vector<std::unique_ptr<NetworkConnection>> clients;
+	start = benchNow();
+	for (auto& host : hosts) {
+		if (host->getStatus() == NetworkConnection::NetStatus::Connected) {
+			clients.push_back(std::make_unique<NetworkConnection>(config, host->getRoomID()));
+		}
+	}
+	// Hosts must keep receiving too, to let their clients in
+	std::vector<std::unique_ptr<NetworkConnection>> everyone;
+	for (auto& client : clients) {
+		everyone.push_back(std::move(client));
+	}
+	size_t numClients = everyone.size();
+	for (auto& host : hosts) {
+		everyone.push_back(std::move(host));
+	}
+	double joining = settle(everyone, start, [&](NetworkConnection& net) {
+		return net.getNumPlayers() == 2 && net.getPlayerID().has_value();
+	});
+	std::vector<double> joinTimes;
+	for (size_t i = 0; i < numClients; i++) {
+		auto times = everyone[i]->getHandshakeTimes();
+		if (everyone[i]->getStatus() == NetworkConnection::NetStatus::Connected && times.connected.has_value()) {
+			joinTimes.push_back(*times.connected);
+		}
+	}
+	result.joined = joinTimes.size();
+	result.joinsPerSecond = joining > 0 ? result.joined / joining : 0;
+	result.joinP50 = handshakePercentile(joinTimes, 0.5);
+	result.joinP90 = handshakePercentile(joinTimes, 0.9);
+	result.joinP99 = handshakePercentile(joinTimes, 0.99);
+	return result;
+}
+
+void cugl::punchServerLoadTest(size_t pairs, uint16_t port) {
+	auto r = loadTestPunchServer(pairs, port);
+	CULog("Punchthrough server load test: %zu host and client pairs on port %d", r.pairs, port);
+	CULog("Rooms: %zu assigned, %.0f per second, p50 %.1f ms, p99 %.1f ms",
+		r.hosted, r.roomsPerSecond, r.roomP50, r.roomP99);
+	CULog("Joins: %zu connected, %.0f per second, p50 %.1f ms, p90 %.1f ms, p99 %.1f ms",
+		r.joined, r.joinsPerSecond, r.joinP50, r.joinP90, r.joinP99);
+}
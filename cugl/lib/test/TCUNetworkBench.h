@@ -0,0 +1,75 @@
+#ifndef __T_CU_NETWORK_BENCH_H__
+#define __T_CU_NETWORK_BENCH_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+#include <cugl/net/CUNetworkLoopback.h>
+
+namespace cugl {
+	/** Results of one benchmark run */
+	struct NetworkBenchResult {
+		/** Players in the game, host included */
+		size_t players;
+		/** Messages received per second, across every player */
+		double messagesPerSecond;
+		/** Latency from send() to receive() (ms), at the 50th, 90th and 99th percentiles */
+		double p50, p90, p99;
+		/** Heap allocations per message sent, each received by every other player */
+		double allocationsPerMessage;
+	};
+
+	/**
+	 * Play a game of the given size on a NetworkLoopback, with every player sending as fast as
+	 * the others keep up, and measure how it goes.
+	 *
+	 * Messages between clients go through the host's relay. Each player keeps at most a fixed
+	 * number of its messages in flight, so latencies include time spent queued.
+	 *
+	 * @param players Players in the game, host included, from 2 up
+	 * @param link Conditions on the network
+	 * @param seconds How long to measure for, after a short warm up
+	 * @param allocations Returns how many heap allocations this process has made so far, or
+	 *                    nullptr to skip counting them
+	 */
+	NetworkBenchResult benchmarkRelay(size_t players, const NetworkLoopback::LinkConfig& link, double seconds,
+		const std::function<uint64_t()>& allocations);
+
+	/** Run benchmarkRelay() for 2, 4, 8 and 16 players, logging each result */
+	void networkBenchmark(const NetworkLoopback::LinkConfig& link, double seconds,
+		const std::function<uint64_t()>& allocations);
+
+	/** Results of one punchthrough server load test */
+	struct PunchLoadResult {
+		/** Host and client pairs started */
+		size_t pairs;
+		/** Hosts that got a room, and clients that joined theirs */
+		size_t hosted, joined;
+		/** Rooms assigned per second, from starting the first host to the last room */
+		double roomsPerSecond;
+		/** Time from starting a host to getting its room (ms), at the 50th and 99th percentiles */
+		double roomP50, roomP99;
+		/** Clients joined per second, from starting the first client to the last join */
+		double joinsPerSecond;
+		/** Time from starting a client to joining its room (ms), at the 50th, 90th and 99th percentiles */
+		double joinP50, joinP90, joinP99;
+	};
+
+	/**
+	 * Run a NetworkPunchServer on localhost and put it under load from one process.
+	 *
+	 * Starts every host at once, waits for their rooms, then starts one client per room at
+	 * once and waits for them all to join. Every connection is an ordinary NetworkConnection
+	 * over UDP, with its own RakNet peer, so this also measures the punchthrough itself.
+	 *
+	 * @param pairs Number of hosts, and of clients
+	 * @param port Port for the server
+	 */
+	PunchLoadResult loadTestPunchServer(size_t pairs, uint16_t port);
+
+	/** Run loadTestPunchServer() and log the result */
+	void punchServerLoadTest(size_t pairs, uint16_t port);
+}
+
+#endif
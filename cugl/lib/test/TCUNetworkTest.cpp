@@ -0,0 +1,1425 @@
+#include "TCUNetworkTest.h"
+
+#include <cugl/cugl.h>
+#include <slikenet/peerinterface.h>
+#include <slikenet/MessageIdentifiers.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <tuple>
+
+#include "../net/CUNetworkClock.h"
+#include "../net/CUNetworkFraming.h"
+#include "../net/CUNetworkQueue.h"
+#include "../net/CUNetworkTransport.h"
+
+/** How long the loopback tests wait for a packet before failing (ms) */
+constexpr long long LOOPBACK_TIMEOUT = 5000;
+
+/**
+ * Call receive() on every connection until the condition holds.
+ *
+ * Returns false on timeout.
+ */
+static bool pumpUntil(const std::vector<cugl::NetworkConnection*>& nets, const std::function<bool()>& done,
+	const std::function<void(const uint8_t*, size_t, uint8_t, cugl::NetworkConnection::MessageType)>& dispatcher,
+	long long timeout = LOOPBACK_TIMEOUT) {
+	auto start = std::chrono::steady_clock::now();
+	while (std::chrono::duration_cast<std::chrono::milliseconds>(
+		std::chrono::steady_clock::now() - start).count() < timeout) {
+		for (auto* net : nets) {
+			net->receive(dispatcher);
+		}
+		if (done()) {
+			return true;
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	return false;
+}
+
+/**
+ * Pump a peer until a packet with the given message ID arrives.
+ *
+ * Returns nullptr on timeout. The caller must deallocate the packet.
+ */
+static SLNet::Packet* waitFor(SLNet::RakPeerInterface* peer, uint8_t messageID) {
+	auto start = std::chrono::steady_clock::now();
+	while (std::chrono::duration_cast<std::chrono::milliseconds>(
+		std::chrono::steady_clock::now() - start).count() < LOOPBACK_TIMEOUT) {
+		for (SLNet::Packet* p = peer->Receive(); p != nullptr; p = peer->Receive()) {
+			if (p->data[0] == messageID) {
+				return p;
+			}
+			peer->DeallocatePacket(p);
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	return nullptr;
+}
+
+/** A host and its clients on a loopback network, host first */
+using Room = std::vector<std::shared_ptr<cugl::NetworkConnection>>;
+
+/** Messages each connection in a room received, in order, with the player who sent each */
+using Inboxes = std::vector<std::vector<std::pair<std::vector<uint8_t>, uint8_t>>>;
+
+/**
+ * Call receive() on every connection in a room until the condition holds, collecting what each receives.
+ *
+ * Returns false on timeout.
+ */
+static bool pumpRoom(const Room& room, Inboxes& inboxes, const std::function<bool()>& done,
+	long long timeout = LOOPBACK_TIMEOUT) {
+	inboxes.resize(room.size());
+	auto start = std::chrono::steady_clock::now();
+	while (std::chrono::duration_cast<std::chrono::milliseconds>(
+		std::chrono::steady_clock::now() - start).count() < timeout) {
+		for (size_t i = 0; i < room.size(); i++) {
+			room[i]->receive([&](const uint8_t* msg, size_t length, uint8_t sender, cugl::NetworkConnection::MessageType) {
+				inboxes[i].emplace_back(std::vector<uint8_t>(msg, msg + length), sender);
+			});
+		}
+		if (done()) {
+			return true;
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	return false;
+}
+
+/**
+ * Open a room on the loopback network in the config, with the given number of clients.
+ *
+ * Returns once every connection has every player, failing the test if that takes too long.
+ */
+static Room openRoom(const cugl::NetworkConnection::ConnectionConfig& config, size_t clients) {
+	Room room = { std::make_shared<cugl::NetworkConnection>(config) };
+	for (size_t i = 0; i < clients; i++) {
+		room.push_back(std::make_shared<cugl::NetworkConnection>(config, room[0]->getRoomID()));
+	}
+	Inboxes ignored;
+	CUAssertAlwaysLog(pumpRoom(room, ignored, [&] {
+		return std::all_of(room.begin(), room.end(), [&](auto& net) {
+			return net->getStatus() == cugl::NetworkConnection::NetStatus::Connected
+				&& net->getNumPlayers() == clients + 1 && net->getPlayerID().has_value();
+		});
+	}), "loopback room test");
+	return room;
+}
+
+/** Returns the messages in an inbox from one sender, in order */
+static std::vector<std::vector<uint8_t>> from(const Inboxes::value_type& inbox, uint8_t sender) {
+	std::vector<std::vector<uint8_t>> result;
+	for (auto& entry : inbox) {
+		if (entry.second == sender) {
+			result.push_back(entry.first);
+		}
+	}
+	return result;
+}
+
+void cugl::networkUnitTest() {
+	cugl::testVarintFraming();
+	cugl::testLargeMessageLoopback();
+	cugl::testMalformedFrames();
+	cugl::testNetworkQueue();
+	cugl::testBatching();
+	cugl::testPeerStats();
+	cugl::testAdaptiveSendRate();
+	cugl::testRelevanceFilter();
+	cugl::testMesh();
+	cugl::testHostMigration();
+	cugl::testLanMigration();
+	cugl::testSessionResume();
+	cugl::testDeltaSnapshots();
+	cugl::testNetworkClock();
+	cugl::testInterpolator();
+	cugl::testLockstep();
+	cugl::testRollback();
+	cugl::testLanSession();
+	cugl::testRoomServer();
+	cugl::testLoopbackNetwork();
+	cugl::testPunchServer();
+	cugl::testSimulatedConditions();
+}
+
+void cugl::testVarintFraming() {
+	std::vector<size_t> lengths = {
+		0, 1, 127, 128, 255, 256, 16383, 16384, 65536, netframing::MAX_MESSAGE_SIZE
+	};
+	for (auto& len : lengths) {
+		std::vector<uint8_t> packet(netframing::MAX_HEADER_SIZE);
+		size_t written = netframing::writeHeader(packet.data(), ID_USER_PACKET_ENUM, len);
+		packet.resize(written + len);
+
+		size_t headerSize = 0;
+		size_t msgSize = 0;
+		CUAssertAlwaysLog(netframing::readHeader(packet.data(), packet.size(), headerSize, msgSize),
+			"varint header test");
+		CUAssertAlwaysLog(headerSize == written, "varint header size test");
+		CUAssertAlwaysLog(msgSize == len, "varint length test");
+	}
+
+	// Short payloads keep the old two byte header
+	uint8_t header[netframing::MAX_HEADER_SIZE];
+	CUAssertAlwaysLog(netframing::writeHeader(header, ID_USER_PACKET_ENUM, 127) == 2, "small header test");
+	CUAssertAlwaysLog(netframing::writeHeader(header, ID_USER_PACKET_ENUM, 128) == 3, "medium header test");
+
+	// Routing prefix sits between the message ID and the length
+	uint8_t prefix = 0xA5;
+	std::vector<uint8_t> prefixed(netframing::MAX_HEADER_SIZE);
+	size_t prefixedSize = netframing::writeHeader(prefixed.data(), ID_USER_PACKET_ENUM, 200, &prefix, 1);
+	prefixed.resize(prefixedSize + 200);
+	size_t prefixedHeader = 0;
+	size_t prefixedMsg = 0;
+	CUAssertAlwaysLog(netframing::readHeader(prefixed.data(), prefixed.size(), prefixedHeader, prefixedMsg, 1),
+		"prefixed header test");
+	CUAssertAlwaysLog(prefixed[1] == prefix && prefixedHeader == 4 && prefixedMsg == 200, "prefix test");
+
+	// Length claims more bytes than the packet has
+	std::vector<uint8_t> truncated(netframing::MAX_HEADER_SIZE);
+	size_t written = netframing::writeHeader(truncated.data(), ID_USER_PACKET_ENUM, 300);
+	truncated.resize(written + 299);
+	size_t headerSize = 0;
+	size_t msgSize = 0;
+	CUAssertAlwaysLog(!netframing::readHeader(truncated.data(), truncated.size(), headerSize, msgSize),
+		"truncated payload test");
+
+	// Varint never terminates
+	std::vector<uint8_t> runaway = { ID_USER_PACKET_ENUM, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+	CUAssertAlwaysLog(!netframing::readHeader(runaway.data(), runaway.size(), headerSize, msgSize),
+		"malformed varint test");
+}
+
+void cugl::testLargeMessageLoopback() {
+	SLNet::RakPeerInterface* sender = SLNet::RakPeerInterface::GetInstance();
+	SLNet::RakPeerInterface* recver = SLNet::RakPeerInterface::GetInstance();
+
+	SLNet::SocketDescriptor sendSocket(0, "127.0.0.1");
+	SLNet::SocketDescriptor recvSocket(0, "127.0.0.1");
+	sender->Startup(1, &sendSocket, 1);
+	recver->Startup(1, &recvSocket, 1);
+	recver->SetMaximumIncomingConnections(1);
+
+	sender->Connect("127.0.0.1", recver->GetMyBoundAddress().GetPort(), nullptr, 0);
+	SLNet::Packet* accepted = waitFor(sender, ID_CONNECTION_REQUEST_ACCEPTED);
+	CUAssertAlwaysLog(accepted != nullptr, "loopback connection test");
+	SLNet::SystemAddress dest = accepted->systemAddress;
+	sender->DeallocatePacket(accepted);
+
+	std::vector<uint8_t> msg(64 * 1024);
+	for (size_t i = 0; i < msg.size(); i++) {
+		msg[i] = static_cast<uint8_t>((i * 31 + 7) ^ (i >> 8));
+	}
+
+	uint8_t messageID = ID_USER_PACKET_ENUM;
+	CUAssertAlwaysLog(netframing::sendFramed(sender, messageID, msg.data(), msg.size(),
+		MEDIUM_PRIORITY, RELIABLE, 1, dest, false), "large message send test");
+
+	SLNet::Packet* received = waitFor(recver, messageID);
+	CUAssertAlwaysLog(received != nullptr, "large message receive test");
+
+	size_t headerSize = 0;
+	size_t msgSize = 0;
+	CUAssertAlwaysLog(netframing::readHeader(received->data, received->length, headerSize, msgSize),
+		"large message header test");
+	CUAssertAlwaysLog(msgSize == msg.size(), "large message length test");
+	CUAssertAlwaysLog(std::equal(msg.begin(), msg.end(), received->data + headerSize),
+		"large message content test");
+	recver->DeallocatePacket(received);
+
+	sender->Shutdown(0);
+	recver->Shutdown(0);
+	SLNet::RakPeerInterface::DestroyInstance(sender);
+	SLNet::RakPeerInterface::DestroyInstance(recver);
+}
+
+void cugl::testMalformedFrames() {
+	NetworkConnection::ConnectionConfig config("", 0, 6, 0);
+	config.loopback = std::make_shared<NetworkLoopback>();
+	NetworkConnection host(config);
+	std::string room = host.getRoomID();
+	auto ignore = [](const uint8_t*, size_t, uint8_t, NetworkConnection::MessageType) {};
+
+	// Message IDs of NetworkConnection's AssignedRoom and JoinRoom packets
+	const uint8_t assignedRoom = ID_USER_PACKET_ENUM + 1;
+	const uint8_t joinRoom = ID_USER_PACKET_ENUM + 2;
+	std::vector<std::vector<std::vector<uint8_t>>> attempts = {
+		// A room ID too short to read, then a length longer than the packet
+		{ { assignedRoom, 1, '7' }, { joinRoom, 9, 1 } },
+		// An empty answer to JoinRoom
+		{ { joinRoom, 0 } },
+		// No length at all
+		{ { joinRoom } },
+	};
+
+	for (auto& frames : attempts) {
+		// Joins as a client would, then answers with garbage
+		auto raw = openLoopback(config.loopback);
+		SLNet::SocketDescriptor socket;
+		CUAssertAlwaysLog(raw->Startup(1, &socket, 1) == SLNet::RAKNET_STARTED, "malformed frame startup test");
+		raw->Connect("127.0.0.1", config.lanPort, nullptr, 0);
+		std::optional<SLNet::SystemAddress> hostAddr;
+		CUAssertAlwaysLog(pumpUntil({ &host }, [&] {
+			for (SLNet::Packet* p = raw->Receive(); p != nullptr; raw->DeallocatePacket(p), p = raw->Receive()) {
+				if (p->data[0] == joinRoom) {
+					hostAddr = p->systemAddress;
+				}
+			}
+			return hostAddr.has_value();
+		}, ignore), "malformed frame join test");
+
+		for (auto& frame : frames) {
+			raw->Send(reinterpret_cast<const char*>(frame.data()), static_cast<int>(frame.size()),
+				HIGH_PRIORITY, RELIABLE_ORDERED, 0, *hostAddr, false);
+		}
+		pumpUntil({ &host }, [] { return false; }, ignore, 100);
+		CUAssertAlwaysLog(host.getStatus() == NetworkConnection::NetStatus::Connected
+			&& host.getNumPlayers() == 1 && host.getRoomID() == room, "malformed frame test");
+		raw->Shutdown(0);
+	}
+
+	NetworkConnection client(config, room);
+	CUAssertAlwaysLog(pumpUntil({ &host, &client }, [&] {
+		return client.getStatus() == NetworkConnection::NetStatus::Connected && host.getNumPlayers() == 2;
+	}, ignore), "malformed frame recovery test");
+}
+
+void cugl::testNetworkQueue() {
+	cugl::NetworkQueue<std::vector<uint8_t>> queue(6);
+	CUAssertAlwaysLog(queue.front() == nullptr, "empty queue test");
+
+	// Capacity rounds up to 8
+	for (uint8_t i = 0; i < 8; i++) {
+		auto* slot = queue.prepare();
+		CUAssertAlwaysLog(slot != nullptr, "queue capacity test");
+		slot->assign(1, i);
+		queue.commit();
+	}
+	CUAssertAlwaysLog(queue.prepare() == nullptr, "full queue test");
+	for (uint8_t i = 0; i < 8; i++) {
+		auto* slot = queue.front();
+		CUAssertAlwaysLog(slot != nullptr && (*slot)[0] == i, "queue order test");
+		queue.pop();
+	}
+	CUAssertAlwaysLog(queue.front() == nullptr, "drained queue test");
+
+	// One producer thread, one consumer thread
+	constexpr uint32_t count = 100000;
+	cugl::NetworkQueue<uint32_t> shared(64);
+	std::thread producer([&] {
+		for (uint32_t i = 0; i < count; i++) {
+			uint32_t* slot;
+			while ((slot = shared.prepare()) == nullptr) {
+				std::this_thread::yield();
+			}
+			*slot = i;
+			shared.commit();
+		}
+	});
+	for (uint32_t expected = 0; expected < count;) {
+		uint32_t* slot = shared.front();
+		if (slot == nullptr) {
+			std::this_thread::yield();
+			continue;
+		}
+		CUAssertAlwaysLog(*slot == expected, "threaded queue order test");
+		shared.pop();
+		expected++;
+	}
+	producer.join();
+}
+
+void cugl::testBatching() {
+	NetworkConnection::ConnectionConfig config("", 0, 3, 0);
+	config.loopback = std::make_shared<NetworkLoopback>();
+	config.batchSends = true;
+	config.flushOnReceive = false;
+	Room room = openRoom(config, 2);
+	auto& client = *room[1];
+	uint8_t sender = *client.getPlayerID();
+	uint8_t other = *room[2]->getPlayerID();
+
+	Inboxes inboxes;
+	auto before = room[0]->getStats(sender);
+	for (uint8_t i = 0; i < 20; i++) {
+		client.send({ i });
+	}
+	pumpRoom(room, inboxes, [] { return false; }, 50);
+	CUAssertAlwaysLog(from(inboxes[0], sender).empty(), "batching hold test");
+
+	client.flush();
+	CUAssertAlwaysLog(pumpRoom(room, inboxes, [&] {
+		return from(inboxes[0], sender).size() == 20 && from(inboxes[2], sender).size() == 20;
+	}), "batching delivery test");
+	for (size_t i : { size_t(0), size_t(2) }) {
+		auto msgs = from(inboxes[i], sender);
+		for (size_t j = 0; j < msgs.size(); j++) {
+			CUAssertAlwaysLog(msgs[j] == std::vector<uint8_t>({ static_cast<uint8_t>(j) }), "batching order test");
+		}
+	}
+
+	// Twenty messages, but about one packet's worth of overhead
+	auto after = room[0]->getStats(sender);
+	CUAssertAlwaysLog(before.has_value() && after.has_value(), "batching stats test");
+	CUAssertAlwaysLog(after->messagesReceived - before->messagesReceived == 20, "batching message count test");
+	CUAssertAlwaysLog(after->bytesReceived - before->bytesReceived < 10 * NetworkLoopback::PACKET_OVERHEAD,
+		"batching overhead test");
+
+	// The host batches its own messages the same way
+	room[0]->send({ 1, 2 });
+	room[0]->send({ 3 });
+	room[0]->flush();
+	CUAssertAlwaysLog(pumpRoom(room, inboxes, [&] {
+		return from(inboxes[1], 0).size() == 2 && from(inboxes[2], 0).size() == 2;
+	}), "batching host test");
+	CUAssertAlwaysLog(from(inboxes[2], 0)[0] == std::vector<uint8_t>({ 1, 2 }), "batching host contents test");
+	CUAssertAlwaysLog(from(inboxes[1], other).empty(), "batching echo test");
+
+	// Immediate messages are not held back for the next flush
+	client.send({ 42 }, NetworkConnection::Delivery::Reliable, NetworkConnection::Priority::Immediate, 1);
+	CUAssertAlwaysLog(pumpRoom(room, inboxes, [&] {
+		auto msgs = from(inboxes[0], sender);
+		return !msgs.empty() && msgs.back() == std::vector<uint8_t>({ 42 });
+	}), "batching immediate test");
+}
+
+void cugl::testPeerStats() {
+	NetworkLoopback::LinkConfig link;
+	link.latency = 15;
+	NetworkConnection::ConnectionConfig config("", 0, 2, 0);
+	config.loopback = std::make_shared<NetworkLoopback>(link);
+	Room room = openRoom(config, 1);
+	auto& host = *room[0];
+	auto& client = *room[1];
+	uint8_t pID = *client.getPlayerID();
+
+	Inboxes inboxes;
+	for (uint8_t i = 0; i < 10; i++) {
+		client.send(std::vector<uint8_t>(100, i));
+	}
+	CUAssertAlwaysLog(pumpRoom(room, inboxes, [&] { return from(inboxes[0], pID).size() == 10; }), "stats delivery test");
+
+	auto hostSide = host.getStats(pID);
+	auto clientSide = client.getStats(0);
+	CUAssertAlwaysLog(hostSide.has_value() && clientSide.has_value(), "stats link test");
+	CUAssertAlwaysLog(hostSide->messagesReceived == 10 && clientSide->messagesSent == 10, "stats message count test");
+	CUAssertAlwaysLog(hostSide->bytesReceived >= 1000 && clientSide->bytesSent >= 1000, "stats byte count test");
+	CUAssertAlwaysLog(!host.getStats(42).has_value(), "stats unknown player test");
+
+	// Round trips are measured once a second
+	CUAssertAlwaysLog(pumpRoom(room, inboxes, [&] {
+		auto stats = host.getStats(pID);
+		return stats.has_value() && stats->rtt >= 0;
+	}, 3 * LOOPBACK_TIMEOUT / 2), "stats ping test");
+	int rtt = host.getStats(pID)->rtt;
+	CUAssertAlwaysLog(rtt >= 2 * link.latency && rtt < 2 * link.latency + 20, "stats round trip test");
+}
+
+void cugl::testAdaptiveSendRate() {
+	NetworkConnection::ConnectionConfig config("", 0, 2, 0);
+	config.loopback = std::make_shared<NetworkLoopback>();
+	config.adaptiveSendRate = true;
+	Room room = openRoom(config, 1);
+	auto& client = *room[1];
+	uint8_t pID = *client.getPlayerID();
+	CUAssertAlwaysLog(client.getSendRate() == 1, "send rate start test");
+
+	// Heavy loss is congestion, so low priority updates are thinned out
+	NetworkLoopback::LinkConfig lossy;
+	lossy.loss = 0.3;
+	config.loopback->setLinkConfig(lossy);
+	Inboxes inboxes;
+	size_t sent = 0;
+	CUAssertAlwaysLog(pumpRoom(room, inboxes, [&] {
+		for (int i = 0; i < 5; i++, sent++) {
+			client.send({ 0 }, NetworkConnection::Delivery::Unreliable, NetworkConnection::Priority::Low, 0);
+		}
+		return client.getSendRate() < 1;
+	}, 2 * LOOPBACK_TIMEOUT), "send rate decrease test");
+
+	// Reliable ones are held back instead, and all go out once the link recovers
+	for (uint8_t i = 1; i <= 30; i++) {
+		client.send({ i }, NetworkConnection::Delivery::ReliableOrdered, NetworkConnection::Priority::Low, 2);
+	}
+	config.loopback->setLinkConfig(NetworkLoopback::LinkConfig());
+	auto reliable = [&] {
+		std::vector<uint8_t> result;
+		for (auto& msg : from(inboxes[0], pID)) {
+			if (msg[0] != 0) {
+				result.push_back(msg[0]);
+			}
+		}
+		return result;
+	};
+	CUAssertAlwaysLog(pumpRoom(room, inboxes, [&] {
+		return client.getSendRate() == 1 && reliable().size() == 30;
+	}, 3 * LOOPBACK_TIMEOUT), "send rate recovery test");
+	auto got = reliable();
+	for (size_t i = 0; i < got.size(); i++) {
+		CUAssertAlwaysLog(got[i] == i + 1, "send rate order test");
+	}
+	CUAssertAlwaysLog(from(inboxes[0], pID).size() - 30 < sent, "send rate thinning test");
+
+	// Only so many are held back; past that the oldest are dropped, but order is kept
+	config.loopback->setLinkConfig(lossy);
+	CUAssertAlwaysLog(pumpRoom(room, inboxes, [&] {
+		client.send({ 0 }, NetworkConnection::Delivery::Unreliable, NetworkConnection::Priority::Low, 0);
+		return client.getSendRate() < 1;
+	}, 2 * LOOPBACK_TIMEOUT), "send rate decrease test");
+	const int burst = 1000;
+	for (int i = 0; i < burst; i++) {
+		client.send({ 0xFF, static_cast<uint8_t>(i >> 8), static_cast<uint8_t>(i) },
+			NetworkConnection::Delivery::ReliableOrdered, NetworkConnection::Priority::Low, 2);
+	}
+	config.loopback->setLinkConfig(NetworkLoopback::LinkConfig());
+	auto burstReceived = [&] {
+		std::vector<int> result;
+		for (auto& msg : from(inboxes[0], pID)) {
+			if (msg.size() == 3) {
+				result.push_back(msg[1] << 8 | msg[2]);
+			}
+		}
+		return result;
+	};
+	CUAssertAlwaysLog(pumpRoom(room, inboxes, [&] {
+		auto received = burstReceived();
+		return !received.empty() && received.back() == burst - 1;
+	}, 3 * LOOPBACK_TIMEOUT), "send rate newest message test");
+	auto received = burstReceived();
+	CUAssertAlwaysLog(received.size() < burst / 2, "send rate hold back limit test (%zu)", received.size());
+	for (size_t i = 1; i < received.size(); i++) {
+		CUAssertAlwaysLog(received[i] > received[i - 1], "send rate hold back order test");
+	}
+}
+
+void cugl::testRelevanceFilter() {
+	NetworkConnection::ConnectionConfig config("", 0, 4, 0);
+	config.loopback = std::make_shared<NetworkLoopback>();
+	Room room = openRoom(config, 3);
+	uint8_t a = *room[1]->getPlayerID();
+	uint8_t b = *room[2]->getPlayerID();
+	uint8_t c = *room[3]->getPlayerID();
+
+	// Nothing from A reaches C, and B gets every other message from A
+	room[0]->setRelevanceFilter([&](const uint8_t*, size_t, uint8_t sender, uint8_t recipient) {
+		NetworkConnection::Relevance result;
+		if (sender == a && recipient == c) {
+			result.deliver = false;
+		} else if (sender == a && recipient == b) {
+			result.interval = 2;
+		}
+		return result;
+	});
+	Inboxes inboxes;
+	for (uint8_t i = 0; i < 10; i++) {
+		room[1]->send({ i });
+	}
+	room[0]->send({ 42 });
+	CUAssertAlwaysLog(pumpRoom(room, inboxes, [&] {
+		return from(inboxes[0], a).size() == 10 && from(inboxes[2], a).size() == 5 && from(inboxes[3], 0).size() == 1;
+	}), "relevance delivery test");
+	pumpRoom(room, inboxes, [] { return false; }, 100);
+	CUAssertAlwaysLog(from(inboxes[2], a).size() == 5, "relevance interval test");
+	CUAssertAlwaysLog(from(inboxes[3], a).empty(), "relevance drop test");
+	CUAssertAlwaysLog(from(inboxes[2], 0).size() == 1, "relevance passthrough test");
+
+	// Without the filter, everyone gets everything again
+	room[0]->setRelevanceFilter(nullptr);
+	room[1]->send({ 10 });
+	CUAssertAlwaysLog(pumpRoom(room, inboxes, [&] {
+		return from(inboxes[3], a).size() == 1 && from(inboxes[2], a).size() == 6;
+	}), "relevance reset test");
+}
+
+void cugl::testMesh() {
+	NetworkLoopback::LinkConfig link;
+	link.latency = 50;
+	NetworkConnection::ConnectionConfig config("", 0, 3, 0);
+	config.loopback = std::make_shared<NetworkLoopback>(link);
+	config.mesh = true;
+	Room room = openRoom(config, 2);
+	auto& a = *room[1];
+	auto& b = *room[2];
+	uint8_t aID = *a.getPlayerID();
+	uint8_t bID = *b.getPlayerID();
+	Inboxes inboxes;
+	CUAssertAlwaysLog(pumpRoom(room, inboxes, [&] {
+		return a.hasDirectLink(bID) && b.hasDirectLink(aID);
+	}), "mesh link test");
+	CUAssertAlwaysLog(room[0]->hasDirectLink(aID) && !room[0]->hasDirectLink(42), "mesh host link test");
+
+	// One trip over the direct link, where a relay through the host would take two
+	auto sent = std::chrono::steady_clock::now();
+	a.send({ 7 });
+	CUAssertAlwaysLog(pumpRoom(room, inboxes, [&] { return !from(inboxes[2], aID).empty(); }), "mesh delivery test");
+	auto trip = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - sent).count();
+	CUAssertAlwaysLog(trip < 90, "mesh direct test (%lld ms)", trip);
+
+	// The host still gets it, and B does not get the relayed copy as well
+	pumpRoom(room, inboxes, [] { return false; }, 200);
+	CUAssertAlwaysLog(from(inboxes[0], aID).size() == 1, "mesh host delivery test");
+	CUAssertAlwaysLog(from(inboxes[2], aID).size() == 1, "mesh duplicate test");
+	CUAssertAlwaysLog(from(inboxes[2], aID)[0] == std::vector<uint8_t>({ 7 }), "mesh contents test");
+}
+
+void cugl::testHostMigration() {
+	NetworkConnection::ConnectionConfig config("", 0, 4, 0);
+	config.loopback = std::make_shared<NetworkLoopback>();
+	config.hostMigration = true;
+	Room room = openRoom(config, 3);
+	room[0]->startGame();
+	std::vector<uint8_t> ids;
+	for (size_t i = 1; i < room.size(); i++) {
+		ids.push_back(*room[i]->getPlayerID());
+	}
+
+	// The connected client with the lowest player ID takes over, and the others follow it
+	room.erase(room.begin());
+	auto successor = std::min_element(ids.begin(), ids.end()) - ids.begin();
+	Inboxes inboxes;
+	CUAssertAlwaysLog(pumpRoom(room, inboxes, [&] {
+		return std::all_of(room.begin(), room.end(), [&](auto& net) {
+			return net->getStatus() == NetworkConnection::NetStatus::Connected && net->getNumPlayers() == 3;
+		});
+	}, 3 * LOOPBACK_TIMEOUT), "host migration test");
+	for (size_t i = 0; i < room.size(); i++) {
+		CUAssertAlwaysLog(room[i]->getHostID() == ids[successor], "host migration successor test");
+		CUAssertAlwaysLog(room[i]->getPlayerID() == ids[i], "host migration player ID test");
+		for (uint8_t pID : ids) {
+			CUAssertAlwaysLog(room[i]->isPlayerActive(pID), "host migration player list test");
+		}
+	}
+
+	// Messages flow both ways through the new host
+	size_t other = successor == 0 ? 1 : 0;
+	room[other]->send({ 1 });
+	room[successor]->send({ 2 });
+	CUAssertAlwaysLog(pumpRoom(room, inboxes, [&] {
+		for (size_t i = 0; i < room.size(); i++) {
+			if (i != other && from(inboxes[i], ids[other]).size() != 1) {
+				return false;
+			}
+			if (i != static_cast<size_t>(successor) && from(inboxes[i], ids[successor]).size() != 1) {
+				return false;
+			}
+		}
+		return true;
+	}), "host migration message test");
+}
+
+void cugl::testSessionResume() {
+	NetworkConnection::ConnectionConfig config("", 0, 3, 0);
+	config.loopback = std::make_shared<NetworkLoopback>();
+	config.sessionResume = true;
+	Room room = openRoom(config, 2);
+	room[0]->startGame();
+
+	// With the first client gone, the host has an empty slot ahead of the one that resumes
+	room.erase(room.begin() + 1);
+	auto& host = *room[0];
+	auto& client = *room[1];
+	uint8_t pID = *client.getPlayerID();
+	Inboxes inboxes;
+	CUAssertAlwaysLog(pumpRoom(room, inboxes, [&] { return host.getNumPlayers() == 2; }), "resume departure test");
+
+	// Everything the host sends while the client is cut off reaches it once it is back
+	config.loopback->dropConnections();
+	for (uint8_t i = 0; i < 3; i++) {
+		host.send({ i });
+	}
+	CUAssertAlwaysLog(pumpRoom(room, inboxes, [&] {
+		return client.getStatus() == NetworkConnection::NetStatus::Reconnecting;
+	}, 2 * LOOPBACK_TIMEOUT), "resume outage test");
+	for (uint8_t i = 3; i < 6; i++) {
+		host.send({ i });
+	}
+	CUAssertAlwaysLog(pumpRoom(room, inboxes, [&] {
+		return client.getStatus() == NetworkConnection::NetStatus::Connected && from(inboxes[1], 0).size() >= 6;
+	}, 3 * LOOPBACK_TIMEOUT), "resume reconnection test");
+	pumpRoom(room, inboxes, [] { return false; }, 100);
+
+	CUAssertAlwaysLog(client.getPlayerID() == pID && host.isPlayerActive(pID), "resume player ID test");
+	CUAssertAlwaysLog(host.getNumPlayers() == 2 && client.getNumPlayers() == 2, "resume player count test");
+	auto msgs = from(inboxes[1], 0);
+	CUAssertAlwaysLog(msgs.size() == 6, "resume replay count test (%zu)", msgs.size());
+	for (size_t i = 0; i < msgs.size(); i++) {
+		CUAssertAlwaysLog(msgs[i] == std::vector<uint8_t>({ static_cast<uint8_t>(i) }), "resume replay order test");
+	}
+}
+
+void cugl::testLanMigration() {
+	NetworkConnection::ConnectionConfig config("", 0, 4, 0);
+	config.loopback = std::make_shared<NetworkLoopback>();
+	config.hostMigration = true;
+	Room room = openRoom(config, 2);
+	std::vector<uint8_t> ids = { *room[1]->getPlayerID(), *room[2]->getPlayerID() };
+
+	// The new host answers for a room of its own on the LAN port, which the old host has freed
+	room.erase(room.begin());
+	auto successor = std::min_element(ids.begin(), ids.end()) - ids.begin();
+	Inboxes inboxes;
+	CUAssertAlwaysLog(pumpRoom(room, inboxes, [&] {
+		return !room[successor]->getRoomID().empty() && std::all_of(room.begin(), room.end(), [&](auto& net) {
+			return net->getStatus() == NetworkConnection::NetStatus::Connected && net->getNumPlayers() == 2;
+		});
+	}, 3 * LOOPBACK_TIMEOUT), "LAN migration test");
+
+	// Someone new finds it there, and gets a player ID nobody has
+	room.push_back(std::make_shared<NetworkConnection>(config, room[successor]->getRoomID()));
+	CUAssertAlwaysLog(pumpRoom(room, inboxes, [&] {
+		return std::all_of(room.begin(), room.end(), [&](auto& net) {
+			return net->getStatus() == NetworkConnection::NetStatus::Connected && net->getNumPlayers() == 3;
+		});
+	}), "LAN migration join test");
+	auto joined = room.back()->getPlayerID();
+	CUAssertAlwaysLog(joined.has_value() && std::find(ids.begin(), ids.end(), *joined) == ids.end(),
+		"LAN migration player ID test");
+	CUAssertAlwaysLog(room.back()->getHostID() == ids[successor], "LAN migration host test");
+}
+
+void cugl::testDeltaSnapshots() {
+	NetworkDeltaEncoder encoder;
+	NetworkDeltaDecoder decoder;
+
+	std::vector<uint8_t> state(1000);
+	for (size_t i = 0; i < state.size(); i++) {
+		state[i] = static_cast<uint8_t>(i * 7);
+	}
+
+	// Nobody has acknowledged anything, so the first snapshot is full
+	encoder.addPeer(1);
+	auto msg = encoder.encode(state);
+	CUAssertAlwaysLog(msg.size() > state.size(), "first snapshot full test");
+	CUAssertAlwaysLog(decoder.decode(msg), "first snapshot decode test");
+	CUAssertAlwaysLog(decoder.getState() == state, "first snapshot state test");
+	encoder.acknowledge(1, decoder.getSequence());
+
+	// Small changes against an acknowledged baseline are sent as a small delta
+	state[10] = 1;
+	state[500] = 2;
+	state.push_back(3);
+	msg = encoder.encode(state);
+	CUAssertAlwaysLog(msg.size() < 32, "delta size test");
+	CUAssertAlwaysLog(decoder.decode(msg), "delta decode test");
+	CUAssertAlwaysLog(decoder.getState() == state, "delta state test");
+
+	// A stale snapshot is rejected
+	auto stale = msg;
+	state[20] = 4;
+	msg = encoder.encode(state);
+	CUAssertAlwaysLog(decoder.decode(msg), "newer delta decode test");
+	CUAssertAlwaysLog(!decoder.decode(stale), "stale snapshot test");
+
+	// Shrinking the state still round trips
+	state.resize(600);
+	msg = encoder.encode(state);
+	CUAssertAlwaysLog(decoder.decode(msg), "shrink decode test");
+	CUAssertAlwaysLog(decoder.getState() == state, "shrink state test");
+
+	// A decoder that lost its baseline cannot apply a delta...
+	NetworkDeltaDecoder late;
+	CUAssertAlwaysLog(!late.decode(msg), "missing baseline test");
+
+	// ...and once its peer stops acknowledging, the encoder falls back to a full snapshot
+	encoder.addPeer(2);
+	msg = encoder.encode(state);
+	CUAssertAlwaysLog(late.decode(msg), "full fallback decode test");
+	CUAssertAlwaysLog(late.getState() == state, "full fallback state test");
+	CUAssertAlwaysLog(decoder.decode(msg), "full fallback broadcast test");
+
+	// Acknowledgements older than the history window are useless
+	for (uint32_t i = 0; i <= NetworkDeltaEncoder::HISTORY; i++) {
+		encoder.acknowledge(2, late.getSequence());
+		msg = encoder.encode(state);
+		CUAssertAlwaysLog(decoder.decode(msg), "window decode test");
+		CUAssertAlwaysLog(decoder.getState() == state, "window state test");
+		encoder.acknowledge(1, decoder.getSequence());
+	}
+	CUAssertAlwaysLog(msg.size() > state.size(), "window fallback test");
+
+	// Removing the lagging peer lets deltas resume
+	encoder.removePeer(2);
+	state[0] ^= 0xFF;
+	msg = encoder.encode(state);
+	CUAssertAlwaysLog(msg.size() < 32, "remove peer test");
+	CUAssertAlwaysLog(decoder.decode(msg), "remove peer decode test");
+	CUAssertAlwaysLog(decoder.getState() == state, "remove peer state test");
+
+	// Garbage does not decode
+	msg[msg.size() - 1] ^= 0xFF;
+	msg.push_back(0x7F);
+	CUAssertAlwaysLog(!decoder.decode(msg), "malformed delta test");
+}
+
+void cugl::testNetworkClock() {
+	NetworkClock clock;
+	CUAssertAlwaysLog(!clock.isSynced(), "unsynced clock test");
+
+	// Remote clock is 5 s ahead and gains 50 us every second
+	const int64_t offset = 5000000;
+	const double drift = 50e-6;
+	auto remoteAt = [&](int64_t local) {
+		return local + offset + static_cast<int64_t>(drift * static_cast<double>(local));
+	};
+
+	// One exchange per second; each one-way trip takes 15 ms plus up to 2 ms of jitter,
+	// with a spike of up to 40 ms one time in five
+	uint32_t seed = 12345;
+	auto delay = [&]() {
+		seed = seed * 1103515245 + 12345;
+		uint32_t r = seed >> 8;
+		return 15000 + static_cast<int64_t>(r % 5 == 0 ? (r / 5) % 40000 : (r / 5) % 2000);
+	};
+	int64_t local = 0;
+	for (int i = 0; i < 120; i++) {
+		int64_t up = delay();
+		int64_t down = delay();
+		clock.addSample(local, remoteAt(local + up), local + up + down);
+		local += 1000000;
+	}
+	CUAssertAlwaysLog(clock.isSynced(), "synced clock test");
+
+	// Minimum round trip filtering keeps the error well under the jitter spikes
+	int64_t error = clock.toRemote(local) - remoteAt(local);
+	CUAssertAlwaysLog(std::abs(error) < 1000, "clock offset test (error %lld us)", static_cast<long long>(error));
+	CUAssertAlwaysLog(std::abs(clock.getDrift() - drift * 1e6) < 25, "clock drift test (%f ppm)", clock.getDrift());
+
+	// A new estimate never moves the converted time backwards
+	int64_t before = clock.toRemote(local);
+	clock.addSample(local - 100000, remoteAt(local) - 200000, local);
+	CUAssertAlwaysLog(clock.toRemote(local) >= before, "monotonic clock test");
+
+	// Over a connection, a client converges on the host's time despite a 20 ms trip
+	NetworkConnection::ConnectionConfig config("", 0, 2, 0);
+	config.loopback = std::make_shared<NetworkLoopback>();
+	NetworkLoopback::LinkConfig slow;
+	slow.latency = 20;
+	slow.jitter = 2;
+	config.loopback->setLinkConfig(slow);
+	Room room = openRoom(config, 1);
+	Inboxes inboxes;
+	CUAssertAlwaysLog(pumpRoom(room, inboxes, [&] { return room[1]->isClockSynced(); }), "loopback clock sync test");
+	double gap = room[1]->getSessionTime() - room[0]->getSessionTime();
+	CUAssertAlwaysLog(std::abs(gap) < 0.005, "loopback session time test (off by %f s)", gap);
+}
+
+void cugl::testInterpolator() {
+	NetworkInterpolator<double> buffer([](const double& a, const double& b, double t) { return a + (b - a) * t; });
+	CUAssertAlwaysLog(!buffer.sample(0).has_value(), "empty interpolator test");
+
+	// Position moves at 10 units per second, sent at 20 Hz. Each snapshot takes 30 ms plus up
+	// to 40 ms of jitter, so snapshots often arrive late and out of order.
+	struct Arrival {
+		double arrive;
+		double sent;
+	};
+	std::vector<Arrival> inFlight;
+	uint32_t seed = 4321;
+	for (int k = 0; k < 200; k++) {
+		seed = seed * 1103515245 + 12345;
+		double sent = k * 0.05;
+		inFlight.push_back({ sent + 0.03 + ((seed >> 8) % 40000) / 1e6, sent });
+	}
+	std::sort(inFlight.begin(), inFlight.end(), [](const Arrival& a, const Arrival& b) { return a.arrive < b.arrive; });
+
+	// Present at 60 fps; after the delay settles, every frame must move forward smoothly
+	size_t next = 0;
+	double last = -1;
+	int stalls = 0;
+	for (int frame = 0; frame < 540; frame++) {
+		double now = frame / 60.0;
+		for (; next < inFlight.size() && inFlight[next].arrive <= now; next++) {
+			buffer.add(inFlight[next].sent, inFlight[next].sent * 10, now);
+		}
+		auto x = buffer.sample(now);
+		if (frame < 120 || !x.has_value()) {
+			last = x.value_or(last);
+			continue;
+		}
+		CUAssertAlwaysLog(*x >= last, "interpolator monotonic test");
+		double step = *x - last;
+		if (step < 0.5 * 10 / 60.0 || step > 1.5 * 10 / 60.0) {
+			stalls++;
+		}
+		last = *x;
+	}
+	CUAssertAlwaysLog(stalls == 0, "interpolator smoothness test (%d stalls)", stalls);
+	CUAssertAlwaysLog(buffer.getDelay() > 0.05 && buffer.getDelay() < 0.2,
+		"interpolator delay test (%f s)", buffer.getDelay());
+
+	// A duplicated snapshot must not leave two snapshots at one time to divide between
+	buffer.clear();
+	buffer.add(1, 10, 1.03);
+	buffer.add(1, 10, 1.04);
+	CUAssertAlwaysLog(buffer.size() == 1, "interpolator duplicate test");
+	buffer.add(1.05, 10.5, 1.08);
+	buffer.add(1.05, 10.5, 1.09);
+	CUAssertAlwaysLog(buffer.size() == 2, "interpolator duplicate test");
+	auto x = buffer.sample(3);
+	CUAssertAlwaysLog(x.has_value() && std::isfinite(*x) && *x >= 10.5,
+		"interpolator duplicate sample test");
+}
+
+void cugl::testLockstep() {
+	NetworkLoopback::LinkConfig link;
+	link.latency = 30;
+	link.jitter = 10;
+	link.loss = 0.1;
+	NetworkConnection::ConnectionConfig config("", 0, 2, 0);
+	config.loopback = std::make_shared<NetworkLoopback>(link);
+	Room room = openRoom(config, 1);
+	room[0]->startGame();
+
+	// Each peer records the frames it simulated and everyone's input to each
+	const uint32_t frames = 60;
+	const uint32_t delay = 3;
+	using Trace = std::vector<std::tuple<uint32_t, std::vector<uint8_t>, std::vector<uint8_t>>>;
+	std::vector<NetworkLockstep> sessions;
+	for (auto& net : room) {
+		sessions.emplace_back(net, delay);
+	}
+	std::vector<Trace> traces(room.size());
+	std::vector<uint8_t> added(room.size(), 0);
+	auto start = std::chrono::steady_clock::now();
+	while ((traces[0].size() < frames || traces[1].size() < frames) && std::chrono::duration_cast<std::chrono::milliseconds>(
+		std::chrono::steady_clock::now() - start).count() < 2 * LOOPBACK_TIMEOUT) {
+		for (size_t i = 0; i < room.size(); i++) {
+			sessions[i].update([](const uint8_t*, size_t, uint8_t) {});
+			if (sessions[i].addInput({ *room[i]->getPlayerID(), added[i] })) {
+				added[i]++;
+			}
+			while (sessions[i].advance()) {
+				traces[i].emplace_back(sessions[i].getFrame(), sessions[i].getInput(0), sessions[i].getInput(1));
+			}
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	CUAssertAlwaysLog(traces[0].size() >= frames && traces[1].size() >= frames, "lockstep progress test");
+
+	// Both simulate the same frames, in order, on the same inputs
+	for (uint32_t f = 0; f < frames; f++) {
+		CUAssertAlwaysLog(traces[0][f] == traces[1][f], "lockstep agreement test (frame %d)", f);
+		CUAssertAlwaysLog(std::get<0>(traces[0][f]) == f, "lockstep frame order test");
+		if (f >= delay) {
+			uint8_t n = static_cast<uint8_t>(f - delay);
+			CUAssertAlwaysLog(std::get<1>(traces[0][f]) == std::vector<uint8_t>({ 0, n })
+				&& std::get<2>(traces[0][f]) == std::vector<uint8_t>({ 1, n }), "lockstep input test (frame %d)", f);
+		}
+	}
+}
+
+void cugl::testRollback() {
+	NetworkLoopback::LinkConfig link;
+	link.latency = 50;
+	NetworkConnection::ConnectionConfig config("", 0, 2, 0);
+	config.loopback = std::make_shared<NetworkLoopback>(link);
+	Room room = openRoom(config, 1);
+	room[0]->startGame();
+
+	// The game is a hash of every frame's inputs; each player changes input every 5 frames
+	const uint32_t frames = 60;
+	auto input = [](uint8_t pID, uint32_t f) { return std::vector<uint8_t>({ pID, static_cast<uint8_t>(f / 5) }); };
+	auto step = [](uint64_t state, uint32_t f, const std::vector<uint8_t>& a, const std::vector<uint8_t>& b) {
+		state = state * 31 + f;
+		for (auto* in : { &a, &b }) {
+			for (uint8_t byte : *in) {
+				state = state * 131 + byte + 1;
+			}
+		}
+		return state;
+	};
+	std::vector<uint64_t> expected;
+	uint64_t reference = 1;
+	for (uint32_t f = 0; f < frames; f++) {
+		reference = step(reference, f, input(0, f), input(1, f));
+		expected.push_back(reference);
+	}
+
+	std::vector<std::unique_ptr<NetworkRollback>> sessions(room.size());
+	std::vector<uint64_t> states(room.size(), 1);
+	std::vector<std::vector<uint64_t>> after(room.size(), std::vector<uint64_t>(frames + 10));
+	std::vector<uint32_t> simulated(room.size(), 0);
+	for (size_t i = 0; i < room.size(); i++) {
+		NetworkRollback::Callbacks callbacks;
+		callbacks.save = [&, i](std::vector<uint8_t>& buffer) {
+			buffer.resize(sizeof(uint64_t));
+			std::memcpy(buffer.data(), &states[i], sizeof(uint64_t));
+		};
+		callbacks.load = [&, i](const std::vector<uint8_t>& buffer) {
+			std::memcpy(&states[i], buffer.data(), sizeof(uint64_t));
+		};
+		callbacks.advance = [&, i](uint32_t f) {
+			states[i] = step(states[i], f, sessions[i]->getInput(0), sessions[i]->getInput(1));
+			if (f < after[i].size()) {
+				after[i][f] = states[i];
+			}
+			simulated[i]++;
+		};
+		sessions[i] = std::make_unique<NetworkRollback>(room[i], callbacks);
+	}
+
+	// Ten milliseconds a frame, so remote inputs arrive five frames late
+	auto start = std::chrono::steady_clock::now();
+	auto done = [&] {
+		return std::all_of(sessions.begin(), sessions.end(), [&](auto& rb) { return rb->getConfirmedFrame() >= frames; });
+	};
+	while (!done() && std::chrono::duration_cast<std::chrono::milliseconds>(
+		std::chrono::steady_clock::now() - start).count() < 2 * LOOPBACK_TIMEOUT) {
+		auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+		for (size_t i = 0; i < room.size(); i++) {
+			auto& rb = *sessions[i];
+			rb.update([](const uint8_t*, size_t, uint8_t) {});
+			if (rb.getFrame() < frames + 10 && elapsed >= 10 * static_cast<long long>(rb.getFrame())) {
+				rb.advance(input(*room[i]->getPlayerID(), rb.getFrame()));
+			}
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	CUAssertAlwaysLog(done(), "rollback confirmation test");
+
+	// Mispredictions were resimulated, and every confirmed frame matches the real inputs
+	for (size_t i = 0; i < room.size(); i++) {
+		CUAssertAlwaysLog(simulated[i] > sessions[i]->getFrame(), "rollback resimulation test");
+		for (uint32_t f = 0; f < frames; f++) {
+			CUAssertAlwaysLog(after[i][f] == expected[f], "rollback state test (frame %d)", f);
+		}
+	}
+}
+
+void cugl::testLanSession() {
+	NetworkConnection::ConnectionConfig config("", 0, 4, 0);
+	config.lan = true;
+	config.lanPort = 61113;
+	config.lanAddress = "127.0.0.1";
+
+	NetworkConnection host(config);
+	CUAssertAlwaysLog(host.getStatus() == NetworkConnection::NetStatus::Connected, "LAN host status test");
+	CUAssertAlwaysLog(host.getRoomID().size() == 5, "LAN room ID test");
+
+	NetworkConnection client(config, host.getRoomID());
+	std::vector<std::pair<std::vector<uint8_t>, uint8_t>> received;
+	auto dispatcher = [&](const uint8_t* msg, size_t length, uint8_t sender, NetworkConnection::MessageType /*type*/) {
+		received.emplace_back(std::vector<uint8_t>(msg, msg + length), sender);
+	};
+	CUAssertAlwaysLog(pumpUntil({ &host, &client }, [&] {
+		return client.getStatus() == NetworkConnection::NetStatus::Connected && host.getNumPlayers() == 2;
+	}, dispatcher), "LAN join test");
+	CUAssertAlwaysLog(client.getPlayerID() == std::optional<uint8_t>(1), "LAN player ID test");
+	CUAssertAlwaysLog(host.isPlayerActive(1) && client.isPlayerActive(0), "LAN roster test");
+
+	auto times = client.getHandshakeTimes();
+	CUAssertAlwaysLog(!times.serverConnected.has_value() && times.punchSucceeded.has_value()
+		&& times.connected.has_value() && *times.punchSucceeded <= *times.connected, "LAN handshake times test");
+
+	client.send({ 1, 2, 3 });
+	host.send({ 4, 5 });
+	CUAssertAlwaysLog(pumpUntil({ &host, &client }, [&] { return received.size() == 2; }, dispatcher),
+		"LAN message test");
+	std::sort(received.begin(), received.end());
+	CUAssertAlwaysLog(received[0].first == std::vector<uint8_t>({ 1, 2, 3 }) && received[0].second == 1,
+		"LAN client to host test");
+	CUAssertAlwaysLog(received[1].first == std::vector<uint8_t>({ 4, 5 }) && received[1].second == 0,
+		"LAN host to client test");
+
+	// Room IDs are digits, so nobody answers for this one
+	NetworkConnection lost(config, "none!");
+	pumpUntil({ &host, &lost }, [&] { return lost.getStatus() != NetworkConnection::NetStatus::Pending; },
+		dispatcher, 2 * LOOPBACK_TIMEOUT);
+	CUAssertAlwaysLog(lost.getStatus() == NetworkConnection::NetStatus::RoomNotFound, "LAN room not found test");
+}
+
+void cugl::testRoomServer() {
+	NetworkServer::ServerConfig serverConfig(61114, 0);
+	serverConfig.maxRooms = 4;
+	serverConfig.maxPlayersPerRoom = 2;
+	serverConfig.tickInterval = 10;
+
+	// Callbacks run on the worker threads
+	std::mutex lock;
+	std::vector<std::thread::id> owners(serverConfig.maxRooms);
+	std::vector<int> joins(serverConfig.maxRooms), ticks(serverConfig.maxRooms), closes(serverConfig.maxRooms);
+	std::vector<std::tuple<uint32_t, std::vector<uint8_t>, uint8_t, NetworkConnection::MessageType>> serverReceived;
+	NetworkServer* self = nullptr;
+	NetworkServer::Callbacks callbacks;
+	callbacks.open = [&](uint32_t room) {
+		std::lock_guard<std::mutex> guard(lock);
+		owners[room] = std::this_thread::get_id();
+	};
+	callbacks.join = [&](uint32_t room, uint8_t /*playerID*/) {
+		std::lock_guard<std::mutex> guard(lock);
+		joins[room]++;
+	};
+	callbacks.message = [&](uint32_t room, const uint8_t* msg, size_t length, uint8_t sender,
+		NetworkConnection::MessageType type) {
+		if (length == 1 && msg[0] == 9) {
+			self->send(room, { 42 });
+		}
+		std::lock_guard<std::mutex> guard(lock);
+		CUAssertAlwaysLog(owners[room] == std::this_thread::get_id(), "room server worker test");
+		serverReceived.emplace_back(room, std::vector<uint8_t>(msg, msg + length), sender, type);
+	};
+	callbacks.update = [&](uint32_t room) {
+		std::lock_guard<std::mutex> guard(lock);
+		ticks[room]++;
+	};
+	callbacks.close = [&](uint32_t room) {
+		std::lock_guard<std::mutex> guard(lock);
+		closes[room]++;
+	};
+
+	NetworkServer server(serverConfig, callbacks);
+	self = &server;
+	CUAssertAlwaysLog(server.getStatus() == NetworkConnection::NetStatus::Connected, "room server status test");
+	auto roomA = server.openRoom();
+	auto roomB = server.openRoom();
+	CUAssertAlwaysLog(roomA.has_value() && roomB.has_value() && server.getNumRooms() == 2, "room server open test");
+	CUAssertAlwaysLog(server.getRoomID(*roomA).size() == 5 && server.getRoomID(*roomA) != server.getRoomID(*roomB),
+		"room server room ID test");
+
+	NetworkConnection::ConnectionConfig config("", 0, 4, 0);
+	config.lan = true;
+	config.lanPort = 61114;
+	config.lanAddress = "127.0.0.1";
+	NetworkConnection a1(config, server.getRoomID(*roomA));
+	NetworkConnection a2(config, server.getRoomID(*roomA));
+	NetworkConnection b1(config, server.getRoomID(*roomB));
+	std::vector<NetworkConnection*> clients = { &a1, &a2, &b1 };
+
+	std::vector<std::vector<std::pair<std::vector<uint8_t>, uint8_t>>> received(clients.size());
+	auto receiveAll = [&] {
+		for (size_t i = 0; i < clients.size(); i++) {
+			clients[i]->receive([&](const uint8_t* msg, size_t length, uint8_t sender, NetworkConnection::MessageType) {
+				received[i].emplace_back(std::vector<uint8_t>(msg, msg + length), sender);
+			});
+		}
+	};
+	auto pumpClients = [&](const std::function<bool()>& done) {
+		auto start = std::chrono::steady_clock::now();
+		while (std::chrono::duration_cast<std::chrono::milliseconds>(
+			std::chrono::steady_clock::now() - start).count() < LOOPBACK_TIMEOUT) {
+			receiveAll();
+			if (done()) {
+				return true;
+			}
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+		return false;
+	};
+
+	CUAssertAlwaysLog(pumpClients([&] {
+		std::lock_guard<std::mutex> guard(lock);
+		return joins[*roomA] == 2 && joins[*roomB] == 1 && a1.isPlayerActive(a2.getPlayerID().value_or(0));
+	}), "room server join test");
+	CUAssertAlwaysLog(a1.getPlayerID() != a2.getPlayerID() && b1.getPlayerID() == std::optional<uint8_t>(1),
+		"room server player ID test");
+	CUAssertAlwaysLog(a1.getNumPlayers() == 3 && b1.getNumPlayers() == 2 && b1.isPlayerActive(0),
+		"room server roster test");
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		CUAssertAlwaysLog(owners[*roomA] != owners[*roomB], "room server sharding test");
+	}
+
+	// Relayed within the room only, and seen by the server
+	uint8_t a1ID = *a1.getPlayerID();
+	a1.send({ 1 });
+	b1.sendOnlyToHost({ 2 });
+	a1.send({ 9 });
+	CUAssertAlwaysLog(pumpClients([&] {
+		std::lock_guard<std::mutex> guard(lock);
+		return received[0].size() == 1 && received[1].size() == 3 && serverReceived.size() == 3;
+	}), "room server relay test");
+	CUAssertAlwaysLog(received[1][0] == std::make_pair(std::vector<uint8_t>({ 1 }), a1ID), "room server sender test");
+	CUAssertAlwaysLog(received[0][0] == std::make_pair(std::vector<uint8_t>({ 42 }), uint8_t(0))
+		&& std::count(received[1].begin(), received[1].end(), std::make_pair(std::vector<uint8_t>({ 42 }), uint8_t(0))) == 1,
+		"room server send test");
+	CUAssertAlwaysLog(received[2].empty(), "room server isolation test");
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		CUAssertAlwaysLog(std::count(serverReceived.begin(), serverReceived.end(),
+			std::make_tuple(*roomB, std::vector<uint8_t>({ 2 }), uint8_t(1), NetworkConnection::MessageType::DirectToHost)) == 1,
+			"room server direct to host test");
+		CUAssertAlwaysLog(ticks[*roomA] > 0 && ticks[*roomB] > 0, "room server update test");
+	}
+
+	// Closing a room sends its clients away for good
+	CUAssertAlwaysLog(server.closeRoom(*roomB) && !server.closeRoom(*roomB) && server.getNumRooms() == 1,
+		"room server close test");
+	CUAssertAlwaysLog(pumpClients([&] {
+		std::lock_guard<std::mutex> guard(lock);
+		return closes[*roomB] == 1 && b1.getStatus() == NetworkConnection::NetStatus::RoomNotFound;
+	}), "room server closed room test");
+	CUAssertAlwaysLog(a1.getStatus() == NetworkConnection::NetStatus::Connected, "room server other room test");
+}
+
+void cugl::testLoopbackNetwork() {
+	NetworkLoopback::LinkConfig link;
+	link.latency = 20;
+	link.jitter = 5;
+	link.loss = 0.1;
+	auto network = std::make_shared<NetworkLoopback>(link, 1234);
+
+	NetworkConnection::ConnectionConfig config("", 0, 4, 0);
+	config.loopback = network;
+	NetworkConnection host(config);
+	CUAssertAlwaysLog(host.getStatus() == NetworkConnection::NetStatus::Connected, "loopback host status test");
+
+	std::vector<std::unique_ptr<NetworkConnection>> clients;
+	for (int i = 0; i < 3; i++) {
+		clients.push_back(std::make_unique<NetworkConnection>(config, host.getRoomID()));
+	}
+	std::vector<NetworkConnection*> all = { &host };
+	for (auto& client : clients) {
+		all.push_back(client.get());
+	}
+
+	// What each connection received, in order
+	std::vector<std::vector<uint8_t>> received(all.size());
+	size_t current = 0;
+	uint8_t senderID = 0;
+	auto dispatcher = [&](const uint8_t* msg, size_t length, uint8_t sender, NetworkConnection::MessageType /*type*/) {
+		if (sender == senderID && length == 1) {
+			received[current].push_back(msg[0]);
+		}
+	};
+	auto pump = [&](const std::function<bool()>& done) {
+		auto start = std::chrono::steady_clock::now();
+		while (std::chrono::duration_cast<std::chrono::milliseconds>(
+			std::chrono::steady_clock::now() - start).count() < LOOPBACK_TIMEOUT) {
+			for (current = 0; current < all.size(); current++) {
+				all[current]->receive(dispatcher);
+			}
+			if (done()) {
+				return true;
+			}
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+		return false;
+	};
+
+	CUAssertAlwaysLog(pump([&] {
+		return host.getNumPlayers() == 4 && std::all_of(clients.begin(), clients.end(), [](auto& c) {
+			return c->getStatus() == NetworkConnection::NetStatus::Connected && c->getNumPlayers() == 4;
+		});
+	}), "loopback join test");
+
+	// Relayed through the host, so a message crosses two links
+	auto& sender = *clients[0];
+	CUAssertAlwaysLog(sender.getPlayerID().has_value(), "loopback player ID test");
+	senderID = *sender.getPlayerID();
+	auto sent = std::chrono::steady_clock::now();
+	sender.send({ 0 });
+	CUAssertAlwaysLog(pump([&] { return received[2].size() == 1; }), "loopback relay test");
+	auto relay = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - sent).count();
+	CUAssertAlwaysLog(relay >= 2 * link.latency, "loopback latency test");
+
+	// Losses cost resends, but never order or delivery
+	for (uint8_t i = 1; i < 50; i++) {
+		sender.send({ i }, NetworkConnection::Delivery::ReliableOrdered);
+	}
+	CUAssertAlwaysLog(pump([&] {
+		return received[0].size() == 50 && received[2].size() == 50 && received[3].size() == 50;
+	}), "loopback reliable test");
+	for (size_t i = 0; i < all.size(); i++) {
+		for (size_t j = 0; j < received[i].size(); j++) {
+			CUAssertAlwaysLog(received[i][j] == j, "loopback order test");
+		}
+	}
+	CUAssertAlwaysLog(received[1].empty(), "loopback echo test");
+
+	// A channel out of range is refused rather than sent on some other channel
+	sender.send({ 99 }, NetworkConnection::Delivery::Reliable, NetworkConnection::Priority::Medium,
+		NetworkConnection::NUM_CHANNELS);
+	sender.send({ 50 }, NetworkConnection::Delivery::Reliable, NetworkConnection::Priority::Medium,
+		NetworkConnection::NUM_CHANNELS - 1);
+	CUAssertAlwaysLog(pump([&] { return received[0].size() == 51; }), "loopback last channel test");
+	pump([&] { return received[0].size() > 51; });
+	CUAssertAlwaysLog(received[0].size() == 51 && received[0].back() == 50, "loopback channel range test");
+}
+
+void cugl::testPunchServer() {
+	NetworkPunchServer server(NetworkPunchServer::ServerConfig(61115));
+	CUAssertAlwaysLog(server.getStatus() == NetworkConnection::NetStatus::Connected, "punchthrough server status test");
+
+	NetworkConnection::ConnectionConfig config("127.0.0.1", 61115, 2, 0);
+	NetworkConnection host(config);
+	auto ignore = [](const uint8_t*, size_t, uint8_t, NetworkConnection::MessageType) {};
+	CUAssertAlwaysLog(pumpUntil({ &host }, [&] { return host.getStatus() == NetworkConnection::NetStatus::Connected; },
+		ignore), "punchthrough room assignment test");
+	CUAssertAlwaysLog(host.getRoomID().size() == 5, "punchthrough room ID test");
+
+	std::vector<uint8_t> received;
+	NetworkConnection client(config, host.getRoomID());
+	auto dispatcher = [&](const uint8_t* msg, size_t length, uint8_t /*sender*/, NetworkConnection::MessageType /*type*/) {
+		received.assign(msg, msg + length);
+	};
+	CUAssertAlwaysLog(pumpUntil({ &host, &client }, [&] {
+		return client.getStatus() == NetworkConnection::NetStatus::Connected && host.getNumPlayers() == 2;
+	}, dispatcher), "punchthrough join test");
+	auto times = client.getHandshakeTimes();
+	CUAssertAlwaysLog(times.serverConnected.has_value() && times.punchSucceeded.has_value()
+		&& *times.serverConnected <= *times.punchSucceeded, "punchthrough handshake times test");
+
+	client.send({ 7, 8, 9 });
+	CUAssertAlwaysLog(pumpUntil({ &host, &client }, [&] { return !received.empty(); }, dispatcher),
+		"punchthrough message test");
+	CUAssertAlwaysLog(received == std::vector<uint8_t>({ 7, 8, 9 }), "punchthrough message contents test");
+
+	// Not a number, so it names room 0, which is almost certainly not open
+	NetworkConnection lost(config, "none!");
+	pumpUntil({ &lost }, [&] { return lost.getStatus() != NetworkConnection::NetStatus::Pending; }, ignore);
+	CUAssertAlwaysLog(lost.getStatus() == NetworkConnection::NetStatus::GenericError, "punchthrough room not found test");
+
+	auto stats = server.getStats();
+	CUAssertAlwaysLog(stats.roomsAssigned == 3 && stats.punchthroughs == 1 && stats.roomsNotFound == 1,
+		"punchthrough stats test");
+}
+
+void cugl::testSimulatedConditions() {
+	NetworkConnection::ConnectionConfig config("", 0, 3, 0);
+	config.loopback = std::make_shared<NetworkLoopback>();
+	config.simulateConditions = true;
+	NetworkConnection host(config);
+	NetworkConnection a(config, host.getRoomID());
+	NetworkConnection b(config, host.getRoomID());
+	std::vector<NetworkConnection*> all = { &host, &a, &b };
+
+	// What each connection received, in order
+	std::vector<std::vector<uint8_t>> received(all.size());
+	size_t current = 0;
+	auto pump = [&](const std::function<bool()>& done) {
+		auto start = std::chrono::steady_clock::now();
+		while (std::chrono::duration_cast<std::chrono::milliseconds>(
+			std::chrono::steady_clock::now() - start).count() < LOOPBACK_TIMEOUT) {
+			for (current = 0; current < all.size(); current++) {
+				all[current]->receive([&](const uint8_t* msg, size_t, uint8_t, NetworkConnection::MessageType) {
+					received[current].push_back(msg[0]);
+				});
+			}
+			if (done()) {
+				return true;
+			}
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+		return false;
+	};
+	auto clear = [&] {
+		for (auto* net : all) {
+			net->clearLinkConditions();
+		}
+		for (auto& r : received) {
+			r.clear();
+		}
+	};
+	auto elapsed = [](std::chrono::steady_clock::time_point since) {
+		return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - since).count();
+	};
+
+	CUAssertAlwaysLog(pump([&] {
+		return host.getNumPlayers() == 3 && a.getNumPlayers() == 3 && b.getNumPlayers() == 3
+			&& a.getPlayerID().has_value() && b.getPlayerID().has_value();
+	}), "conditions join test");
+
+	// One direction of one link
+	NetworkLoopback::LinkConfig slow;
+	slow.latency = 150;
+	CUAssertAlwaysLog(a.setLinkConditions(0, slow, NetworkConnection::Direction::Outgoing), "conditions link test");
+	auto sent = std::chrono::steady_clock::now();
+	a.send({ 1 });
+	CUAssertAlwaysLog(pump([&] { return received[0].size() == 1; }), "conditions outgoing test");
+	CUAssertAlwaysLog(elapsed(sent) >= slow.latency, "conditions outgoing latency test");
+	sent = std::chrono::steady_clock::now();
+	host.send({ 2 });
+	CUAssertAlwaysLog(pump([&] { return received[1].size() == 1; }), "conditions incoming test");
+	CUAssertAlwaysLog(elapsed(sent) < slow.latency, "conditions direction test");
+	clear();
+
+	// One peer of several
+	CUAssertAlwaysLog(host.setLinkConditions(*b.getPlayerID(), slow), "conditions peer test");
+	sent = std::chrono::steady_clock::now();
+	host.send({ 3 });
+	CUAssertAlwaysLog(pump([&] { return received[1].size() == 1; }), "conditions fast peer test");
+	CUAssertAlwaysLog(elapsed(sent) < slow.latency, "conditions fast peer latency test");
+	CUAssertAlwaysLog(pump([&] { return received[2].size() == 1; }), "conditions slow peer test");
+	CUAssertAlwaysLog(elapsed(sent) >= slow.latency, "conditions slow peer latency test");
+	clear();
+
+	// Only unreliable messages are lost or duplicated
+	NetworkLoopback::LinkConfig lossy;
+	lossy.loss = 0.5;
+	host.setLinkConditions(lossy, NetworkConnection::Direction::Incoming);
+	for (uint8_t i = 0; i < 100; i++) {
+		a.send({ i }, NetworkConnection::Delivery::Unreliable, NetworkConnection::Priority::Medium, 0);
+	}
+	for (uint8_t i = 0; i < 100; i++) {
+		a.send({ i }, NetworkConnection::Delivery::ReliableOrdered);
+	}
+	pump([&] { return false; });
+	CUAssertAlwaysLog(received[0].size() > 100 && received[0].size() < 200, "conditions loss test");
+	std::vector<uint8_t> reliable(received[0].end() - 100, received[0].end());
+	for (size_t i = 0; i < reliable.size(); i++) {
+		CUAssertAlwaysLog(reliable[i] == i, "conditions reliable loss test");
+	}
+	clear();
+
+	NetworkLoopback::LinkConfig doubled;
+	doubled.duplicate = 1;
+	a.setLinkConditions(doubled);
+	for (uint8_t i = 0; i < 10; i++) {
+		a.send({ i }, NetworkConnection::Delivery::Unreliable, NetworkConnection::Priority::Medium, 0);
+	}
+	CUAssertAlwaysLog(pump([&] { return received[0].size() == 20; }), "conditions duplicate test");
+	received[0].clear();
+	for (uint8_t i = 0; i < 10; i++) {
+		a.send({ i });
+	}
+	pump([&] { return received[0].size() > 10; });
+	CUAssertAlwaysLog(received[0].size() == 10, "conditions reliable duplicate test");
+	clear();
+
+	// Reordering never breaks an ordered or sequenced channel
+	NetworkLoopback::LinkConfig shuffled;
+	shuffled.reorder = 0.5;
+	host.setLinkConditions(shuffled, NetworkConnection::Direction::Outgoing);
+	for (uint8_t i = 0; i < 50; i++) {
+		host.send({ i }, NetworkConnection::Delivery::Reliable, NetworkConnection::Priority::Medium, 0);
+	}
+	CUAssertAlwaysLog(pump([&] { return received[1].size() == 50; }), "conditions reorder test");
+	CUAssertAlwaysLog(!std::is_sorted(received[1].begin(), received[1].end()), "conditions reorder order test");
+	received[1].clear();
+	for (uint8_t i = 0; i < 50; i++) {
+		host.send({ i }, NetworkConnection::Delivery::ReliableOrdered);
+	}
+	CUAssertAlwaysLog(pump([&] { return received[1].size() == 50; }), "conditions ordered test");
+	for (size_t i = 0; i < received[1].size(); i++) {
+		CUAssertAlwaysLog(received[1][i] == i, "conditions ordered order test");
+	}
+	received[1].clear();
+	for (uint8_t i = 0; i < 50; i++) {
+		host.send({ i }, NetworkConnection::Delivery::UnreliableSequenced, NetworkConnection::Priority::Medium, 2);
+	}
+	pump([&] { return !received[1].empty() && received[1].back() == 49; });
+	CUAssertAlwaysLog(!received[1].empty() && received[1].size() < 50, "conditions sequenced test");
+	CUAssertAlwaysLog(std::adjacent_find(received[1].begin(), received[1].end(), std::greater_equal<uint8_t>())
+		== received[1].end(), "conditions sequenced order test");
+	clear();
+
+	// Bandwidth queues up what is sent
+	NetworkLoopback::LinkConfig narrow;
+	narrow.bandwidth = 10000;
+	host.setLinkConditions(*a.getPlayerID(), narrow, NetworkConnection::Direction::Outgoing);
+	sent = std::chrono::steady_clock::now();
+	for (uint8_t i = 0; i < 20; i++) {
+		std::vector<uint8_t> msg(100, i);
+		host.send(msg);
+	}
+	CUAssertAlwaysLog(pump([&] { return received[1].size() == 20; }), "conditions bandwidth test");
+	CUAssertAlwaysLog(elapsed(sent) >= 200, "conditions bandwidth time test");
+	clear();
+}
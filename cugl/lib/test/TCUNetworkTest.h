@@ -0,0 +1,53 @@
+#ifndef __T_CU_NETWORK_TEST_H__
+#define __T_CU_NETWORK_TEST_H__
+
+namespace cugl {
+	/** Main unit test that invokes all others in this module */
+	void networkUnitTest();
+
+	void testVarintFraming();
+
+	void testLargeMessageLoopback();
+
+	void testMalformedFrames();
+
+	void testNetworkQueue();
+
+	void testBatching();
+
+	void testPeerStats();
+
+	void testAdaptiveSendRate();
+
+	void testRelevanceFilter();
+
+	void testMesh();
+
+	void testHostMigration();
+
+	void testLanMigration();
+
+	void testSessionResume();
+
+	void testDeltaSnapshots();
+
+	void testNetworkClock();
+
+	void testInterpolator();
+
+	void testLockstep();
+
+	void testRollback();
+
+	void testLanSession();
+
+	void testRoomServer();
+
+	void testLoopbackNetwork();
+
+	void testPunchServer();
+
+	void testSimulatedConditions();
+}
+
+#endif
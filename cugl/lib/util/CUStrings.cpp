@@ -37,6 +37,7 @@
 #include <iostream>
 #include <iomanip>
 #include <sstream>
+#include <limits>
 #include <cugl/util/CUStrings.h>
 #include <cugl/util/CUDebug.h>
 